@@ -0,0 +1,193 @@
+/*
+ *  cornerFinderBenchmark.cpp
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+//
+// Measures corner finding throughput and accuracy without a camera, by driving Calibration with
+// frames from a ReplaySource: either a session recording, or synthetic frames of a chessboard.
+// Frames are processed to completion one at a time, in order, so results are repeatable, unless
+// -live is given, in which case frames are dropped while the corner finder is busy, as they would
+// be from a camera. Accuracy is the distance of each corner found from the nearest reference corner.
+// With -calib, every frame in which the pattern is found is captured and the camera calibrated.
+//
+// Usage: cornerFinderBenchmark [-replay=path] [-frames=n] [-width=n] [-height=n] [-cornerx=n]
+//            [-cornery=n] [-seed=n] [-fps=f] [-live] [-calib]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+#include <vector>
+
+#include <ARX/AR/ar.h>
+
+#include "Calibration.hpp"
+#include "replaySource.h"
+
+#define FRAME_COUNT_DEFAULT 100
+#define VIDEO_WIDTH_DEFAULT 640
+#define VIDEO_HEIGHT_DEFAULT 480
+#define CORNER_X_DEFAULT 7
+#define CORNER_Y_DEFAULT 5
+#define SEED_DEFAULT 1
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return ((double)tv.tv_sec + (double)tv.tv_usec/1.0e6);
+}
+
+static void usage(const char *com)
+{
+    ARPRINT("Usage: %s [options]\n", com);
+    ARPRINT("  -replay=path: replay a session recording instead of synthetic frames.\n");
+    ARPRINT("  -frames=n: number of synthetic frames (default %d).\n", FRAME_COUNT_DEFAULT);
+    ARPRINT("  -width=n -height=n: size of synthetic frames (default %dx%d).\n", VIDEO_WIDTH_DEFAULT, VIDEO_HEIGHT_DEFAULT);
+    ARPRINT("  -cornerx=n -cornery=n: inner corners of the synthetic chessboard (default %dx%d).\n", CORNER_X_DEFAULT, CORNER_Y_DEFAULT);
+    ARPRINT("  -seed=n: seed for synthetic frame poses (default %d).\n", SEED_DEFAULT);
+    ARPRINT("  -fps=f: deliver frames at f frames per second, rather than as fast as possible.\n");
+    ARPRINT("  -live: drop frames while the corner finder is busy, as for a camera.\n");
+    ARPRINT("  -calib: capture every frame in which the pattern is found, and calibrate.\n");
+    exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *replayPathname = NULL;
+    int frameCount = FRAME_COUNT_DEFAULT;
+    int videoWidth = VIDEO_WIDTH_DEFAULT, videoHeight = VIDEO_HEIGHT_DEFAULT;
+    int cornerX = CORNER_X_DEFAULT, cornerY = CORNER_Y_DEFAULT;
+    unsigned int seed = SEED_DEFAULT;
+    float fps = 0.0f;
+    bool live = false;
+    bool calib = false;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "-replay=", 8) == 0) replayPathname = &(argv[i][8]);
+        else if (strncmp(argv[i], "-frames=", 8) == 0) frameCount = atoi(&(argv[i][8]));
+        else if (strncmp(argv[i], "-width=", 7) == 0) videoWidth = atoi(&(argv[i][7]));
+        else if (strncmp(argv[i], "-height=", 8) == 0) videoHeight = atoi(&(argv[i][8]));
+        else if (strncmp(argv[i], "-cornerx=", 9) == 0) cornerX = atoi(&(argv[i][9]));
+        else if (strncmp(argv[i], "-cornery=", 9) == 0) cornerY = atoi(&(argv[i][9]));
+        else if (strncmp(argv[i], "-seed=", 6) == 0) seed = (unsigned int)strtoul(&(argv[i][6]), NULL, 10);
+        else if (strncmp(argv[i], "-fps=", 5) == 0) fps = (float)atof(&(argv[i][5]));
+        else if (strcmp(argv[i], "-live") == 0) live = true;
+        else if (strcmp(argv[i], "-calib") == 0) calib = true;
+        else usage(argv[0]);
+    }
+
+    REPLAY_SOURCE_t *source;
+    if (replayPathname) source = replaySourceOpenRecording(replayPathname);
+    else source = replaySourceOpenSynthetic(cornerX, cornerY, videoWidth, videoHeight, frameCount, seed);
+    if (!source) {
+        ARLOGe("Error: Unable to open replay source.\n");
+        return (-1);
+    }
+    replaySourceSetFPS(source, fps);
+    frameCount = replaySourceGetFrameCount(source);
+    videoWidth = replaySourceGetVideoWidth(source);
+    videoHeight = replaySourceGetVideoHeight(source);
+    int patternType, patternWidth, patternHeight;
+    float patternSpacing;
+    replaySourceGetPattern(source, &patternType, &patternWidth, &patternHeight, &patternSpacing);
+
+    Calibration *calibration = new Calibration((Calibration::CalibrationPatternType)patternType, (frameCount > 0 ? frameCount : 1), cv::Size(patternWidth, patternHeight), (int)patternSpacing, videoWidth, videoHeight);
+    calibration->setCaptureNoveltyThreshold(0.0f);
+
+    // Frame source time is excluded, since synthetic frames are costly to render.
+    const uint8_t *frame;
+    int index;
+    int processed = 0, found = 0;
+    long errCount = 0;
+    double errSum = 0.0, errMax = 0.0;
+    double processingTime = 0.0;
+    double t0 = now();
+    while ((frame = replaySourceNextFrame(source, &index))) {
+        bool newResults;
+        double t = now();
+        calibration->frame(frame, !live, &newResults);
+        processingTime += now() - t;
+        if (!newResults) continue;
+        processed++;
+
+        int cornerFoundAllFlag;
+        std::vector<cv::Point2f> corners;
+        ARUint8 *videoFrame;
+        calibration->cornerFinderResultsLockAndFetch(&cornerFoundAllFlag, corners, &videoFrame);
+        calibration->cornerFinderResultsUnlock();
+        if (!cornerFoundAllFlag) continue;
+        found++;
+
+        // In live mode, results are for an earlier frame than this one, so can't be compared.
+        const float *reference;
+        int referenceCount;
+        if (!live && (referenceCount = replaySourceGetReferenceCorners(source, index, &reference)) > 0) {
+            for (size_t j = 0; j < corners.size(); j++) {
+                double dMin = HUGE_VAL;
+                for (int k = 0; k < referenceCount; k++) {
+                    double dx = corners[j].x - reference[2*k], dy = corners[j].y - reference[2*k + 1];
+                    double d = dx*dx + dy*dy;
+                    if (d < dMin) dMin = d;
+                }
+                dMin = sqrt(dMin);
+                errSum += dMin;
+                if (dMin > errMax) errMax = dMin;
+                errCount++;
+            }
+        }
+        if (calib) calibration->capture();
+    }
+    double elapsed = now() - t0;
+
+    ARPRINT("Frames: %d delivered, %d processed, pattern found in %d (%.1f%%).\n", frameCount, processed, found, (processed ? 100.0*found/processed : 0.0));
+    ARPRINT("Corner finding: %.2f ms per processed frame, %.1f frames per second (%.2f s elapsed in total).\n", (processed ? 1000.0*processingTime/processed : 0.0), (processingTime > 0.0 ? processed/processingTime : 0.0), elapsed);
+    if (errCount) ARPRINT("Corner error: mean %.3f, max %.3f pixels over %ld corners.\n", errSum/errCount, errMax, errCount);
+
+    if (calib && calibration->calibImageCount() > 0) {
+        ARParam param;
+        ARdouble err_min, err_avg, err_max;
+        calibration->calib(&param, &err_min, &err_avg, &err_max);
+        ARPRINT("Calibration from %d images: error min=%.3f, avg=%.3f, max=%.3f.\n", calibration->calibImageCount(), err_min, err_avg, err_max);
+        ARPRINT("fx=%.2f fy=%.2f cx=%.2f cy=%.2f\n", param.mat[0][0], param.mat[1][1], param.mat[0][2], param.mat[1][2]);
+        if (!replayPathname) ARPRINT("(synthetic camera: fx=fy=%d cx=%.2f cy=%.2f)\n", (videoWidth > videoHeight ? videoWidth : videoHeight), videoWidth/2.0, videoHeight/2.0);
+    }
+
+    delete calibration;
+    replaySourceClose(&source);
+    return (0);
+}
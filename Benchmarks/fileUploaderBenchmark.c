@@ -0,0 +1,379 @@
+/*
+ *  fileUploaderBenchmark.c
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+//
+// Measures how quickly fileUploader drains a queue of synthetic calibrations to a server,
+// normally the local stand-in, Server/calibrationServerStandIn.py (which can also inject latency,
+// errors and dropped connections). The journal is filled with "count" forms before the uploader
+// starts, and the time until the last form is accepted is measured. Request count and bytes sent
+// are read from the stand-in's /stats page before and after the run.
+//
+// Failed runs would normally be retried only after a backoff delay. To measure throughput rather
+// than the backoff schedule, the uploader is tickled again as soon as each run ends.
+//
+// The per-transfer timing breakdowns are summed, to show where upload time goes. They are
+// also logged per transfer with -verbose. -maxbps caps the upload bandwidth.
+//
+// Usage: fileUploaderBenchmark [-url=uploadURL] [-batchurl=batchURL] [-batchbytes=n]
+//            [-concurrency=n] [-maxbps=n] [-n=count] [-statsurl=URL] [-timeout=secs]
+//            [-dir=path] [-verbose]
+//
+// A directory given with -dir must be empty, so that no real queued forms are uploaded or removed.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/param.h> // MAXPATHLEN
+#include <curl/curl.h>
+
+#include <ARX/AR/ar.h>
+
+#include "fileUploader.h"
+#include "uploadJournal.h"
+#include "paramBuffer.h"
+
+#define UPLOAD_URL_DEFAULT "http://127.0.0.1:8080/upload"
+#define FORM_COUNT_DEFAULT 1000
+#define TIMEOUT_SECS_DEFAULT 300
+#define JOURNAL_FILENAME "queue.journal" // As used by fileUploader.c.
+#define RETRY_STATE_FILENAME "retry-state" // As used by fileUploader.c.
+
+typedef struct {
+    long requests;
+    long bytes;
+    long accepted;
+    long errors;
+    long drops;
+} SERVER_STATS_t;
+
+// Sums of the uploader's per-transfer metrics. Written only on the upload thread, and read after it has ended.
+typedef struct {
+    long transfers;
+    long failures;
+    long bytes;
+    double dns;
+    double connect;
+    double tls;
+    double transfer;
+    double server;
+    double total;
+} TRANSFER_STATS_t;
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return ((double)tv.tv_sec + (double)tv.tv_usec/1.0e6);
+}
+
+// Builds a form with the same fields saveParam() sends, with plausible values.
+static UPLOAD_JOURNAL_ENTRY_t *syntheticForm(int i)
+{
+    ARParam param;
+    unsigned char paramBuf[PARAM_BUFFER_LEN_MAX];
+    char filename[32], s[64];
+    int j, k;
+
+    memset(&param, 0, sizeof(param));
+    param.xsize = 1280;
+    param.ysize = 720;
+    for (j = 0; j < 3; j++) for (k = 0; k < 4; k++) param.mat[j][k] = (j == k ? 1000.0 + (i % 97) : 0.0);
+    param.mat[0][2] = 640.0 + (i % 13);
+    param.mat[1][2] = 360.0 - (i % 11);
+    param.mat[2][2] = 1.0;
+    param.dist_function_version = 5;
+    for (j = 0; j < 12; j++) param.dist_factor[j] = ((double)((i * 31 + j * 7) % 1000) - 500.0)/10000.0;
+    param.dist_factor[12] = 1000.0 + (i % 97);
+    param.dist_factor[13] = param.dist_factor[12];
+    param.dist_factor[14] = param.mat[0][2];
+    param.dist_factor[15] = param.mat[1][2];
+    param.dist_factor[16] = 1.0;
+    size_t paramBufLen = paramBufferWrite(&param, paramBuf, sizeof(paramBuf));
+    if (!paramBufLen) return (NULL);
+
+    UPLOAD_JOURNAL_ENTRY_t *entry = uploadJournalEntryNew();
+    if (!entry) return (NULL);
+    bool ok = uploadJournalEntryAddField(entry, "version", "2");
+    snprintf(filename, sizeof(filename), "%06d-camera_para.dat", i % 240000);
+    ok = ok && uploadJournalEntryAddFile(entry, "file", filename, paramBuf, (uint32_t)paramBufLen);
+    ok = ok && uploadJournalEntryAddField(entry, "timestamp", "2018-04-02 12:00:00 +0000");
+    ok = ok && uploadJournalEntryAddField(entry, "os_name", "linux");
+    ok = ok && uploadJournalEntryAddField(entry, "os_arch", "x86_64");
+    ok = ok && uploadJournalEntryAddField(entry, "os_version", "4.15.0");
+    snprintf(s, sizeof(s), "benchmark-camera-%d", i % 50);
+    ok = ok && uploadJournalEntryAddField(entry, "device_id", s);
+    ok = ok && uploadJournalEntryAddField(entry, "focal_length", "0.000");
+    ok = ok && uploadJournalEntryAddField(entry, "camera_index", "0");
+    ok = ok && uploadJournalEntryAddField(entry, "camera_face", "rear");
+    ok = ok && uploadJournalEntryAddField(entry, "camera_width", "1280");
+    ok = ok && uploadJournalEntryAddField(entry, "camera_height", "720");
+    snprintf(s, sizeof(s), "%f", 0.1 + (i % 10)/100.0);
+    ok = ok && uploadJournalEntryAddField(entry, "err_min", s);
+    snprintf(s, sizeof(s), "%f", 0.3 + (i % 10)/100.0);
+    ok = ok && uploadJournalEntryAddField(entry, "err_avg", s);
+    snprintf(s, sizeof(s), "%f", 0.6 + (i % 10)/100.0);
+    ok = ok && uploadJournalEntryAddField(entry, "err_max", s);
+    ok = ok && uploadJournalEntryAddField(entry, "ss", "d41d8cd98f00b204e9800998ecf8427e"); // MD5 of "".
+    if (!ok) uploadJournalEntryFree(&entry);
+    return (entry);
+}
+
+static void transferMetrics(const FILE_UPLOAD_TRANSFER_METRICS_t *metrics, void *userdata)
+{
+    TRANSFER_STATS_t *stats = (TRANSFER_STATS_t *)userdata;
+    stats->transfers++;
+    if (metrics->curlResult != CURLE_OK || metrics->httpStatus != 200) stats->failures++;
+    stats->bytes += metrics->bytesSent;
+    stats->dns += metrics->dnsTime;
+    stats->connect += metrics->connectTime;
+    stats->tls += metrics->tlsTime;
+    stats->transfer += metrics->transferTime;
+    stats->server += metrics->serverTime;
+    stats->total += metrics->totalTime;
+}
+
+static bool populate(const char *dir, int count)
+{
+    char path[MAXPATHLEN];
+    UPLOAD_JOURNAL_t *journal;
+    int i;
+
+    snprintf(path, sizeof(path), "%s/" JOURNAL_FILENAME, dir);
+    if (!(journal = uploadJournalOpen(path))) return (false);
+    for (i = 0; i < count; i++) {
+        UPLOAD_JOURNAL_ENTRY_t *entry = syntheticForm(i);
+        bool ok = (entry && uploadJournalAppend(journal, entry, NULL));
+        uploadJournalEntryFree(&entry);
+        if (!ok) {
+            ARLOGe("Error adding form %d to journal.\n", i);
+            uploadJournalClose(&journal);
+            return (false);
+        }
+    }
+    uploadJournalClose(&journal);
+    return (true);
+}
+
+static size_t statsWrite(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    char *buf = (char *)userdata;
+    size_t len = strlen(buf);
+    size_t n = MIN(size * nmemb, 1023 - len);
+    memcpy(buf + len, ptr, n);
+    buf[len + n] = '\0';
+    return (size * nmemb);
+}
+
+// Reads the stand-in server's counters. Returns false if they're not available.
+static bool getServerStats(const char *statsURL, SERVER_STATS_t *stats)
+{
+    char buf[1024] = "";
+    char name[64];
+    long value;
+    long http_response = 0;
+    const char *p;
+
+    CURL *curl = curl_easy_init();
+    if (!curl) return (false);
+    curl_easy_setopt(curl, CURLOPT_URL, statsURL);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, statsWrite);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, buf);
+    CURLcode curlErr = curl_easy_perform(curl);
+    if (curlErr == CURLE_OK) curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_response);
+    curl_easy_cleanup(curl);
+    if (http_response != 200) return (false);
+
+    memset(stats, 0, sizeof(SERVER_STATS_t));
+    for (p = buf; *p; p += strcspn(p, "\n"), p += (*p ? 1 : 0)) {
+        if (sscanf(p, "%63s %ld", name, &value) != 2) continue;
+        if (strcmp(name, "requests") == 0) stats->requests = value;
+        else if (strcmp(name, "bytes_received") == 0) stats->bytes = value;
+        else if (strcmp(name, "forms_accepted") == 0) stats->accepted = value;
+        else if (strcmp(name, "errors_injected") == 0) stats->errors = value;
+        else if (strcmp(name, "drops_injected") == 0) stats->drops = value;
+    }
+    return (true);
+}
+
+static bool dirIsEmpty(const char *dir)
+{
+    DIR *dirp;
+    struct dirent *direntp;
+    bool empty = true;
+
+    if (!(dirp = opendir(dir))) return (false);
+    while (empty && (direntp = readdir(dirp))) {
+        if (strcmp(direntp->d_name, ".") != 0 && strcmp(direntp->d_name, "..") != 0) empty = false;
+    }
+    closedir(dirp);
+    return (empty);
+}
+
+// Removes only the files written by populate() and the uploader.
+static void cleanup(const char *dir)
+{
+    static const char *names[] = {JOURNAL_FILENAME, JOURNAL_FILENAME ".tmp", RETRY_STATE_FILENAME, RETRY_STATE_FILENAME ".tmp"};
+    char path[MAXPATHLEN];
+    size_t i;
+
+    for (i = 0; i < sizeof(names)/sizeof(names[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        unlink(path);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *url = UPLOAD_URL_DEFAULT;
+    const char *batchURL = NULL;
+    const char *statsURLArg = NULL;
+    char statsURL[1024];
+    size_t batchBytes = 0;
+    long maxBytesPerSecond = 0;
+    bool verbose = false;
+    TRANSFER_STATS_t transferStats = {0};
+    int concurrency = FILE_UPLOADER_MAX_CONCURRENT_UPLOADS_DEFAULT;
+    int count = FORM_COUNT_DEFAULT;
+    int timeoutSecs = TIMEOUT_SECS_DEFAULT;
+    char *dir = NULL;
+    char dirTemplate[] = "/tmp/fileUploaderBenchmark.XXXXXX";
+    SERVER_STATS_t before, after;
+    bool haveStats;
+    int i, pending, runs = 0;
+    char status[UPLOAD_STATUS_BUFFER_LEN];
+    struct timeval tv;
+
+    for (i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "-url=", 5) == 0) url = &(argv[i][5]);
+        else if (strncmp(argv[i], "-batchurl=", 10) == 0) batchURL = &(argv[i][10]);
+        else if (strncmp(argv[i], "-batchbytes=", 12) == 0) batchBytes = (size_t)atol(&(argv[i][12]));
+        else if (strncmp(argv[i], "-concurrency=", 13) == 0) concurrency = atoi(&(argv[i][13]));
+        else if (strncmp(argv[i], "-maxbps=", 8) == 0) maxBytesPerSecond = atol(&(argv[i][8]));
+        else if (strncmp(argv[i], "-n=", 3) == 0) count = atoi(&(argv[i][3]));
+        else if (strncmp(argv[i], "-statsurl=", 10) == 0) statsURLArg = &(argv[i][10]);
+        else if (strncmp(argv[i], "-timeout=", 9) == 0) timeoutSecs = atoi(&(argv[i][9]));
+        else if (strncmp(argv[i], "-dir=", 5) == 0) dir = &(argv[i][5]);
+        else if (strcmp(argv[i], "-verbose") == 0) verbose = true;
+        else {
+            ARPRINT("Usage: %s [-url=uploadURL] [-batchurl=batchURL] [-batchbytes=n] [-concurrency=n] [-maxbps=n] [-n=count] [-statsurl=URL] [-timeout=secs] [-dir=path] [-verbose]\n", argv[0]);
+            return (1);
+        }
+    }
+    if (count <= 0) count = FORM_COUNT_DEFAULT;
+    if (!verbose) arLogLevel = AR_LOG_LEVEL_WARN; // Otherwise each transfer is logged.
+
+    // By default, the stats page is on the same server as the upload URL.
+    if (statsURLArg) {
+        snprintf(statsURL, sizeof(statsURL), "%s", statsURLArg);
+    } else {
+        const char *host = strstr(url, "://");
+        size_t prefixLen = (host ? (size_t)(host + 3 - url) + strcspn(host + 3, "/") : strlen(url));
+        snprintf(statsURL, sizeof(statsURL), "%.*s/stats", (int)prefixLen, url);
+    }
+
+    if (!dir) {
+        if (!(dir = mkdtemp(dirTemplate))) {
+            ARLOGe("Error creating temporary directory.\n");
+            ARLOGperror(NULL);
+            return (1);
+        }
+    } else if (!dirIsEmpty(dir)) {
+        ARLOGe("Error: '%s' must be an existing, empty directory.\n", dir);
+        return (1);
+    }
+    ARPRINT("Queue directory '%s', %d forms, %d concurrent uploads, %s.\n", dir, count, concurrency, (batchURL ? "batched" : "unbatched"));
+    if (maxBytesPerSecond) ARPRINT("Upload bandwidth capped at %ld bytes/s.\n", maxBytesPerSecond);
+
+    double t0 = now();
+    if (!populate(dir, count)) return (1);
+    ARPRINT("Filled journal in %.3f s.\n", now() - t0);
+
+    curl_global_init(CURL_GLOBAL_DEFAULT); // Keeps libcurl initialised for getServerStats() across the uploader's init and final.
+    haveStats = getServerStats(statsURL, &before);
+    if (!haveStats) ARPRINT("Server stats not available from '%s'; request counts will not be reported.\n", statsURL);
+
+    FILE_UPLOAD_HANDLE_t *handle = fileUploaderInit(dir, "upload", url, 1.0f);
+    if (!handle) return (1);
+    if (!fileUploaderSetMaxConcurrentUploads(handle, concurrency)) return (1);
+    if (batchURL) fileUploaderSetBatchUploads(handle, batchURL, batchBytes);
+    if (!fileUploaderSetMaxBytesPerSecond(handle, maxBytesPerSecond)) return (1);
+    fileUploaderSetTransferMetricsCallback(handle, transferMetrics, &transferStats);
+
+    t0 = now();
+    fileUploaderTickle(handle);
+    runs++;
+    do {
+        usleep(10000);
+        pending = fileUploaderPendingCount(handle);
+        if (pending <= 0) break;
+        gettimeofday(&tv, NULL);
+        if (fileUploaderStatusGet(handle, status, &tv) != 1) {
+            // The run ended with forms still queued (i.e. after an error). Go again without waiting for the backoff.
+            fileUploaderTickle(handle);
+            runs++;
+        }
+    } while (now() - t0 < timeoutSecs);
+    double t = now() - t0;
+    fileUploaderFinal(&handle);
+
+    if (pending != 0) {
+        ARPRINT("Timed out after %.3f s with %d forms still queued.\n", t, pending);
+    } else {
+        ARPRINT("Drained %d forms in %.3f s (%.1f forms/s), %d tickles.\n", count, t, count/t, runs);
+    }
+    if (transferStats.transfers) {
+        double n = (double)transferStats.transfers;
+        ARPRINT("Client: %ld transfers (%ld failed), %ld bytes sent (%.0f bytes/s).\n", transferStats.transfers, transferStats.failures, transferStats.bytes, transferStats.bytes/t);
+        ARPRINT("Mean per transfer: DNS %.2f ms, connect %.2f ms, TLS %.2f ms, transfer %.2f ms, server %.2f ms, total %.2f ms.\n",
+                transferStats.dns*1000.0/n, transferStats.connect*1000.0/n, transferStats.tls*1000.0/n, transferStats.transfer*1000.0/n, transferStats.server*1000.0/n, transferStats.total*1000.0/n);
+    }
+    if (haveStats && getServerStats(statsURL, &after)) {
+        long requests = after.requests - before.requests;
+        long bytes = after.bytes - before.bytes;
+        ARPRINT("Server: %ld requests (%.2f forms/request), %ld body bytes (%.1f bytes/form), %ld forms accepted, %ld errors and %ld drops injected.\n",
+                requests, (double)count/(requests ? requests : 1), bytes, (double)bytes/count, after.accepted - before.accepted, after.errors - before.errors, after.drops - before.drops);
+    }
+    curl_global_cleanup();
+
+    cleanup(dir);
+    if (dir == dirTemplate) rmdir(dir);
+    return (pending == 0 ? 0 : 1);
+}
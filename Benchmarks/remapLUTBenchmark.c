@@ -0,0 +1,173 @@
+/*
+ *  remapLUTBenchmark.c
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+
+//
+// Compares building a full undistortion map by evaluating the distortion model at every pixel, as
+// clients do at startup, against expanding a precomputed remap table at a range of grid steps.
+// Reports the time for each, the time to generate each table, its size, and its error against the model.
+//
+// Usage: remapLUTBenchmark [-param=camera_para.dat] [-threads=n] [-ideal2observ]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+
+#include <ARX/AR/ar.h>
+
+#include "paramBuffer.h"
+#include "remapLUT.h"
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return ((double)tv.tv_sec + (double)tv.tv_usec/1.0e6);
+}
+
+// A 1280x720 camera with strong barrel distortion, as made by the calibrator (distortion function version 4).
+static void paramMakeDefault(ARParam *param)
+{
+    const ARdouble dist[9] = {-0.35, 0.15, 0.001, -0.0005, 1000.0, 1000.0, 640.0, 360.0, 1.0};
+    memset(param, 0, sizeof(ARParam));
+    param->xsize = 1280;
+    param->ysize = 720;
+    param->mat[0][0] = 1000.0; param->mat[0][2] = 640.0;
+    param->mat[1][1] = 1000.0; param->mat[1][2] = 360.0;
+    param->mat[2][2] = 1.0;
+    memcpy(param->dist_factor, dist, sizeof(dist));
+    param->dist_function_version = 4;
+}
+
+static bool paramLoad(const char *path, ARParam *param)
+{
+    unsigned char buf[PARAM_BUFFER_LEN_MAX + 1];
+    FILE *fp;
+
+    if (!(fp = fopen(path, "rb"))) {
+        ARLOGe("Error opening '%s'.\n", path);
+        ARLOGperror(NULL);
+        return (false);
+    }
+    size_t len = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    if (!paramBufferRead(buf, len, param)) {
+        ARLOGe("Error: '%s' is not a camera parameters file.\n", path);
+        return (false);
+    }
+    return (true);
+}
+
+int main(int argc, char *argv[])
+{
+    ARParam param;
+    char *paramPath = NULL;
+    int threadCount = 0;
+    REMAP_LUT_DIRECTION direction = REMAP_LUT_OBSERV2IDEAL;
+    int x, y, i, step;
+    double t0, t;
+
+    for (i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "-param=", 7) == 0) paramPath = &(argv[i][7]);
+        else if (strncmp(argv[i], "-threads=", 9) == 0) threadCount = atoi(&(argv[i][9]));
+        else if (strcmp(argv[i], "-ideal2observ") == 0) direction = REMAP_LUT_IDEAL2OBSERV;
+        else {
+            ARPRINT("Usage: %s [-param=camera_para.dat] [-threads=n] [-ideal2observ]\n", argv[0]);
+            return (1);
+        }
+    }
+    if (paramPath) {
+        if (!paramLoad(paramPath, &param)) return (1);
+    } else {
+        paramMakeDefault(&param);
+    }
+    ARPRINT("Image %dx%d, distortion function version %d, %s.\n", param.xsize, param.ysize, param.dist_function_version,
+            (direction == REMAP_LUT_OBSERV2IDEAL ? "observed to ideal" : "ideal to observed"));
+
+    // Reference map, one model evaluation per pixel.
+    size_t mapLen = (size_t)param.xsize*param.ysize*2;
+    float *ref = (float *)malloc(mapLen*sizeof(float));
+    float *map = (float *)malloc(mapLen*sizeof(float));
+    if (!ref || !map) {
+        ARLOGe("Out of memory!\n");
+        return (1);
+    }
+    t0 = now();
+    for (y = 0; y < param.ysize; y++) {
+        for (x = 0; x < param.xsize; x++) {
+            ARdouble ox, oy;
+            if (direction == REMAP_LUT_OBSERV2IDEAL) arParamObserv2Ideal(param.dist_factor, (ARdouble)x, (ARdouble)y, &ox, &oy, param.dist_function_version);
+            else arParamIdeal2Observ(param.dist_factor, (ARdouble)x, (ARdouble)y, &ox, &oy, param.dist_function_version);
+            ref[((size_t)y*param.xsize + x)*2] = (float)ox;
+            ref[((size_t)y*param.xsize + x)*2 + 1] = (float)oy;
+        }
+    }
+    t = now() - t0;
+    ARPRINT("Per-pixel model:  map in %8.2f ms.\n", t*1.0e3);
+
+    for (step = 1; step <= REMAP_LUT_GRID_STEP_MAX; step *= 2) {
+        REMAP_LUT_t *lut;
+
+        t0 = now();
+        if (!(lut = remapLUTCreate(&param, direction, step, 1))) return (1);
+        double tCreate1 = now() - t0;
+        remapLUTFree(&lut);
+        t0 = now();
+        if (!(lut = remapLUTCreate(&param, direction, step, threadCount))) return (1);
+        double tCreate = now() - t0;
+
+        t0 = now();
+        for (y = 0; y < param.ysize; y++) remapLUTLookupRow(lut, y, map + (size_t)y*param.xsize*2);
+        t = now() - t0;
+
+        double errMax = 0.0, errSq = 0.0;
+        for (i = 0; i < (int)(mapLen/2); i++) {
+            double ex = (double)map[i*2] - (double)ref[i*2], ey = (double)map[i*2 + 1] - (double)ref[i*2 + 1];
+            double e2 = ex*ex + ey*ey;
+            errSq += e2;
+            if (e2 > errMax) errMax = e2;
+        }
+        ARPRINT("Table step %2d:    map in %8.2f ms; generated in %8.2f ms (%8.2f ms on 1 thread); %8zu bytes, %2d fractional bits; error rms %.4f px, max %.4f px.\n",
+                step, t*1.0e3, tCreate*1.0e3, tCreate1*1.0e3, remapLUTBufferLen(lut), lut->fracBits, sqrt(errSq/(double)(mapLen/2)), sqrt(errMax));
+        remapLUTFree(&lut);
+    }
+
+    free(ref);
+    free(map);
+    return (0);
+}
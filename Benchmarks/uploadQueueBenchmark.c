@@ -0,0 +1,231 @@
+/*
+ *  uploadQueueBenchmark.c
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+
+//
+// Measures the cost of draining an upload queue directory holding a large number of entries,
+// comparing a rescan of the directory for each file (as fileUploader used to do) against
+// the in-memory queue in uploadQueue.c.
+//
+// Usage: uploadQueueBenchmark [-n=count] [-dir=path] [-skiplegacy]
+//
+// A directory given with -dir must be empty, since draining the queue removes every index file in it.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/param.h> // MAXPATHLEN
+
+#include <ARX/AR/ar.h>
+#include <ARX/ARUtil/file_utils.h>
+
+#include "uploadQueue.h"
+
+#define QUEUE_INDEX_FILE_EXTENSION "upload"
+#define QUEUE_ENTRY_COUNT_DEFAULT 10000
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return ((double)tv.tv_sec + (double)tv.tv_usec/1.0e6);
+}
+
+// Creates "count" index files and the same number of parameter files, as saveParam() would.
+static bool populate(const char *dir, int count)
+{
+    char path[MAXPATHLEN];
+    int i;
+
+    for (i = 0; i < count; i++) {
+        FILE *fp;
+        snprintf(path, sizeof(path), "%s/%06d-index." QUEUE_INDEX_FILE_EXTENSION, dir, i);
+        if (!(fp = fopen(path, "wb"))) {
+            ARLOGe("Error creating '%s'.\n", path);
+            ARLOGperror(NULL);
+            return (false);
+        }
+        fprintf(fp, "file,%s/%06d-camera_para.dat\n", dir, i);
+        fclose(fp);
+        snprintf(path, sizeof(path), "%s/%06d-camera_para.dat", dir, i);
+        if (!(fp = fopen(path, "wb"))) {
+            ARLOGe("Error creating '%s'.\n", path);
+            ARLOGperror(NULL);
+            return (false);
+        }
+        fclose(fp);
+    }
+    return (true);
+}
+
+// The pre-uploadQueue lookup: a full directory scan per file.
+static bool legacyGetNextFileInQueueWithExtension(const char *queueDir, const char *ext, char *buf, int len)
+{
+    DIR *dirp;
+    struct dirent *direntp;
+
+    if (!(dirp = opendir(queueDir))) return (false);
+    *buf = '\0';
+    while ((direntp = readdir(dirp))) {
+        char *ext0 = arUtilGetFileExtensionFromPath(direntp->d_name, true);
+        if (!ext0) continue;
+        if (strcmp(ext0, ext) == 0) {
+            free(ext0);
+            snprintf(buf, len, "%s/%s", queueDir, direntp->d_name);
+            break;
+        }
+        free(ext0);
+    }
+    closedir(dirp);
+    return (*buf != '\0');
+}
+
+static int drainLegacy(const char *dir)
+{
+    char path[MAXPATHLEN];
+    int drained = 0;
+
+    while (legacyGetNextFileInQueueWithExtension(dir, QUEUE_INDEX_FILE_EXTENSION, path, sizeof(path))) {
+        if (unlink(path) < 0) break;
+        drained++;
+    }
+    return (drained);
+}
+
+static int drainQueue(const char *dir, double *initTime_p)
+{
+    char path[MAXPATHLEN];
+    int drained = 0;
+    const char *name;
+
+    double t0 = now();
+    UPLOAD_QUEUE_t *queue = uploadQueueInit(dir, QUEUE_INDEX_FILE_EXTENSION);
+    *initTime_p = now() - t0;
+    if (!queue) return (0);
+
+    while (uploadQueueRefresh(queue) && (name = uploadQueueGet(queue, 0))) {
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        if (unlink(path) < 0) break;
+        uploadQueueRemove(queue, name);
+        drained++;
+    }
+    uploadQueueFinal(&queue);
+    return (drained);
+}
+
+static bool dirIsEmpty(const char *dir)
+{
+    DIR *dirp;
+    struct dirent *direntp;
+    bool empty = true;
+
+    if (!(dirp = opendir(dir))) return (false);
+    while (empty && (direntp = readdir(dirp))) {
+        if (strcmp(direntp->d_name, ".") != 0 && strcmp(direntp->d_name, "..") != 0) empty = false;
+    }
+    closedir(dirp);
+    return (empty);
+}
+
+// Removes only the files populate() created.
+static void cleanup(const char *dir, int count)
+{
+    char path[MAXPATHLEN];
+    int i;
+
+    for (i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "%s/%06d-index." QUEUE_INDEX_FILE_EXTENSION, dir, i);
+        unlink(path);
+        snprintf(path, sizeof(path), "%s/%06d-camera_para.dat", dir, i);
+        unlink(path);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int count = QUEUE_ENTRY_COUNT_DEFAULT;
+    char *dir = NULL;
+    char dirTemplate[] = "/tmp/uploadQueueBenchmark.XXXXXX";
+    bool skipLegacy = false;
+    int i;
+    double t0, t, initTime;
+    int drained;
+
+    for (i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "-n=", 3) == 0) count = atoi(&(argv[i][3]));
+        else if (strncmp(argv[i], "-dir=", 5) == 0) dir = &(argv[i][5]);
+        else if (strcmp(argv[i], "-skiplegacy") == 0) skipLegacy = true;
+        else {
+            ARPRINT("Usage: %s [-n=count] [-dir=path] [-skiplegacy]\n", argv[0]);
+            return (1);
+        }
+    }
+    if (count <= 0) count = QUEUE_ENTRY_COUNT_DEFAULT;
+    if (!dir) {
+        if (!(dir = mkdtemp(dirTemplate))) {
+            ARLOGe("Error creating temporary directory.\n");
+            ARLOGperror(NULL);
+            return (1);
+        }
+    } else if (!dirIsEmpty(dir)) {
+        ARLOGe("Error: '%s' must be an existing, empty directory.\n", dir);
+        return (1);
+    }
+    ARPRINT("Queue directory '%s', %d queued entries.\n", dir, count);
+
+    if (!skipLegacy) {
+        if (!populate(dir, count)) return (1);
+        t0 = now();
+        drained = drainLegacy(dir);
+        t = now() - t0;
+        ARPRINT("Rescan per file:   drained %d in %.3f s (%.1f us/file).\n", drained, t, t*1.0e6/(drained ? drained : 1));
+        cleanup(dir, count);
+    }
+
+    if (!populate(dir, count)) return (1);
+    t0 = now();
+    drained = drainQueue(dir, &initTime);
+    t = now() - t0;
+    ARPRINT("In-memory queue:   drained %d in %.3f s (%.1f us/file), of which initial scan %.3f s.\n", drained, t, t*1.0e6/(drained ? drained : 1), initTime);
+    cleanup(dir, count);
+
+    if (dir == dirTemplate) rmdir(dir);
+    return (0);
+}
@@ -37,10 +37,17 @@
  */
 
 #include "Calibration.hpp"
+#include <algorithm>
+#include <cmath>
 #include <opencv2/calib3d/calib3d.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include "calc.hpp"
 
+// Scales for pose novelty. A novelty of 1.0 corresponds to a rotation of this many degrees...
+#define CAPTURE_NOVELTY_ROTATION_SCALE_DEGREES 5.0
+// ...or a translation of this fraction of the distance from the camera to the pattern.
+#define CAPTURE_NOVELTY_TRANSLATION_SCALE 0.05
+
 //
 // A class to encapsulate the inputs and outputs of a corner-finding run, and to allow for copying of the results
 // of a completed run.
@@ -140,28 +147,48 @@ Calibration::Calibration(const CalibrationPatternType patternType, const int cal
     m_chessboardSquareWidth(chessboardSquareWidth),
     m_videoWidth(videoWidth),
     m_videoHeight(videoHeight),
-    m_corners()
+    m_corners(),
+    m_poses(),
+    m_captureNoveltyThreshold(CALIBRATION_CAPTURE_NOVELTY_THRESHOLD_DEFAULT),
+    m_captureRejectReason()
 {
+    // Pose estimation for novelty gating uses the pattern geometry and a camera model with a
+    // nominal field of view and no distortion. This is accurate enough to compare poses with each other.
+    calcChessboardCorners(patternType, patternSize, (float)chessboardSquareWidth, m_objectPoints);
+    double f = (double)std::max(videoWidth, videoHeight);
+    m_poseCameraMatrix = cv::Matx33d(f, 0.0, videoWidth/2.0, 0.0, f, videoHeight/2.0, 0.0, 0.0, 1.0);
+    
     // Spawn the corner finder worker thread.
     m_cornerFinderThread = threadInit(0, (void *)(&m_cornerFinderData), cornerFinder);
     
     pthread_mutex_init(&m_cornerFinderResultLock, NULL);
 }
 
-bool Calibration::frame(ARVideoSource *vs)
+// Collect the results of the corner finder, if it has finished. If "wait" is true and the corner
+// finder is busy, wait for it to finish.
+bool Calibration::cornerFinderCollect(const bool wait)
+{
+    if (!threadGetStatus(m_cornerFinderThread) && !(wait && threadGetBusyStatus(m_cornerFinderThread))) return false;
+    threadEndWait(m_cornerFinderThread); // Waits for the worker to finish, if it hasn't already, and resets it.
+    
+    // Copy the results.
+    pthread_mutex_lock(&m_cornerFinderResultLock); // Results are also read by GL thread, so need to lock before modifying.
+    m_cornerFinderResultData = m_cornerFinderData;
+    pthread_mutex_unlock(&m_cornerFinderResultLock);
+    return true;
+}
+
+bool Calibration::frame(ARVideoSource *vs, bool *newResults_out)
 {
     //
     // Start of main calibration-related cycle.
     //
     
+    if (newResults_out) *newResults_out = false;
+    
     // First, see if an image has been completely processed.
-    if (threadGetStatus(m_cornerFinderThread)) {
-        threadEndWait(m_cornerFinderThread); // We know from status above that worker has already finished, so this just resets it.
-        
-        // Copy the results.
-        pthread_mutex_lock(&m_cornerFinderResultLock); // Results are also read by GL thread, so need to lock before modifying.
-        m_cornerFinderResultData = m_cornerFinderData;
-        pthread_mutex_unlock(&m_cornerFinderResultLock);
+    if (cornerFinderCollect(false)) {
+        if (newResults_out) *newResults_out = true;
     }
     
     // If corner finder worker thread is ready and waiting, submit the new image.
@@ -185,6 +212,27 @@ bool Calibration::frame(ARVideoSource *vs)
     return true;
 }
 
+bool Calibration::frame(const ARUint8 *videoFrame, const bool wait, bool *newResults_out)
+{
+    if (newResults_out) *newResults_out = false;
+    if (!videoFrame) return false;
+    
+    if (cornerFinderCollect(wait)) {
+        if (newResults_out) *newResults_out = true;
+    }
+    if (threadGetBusyStatus(m_cornerFinderThread)) return true; // Frame dropped.
+    
+    memcpy(m_cornerFinderData.videoFrame, videoFrame, m_videoWidth*m_videoHeight);
+    threadStartSignal(m_cornerFinderThread);
+    
+    // When waiting, the results for this frame are always the ones available on return.
+    if (wait) {
+        cornerFinderCollect(true);
+        if (newResults_out) *newResults_out = true;
+    }
+    return true;
+}
+
 bool Calibration::cornerFinderResultsLockAndFetch(int *cornerFoundAllFlag, std::vector<cv::Point2f>& corners, ARUint8** videoFrame)
 {
     pthread_mutex_lock(&m_cornerFinderResultLock);
@@ -233,39 +281,112 @@ void *Calibration::cornerFinder(THREAD_HANDLE_T *threadHandle)
     return (NULL);
 }
 
+bool Calibration::estimatePose(const std::vector<cv::Point2f>& corners, CapturePose& pose_out) const
+{
+    if (corners.size() != m_objectPoints.size()) return false;
+    
+    cv::Mat rvec, tvec;
+    if (!cv::solvePnP(m_objectPoints, corners, m_poseCameraMatrix, cv::noArray(), rvec, tvec)) return false;
+    cv::Mat R;
+    cv::Rodrigues(rvec, R);
+    pose_out.R = cv::Matx33d(R);
+    pose_out.t = cv::Vec3d(tvec);
+    return true;
+}
+
+// static
+float Calibration::poseNovelty(const CapturePose& a, const CapturePose& b)
+{
+    // Angle of the rotation taking a's orientation to b's.
+    cv::Matx33d Rab = a.R.t() * b.R;
+    double c = (cv::trace(Rab) - 1.0) / 2.0;
+    if (c > 1.0) c = 1.0;
+    else if (c < -1.0) c = -1.0;
+    double angle = acos(c) * 180.0 / M_PI;
+    
+    // Change in position, relative to distance from the camera.
+    double dist = std::max(cv::norm(a.t), cv::norm(b.t));
+    double translation = (dist > 0.0 ? cv::norm(a.t - b.t) / dist : 0.0);
+    
+    return (float)(angle / CAPTURE_NOVELTY_ROTATION_SCALE_DEGREES + translation / CAPTURE_NOVELTY_TRANSLATION_SCALE);
+}
+
 bool Calibration::capture()
 {
-    if (m_corners.size() >= m_calibImageCountMax) return false;
+    if (m_corners.size() >= m_calibImageCountMax) {
+        m_captureRejectReason = "Maximum number of images already captured";
+        return false;
+    }
    
-    bool saved = false;
+    bool found = false;
+    std::vector<cv::Point2f> corners;
+    std::vector<cv::Point2f> cornersRaw;
     
     pthread_mutex_lock(&m_cornerFinderResultLock);
     if (m_cornerFinderResultData.cornerFoundAllFlag) {
+        if (m_recorder) {
+            cornersRaw = m_cornerFinderResultData.corners;
+            m_recordFrame.assign(m_cornerFinderResultData.videoFrame, m_cornerFinderResultData.videoFrame + m_videoWidth*m_videoHeight);
+        }
         // Refine the corner positions.
         cornerSubPix(cv::cvarrToMat(m_cornerFinderResultData.calibImage), m_cornerFinderResultData.corners, cv::Size(5,5), cvSize(-1,-1), cv::TermCriteria(CV_TERMCRIT_ITER, 100, 0.1));
-        
-        // Save the corners.
-        m_corners.push_back(m_cornerFinderResultData.corners);
-        saved = true;
+        corners = m_cornerFinderResultData.corners;
+        found = true;
     }
     pthread_mutex_unlock(&m_cornerFinderResultLock);
-
-    if (saved) {
-        ARPRINT("---------- %2d/%2d -----------\n", (int)m_corners.size(), m_calibImageCountMax);
-        const std::vector<cv::Point2f>& corners = m_corners.back();
-        for (std::vector<cv::Point2f>::const_iterator it = corners.begin(); it < corners.end(); it++) {
-            ARPRINT("  %f, %f\n", it->x, it->y);
+    
+    if (!found) {
+        m_captureRejectReason = "Calibration pattern not found";
+        return false;
+    }
+    
+    // Reject the capture if the pattern pose is too similar to one already captured.
+    CapturePose pose;
+    bool havePose = estimatePose(corners, pose);
+    if (havePose && m_captureNoveltyThreshold > 0.0f) {
+        for (size_t i = 0; i < m_poses.size(); i++) {
+            float novelty = poseNovelty(m_poses[i], pose);
+            if (novelty < m_captureNoveltyThreshold) {
+                char buf[128];
+                snprintf(buf, sizeof(buf), "Too similar to image %d (novelty %.2f < %.2f). Move or tilt the pattern", (int)i + 1, novelty, m_captureNoveltyThreshold);
+                m_captureRejectReason = buf;
+                ARLOGi("Capture rejected: %s.\n", buf);
+                return false;
+            }
         }
-        ARPRINT("---------- %2d/%2d -----------\n", (int)m_corners.size(), m_calibImageCountMax);
+    } else if (!havePose) {
+        ARLOGw("Unable to estimate calibration pattern pose. Accepting capture without novelty check.\n");
+        pose.R = cv::Matx33d::eye();
+        pose.t = cv::Vec3d(0.0, 0.0, 0.0);
     }
     
-    return (saved);
+    // Save the corners.
+    m_corners.push_back(corners);
+    m_poses.push_back(pose);
+    m_captureRejectReason.clear();
+    if (m_journal) {
+        captureJournalAddCapture(m_journal, reinterpret_cast<const float *>(corners.data()), (int)corners.size());
+    }
+    if (m_recorder) {
+        sessionRecorderAddCapture(m_recorder, m_recordFrame.data(), reinterpret_cast<const float *>(cornersRaw.data()), reinterpret_cast<const float *>(corners.data()), (int)corners.size());
+    }
+
+    ARPRINT("---------- %2d/%2d -----------\n", (int)m_corners.size(), m_calibImageCountMax);
+    for (std::vector<cv::Point2f>::const_iterator it = corners.begin(); it < corners.end(); it++) {
+        ARPRINT("  %f, %f\n", it->x, it->y);
+    }
+    ARPRINT("---------- %2d/%2d -----------\n", (int)m_corners.size(), m_calibImageCountMax);
+    
+    return true;
 }
 
 bool Calibration::uncapture(void)
 {
     if (m_corners.size() <= 0) return false;
     m_corners.pop_back();
+    m_poses.pop_back();
+    if (m_journal) captureJournalUncapture(m_journal);
+    if (m_recorder) sessionRecorderUncapture(m_recorder);
     return true;
 }
 
@@ -273,16 +394,110 @@ bool Calibration::uncaptureAll(void)
 {
     if (m_corners.size() <= 0) return false;
     m_corners.clear();
+    m_poses.clear();
+    if (m_journal) captureJournalUncaptureAll(m_journal);
+    if (m_recorder) sessionRecorderUncaptureAll(m_recorder);
     return true;
 }
 
+bool Calibration::startRecording(const char *pathname, const bool compress)
+{
+    stopRecording();
+    m_recorder = sessionRecorderOpen(pathname, static_cast<int>(m_patternType), m_patternSize.width, m_patternSize.height, (float)m_chessboardSquareWidth, m_videoWidth, m_videoHeight, compress);
+    return (m_recorder != NULL);
+}
+
+void Calibration::stopRecording()
+{
+    sessionRecorderClose(&m_recorder);
+    m_recordFrame.clear();
+    m_recordFrame.shrink_to_fit();
+}
+
+bool Calibration::startJournal(const char *pathname, const char *key)
+{
+    stopJournal();
+    
+    CAPTURE_JOURNAL_CONFIG_t config = {static_cast<int>(m_patternType), m_patternSize.width, m_patternSize.height, (float)m_chessboardSquareWidth, m_videoWidth, m_videoHeight, key};
+    if (!(m_journal = captureJournalOpen(pathname, &config))) return false;
+    
+    // Resume any captures from an interrupted run, in place of those made so far.
+    int count = std::min(captureJournalResumeCount(m_journal), m_calibImageCountMax);
+    if (count > 0) {
+        m_corners.clear();
+        m_poses.clear();
+        size_t cornerCount = (size_t)(m_patternSize.width*m_patternSize.height);
+        for (int i = 0; i < count; i++) {
+            const cv::Point2f *corners = reinterpret_cast<const cv::Point2f *>(captureJournalResumeCapture(m_journal, i));
+            m_corners.push_back(std::vector<cv::Point2f>(corners, corners + cornerCount));
+            CapturePose pose;
+            if (!estimatePose(m_corners.back(), pose)) {
+                pose.R = cv::Matx33d::eye();
+                pose.t = cv::Vec3d(0.0, 0.0, 0.0);
+            }
+            m_poses.push_back(pose);
+        }
+        ARLOGi("Resumed %d captures from interrupted calibration run.\n", count);
+    }
+    return true;
+}
+
+void Calibration::stopJournal()
+{
+    captureJournalClose(&m_journal);
+}
+
 void Calibration::calib(ARParam *param_out, ARdouble *err_min_out, ARdouble *err_avg_out, ARdouble *err_max_out)
 {
     calc((int)m_corners.size(), m_patternType, m_patternSize, m_chessboardSquareWidth, m_corners, m_videoWidth, m_videoHeight, AR_DIST_FUNCTION_VERSION_DEFAULT, param_out, err_min_out, err_avg_out, err_max_out);
 }
 
+bool Calibration::validate(const ARParam *param, ARdouble *err_avg_out, ARdouble *err_max_out) const
+{
+    if (!param || m_corners.empty()) return false;
+    if (param->xsize != m_videoWidth || param->ysize != m_videoHeight) {
+        ARLOGw("Can't validate %dx%d calibration against %dx%d video.\n", param->xsize, param->ysize, m_videoWidth, m_videoHeight);
+        return false;
+    }
+    
+    // Fit the pose in ideal (undistorted) coordinates, where the calibration is a plain pinhole camera.
+    // The error is then measured as calc() measures it, so that the two can be compared: the RMS
+    // distance per image in observed pixels, averaged over the images.
+    cv::Matx33d cameraMatrix(param->mat[0][0], param->mat[0][1], param->mat[0][2],
+                             param->mat[1][0], param->mat[1][1], param->mat[1][2],
+                             0.0, 0.0, 1.0);
+    double errSum = 0.0, errMax = 0.0;
+    for (size_t i = 0; i < m_corners.size(); i++) {
+        std::vector<cv::Point2f> ideal(m_corners[i].size());
+        for (size_t j = 0; j < m_corners[i].size(); j++) {
+            ARdouble ix, iy;
+            arParamObserv2Ideal(param->dist_factor, m_corners[i][j].x, m_corners[i][j].y, &ix, &iy, param->dist_function_version);
+            ideal[j] = cv::Point2f((float)ix, (float)iy);
+        }
+        cv::Mat rvec, tvec;
+        if (!cv::solvePnP(m_objectPoints, ideal, cameraMatrix, cv::noArray(), rvec, tvec)) return false;
+        std::vector<cv::Point2f> projected;
+        cv::projectPoints(m_objectPoints, rvec, tvec, cameraMatrix, cv::noArray(), projected);
+        double err = 0.0;
+        for (size_t j = 0; j < projected.size(); j++) {
+            ARdouble ox, oy;
+            arParamIdeal2Observ(param->dist_factor, projected[j].x, projected[j].y, &ox, &oy, param->dist_function_version);
+            err += (ox - m_corners[i][j].x)*(ox - m_corners[i][j].x) + (oy - m_corners[i][j].y)*(oy - m_corners[i][j].y);
+        }
+        err = std::sqrt(err/projected.size());
+        errSum += err;
+        if (err > errMax) errMax = err;
+    }
+    if (err_avg_out) *err_avg_out = (ARdouble)(errSum/m_corners.size());
+    if (err_max_out) *err_max_out = (ARdouble)errMax;
+    return true;
+}
+
 Calibration::~Calibration()
 {
+    stopRecording();
+    stopJournal();
+    
     pthread_mutex_destroy(&m_cornerFinderResultLock);
     
     // Clean up the corner finder.
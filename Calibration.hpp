@@ -42,8 +42,14 @@
 #include <opencv2/core/core.hpp>
 #include <ARX/ARVideoSource.h>
 #include <map>
+#include <string>
 
 #include <ARX/ARUtil/thread_sub.h>
+#include "sessionRecorder.h"
+#include "captureJournal.h"
+
+// Default minimum pose novelty required for a capture to be accepted. See Calibration::setCaptureNoveltyThreshold().
+#define CALIBRATION_CAPTURE_NOVELTY_THRESHOLD_DEFAULT 1.0f
 
 class Calibration
 {
@@ -90,9 +96,26 @@ public:
             per frame, and runs in a separate thread. If the corner finder is waiting for a frame, this
             function will copy the source frame, and begin corner finding.
         @param vs ARVideoSource from which to grab the frame.
+        @param newResults_out If non-NULL, the bool pointed to will be set to true if the results of a
+            completed corner finding run were collected during this call, i.e. if the results returned by
+            cornerFinderResultsLockAndFetch() have changed, or false otherwise.
+        @result true if the frame was processed OK, false in the case of error.
+     */
+    bool frame(ARVideoSource *vs, bool *newResults_out = nullptr);
+    
+    /*!
+        @brief Pass a video frame for possible processing, from a source other than an ARVideoSource.
+        @details As frame(ARVideoSource *, bool *), but taking the luma plane of the frame directly, e.g.
+            from a ReplaySource. If wait is false, the frame is dropped if the corner finder is still busy
+            with an earlier frame, just as for live video. If wait is true, this call blocks until the
+            corner finder has processed this frame, so that every frame is processed, in order, and the
+            results returned by cornerFinderResultsLockAndFetch() are those for this frame.
+        @param videoFrame The luma plane of the frame, of the width and height passed to the constructor.
+        @param wait true to process this frame to completion before returning.
+        @param newResults_out As for frame(ARVideoSource *, bool *).
         @result true if the frame was processed OK, false in the case of error.
      */
-    bool frame(ARVideoSource *vs);
+    bool frame(const ARUint8 *videoFrame, const bool wait, bool *newResults_out = nullptr);
     
     /*!
         @brief Access the results of the most recent corner finding processing step, with lock.
@@ -117,11 +140,37 @@ public:
      */
     bool cornerFinderResultsUnlock(void);
     
+    /*!
+        @brief Set the minimum pose novelty a capture must have to be accepted.
+        @details When capture() is called, the pose of the calibration pattern relative to the camera
+            is estimated and compared against the poses of all the patterns already captured.
+            Novelty is the sum of the change in orientation in units of 5 degrees, and the change in
+            position in units of 5% of the distance from the camera.
+            Captures less novel than this threshold are rejected, since they add solver cost without
+            adding information. Set to 0.0f to accept all captures.
+        @param threshold The minimum novelty, or 0.0f to disable gating.
+            Defaults to CALIBRATION_CAPTURE_NOVELTY_THRESHOLD_DEFAULT.
+     */
+    void setCaptureNoveltyThreshold(const float threshold) {m_captureNoveltyThreshold = threshold; }
+    
+    /*!
+        @brief Get the minimum pose novelty a capture must have to be accepted.
+     */
+    float captureNoveltyThreshold() const {return m_captureNoveltyThreshold; }
+    
     /*!
         @brief Capture the most recent corner finder results as a calibration input.
+        @result true if the results were captured, or false if they were rejected, in which case
+            captureRejectReason() describes why.
      */
     bool capture();
     
+    /*!
+        @brief Get a user-readable description of why the most recent call to capture() returned false.
+        @result The reason, or an empty string if the most recent capture was accepted.
+     */
+    const std::string& captureRejectReason() const {return m_captureRejectReason; }
+    
     /*!
         @brief Undo the capture of the most recent corner finder results.
      */
@@ -132,6 +181,40 @@ public:
      */
     bool uncaptureAll();
     
+    /*!
+        @brief Begin recording the session to a file.
+        @details Each accepted capture, including the video frame and the corners both as found and
+            after refinement, is written to the file along with any undoing of captures. Writing
+            is done on a separate thread, so recording doesn't delay capture(). See sessionRecorder.h.
+            Any recording already in progress is stopped first.
+        @param pathname The file to record to. Any existing file is replaced.
+        @param compress If true, video frames are compressed.
+        @result true if recording began, false in the case of error.
+     */
+    bool startRecording(const char *pathname, const bool compress);
+    
+    /*!
+        @brief Finish writing the recording, if any. Also done when the session ends.
+     */
+    void stopRecording();
+    
+    /*!
+        @brief Begin journaling captures to a file, so that an interrupted run can be resumed.
+        @details Each capture and uncapture is appended to the journal as it happens. If the journal
+            already holds captures from a run with the same pattern, video size and key, those captures
+            replace any made so far, and calibImageCount() includes them. See captureJournal.h.
+            Any journal already open is closed first.
+        @param pathname The journal file. It is created if it doesn't exist.
+        @param key Identifies the camera, e.g. its AR_VIDEO_PARAM_DEVICEID.
+        @result true if journaling began, false in the case of error.
+     */
+    bool startJournal(const char *pathname, const char *key);
+    
+    /*!
+        @brief Close the journal, if any, leaving its contents to be resumed. Also done when the session ends.
+     */
+    void stopJournal();
+    
     /*!
         @brief Perform a calibration calculation on the currently captured results, and return as an ARParam.
         @param param_out Pointer to an ARParam which will be filled with the calibration result.
@@ -141,6 +224,19 @@ public:
      */
     void calib(ARParam *param_out, ARdouble *err_min_out, ARdouble *err_avg_out, ARdouble *err_max_out);
     
+    /*!
+        @brief Check an existing calibration against the currently captured results.
+        @details The pose of the pattern in each captured image is estimated using the calibration,
+            and the pattern corners reprojected. A calibration which still fits the camera will have a
+            reprojection error comparable to that of the original calibration. The error is measured as
+            by calib(), i.e. the RMS error of each image in observed pixels.
+        @param param The calibration to check. Its size must match the video size.
+        @param err_avg_out Pointer to an ARdouble which will be filled with the average over the images of the reprojection error, in pixels.
+        @param err_max_out Pointer to an ARdouble which will be filled with the maximum over the images of the reprojection error, in pixels.
+        @result true if the error was calculated, or false if there are no captured results, or in case of error.
+     */
+    bool validate(const ARParam *param, ARdouble *err_avg_out, ARdouble *err_max_out) const;
+    
     /*!
         @brief Terminate calibration and cleanup.
      */
@@ -155,6 +251,9 @@ private:
     // passed to threadInit().
     static void *cornerFinder(THREAD_HANDLE_T *threadHandle);
     
+    // Collect corner finder results into m_cornerFinderResultData. Returns true if results were collected.
+    bool cornerFinderCollect(const bool wait);
+    
     // A class to encapsulate the inputs and outputs of a corner-finding run, and to allow for copying of the results
     // of a completed run.
     class CalibrationCornerFinderData {
@@ -177,16 +276,36 @@ private:
         void dealloc();
     };
     
+    // Estimated pose of the calibration pattern in a captured image, in camera coordinates.
+    struct CapturePose {
+        cv::Matx33d R;
+        cv::Vec3d t;
+    };
+    
+    // Estimate the pose of the calibration pattern from its corners, using an approximate camera model.
+    bool estimatePose(const std::vector<cv::Point2f>& corners, CapturePose& pose_out) const;
+    
+    // Returns the novelty of pose b relative to pose a. See setCaptureNoveltyThreshold().
+    static float poseNovelty(const CapturePose& a, const CapturePose& b);
+    
     CalibrationCornerFinderData m_cornerFinderData; // Corner finder input and output.
     THREAD_HANDLE_T     *m_cornerFinderThread = NULL;
     pthread_mutex_t      m_cornerFinderResultLock;
     CalibrationCornerFinderData m_cornerFinderResultData; // Corner finder results copy, for display to user.
     
     std::vector<std::vector<cv::Point2f> > m_corners; // Collected corner information which gets passed to the OpenCV calibration function.
+    std::vector<CapturePose> m_poses; // Estimated pattern pose for each entry in m_corners.
+    std::vector<cv::Point3f> m_objectPoints; // Pattern corner positions, in pattern coordinates.
+    cv::Matx33d          m_poseCameraMatrix; // Approximate camera matrix used for pose estimation.
+    float                m_captureNoveltyThreshold;
+    std::string          m_captureRejectReason;
     int                  m_calibImageCountMax;
     CalibrationPatternType m_patternType;
     cv::Size             m_patternSize;
     int                  m_chessboardSquareWidth;
     int                  m_videoWidth;
     int                  m_videoHeight;
+    SESSION_RECORDER_t  *m_recorder = NULL;
+    std::vector<uint8_t> m_recordFrame; // Copy of the frame being captured, when recording.
+    CAPTURE_JOURNAL_t   *m_journal = NULL;
 };
@@ -0,0 +1,223 @@
+#!/usr/bin/env python3
+#
+#  calibrationLoadGenerator.py
+#  artoolkitX Camera Calibration Utility
+#
+#  Measures the ingest rate of a calibration upload server, normally the local reference server,
+#  calibrationServer.py. Posts synthetic forms, as produced by saveParam(), from a number of
+#  concurrent keep-alive connections, either one form per request or in gzip-compressed batches
+#  (see fileUploader.h for the batch format), and reports forms accepted per second and the
+#  distribution of request latency.
+#
+#  Forms are generated for --cameras distinct cameras, each with a unique timestamp, so every form
+#  is a new entry. With --repeat, every form is sent twice, to exercise the server's handling of
+#  forms sent again.
+#
+#  Usage:
+#      python3 calibrationLoadGenerator.py --token SECRET [--url http://127.0.0.1:8080/upload]
+#          [--batch-url URL --batch-size N] [--connections N] [--count N] [--cameras N] [--repeat]
+#
+#  This file is part of artoolkitX.
+#
+#  artoolkitX is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU Lesser General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  artoolkitX is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU Lesser General Public License for more details.
+#
+#  You should have received a copy of the GNU Lesser General Public License
+#  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+#
+#  Copyright 2018 Realmax, Inc.
+#
+#  Author(s): Philip Lamb
+#
+
+import argparse
+import gzip
+import hashlib
+import http.client
+import random
+import struct
+import sys
+import threading
+import time
+import urllib.parse
+
+BOUNDARY = 'arxccLoadGeneratorBoundary'
+RESOLUTIONS = ((640, 480), (1280, 720), (1920, 1080))
+
+
+def param_file(width, height, rng):
+    """A distortion function version 4 parameters file, big-endian as written by arParamSave()."""
+    fx = fy = width * rng.uniform(0.8, 1.2)
+    mat = (fx, 0.0, width / 2.0, 0.0, 0.0, fy, height / 2.0, 0.0, 0.0, 0.0, 1.0, 0.0)
+    dist = (rng.uniform(-0.4, 0.0), rng.uniform(0.0, 0.2), 0.0, 0.0, fx, fy, width / 2.0, height / 2.0, 1.0)
+    return struct.pack('>ii12d9d', width, height, *(mat + dist))
+
+
+def make_form(index, cameras, ss, rng):
+    """Returns the fields of form "index", as a list of (name, filename or None, value bytes)."""
+    camera = index % cameras
+    width, height = RESOLUTIONS[camera % len(RESOLUTIONS)]
+    err_avg = rng.uniform(0.1, 1.0)
+    # Unique per form: seconds from a fixed date, plus the form index.
+    timestamp = time.strftime('%Y-%m-%d %H:%M:%S +0000', time.gmtime(1514764800 + index))
+    fields = [
+        ('version', None, '1'),
+        ('file', '%06d-camera_para.dat' % (index % 1000000), param_file(width, height, rng)),
+        ('timestamp', None, timestamp),
+        ('os_name', None, 'linux'),
+        ('os_arch', None, 'x86_64'),
+        ('os_version', None, '4.15'),
+        ('device_id', None, 'loadgen/camera%d' % camera),
+        ('focal_length', None, '0.000'),
+        ('camera_index', None, '0'),
+        ('camera_face', None, 'rear'),
+        ('camera_width', None, str(width)),
+        ('camera_height', None, str(height)),
+        ('err_min', None, '%f' % (err_avg * 0.5)),
+        ('err_avg', None, '%f' % err_avg),
+        ('err_max', None, '%f' % (err_avg * 2.0)),
+        ('ss', None, ss),
+    ]
+    return [(name, filename, value if isinstance(value, bytes) else value.encode('utf-8')) for name, filename, value in fields]
+
+
+def encode_multipart(fields):
+    parts = []
+    for name, filename, value in fields:
+        disposition = 'form-data; name="%s"' % name
+        if filename is not None:
+            disposition += '; filename="%s"' % filename
+            head = 'Content-Disposition: %s\r\nContent-Type: application/octet-stream\r\n\r\n' % disposition
+        else:
+            head = 'Content-Disposition: %s\r\n\r\n' % disposition
+        parts.append(b'--' + BOUNDARY.encode('latin-1') + b'\r\n' + head.encode('utf-8') + value + b'\r\n')
+    parts.append(b'--' + BOUNDARY.encode('latin-1') + b'--\r\n')
+    return b''.join(parts)
+
+
+class Results:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.accepted = 0
+        self.rejected = 0
+        self.failed_requests = 0
+        self.latencies = []
+
+
+class Client(threading.Thread):
+    """Sends its share of the requests over one keep-alive connection."""
+
+    def __init__(self, url, requests, results):
+        super().__init__(daemon=True)
+        self.url = url
+        self.requests = requests  # List of (headers, body, form count, batch).
+        self.results = results
+
+    def connect(self):
+        cls = http.client.HTTPSConnection if self.url.scheme == 'https' else http.client.HTTPConnection
+        return cls(self.url.hostname, self.url.port, timeout=60)
+
+    def run(self):
+        conn = self.connect()
+        accepted = rejected = failed = 0
+        latencies = []
+        for headers, body, count, batch in self.requests:
+            t0 = time.perf_counter()
+            try:
+                conn.request('POST', self.url.path, body, headers)
+                response = conn.getresponse()
+                text = response.read().decode('utf-8', 'replace')
+            except (OSError, http.client.HTTPException):
+                conn.close()
+                conn = self.connect()
+                failed += 1
+                rejected += count
+                continue
+            latencies.append(time.perf_counter() - t0)
+            if response.status != 200:
+                failed += 1
+                rejected += count
+            elif not batch:
+                accepted += 1
+            else:
+                # One "index status" line per form.
+                ok = sum(1 for line in text.splitlines() if line.split()[-1:] == ['200'])
+                accepted += ok
+                rejected += count - ok
+        conn.close()
+        with self.results.lock:
+            self.results.accepted += accepted
+            self.results.rejected += rejected
+            self.results.failed_requests += failed
+            self.results.latencies.extend(latencies)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Load generator for a calibration upload server.')
+    parser.add_argument('--url', default='http://127.0.0.1:8080/upload')
+    parser.add_argument('--batch-url', help='Send forms in batches to this URL instead.')
+    parser.add_argument('--batch-size', type=int, default=64, help='Forms per batch.')
+    parser.add_argument('--token', required=True, help='Calibration server authentication token.')
+    parser.add_argument('--connections', type=int, default=8)
+    parser.add_argument('--count', type=int, default=10000, help='Number of forms to send.')
+    parser.add_argument('--cameras', type=int, default=100, help='Number of distinct cameras.')
+    parser.add_argument('--repeat', action='store_true', help='Send every form twice.')
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+    if args.connections <= 0 or args.count <= 0 or args.cameras <= 0 or args.batch_size <= 0:
+        parser.error('--connections, --count, --cameras and --batch-size must be positive')
+
+    # Build every request up front, so that only sending is timed.
+    rng = random.Random(args.seed)
+    ss = hashlib.md5(args.token.encode('utf-8')).hexdigest()
+    forms = [make_form(i, args.cameras, ss, rng) for i in range(args.count)]
+    if args.repeat:
+        forms = forms + forms
+    requests = []
+    if args.batch_url:
+        url = urllib.parse.urlsplit(args.batch_url)
+        for start in range(0, len(forms), args.batch_size):
+            batch = forms[start:start + args.batch_size]
+            fields = [('count', None, str(len(batch)).encode('ascii'))]
+            for i, form in enumerate(batch):
+                fields.extend(('%d.%s' % (i, name), filename, value) for name, filename, value in form)
+            body = gzip.compress(encode_multipart(fields), 1)
+            headers = {'Content-Type': 'multipart/form-data; boundary=%s' % BOUNDARY, 'Content-Encoding': 'gzip'}
+            requests.append((headers, body, len(batch), True))
+    else:
+        url = urllib.parse.urlsplit(args.url)
+        headers = {'Content-Type': 'multipart/form-data; boundary=%s' % BOUNDARY}
+        requests = [(headers, encode_multipart(form), 1, False) for form in forms]
+    sys.stderr.write('%d forms in %d requests, %d bytes, over %d connections.\n'
+                     % (len(forms), len(requests), sum(len(r[1]) for r in requests), args.connections))
+
+    results = Results()
+    clients = [Client(url, requests[i::args.connections], results) for i in range(args.connections)]
+    t0 = time.perf_counter()
+    for c in clients:
+        c.start()
+    for c in clients:
+        c.join()
+    elapsed = time.perf_counter() - t0
+
+    latencies = sorted(results.latencies)
+
+    def percentile(p):
+        return latencies[min(len(latencies) - 1, int(p * len(latencies)))] * 1000.0 if latencies else 0.0
+
+    print('%d forms accepted, %d rejected, %d requests failed, in %.2f s: %.0f forms/s.'
+          % (results.accepted, results.rejected, results.failed_requests, elapsed, results.accepted / elapsed))
+    print('Request latency: median %.1f ms, 90%% %.1f ms, 99%% %.1f ms, max %.1f ms.'
+          % (percentile(0.5), percentile(0.9), percentile(0.99), percentile(1.0)))
+    return 0 if results.rejected == 0 else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,435 @@
+#!/usr/bin/env python3
+#
+#  calibrationServer.py
+#  artoolkitX Camera Calibration Utility
+#
+#  A self-contained reference implementation of the ingest end of the calibration server, for
+#  load-testing uploads without the external server. Accepts the forms produced by saveParam(),
+#  one per request at the upload path, or in gzip-compressed batches at the batch path (see
+#  fileUploader.h for the batch format). Uses only the Python standard library.
+#
+#  Every field is validated, and the "ss" field must be the MD5 hash of one of the tokens given
+#  with --token. Accepted calibrations are stored in an SQLite database in the store directory,
+#  indexed by camera (device_id, dimensions and focal length). Forms are answered only once their
+#  entry is committed. A single writer thread commits whatever forms are waiting in one
+#  transaction, so concurrent uploads share the cost of each sync. Entries are keyed by device_id,
+#  timestamp and the MD5 of the parameters file, so a form that is sent again (e.g. after a lost
+#  response) is acknowledged without being stored twice.
+#
+#  Connections are served by a fixed pool of worker threads. Connections beyond the pool's size
+#  wait until a worker is free, so the load generator should not open more connections than there
+#  are workers. Idle keep-alive connections are closed after --idle-timeout seconds.
+#
+#  Counters are served as "name value" lines at GET /stats, as by calibrationServerStandIn.py.
+#  The best stored calibration for a camera is served at
+#  GET /lookup?device_id=ID&camera_width=W&camera_height=H&focal_length=F.
+#
+#  Usage:
+#      python3 calibrationServer.py --store DIR --token SECRET [--token SECRET2...] [--port 8080]
+#          [--workers N] [--idle-timeout SECS] [--no-sync]
+#  then point the uploader at http://127.0.0.1:8080/upload (and, for batch uploads,
+#  http://127.0.0.1:8080/batch). Use calibrationLoadGenerator.py to measure ingest rate.
+#
+#  This file is part of artoolkitX.
+#
+#  artoolkitX is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU Lesser General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  artoolkitX is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU Lesser General Public License for more details.
+#
+#  You should have received a copy of the GNU Lesser General Public License
+#  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+#
+#  Copyright 2018 Realmax, Inc.
+#
+#  Author(s): Philip Lamb
+#
+
+import argparse
+import gzip
+import hashlib
+import hmac
+import http.server
+import os
+import queue
+import sqlite3
+import sys
+import threading
+import time
+import urllib.parse
+
+from calibrationServerStandIn import REQUIRED_FIELDS, parse_multipart
+
+# Sizes of an ARParam file for the distortion function versions the calibrator produces. Form
+# version "2" carries a version 5 file, version "1" a version 4 file.
+PARAM_FILE_SIZE_BY_FORM_VERSION = {1: 176, 2: 240}
+
+# Most forms committed in one transaction.
+COMMIT_GROUP_MAX = 1024
+
+SCHEMA = '''
+CREATE TABLE IF NOT EXISTS calibrations (
+    id            INTEGER PRIMARY KEY,
+    device_id     TEXT NOT NULL,
+    camera_width  INTEGER NOT NULL,
+    camera_height INTEGER NOT NULL,
+    focal_length  TEXT NOT NULL,
+    camera_index  INTEGER NOT NULL,
+    camera_face   TEXT NOT NULL,
+    version       INTEGER NOT NULL,
+    timestamp     TEXT NOT NULL,
+    os_name       TEXT NOT NULL,
+    os_arch       TEXT NOT NULL,
+    os_version    TEXT NOT NULL,
+    err_min       REAL NOT NULL,
+    err_avg       REAL NOT NULL,
+    err_max       REAL NOT NULL,
+    param         BLOB NOT NULL,
+    param_md5     TEXT NOT NULL,
+    received      REAL NOT NULL,
+    UNIQUE (device_id, timestamp, param_md5)
+);
+CREATE INDEX IF NOT EXISTS calibrations_camera
+    ON calibrations (device_id, camera_width, camera_height, focal_length, err_avg);
+'''
+
+COLUMNS = ('device_id', 'camera_width', 'camera_height', 'focal_length', 'camera_index', 'camera_face',
+           'version', 'timestamp', 'os_name', 'os_arch', 'os_version', 'err_min', 'err_avg', 'err_max',
+           'param', 'param_md5', 'received')
+
+INSERT = 'INSERT OR IGNORE INTO calibrations (%s) VALUES (%s)' % (', '.join(COLUMNS), ', '.join('?' * len(COLUMNS)))
+
+
+class StoreError(Exception):
+    pass
+
+
+class Store:
+    """The on-disk store. Writes go through a single writer thread, which commits in groups."""
+
+    class Pending:
+        def __init__(self, rows):
+            self.rows = rows
+            self.inserted = []  # Per row, False if it was already stored.
+            self.error = None
+            self.done = threading.Event()
+
+    def __init__(self, path, sync):
+        self.path = path
+        self.sync = sync
+        self.queue = queue.Queue()
+        self.local = threading.local()
+        db = self.connect()
+        db.executescript(SCHEMA)
+        db.close()
+        self.commits = 0
+        self.thread = threading.Thread(target=self.writer, name='store writer', daemon=True)
+        self.thread.start()
+
+    def connect(self):
+        db = sqlite3.connect(self.path, timeout=30.0, isolation_level=None)
+        db.execute('PRAGMA journal_mode=WAL')
+        db.execute('PRAGMA synchronous=%s' % ('FULL' if self.sync else 'OFF'))
+        return db
+
+    def put(self, rows):
+        """Stores "rows", waiting until they are committed. Returns, per row, False if it was already stored."""
+        pending = Store.Pending(rows)
+        self.queue.put(pending)
+        pending.done.wait()
+        if pending.error:
+            raise StoreError(pending.error)
+        return pending.inserted
+
+    def writer(self):
+        db = self.connect()
+        while True:
+            group = [self.queue.get()]
+            if group[0] is None:
+                break
+            count = len(group[0].rows)
+            stop = False
+            while count < COMMIT_GROUP_MAX:
+                try:
+                    pending = self.queue.get_nowait()
+                except queue.Empty:
+                    break
+                if pending is None:
+                    stop = True
+                    break
+                group.append(pending)
+                count += len(pending.rows)
+            try:
+                db.execute('BEGIN')
+                for pending in group:
+                    pending.inserted = [db.execute(INSERT, row).rowcount == 1 for row in pending.rows]
+                db.execute('COMMIT')
+                self.commits += 1
+            except sqlite3.Error as e:
+                if db.in_transaction:
+                    db.execute('ROLLBACK')
+                for pending in group:
+                    pending.error = str(e)
+            for pending in group:
+                pending.done.set()
+            if stop:
+                break
+        db.close()
+
+    def close(self):
+        self.queue.put(None)
+        self.thread.join()
+
+    def lookup(self, device_id, camera_width, camera_height, focal_length):
+        """Returns (param, err_avg) for the stored calibration with the least average error, or None."""
+        db = getattr(self.local, 'db', None)
+        if db is None:
+            db = self.local.db = self.connect()
+        return db.execute('SELECT param, err_avg FROM calibrations WHERE device_id = ? AND camera_width = ? AND '
+                          'camera_height = ? AND focal_length = ? ORDER BY err_avg LIMIT 1',
+                          (device_id, camera_width, camera_height, focal_length)).fetchone()
+
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.requests = 0
+        self.forms_accepted = 0
+        self.forms_duplicate = 0
+        self.forms_rejected = 0
+        self.bytes_received = 0
+
+    def text(self, store):
+        with self.lock:
+            counters = dict((k, v) for k, v in vars(self).items() if isinstance(v, int))
+        counters['commits'] = store.commits
+        return ''.join('%s %d\n' % (k, v) for k, v in sorted(counters.items()))
+
+
+class PooledHTTPServer(http.server.HTTPServer):
+    """An HTTP server whose connections are served by a fixed pool of worker threads."""
+
+    request_queue_size = 128  # Listen backlog.
+
+    def __init__(self, address, handler, workers):
+        super().__init__(address, handler)
+        self.connections = queue.Queue(maxsize=workers)
+        self.workers = [threading.Thread(target=self.worker, name='worker %d' % i, daemon=True) for i in range(workers)]
+        for t in self.workers:
+            t.start()
+
+    def process_request(self, request, client_address):
+        self.connections.put((request, client_address))  # Blocks accepting while all workers are busy.
+
+    def worker(self):
+        while True:
+            request, client_address = self.connections.get()
+            if request is None:
+                break
+            try:
+                self.finish_request(request, client_address)
+            except Exception:
+                self.handle_error(request, client_address)
+            finally:
+                self.shutdown_request(request)
+
+    def server_close(self):
+        super().server_close()
+        for _ in self.workers:
+            self.connections.put((None, None))
+        for t in self.workers:
+            t.join()
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def check_form(self, fields):
+        """Returns (row, None) if the form is acceptable, otherwise (None, the reason it is not)."""
+        for f in REQUIRED_FIELDS:
+            if f not in fields:
+                return None, 'missing field "%s"' % f
+        filename, data = fields['file']
+        if filename is None:
+            return None, '"file" is not a file upload'
+        values = dict((k, v.decode('utf-8', 'replace')) for k, (_, v) in fields.items() if k != 'file')
+        if not any(hmac.compare_digest(values['ss'], ss) for ss in self.server.ss):
+            return None, 'bad shared secret'
+        try:
+            version = int(values['version'])
+            camera_width = int(values['camera_width'])
+            camera_height = int(values['camera_height'])
+            camera_index = int(values['camera_index'])
+            err_min, err_avg, err_max = float(values['err_min']), float(values['err_avg']), float(values['err_max'])
+            time.strptime(values['timestamp'], '%Y-%m-%d %H:%M:%S +0000')
+            float(values['focal_length'])
+        except ValueError as e:
+            return None, 'bad field value: %s' % e
+        if version not in PARAM_FILE_SIZE_BY_FORM_VERSION:
+            return None, 'unknown version %d' % version
+        if len(data) != PARAM_FILE_SIZE_BY_FORM_VERSION[version]:
+            return None, 'parameter file has unexpected size %d for version %d' % (len(data), version)
+        if camera_width <= 0 or camera_height <= 0:
+            return None, 'bad camera dimensions %dx%d' % (camera_width, camera_height)
+        if values['camera_face'] not in ('front', 'rear'):
+            return None, 'bad camera_face "%s"' % values['camera_face']
+        if not values['device_id']:
+            return None, 'empty device_id'
+        if not 0.0 <= err_min <= err_avg <= err_max:
+            return None, 'inconsistent errors %f, %f, %f' % (err_min, err_avg, err_max)
+        row = (values['device_id'], camera_width, camera_height, values['focal_length'], camera_index,
+               values['camera_face'], version, values['timestamp'], values['os_name'], values['os_arch'],
+               values['os_version'], err_min, err_avg, err_max, data, hashlib.md5(data).hexdigest(), time.time())
+        return row, None
+
+    def store_rows(self, rows):
+        """Stores "rows", updating counters. Returns False in case of a store error."""
+        try:
+            inserted = self.server.store.put(rows)
+        except StoreError as e:
+            self.log_message('store error: %s', e)
+            return False
+        stats = self.server.stats
+        with stats.lock:
+            stats.forms_accepted += sum(1 for i in inserted if i)
+            stats.forms_duplicate += sum(1 for i in inserted if not i)
+        return True
+
+    def reply(self, code, text='', content_type='text/plain', body=None):
+        if body is None:
+            body = text.encode('utf-8')
+        self.send_response(code)
+        self.send_header('Content-Type', content_type)
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_GET(self):
+        url = urllib.parse.urlsplit(self.path)
+        if url.path == '/stats':
+            self.reply(200, self.server.stats.text(self.server.store))
+        elif url.path == '/lookup':
+            query = urllib.parse.parse_qs(url.query)
+            try:
+                key = (query['device_id'][0], int(query['camera_width'][0]), int(query['camera_height'][0]),
+                       query.get('focal_length', ['0.000'])[0])
+            except (KeyError, ValueError):
+                self.reply(400)
+                return
+            found = self.server.store.lookup(*key)
+            if found is None:
+                self.reply(404)
+            else:
+                self.send_response(200)
+                self.send_header('Content-Type', 'application/octet-stream')
+                self.send_header('Content-Length', str(len(found[0])))
+                self.send_header('X-Err-Avg', '%f' % found[1])
+                self.end_headers()
+                self.wfile.write(found[0])
+        else:
+            self.reply(404)
+
+    def do_POST(self):
+        length = int(self.headers.get('Content-Length', 0))
+        body = self.rfile.read(length)
+        stats = self.server.stats
+        with stats.lock:
+            stats.requests += 1
+            stats.bytes_received += length
+        try:
+            if self.headers.get('Content-Encoding', '').lower() == 'gzip':
+                body = gzip.decompress(body)
+            fields = parse_multipart(self.headers.get('Content-Type', ''), body)
+        except (ValueError, OSError, EOFError) as e:
+            self.log_message('bad request: %s', e)
+            self.reply(400)
+            return
+
+        if self.path == self.server.batch_path:
+            try:
+                count = int(fields['count'][1])
+            except (KeyError, ValueError):
+                self.reply(400)
+                return
+            codes = [400] * count
+            rows = []
+            indices = []
+            for i in range(count):
+                prefix = '%d.' % i
+                row, reason = self.check_form({k[len(prefix):]: v for k, v in fields.items() if k.startswith(prefix)})
+                if reason:
+                    self.log_message('batch form %d rejected: %s', i, reason)
+                else:
+                    rows.append(row)
+                    indices.append(i)
+            with stats.lock:
+                stats.forms_rejected += count - len(rows)
+            if rows:
+                stored = self.store_rows(rows)
+                for i in indices:
+                    codes[i] = (200 if stored else 503)
+            self.reply(200, ''.join('%d %d\n' % (i, code) for i, code in enumerate(codes)))
+        elif self.path == self.server.upload_path:
+            row, reason = self.check_form(fields)
+            if reason:
+                with stats.lock:
+                    stats.forms_rejected += 1
+                self.log_message('form rejected: %s', reason)
+                self.reply(400)
+            elif not self.store_rows([row]):
+                self.reply(503)
+            else:
+                self.reply(200)
+        else:
+            self.reply(404)
+
+    def log_message(self, format, *args):
+        if not self.server.quiet:
+            sys.stderr.write('%s %s\n' % (self.address_string(), format % args))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Reference calibration upload server.')
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=8080)
+    parser.add_argument('--upload-path', default='/upload')
+    parser.add_argument('--batch-path', default='/batch')
+    parser.add_argument('--token', action='append', required=True,
+                        help='Calibration server authentication token. May be given more than once.')
+    parser.add_argument('--store', required=True, help='Directory holding the calibration database.')
+    parser.add_argument('--workers', type=int, default=16, help='Number of connections served at once.')
+    parser.add_argument('--idle-timeout', type=float, default=5.0, help='Seconds before an idle connection is closed.')
+    parser.add_argument('--no-sync', action='store_true', help='Do not sync commits to storage.')
+    parser.add_argument('--quiet', action='store_true')
+    args = parser.parse_args()
+    if args.workers <= 0:
+        parser.error('--workers must be positive')
+
+    os.makedirs(args.store, exist_ok=True)
+    Handler.timeout = args.idle_timeout
+    server = PooledHTTPServer((args.host, args.port), Handler, args.workers)
+    server.upload_path = args.upload_path
+    server.batch_path = args.batch_path
+    server.ss = [hashlib.md5(t.encode('utf-8')).hexdigest() for t in args.token]
+    server.store = Store(os.path.join(args.store, 'calibrations.sqlite3'), not args.no_sync)
+    server.quiet = args.quiet
+    server.stats = Stats()
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    server.server_close()
+    server.store.close()
+    s = server.stats
+    sys.stderr.write('%d requests, %d bytes, %d forms accepted, %d duplicate, %d rejected, in %d commits.\n'
+                     % (s.requests, s.bytes_received, s.forms_accepted, s.forms_duplicate, s.forms_rejected,
+                        server.store.commits))
+
+
+if __name__ == '__main__':
+    main()
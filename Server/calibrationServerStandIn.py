@@ -0,0 +1,290 @@
+#!/usr/bin/env python3
+#
+#  calibrationServerStandIn.py
+#  artoolkitX Camera Calibration Utility
+#
+#  A local stand-in for the calibration upload server, for exercising fileUploader.c.
+#  Accepts the forms posted by the uploader, one per request at the upload path, or in
+#  gzip-compressed batches at the batch path (see fileUploader.h for the batch format).
+#  Uses only the Python standard library.
+#
+#  Faults can be injected to exercise the uploader's error handling: a fixed latency (plus
+#  random jitter) before each response, a probability of answering with an HTTP error code,
+#  and a probability of dropping the connection without any response.
+#
+#  Counters are served as "name value" lines at GET /stats, for use by
+#  Benchmarks/fileUploaderBenchmark.c.
+#
+#  Usage:
+#      python3 calibrationServerStandIn.py [--port 8080] [--token SECRET] [--store DIR]
+#          [--latency MS] [--jitter MS] [--error-rate P] [--error-code CODE] [--drop-rate P]
+#          [--seed N]
+#  then point the uploader at http://127.0.0.1:8080/upload (and, for batch uploads,
+#  http://127.0.0.1:8080/batch).
+#
+#  This file is part of artoolkitX.
+#
+#  artoolkitX is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU Lesser General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  artoolkitX is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU Lesser General Public License for more details.
+#
+#  You should have received a copy of the GNU Lesser General Public License
+#  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+#
+#  Copyright 2018 Realmax, Inc.
+#
+#  Author(s): Philip Lamb
+#
+
+import argparse
+import gzip
+import hashlib
+import http.server
+import os
+import random
+import socket
+import sys
+import threading
+import time
+
+# Sizes of an ARParam file for distortion function versions 1 to 5.
+PARAM_FILE_SIZES = (136, 144, 152, 176, 240)
+
+REQUIRED_FIELDS = ('version', 'file', 'timestamp', 'os_name', 'os_arch', 'os_version', 'device_id',
+                   'focal_length', 'camera_index', 'camera_face', 'camera_width', 'camera_height',
+                   'err_min', 'err_avg', 'err_max', 'ss')
+
+
+def parse_multipart(content_type, body):
+    """Returns a dict of field name -> (filename or None, value bytes).
+
+    A minimal multipart/form-data parser. email.parser handles the general case but is far
+    too slow for batches of hundreds of forms.
+    """
+    ctype, _, params = content_type.partition(';')
+    if ctype.strip().lower() != 'multipart/form-data':
+        raise ValueError('not a multipart/form-data body')
+    boundary = None
+    for param in params.split(';'):
+        k, _, v = param.strip().partition('=')
+        if k.lower() == 'boundary':
+            boundary = v.strip('"')
+    if not boundary:
+        raise ValueError('no boundary')
+    fields = {}
+    for section in body.split(b'--' + boundary.encode('latin-1'))[1:]:
+        if section.startswith(b'--'):
+            break  # Closing delimiter.
+        head, sep, value = section.partition(b'\r\n\r\n')
+        if not head.startswith(b'\r\n') or not sep or not value.endswith(b'\r\n'):
+            raise ValueError('malformed part')
+        name = filename = None
+        for line in head[2:].split(b'\r\n'):
+            hname, _, hvalue = line.decode('utf-8', 'replace').partition(':')
+            if hname.strip().lower() != 'content-disposition':
+                continue
+            for item in hvalue.split(';')[1:]:
+                k, _, v = item.strip().partition('=')
+                if k == 'name':
+                    name = v.strip('"')
+                elif k == 'filename':
+                    filename = v.strip('"')
+        if name is None:
+            raise ValueError('part without a name')
+        fields[name] = (filename, value[:-2])
+    return fields
+
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.requests = 0
+        self.forms_accepted = 0
+        self.forms_rejected = 0
+        self.bytes_received = 0
+        self.errors_injected = 0
+        self.drops_injected = 0
+
+    def text(self):
+        with self.lock:
+            return ''.join('%s %d\n' % (k, v) for k, v in sorted(vars(self).items()) if isinstance(v, int))
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def check_form(self, fields):
+        """Returns None if the form is acceptable, otherwise the reason it is not."""
+        for f in REQUIRED_FIELDS:
+            if f not in fields:
+                return 'missing field "%s"' % f
+        filename, data = fields['file']
+        if filename is None:
+            return '"file" is not a file upload'
+        if len(data) not in PARAM_FILE_SIZES:
+            return 'parameter file has unexpected size %d' % len(data)
+        if self.server.ss is not None and fields['ss'][1].decode('ascii', 'replace') != self.server.ss:
+            return 'bad shared secret'
+        return None
+
+    def accept_form(self, fields):
+        if self.server.store:
+            filename, data = fields['file']
+            device_id = fields['device_id'][1].decode('utf-8', 'replace').replace('/', '_')
+            path = os.path.join(self.server.store, '%s-%s' % (device_id, os.path.basename(filename)))
+            with open(path, 'wb') as f:
+                f.write(data)
+
+    def reply(self, code, text=''):
+        body = text.encode('utf-8')
+        self.send_response(code)
+        self.send_header('Content-Type', 'text/plain')
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_GET(self):
+        if self.path == '/stats':
+            self.reply(200, self.server.stats.text())
+        else:
+            self.reply(404)
+
+    def inject_fault(self):
+        """Applies the configured latency, and returns True if the request was failed or dropped."""
+        server = self.server
+        with server.random_lock:
+            delay = server.latency + server.random.uniform(0.0, server.jitter)
+            r = server.random.random()
+        if delay > 0:
+            time.sleep(delay)
+        if r < server.drop_rate:
+            with server.stats.lock:
+                server.stats.drops_injected += 1
+            self.close_connection = True
+            try:
+                self.connection.shutdown(socket.SHUT_RDWR)
+            except OSError:
+                pass
+            return True
+        if r < server.drop_rate + server.error_rate:
+            with server.stats.lock:
+                server.stats.errors_injected += 1
+            self.reply(server.error_code)
+            return True
+        return False
+
+    def do_POST(self):
+        length = int(self.headers.get('Content-Length', 0))
+        body = self.rfile.read(length)
+        stats = self.server.stats
+        with stats.lock:
+            stats.requests += 1
+            stats.bytes_received += length
+        if self.inject_fault():
+            return
+        try:
+            if self.headers.get('Content-Encoding', '').lower() == 'gzip':
+                body = gzip.decompress(body)
+            fields = parse_multipart(self.headers.get('Content-Type', ''), body)
+        except (ValueError, OSError, EOFError) as e:
+            self.log_message('bad request: %s', e)
+            self.reply(400)
+            return
+
+        if self.path == self.server.batch_path:
+            try:
+                count = int(fields['count'][1])
+            except (KeyError, ValueError):
+                self.reply(400)
+                return
+            lines = []
+            accepted = 0
+            for i in range(count):
+                prefix = '%d.' % i
+                form = {k[len(prefix):]: v for k, v in fields.items() if k.startswith(prefix)}
+                reason = self.check_form(form)
+                if reason:
+                    self.log_message('batch form %d rejected: %s', i, reason)
+                    lines.append('%d 400\n' % i)
+                else:
+                    self.accept_form(form)
+                    lines.append('%d 200\n' % i)
+                    accepted += 1
+            with stats.lock:
+                stats.forms_accepted += accepted
+                stats.forms_rejected += count - accepted
+            self.log_message('batch of %d forms, %d bytes (%d uncompressed), %d accepted', count, length, len(body), accepted)
+            self.reply(200, ''.join(lines))
+        elif self.path == self.server.upload_path:
+            reason = self.check_form(fields)
+            with stats.lock:
+                if reason:
+                    stats.forms_rejected += 1
+                else:
+                    stats.forms_accepted += 1
+            if reason:
+                self.log_message('form rejected: %s', reason)
+                self.reply(400)
+            else:
+                self.accept_form(fields)
+                self.reply(200)
+        else:
+            self.reply(404)
+
+    def log_message(self, format, *args):
+        if not self.server.quiet:
+            sys.stderr.write('%s %s\n' % (self.address_string(), format % args))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Local stand-in for the calibration upload server.')
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=8080)
+    parser.add_argument('--upload-path', default='/upload')
+    parser.add_argument('--batch-path', default='/batch')
+    parser.add_argument('--token', help='Calibration server authentication token. If given, the "ss" field is verified.')
+    parser.add_argument('--store', help='Directory in which to save received parameter files.')
+    parser.add_argument('--latency', type=float, default=0.0, help='Delay in milliseconds before each response.')
+    parser.add_argument('--jitter', type=float, default=0.0, help='Random extra delay of up to this many milliseconds.')
+    parser.add_argument('--error-rate', type=float, default=0.0, help='Probability of answering a POST with --error-code.')
+    parser.add_argument('--error-code', type=int, default=503)
+    parser.add_argument('--drop-rate', type=float, default=0.0, help='Probability of closing the connection without responding.')
+    parser.add_argument('--seed', type=int, help='Seed for fault injection, for repeatable runs.')
+    parser.add_argument('--quiet', action='store_true')
+    args = parser.parse_args()
+    if not (0.0 <= args.error_rate and 0.0 <= args.drop_rate and args.error_rate + args.drop_rate <= 1.0):
+        parser.error('--error-rate and --drop-rate must be non-negative and sum to at most 1')
+
+    server = http.server.ThreadingHTTPServer((args.host, args.port), Handler)
+    server.upload_path = args.upload_path
+    server.batch_path = args.batch_path
+    server.ss = hashlib.md5(args.token.encode('utf-8')).hexdigest() if args.token is not None else None
+    server.store = args.store
+    server.quiet = args.quiet
+    server.latency = args.latency / 1000.0
+    server.jitter = args.jitter / 1000.0
+    server.error_rate = args.error_rate
+    server.error_code = args.error_code
+    server.drop_rate = args.drop_rate
+    server.random = random.Random(args.seed)
+    server.random_lock = threading.Lock()
+    server.stats = Stats()
+    if args.store:
+        os.makedirs(args.store, exist_ok=True)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    s = server.stats
+    sys.stderr.write('%d requests, %d bytes, %d forms accepted, %d rejected, %d errors and %d drops injected.\n'
+                     % (s.requests, s.bytes_received, s.forms_accepted, s.forms_rejected, s.errors_injected, s.drops_injected))
+
+
+if __name__ == '__main__':
+    main()
@@ -42,6 +42,8 @@
 #include <opencv2/core/core.hpp>
 #include "Calibration.hpp"
 
+void calcChessboardCorners(const Calibration::CalibrationPatternType patternType, cv::Size patternSize, float patternSpacing, std::vector<cv::Point3f>& corners);
+
 void calc(const int capturedImageNum,
           const Calibration::CalibrationPatternType patternType,
 		  const cv::Size patternSize,
@@ -44,6 +44,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <errno.h>
+#include <pthread.h>
+#include <atomic>
 #ifdef _WIN32
 #  include <windows.h>
 #  define MAXPATHLEN MAX_PATH
@@ -51,6 +54,7 @@
 #else
 #  include <sys/param.h> // MAXPATHLEN
 #  include <unistd.h> // getcwd
+#  include <sys/stat.h> // mkdir
 #endif
 #include <ARX/AR/ar.h>
 //#include <ARX/ARVideo/video.h>
@@ -66,6 +70,10 @@
 #include <ARX/ARG/glStateCache2.h>
 
 #include "fileUploader.h"
+#include "paramBuffer.h"
+#include "calibrationUploadKey.h"
+#include "calibrationCache.h"
+#include "paramSaveQueue.h"
 #include "Calibration.hpp"
 #include "flow.hpp"
 #include "Eden/EdenMessage.h"
@@ -120,6 +128,12 @@ enum {
 
 // Data upload.
 #define QUEUE_DIR "queue"
+#define CALIBRATION_CACHE_DIR "calibrations"
+// A cached calibration is reused if its validation error is no more than this many times its original error...
+#define CALIBRATION_CACHE_REUSE_ERROR_FACTOR 2.0
+// ...or this many pixels, whichever is greater.
+#define CALIBRATION_CACHE_REUSE_ERROR_MIN 0.5
+#define CAPTURE_JOURNAL_FILE_EXTENSION "journal"
 #define QUEUE_INDEX_FILE_EXTENSION "upload"
 
 
@@ -145,6 +159,13 @@ unsigned char *MD5(const unsigned char *d, size_t n, unsigned char *md);
 #endif
 
 
+// Number of frames over which video ingest rate is measured and reported.
+#define VIDEO_CAPTURE_FPS_FRAMES 150
+
+// While animations or messages are being displayed, the interval at which to redraw even if no events arrive.
+#define REDRAW_INTERVAL_ANIMATING_MS 40
+#define REDRAW_INTERVAL_MESSAGE_MS 250
+
 #define FONT_SIZE 18.0f
 #define UPLOAD_STATUS_HIDE_AFTER_SECONDS 9.0f
 
@@ -155,10 +176,15 @@ unsigned char *MD5(const unsigned char *d, size_t n, unsigned char *md);
 // Prefs.
 static void *gPreferences = NULL;
 Uint32 gSDLEventPreferencesChanged = 0;
+static Uint32 gSDLEventNewVideoFrame = 0; // Posted by video capture thread when there is something new to draw.
+static Uint32 gSDLEventFlowUpdated = 0; // Posted by flow thread when what it is displaying has changed.
+static Uint32 gSDLEventUploadStatusChanged = 0; // Posted by upload thread when it publishes a new status.
+static std::atomic<bool> gSDLEventNewVideoFramePending(false);
 static char *gPreferenceCameraOpenToken = NULL;
 static char *gPreferenceCameraResolutionToken = NULL;
 static bool gCalibrationSave = false;
 static char *gCalibrationSaveDir = NULL;
+static int gCalibrationRemapLUTGridStep = 0; // If non-zero, a remap table is saved alongside each calibration.
 static char *gCalibrationServerUploadURL = NULL;
 static char *gCalibrationServerAuthenticationToken = NULL;
 static int gPreferencesCalibImageCountMax = CALIB_IMAGE_NUM;
@@ -171,20 +197,37 @@ static float gCalibrationPatternSpacing;
 //
 
 static Calibration *gCalibration = nullptr;
+static pthread_mutex_t gCalibrationLock = PTHREAD_MUTEX_INITIALIZER; // Guards gCalibration between video capture and main threads.
 
 //
 // Data upload.
 //
 
 static char *gFileUploadQueuePath = NULL;
+
+//
+// Calibration cache.
+//
+
+static char *gCalibrationCachePath = NULL;
+static bool gCachedCalibrationValid = false; // Set if the camera opened by startVideo() has a cached calibration.
+static ARParam gCachedCalibration;
+static ARdouble gCachedCalibrationErrAvg = 0.0;
 FILE_UPLOAD_HANDLE_t *fileUploadHandle = NULL;
+static PARAM_SAVE_QUEUE_t *gParamSaveQueue = NULL; // Saves calibration results off the flow thread.
 
 // Video acquisition and rendering.
 static ARVideoSource *vs = nullptr;
 static ARVideoView *vv = nullptr;
 static bool gPostVideoSetupDone = false;
 static bool gCameraIsFrontFacing = false;
-static long gFrameCount = 0;
+
+// Video capture thread. Drains the video source at its native rate, independent of the display rate.
+static pthread_t gVideoCaptureThread;
+static bool gVideoCaptureThreadRunning = false;
+static std::atomic<bool> gVideoCaptureThreadStop(false);
+static std::atomic<long> gVideoFrameCount(0); // Incremented for each new frame captured.
+static long gVideoFrameCountSeen = 0; // Value of gVideoFrameCount last seen by main thread.
 
 // Window and GL context.
 static ARG_API drawAPI = ARG_API_None;
@@ -203,6 +246,7 @@ static GLuint program = 0;
 
 // Main state.
 static struct timeval gStartTime;
+static int gUploadStatusDisplayed = 0; // Result of most recent fileUploaderStatusGet() in drawView().
 
 // Corner finder results copy, for display to user.
 static ARGL_CONTEXT_SETTINGS_REF gArglSettingsCornerFinderImage = NULL;
@@ -218,6 +262,204 @@ static void drawView(void);
 //static void          init(int argc, char *argv[]);
 //static void          usage(char *com);
 static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg, ARdouble err_max, void *userdata);
+static void reuseParam(const ARParam *param, ARdouble err_avg, ARdouble err_max, void *userdata);
+static void getCameraIdentity(char **device_id_p, char **name_p, char **focal_length_p);
+static void startCaptureJournal(void);
+
+static void postNewVideoFrameEvent(void)
+{
+    // Coalesce, so that the event queue doesn't fill if the main thread falls behind.
+    if (gSDLEventNewVideoFramePending.exchange(true)) return;
+    
+    SDL_Event event;
+    SDL_zero(event);
+    event.type = gSDLEventNewVideoFrame;
+    SDL_PushEvent(&event);
+}
+
+static void flowUpdated(void *userdata)
+{
+    SDL_Event event;
+    SDL_zero(event);
+    event.type = gSDLEventFlowUpdated;
+    SDL_PushEvent(&event);
+}
+
+static void uploadStatusChanged(void *userdata)
+{
+    SDL_Event event;
+    SDL_zero(event);
+    event.type = gSDLEventUploadStatusChanged;
+    SDL_PushEvent(&event);
+}
+
+// Video capture thread.
+// Captures frames as they arrive and, while the flow is capturing, submits them to the corner finder.
+// The main thread picks up the latest frame from the video source when drawing.
+static void *videoCaptureThread(void *arg)
+{
+    long frameCount = 0;
+    struct timeval fpsStartTime, now;
+    int frameIntervalMs = 0;
+    
+    ARLOGi("Start video capture thread.\n");
+    
+    gettimeofday(&fpsStartTime, NULL);
+    while (!gVideoCaptureThreadStop) {
+        if (!vs->captureFrame()) {
+            arUtilSleep(1); // 1 millisecond.
+            continue;
+        }
+        gVideoFrameCount++;
+        
+        // Only notify the main thread if there is something new to draw. While capturing, that is the corner finder results.
+        bool newResults = false;
+        pthread_mutex_lock(&gCalibrationLock);
+        if (gCalibration && flowStateGet() == FLOW_STATE_CAPTURING) {
+            gCalibration->frame(vs, &newResults);
+        } else {
+            newResults = true;
+        }
+        pthread_mutex_unlock(&gCalibrationLock);
+        if (newResults) postNewVideoFrameEvent();
+        
+        // Report achieved ingest rate.
+        frameCount++;
+        if (frameCount == VIDEO_CAPTURE_FPS_FRAMES) {
+            gettimeofday(&now, NULL);
+            double elapsed = (double)(now.tv_sec - fpsStartTime.tv_sec) + (double)(now.tv_usec - fpsStartTime.tv_usec)/1.0e6;
+            if (elapsed > 0.0) {
+                ARLOGi("*** Camera - %f (frame/sec)\n", (double)frameCount/elapsed);
+                frameIntervalMs = (int)(elapsed * 1000.0 / (double)frameCount);
+            }
+            frameCount = 0;
+            fpsStartTime = now;
+        }
+        
+        // No new frame is expected for a while, so rather than polling, sleep for most of the frame interval.
+        if (frameIntervalMs > 4) arUtilSleep(frameIntervalMs * 3 / 4);
+    }
+    
+    ARLOGi("End video capture thread.\n");
+    return (NULL);
+}
+
+static void startVideoCaptureThread(void)
+{
+    gVideoCaptureThreadStop = false;
+    gVideoFrameCount = 0;
+    gVideoFrameCountSeen = 0;
+    if (pthread_create(&gVideoCaptureThread, NULL, videoCaptureThread, NULL) != 0) {
+        ARLOGe("Error: Unable to create video capture thread.\n");
+        ARLOGperror(NULL);
+        return;
+    }
+    gVideoCaptureThreadRunning = true;
+}
+
+static void stopVideoCaptureThread(void)
+{
+    if (!gVideoCaptureThreadRunning) return;
+    gVideoCaptureThreadStop = true;
+    pthread_join(gVideoCaptureThread, NULL);
+    gVideoCaptureThreadRunning = false;
+}
+
+// Create the calibration session for the current pattern settings and start the calibration flow.
+// The video source must be open.
+static void startCalibration(void)
+{
+    pthread_mutex_lock(&gCalibrationLock);
+    gCalibration = new Calibration(gCalibrationPatternType, gPreferencesCalibImageCountMax, gCalibrationPatternSize, gCalibrationPatternSpacing, vs->getVideoWidth(), vs->getVideoHeight());
+    pthread_mutex_unlock(&gCalibrationLock);
+    if (!gCalibration) {
+        ARLOGe("Error initialising calibration.\n");
+        quit(-1);
+    }
+    startCaptureJournal();
+    
+    // Offer any cached calibration for this camera for reuse.
+    if (gCachedCalibrationValid) {
+        ARdouble errorMax = gCachedCalibrationErrAvg*CALIBRATION_CACHE_REUSE_ERROR_FACTOR;
+        if (errorMax < CALIBRATION_CACHE_REUSE_ERROR_MIN) errorMax = CALIBRATION_CACHE_REUSE_ERROR_MIN;
+        flowSetReuseCandidate(&gCachedCalibration, errorMax, reuseParam, NULL);
+    } else {
+        flowSetReuseCandidate(NULL, 0.0, NULL, NULL);
+    }
+    
+    if (!flowInitAndStart(gCalibration, saveParam, NULL)) {
+        ARLOGe("Error: Could not initialise and start flow.\n");
+        quit(-1);
+    }
+}
+
+// Stop the calibration flow and discard the calibration session. The video source is left open.
+static void stopCalibration(void)
+{
+    // Detach from the video capture thread first, so it stops submitting frames and querying the flow.
+    pthread_mutex_lock(&gCalibrationLock);
+    Calibration *calibration = gCalibration;
+    gCalibration = nullptr;
+    pthread_mutex_unlock(&gCalibrationLock);
+    
+    // Stop calibration flow.
+    flowStopAndFinal();
+    
+    delete calibration;
+}
+
+// Journal captures in the cache directory, so that a run interrupted by a crash or camera disconnection
+// can be resumed. There is one journal per camera and video size.
+static void startCaptureJournal(void)
+{
+    char *device_id, *name, *focal_length;
+    
+    getCameraIdentity(&device_id, &name, &focal_length);
+    const char *identifier = (device_id ? device_id : name);
+    if (identifier && gCalibrationCachePath) {
+        if (mkdir(gCalibrationCachePath, 0755) < 0 && errno != EEXIST) {
+            ARLOGe("Error creating calibration cache directory '%s'.\n", gCalibrationCachePath);
+            ARLOGperror(NULL);
+        } else {
+            char *key, *journalPathname;
+            asprintf(&key, "%s %s", identifier, focal_length);
+            asprintf(&journalPathname, "%s/session-%s-%dx%d." CAPTURE_JOURNAL_FILE_EXTENSION, gCalibrationCachePath, identifier, vs->getVideoWidth(), vs->getVideoHeight());
+            for (char *p = journalPathname + strlen(gCalibrationCachePath) + 1; *p; p++) {
+                if (*p == '/' || *p == '\\') *p = '_';
+            }
+            if (!gCalibration->startJournal(journalPathname, key)) {
+                ARLOGw("Unable to journal captures. An interrupted calibration run will not be resumable.\n");
+            }
+            free(journalPathname);
+            free(key);
+        }
+    }
+    free(device_id);
+    free(name);
+    free(focal_length);
+}
+
+// Look up the cached calibration, if any, for the camera just opened.
+static void lookupCachedCalibration(void)
+{
+    char *device_id, *name, *focal_length;
+    time_t cachedTime;
+    
+    gCachedCalibrationValid = false;
+    getCameraIdentity(&device_id, &name, &focal_length);
+    if (device_id && gCalibrationCachePath) {
+        CALIBRATION_CACHE_KEY_t key = {device_id, vs->getVideoWidth(), vs->getVideoHeight(), focal_length, AR_DIST_FUNCTION_VERSION_DEFAULT};
+        if (calibrationCacheGet(gCalibrationCachePath, &key, &gCachedCalibration, &gCachedCalibrationErrAvg, &cachedTime)) {
+            char timestamp[32] = "";
+            strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", localtime(&cachedTime));
+            ARLOGi("Found calibration for this camera from %s (error avg=%.3f).\n", timestamp, gCachedCalibrationErrAvg);
+            gCachedCalibrationValid = true;
+        }
+    }
+    free(device_id);
+    free(name);
+    free(focal_length);
+}
 
 static void startVideo(void)
 {
@@ -233,6 +475,9 @@ static void startVideo(void)
         if (!vs->open()) {
             ARLOGe("Error: Unable to open video source.\n");
             EdenMessageShow((const unsigned char *)"Welcome to artoolkitX Camera Calibrator\n(c)2018 Realmax, Inc. & (c)2017 DAQRI LLC.\n\nUnable to open video source.\n\nPress 'p' for settings and help.");
+        } else {
+            lookupCachedCalibration();
+            startVideoCaptureThread();
         }
     }
     gPostVideoSetupDone = false;
@@ -240,13 +485,10 @@ static void startVideo(void)
 
 static void stopVideo(void)
 {
-    // Stop calibration flow.
-    flowStopAndFinal();
+    // Stop frame capture before anything it uses is torn down.
+    stopVideoCaptureThread();
     
-    if (gCalibration) {
-        delete gCalibration;
-        gCalibration = nullptr;
-    }
+    stopCalibration();
     
     if (gArglSettingsCornerFinderImage) {
         arglCleanup(gArglSettingsCornerFinderImage); // Clean up any left-over ARGL data.
@@ -259,23 +501,32 @@ static void stopVideo(void)
     vs = nullptr;
 }
 
+// Compare two strings, either or both of which may be NULL.
+static bool stringsEqual(const char *s1, const char *s2)
+{
+    if (!s1 || !s2) return (s1 == s2);
+    return (strcmp(s1, s2) == 0);
+}
+
 static void rereadPreferences(void)
 {
     // Re-read preferences.
     gCalibrationSave = getPreferenceCalibrationSave(gPreferences);
+    gCalibrationRemapLUTGridStep = getPreferenceCalibrationRemapLUTGridStep(gPreferences);
     char *csd = getPreferenceCalibSaveDir(gPreferences);
-    if (csd && gCalibrationSaveDir && strcmp(gCalibrationSaveDir, csd) == 0) {
+    if (stringsEqual(gCalibrationSaveDir, csd)) {
         free(csd);
     } else {
         free(gCalibrationSaveDir);
         gCalibrationSaveDir = csd;
     }
     char *csuu = getPreferenceCalibrationServerUploadURL(gPreferences);
-    if (csuu && gCalibrationServerUploadURL && strcmp(gCalibrationServerUploadURL, csuu) == 0) {
+    if (stringsEqual(gCalibrationServerUploadURL, csuu)) {
         free(csuu);
     } else {
         free(gCalibrationServerUploadURL);
         gCalibrationServerUploadURL = csuu;
+        paramSaveQueueWait(gParamSaveQueue); // Queued saves may refer to the uploader.
         fileUploaderFinal(&fileUploadHandle);
         if (csuu) {
             fileUploadHandle = fileUploaderInit(gFileUploadQueuePath, QUEUE_INDEX_FILE_EXTENSION, gCalibrationServerUploadURL, UPLOAD_STATUS_HIDE_AFTER_SECONDS);
@@ -284,8 +535,16 @@ static void rereadPreferences(void)
             }
         }
     }
+    if (fileUploadHandle) {
+        char *csbuu = getPreferenceCalibrationServerBatchUploadURL(gPreferences);
+        fileUploaderSetBatchUploads(fileUploadHandle, csbuu, 0);
+        free(csbuu);
+        fileUploaderSetMaxBytesPerSecond(fileUploadHandle, getPreferenceCalibrationServerUploadMaxBytesPerSecond(gPreferences));
+        fileUploaderSetDedupKeyFunction(fileUploadHandle, calibrationUploadKey);
+        fileUploaderSetStatusCallback(fileUploadHandle, uploadStatusChanged, NULL);
+    }
     char *csat = getPreferenceCalibrationServerAuthenticationToken(gPreferences);
-    if (csat && gCalibrationServerAuthenticationToken && strcmp(gCalibrationServerAuthenticationToken, csat) == 0) {
+    if (stringsEqual(gCalibrationServerAuthenticationToken, csat)) {
         free(csat);
     } else {
         free(gCalibrationServerAuthenticationToken);
@@ -293,7 +552,7 @@ static void rereadPreferences(void)
     }
     bool changedCameraSettings = false;
     char *crt = getPreferenceCameraResolutionToken(gPreferences);
-    if (crt && gPreferenceCameraResolutionToken && strcmp(gPreferenceCameraResolutionToken, crt) == 0) {
+    if (stringsEqual(gPreferenceCameraResolutionToken, crt)) {
         free(crt);
     } else {
         free(gPreferenceCameraResolutionToken);
@@ -301,13 +560,14 @@ static void rereadPreferences(void)
         changedCameraSettings = true;
     }
     char *cot = getPreferenceCameraOpenToken(gPreferences);
-    if (cot && gPreferenceCameraOpenToken && strcmp(gPreferenceCameraOpenToken, cot) == 0) {
+    if (stringsEqual(gPreferenceCameraOpenToken, cot)) {
         free(cot);
     } else {
         free(gPreferenceCameraOpenToken);
         gPreferenceCameraOpenToken = cot;
         changedCameraSettings = true;
     }
+    bool changedPatternSettings = false;
     Calibration::CalibrationPatternType patternType = getPreferencesCalibrationPatternType(gPreferences);
     cv::Size patternSize = getPreferencesCalibrationPatternSize(gPreferences);
     float patternSpacing = getPreferencesCalibrationPatternSpacing(gPreferences);
@@ -315,7 +575,7 @@ static void rereadPreferences(void)
         gCalibrationPatternType = patternType;
         gCalibrationPatternSize = patternSize;
         gCalibrationPatternSpacing = patternSpacing;
-        changedCameraSettings = true;
+        changedPatternSettings = true;
     }
     
     if (changedCameraSettings) {
@@ -323,6 +583,11 @@ static void rereadPreferences(void)
         // closing of video source, and re-init.
         stopVideo();
         startVideo();
+    } else if (changedPatternSettings && gPostVideoSetupDone) {
+        // Changing only pattern settings requires a new calibration session and flow,
+        // but the video source and view can stay open.
+        stopCalibration();
+        startCalibration();
     }
 }
 
@@ -344,13 +609,22 @@ int main(int argc, char *argv[])
     gPreferenceCameraResolutionToken = getPreferenceCameraResolutionToken(gPreferences);
     gCalibrationSave = getPreferenceCalibrationSave(gPreferences);
     gCalibrationSaveDir = getPreferenceCalibSaveDir(gPreferences);
+    gCalibrationRemapLUTGridStep = getPreferenceCalibrationRemapLUTGridStep(gPreferences);
     gCalibrationServerUploadURL = getPreferenceCalibrationServerUploadURL(gPreferences);
     gCalibrationServerAuthenticationToken = getPreferenceCalibrationServerAuthenticationToken(gPreferences);
     gCalibrationPatternType = getPreferencesCalibrationPatternType(gPreferences);
     gCalibrationPatternSize = getPreferencesCalibrationPatternSize(gPreferences);
     gCalibrationPatternSpacing = getPreferencesCalibrationPatternSpacing(gPreferences);
     
-    gSDLEventPreferencesChanged = SDL_RegisterEvents(1);
+    gSDLEventPreferencesChanged = SDL_RegisterEvents(4);
+    if (gSDLEventPreferencesChanged == (Uint32)-1) {
+        ARLOGe("Error: Unable to register SDL events.\n");
+        quit(-1);
+    }
+    gSDLEventNewVideoFrame = gSDLEventPreferencesChanged + 1;
+    gSDLEventFlowUpdated = gSDLEventPreferencesChanged + 2;
+    gSDLEventUploadStatusChanged = gSDLEventPreferencesChanged + 3;
+    flowSetUpdateCallback(flowUpdated, NULL);
     
     // Create a window.
     gSDLWindow = SDL_CreateWindow("artoolkitX Camera Calibration Utility",
@@ -417,6 +691,7 @@ int main(int argc, char *argv[])
     reshape(w, h);
     
     asprintf(&gFileUploadQueuePath, "%s/%s", arUtilGetResourcesDirectoryPath(AR_UTIL_RESOURCES_DIRECTORY_BEHAVIOR_USE_APP_CACHE_DIR), QUEUE_DIR);
+    asprintf(&gCalibrationCachePath, "%s/%s", arUtilGetResourcesDirectoryPath(AR_UTIL_RESOURCES_DIRECTORY_BEHAVIOR_USE_APP_CACHE_DIR), CALIBRATION_CACHE_DIR);
     // Check for QUEUE_DIR and create if not already existing.
     if (!fileUploaderCreateQueueDir(gFileUploadQueuePath)) {
         ARLOGe("Error: Could not create queue directory.\n");
@@ -428,9 +703,21 @@ int main(int argc, char *argv[])
         if (!fileUploadHandle) {
             ARLOGe("Error: Could not initialise fileUploadHandle.\n");
         }
+        char *csbuu = getPreferenceCalibrationServerBatchUploadURL(gPreferences);
+        fileUploaderSetBatchUploads(fileUploadHandle, csbuu, 0);
+        free(csbuu);
+        fileUploaderSetMaxBytesPerSecond(fileUploadHandle, getPreferenceCalibrationServerUploadMaxBytesPerSecond(gPreferences));
+        fileUploaderSetDedupKeyFunction(fileUploadHandle, calibrationUploadKey);
+        fileUploaderSetStatusCallback(fileUploadHandle, uploadStatusChanged, NULL);
         fileUploaderTickle(fileUploadHandle);
     }
     
+    gParamSaveQueue = paramSaveQueueInit();
+    if (!gParamSaveQueue) {
+        ARLOGe("Error: Could not start save queue.\n");
+        exit(-1);
+    }
+    
     // Calibration prefs.
     ARLOGi("Calbration pattern size X = %d\n", gCalibrationPatternSize.width);
     ARLOGi("Calbration pattern size Y = %d\n", gCalibrationPatternSize.height);
@@ -512,12 +799,20 @@ int main(int argc, char *argv[])
 
     startVideo();
     
-    // Main loop.
+    // Main loop. Sleeps until there is an event to handle, and redraws only when something has changed.
     bool done = false;
+    bool redraw = true;
     while (!done) {
         
+        // Animations in progress and messages awaiting input need periodic redraw.
+        int timeout = -1;
+        if (gUploadStatusDisplayed == 1) timeout = REDRAW_INTERVAL_ANIMATING_MS;
+        else if (gUploadStatusDisplayed == 2 || gEdenMessageDrawRequired) timeout = REDRAW_INTERVAL_MESSAGE_MS;
+        
         SDL_Event ev;
-        while (SDL_PollEvent(&ev)) {
+        int gotEvent = (timeout < 0 ? SDL_WaitEvent(&ev) : SDL_WaitEventTimeout(&ev, timeout));
+        if (!gotEvent) redraw = true; // Timed out.
+        while (gotEvent) {
             if (ev.type == SDL_QUIT /*|| (ev.type == SDL_KEYDOWN && ev.key.keysym.sym == SDLK_ESCAPE)*/) {
                 done = true;
                 break;
@@ -530,7 +825,9 @@ int main(int argc, char *argv[])
                     SDL_GL_GetDrawableSize(gSDLWindow, &w, &h);
                     reshape(w, h);
                 }
+                redraw = true;
             } else if (ev.type == SDL_KEYDOWN) {
+                redraw = true;
                 if (EdenMessageKeyboardRequired()) {
                     EdenMessageInputKeyboard(ev.key.keysym.sym);
                 } else if (ev.key.keysym.sym == SDLK_ESCAPE) {
@@ -542,19 +839,25 @@ int main(int argc, char *argv[])
                 }
             } else if (gSDLEventPreferencesChanged != 0 && ev.type == gSDLEventPreferencesChanged) {
                 rereadPreferences();
+                redraw = true;
+            } else if (gSDLEventNewVideoFrame != 0 && ev.type == gSDLEventNewVideoFrame) {
+                gSDLEventNewVideoFramePending = false;
+                redraw = true;
+            } else if (gSDLEventFlowUpdated != 0 && ev.type == gSDLEventFlowUpdated) {
+                redraw = true;
+            } else if (gSDLEventUploadStatusChanged != 0 && ev.type == gSDLEventUploadStatusChanged) {
+                redraw = true;
             }
+            gotEvent = SDL_PollEvent(&ev);
         }
+        if (done) break;
         
         if (vs->isOpen()) {
-            if (vs->captureFrame()) {
-                gFrameCount++; // Increment ARToolKit FPS counter.
-#ifdef DEBUG
-                if (gFrameCount % 150 == 0) {
-                    ARLOGi("*** Camera - %f (frame/sec)\n", (double)gFrameCount/arUtilTimer());
-                    gFrameCount = 0;
-                    arUtilTimerReset();
-                }
-#endif
+            // Frames are captured on the video capture thread. Check whether a new one has arrived.
+            long videoFrameCount = gVideoFrameCount;
+            if (videoFrameCount != gVideoFrameCountSeen) {
+                gVideoFrameCountSeen = videoFrameCount;
+                
                 if (!gPostVideoSetupDone) {
                     
                     gCameraIsFrontFacing = false;
@@ -618,20 +921,7 @@ int main(int argc, char *argv[])
                     // Calibration init.
                     //
                     
-                    gCalibration = new Calibration(gCalibrationPatternType, gPreferencesCalibImageCountMax, gCalibrationPatternSize, gCalibrationPatternSpacing, vs->getVideoWidth(), vs->getVideoHeight());
-                    if (!gCalibration) {
-                        ARLOGe("Error initialising calibration.\n");
-                        quit(-1);
-                    }
-                    
-                    if (!flowInitAndStart(gCalibration, saveParam, NULL)) {
-                        ARLOGe("Error: Could not initialise and start flow.\n");
-                        quit(-1);
-                    }
-                    
-                    // For FPS statistics.
-                    arUtilTimerReset();
-                    gFrameCount = 0;
+                    startCalibration();
                     
                     gPostVideoSetupDone = true;
                 } // !gPostVideoSetupDone
@@ -641,26 +931,17 @@ int main(int argc, char *argv[])
                     vv->getViewport(gViewport);
                 }
                 
-                FLOW_STATE state = flowStateGet();
-                if (state == FLOW_STATE_WELCOME || state == FLOW_STATE_DONE || state == FLOW_STATE_CALIBRATING) {
-                    
-                    // Upload the frame to OpenGL.
-                    // Now done as part of the draw call.
-                    
-                } else if (state == FLOW_STATE_CAPTURING) {
-                    
-                    gCalibration->frame(vs);
-
-                }
-                
+                // Upload of the frame to OpenGL is done as part of the draw call.
+                // Submission of frames to the corner finder is done on the video capture thread.
             }
             
         } // vs->isOpen()
         
         // The display has changed.
-        drawView();
-                
-        arUtilSleep(1); // 1 millisecond.
+        if (redraw) {
+            drawView();
+            redraw = false;
+        }
     }
     
     stopVideo();
@@ -678,6 +959,7 @@ void reshape(int w, int h)
 
 static void quit(int rc)
 {
+    paramSaveQueueFinal(&gParamSaveQueue); // Completes any queued saves.
     fileUploaderFinal(&fileUploadHandle);
     
     SDL_Quit();
@@ -686,6 +968,7 @@ static void quit(int rc)
     free(gPreferenceCameraResolutionToken);
     free(gCalibrationServerUploadURL);
     free(gCalibrationServerAuthenticationToken);
+    free(gCalibrationCachePath);
     preferencesFinal(&gPreferences);
     
     exit(rc);
@@ -1077,9 +1360,11 @@ void drawView(void)
     }
     
     // If background tasks are proceeding, draw a status box.
+    gUploadStatusDisplayed = 0;
     if (fileUploadHandle) {
         char uploadStatus[UPLOAD_STATUS_BUFFER_LEN];
         int status = fileUploaderStatusGet(fileUploadHandle, uploadStatus, &time);
+        gUploadStatusDisplayed = status;
         if (status > 0) {
             const int squareSize = (int)(16.0f * (float)gDisplayDPI / 160.f) ;
             float x, y, w, h;
@@ -1101,14 +1386,111 @@ void drawView(void)
 }
 
 
-// Save parameters file and index file with info about it, then signal thread that it's ready for upload.
+// Get the main device identifier, name and focal length of the open camera from the video module.
+// device_id and name are set to NULL if not available. focal_length is "0.000" if not known. All must be freed.
+static void getCameraIdentity(char **device_id_p, char **name_p, char **focal_length_p)
+{
+    char *device_id = NULL;
+    char *name = NULL;
+    char *focal_length = NULL;
+    
+    AR2VideoParamT *vid = vs->getAR2VideoParam();
+    if (ar2VideoGetParams(vid, AR_VIDEO_PARAM_DEVICEID, &device_id) < 0 || !device_id) {
+        ARLOGe("Error fetching camera device identification.\n");
+    }
+    if (ar2VideoGetParams(vid, AR_VIDEO_PARAM_NAME, &name) < 0 || !name) {
+        ARLOGe("Error fetching camera name.\n");
+    }
+    
+    if (vid->module == AR_VIDEO_MODULE_AVFOUNDATION) {
+        int focalPreset;
+        ar2VideoGetParami(vid, AR_VIDEO_PARAM_AVFOUNDATION_FOCUS_PRESET, &focalPreset);
+        switch (focalPreset) {
+            case AR_VIDEO_AVFOUNDATION_FOCUS_MACRO:
+                focal_length = strdup("0.01");
+                break;
+            case AR_VIDEO_AVFOUNDATION_FOCUS_0_3M:
+                focal_length = strdup("0.3");
+                break;
+            case AR_VIDEO_AVFOUNDATION_FOCUS_1_0M:
+                focal_length = strdup("1.0");
+                break;
+            case AR_VIDEO_AVFOUNDATION_FOCUS_INF:
+                focal_length = strdup("1000000.0");
+                break;
+            default:
+                break;
+        }
+    }
+    if (!focal_length) {
+        // Not known at present, so just send 0.000.
+        focal_length = strdup("0.000");
+    }
+    
+    *device_id_p = device_id;
+    *name_p = name;
+    *focal_length_p = focal_length;
+}
+
+// Assemble the pathname of the parameters file in the calibration save directory.
+static void calibrationSavePathnameMake(char *calibrationSavePathname, size_t pathnameLen, const char *device_id, const char *name, const char *focal_length)
+{
+    snprintf(calibrationSavePathname, pathnameLen, "%s/camera_para-", gCalibrationSaveDir);
+    size_t len = strlen(calibrationSavePathname);
+    int i = 0;
+    const char *identifier = (device_id ? device_id : (name ? name : ""));
+    while (identifier[i] && (len + i + 2 < pathnameLen)) {
+        calibrationSavePathname[len + i] = (identifier[i] == '/' || identifier[i] == '\\' ? '_' : identifier[i]);
+        i++;
+    }
+    calibrationSavePathname[len + i] = '\0';
+    len = strlen(calibrationSavePathname);
+    snprintf(&calibrationSavePathname[len], pathnameLen - len, "-0-%dx%d", vs->getVideoWidth(), vs->getVideoHeight()); // camera_index is always 0 for desktop platforms.
+    len = strlen(calibrationSavePathname);
+    if (strcmp(focal_length, "0.000") != 0) {
+        snprintf(&calibrationSavePathname[len], pathnameLen - len, "-%s", focal_length);
+        len = strlen(calibrationSavePathname);
+    }
+    snprintf(&calibrationSavePathname[len], pathnameLen - len, ".dat");
+}
+
+// Save a job's parameters to the calibration save directory, with a remap table alongside if requested.
+static void paramSaveJobSetSavePathnames(PARAM_SAVE_JOB_t *job, const char *device_id, const char *name, const char *focal_length)
+{
+    char calibrationSavePathname[MAXPATHLEN];
+    calibrationSavePathnameMake(calibrationSavePathname, sizeof(calibrationSavePathname), device_id, name, focal_length);
+    job->savePathname = strdup(calibrationSavePathname);
+    size_t len = strlen(calibrationSavePathname);
+    if (gCalibrationRemapLUTGridStep > 0 && len > 4) {
+        strcpy(&calibrationSavePathname[len - 4], ".lut"); // Replaces ".dat".
+        job->lutPathname = strdup(calibrationSavePathname);
+        job->lutGridStep = gCalibrationRemapLUTGridStep;
+    }
+}
+
+// A cached calibration has been validated. It was uploaded when first made, so just save it if requested.
+static void reuseParam(const ARParam *param, ARdouble err_avg, ARdouble err_max, void *userdata)
+{
+    if (!gCalibrationSave) return;
+    
+    char *device_id, *name, *focal_length;
+    getCameraIdentity(&device_id, &name, &focal_length);
+    PARAM_SAVE_JOB_t *job = paramSaveJobNew(param);
+    if (job) {
+        paramSaveJobSetSavePathnames(job, device_id, name, focal_length);
+        paramSaveQueueSubmit(gParamSaveQueue, &job);
+    }
+    free(device_id);
+    free(name);
+    free(focal_length);
+}
+
+// Save parameters file if requested, cache the parameters, and queue them with info about them for upload.
+// Everything that depends on the current camera is gathered here, on the flow thread, but all the
+// writing is done on the save queue's worker thread.
 static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg, ARdouble err_max, void *userdata)
 {
     int i;
-#define SAVEPARAM_PATHNAME_LEN MAXPATHLEN
-    char indexPathname[SAVEPARAM_PATHNAME_LEN];
-    char paramPathname[SAVEPARAM_PATHNAME_LEN];
-    char indexUploadPathname[SAVEPARAM_PATHNAME_LEN];
     
     // Get the current time. It will be used for file IDs, plus a timestamp for the parameters file.
     time_t ourClock = time(NULL);
@@ -1124,230 +1506,156 @@ static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg,
     }
     int ID = timeptr->tm_hour*10000 + timeptr->tm_min*100 + timeptr->tm_sec;
     
-    // Save the parameter file.
-    snprintf(paramPathname, SAVEPARAM_PATHNAME_LEN, "%s/%s/%06d-camera_para.dat", arUtilGetResourcesDirectoryPath(AR_UTIL_RESOURCES_DIRECTORY_BEHAVIOR_USE_APP_CACHE_DIR), QUEUE_DIR, ID);
+    // Serialise the parameters, in the same format as arParamSave().
+    unsigned char paramBuf[PARAM_BUFFER_LEN_MAX];
+    size_t paramBufLen = paramBufferWrite(param, paramBuf, sizeof(paramBuf));
+    if (!paramBufLen) {
+        ARLOGe("Error serialising camera parameters.\n");
+        return;
+    }
     
-    //if (arParamSave(strcat(strcat(docsPath,"/"),paramPathname), 1, param) < 0) {
-    if (arParamSave(paramPathname, 1, param) < 0) {
-        
-        ARLOGe("Error writing camera_para.dat file.\n");
-        
-    } else {
-        
-        // Get main device identifier and focal length from video module.
-        char *device_id = NULL;
-        char *name = NULL;
-        char *focal_length = NULL;
-        
-        AR2VideoParamT *vid = vs->getAR2VideoParam();
-        if (ar2VideoGetParams(vid, AR_VIDEO_PARAM_DEVICEID, &device_id) < 0 || !device_id) {
-            ARLOGe("Error fetching camera device identification.\n");
-        }
-        if (ar2VideoGetParams(vid, AR_VIDEO_PARAM_NAME, &name) < 0 || !name) {
-            ARLOGe("Error fetching camera name.\n");
-        }
-        
-        if (vid->module == AR_VIDEO_MODULE_AVFOUNDATION) {
-            int focalPreset;
-            ar2VideoGetParami(vid, AR_VIDEO_PARAM_AVFOUNDATION_FOCUS_PRESET, &focalPreset);
-            switch (focalPreset) {
-                case AR_VIDEO_AVFOUNDATION_FOCUS_MACRO:
-                    focal_length = strdup("0.01");
-                    break;
-                case AR_VIDEO_AVFOUNDATION_FOCUS_0_3M:
-                    focal_length = strdup("0.3");
-                    break;
-                case AR_VIDEO_AVFOUNDATION_FOCUS_1_0M:
-                    focal_length = strdup("1.0");
-                    break;
-                case AR_VIDEO_AVFOUNDATION_FOCUS_INF:
-                    focal_length = strdup("1000000.0");
-                    break;
-                default:
-                    break;
-            }
-        }
-        if (!focal_length) {
-            // Not known at present, so just send 0.000.
-            focal_length = strdup("0.000");
-        }
-        
-        if (gCalibrationSave) {
-            
-            // Assemble the filename.
-            char calibrationSavePathname[SAVEPARAM_PATHNAME_LEN];
-            snprintf(calibrationSavePathname, SAVEPARAM_PATHNAME_LEN, "%s/camera_para-", gCalibrationSaveDir);
-            size_t len = strlen(calibrationSavePathname);
-            int i = 0;
-            const char *identifier = (device_id ? device_id : (name ? name : ""));
-            while (identifier[i] && (len + i + 2 < SAVEPARAM_PATHNAME_LEN)) {
-                calibrationSavePathname[len + i] = (identifier[i] == '/' || identifier[i] == '\\' ? '_' : identifier[i]);
-                i++;
-            }
-            calibrationSavePathname[len + i] = '\0';
-            len = strlen(calibrationSavePathname);
-            snprintf(&calibrationSavePathname[len], SAVEPARAM_PATHNAME_LEN - len, "-0-%dx%d", vs->getVideoWidth(), vs->getVideoHeight()); // camera_index is always 0 for desktop platforms.
-            len = strlen(calibrationSavePathname);
-            if (strcmp(focal_length, "0.000") != 0) {
-                snprintf(&calibrationSavePathname[len], SAVEPARAM_PATHNAME_LEN - len, "-%s", focal_length);
-                len = strlen(calibrationSavePathname);
-            }
-            snprintf(&calibrationSavePathname[len], SAVEPARAM_PATHNAME_LEN - len, ".dat");
-            
-            if (cp_f(paramPathname, calibrationSavePathname) != 0) {
-                ARLOGe("Error saving calibration to '%s'", calibrationSavePathname);
-                ARLOGperror(NULL);
-            } else {
-                ARLOGi("Saved calibration to '%s'.\n", calibrationSavePathname);
-            }
-        }
-
-        // Check for early exit.
-        if (!gCalibrationServerUploadURL || !device_id) {
-            if (remove(paramPathname) < 0) {
-                ARLOGe("Error removing temporary file '%s'.\n", paramPathname);
-                ARLOGperror(NULL);
-            }
-            free(device_id);
-            free(focal_length);
-            return;
-        };
-
-        //
-        // Write an upload index file with the data for the server database entry.
-        //
-        
-        // Open the file.
-        snprintf(indexPathname, SAVEPARAM_PATHNAME_LEN, "%s/%s/%06d-index", arUtilGetResourcesDirectoryPath(AR_UTIL_RESOURCES_DIRECTORY_BEHAVIOR_USE_APP_CACHE_DIR), QUEUE_DIR, ID);
-        FILE *fp;
-        bool goodWrite = true;
-        if (!(fp = fopen(indexPathname, "wb"))) {
-            ARLOGe("Error opening upload index file '%s'.\n", indexPathname);
+    PARAM_SAVE_JOB_t *job = paramSaveJobNew(param);
+    if (!job) return;
+    
+    // Get main device identifier and focal length from video module.
+    char *device_id, *name, *focal_length;
+    getCameraIdentity(&device_id, &name, &focal_length);
+    
+    // Keep a local copy, so that this camera can skip full calibration next time.
+    if (device_id && gCalibrationCachePath) {
+        job->cacheDir = strdup(gCalibrationCachePath);
+        job->cacheKey.deviceID = strdup(device_id);
+        job->cacheKey.width = vs->getVideoWidth();
+        job->cacheKey.height = vs->getVideoHeight();
+        job->cacheKey.focalLength = strdup(focal_length);
+        job->cacheKey.distFunctionVersion = param->dist_function_version;
+        job->err_avg = err_avg;
+    }
+    
+    if (gCalibrationSave) {
+        paramSaveJobSetSavePathnames(job, device_id, name, focal_length);
+    }
+    
+    // Check for early exit.
+    if (!gCalibrationServerUploadURL || !device_id || !fileUploadHandle) {
+        paramSaveQueueSubmit(gParamSaveQueue, &job);
+        free(device_id);
+        free(name);
+        free(focal_length);
+        return;
+    };
+    
+    //
+    // Assemble the form with the data for the server database entry, and queue it for upload.
+    //
+    
+    UPLOAD_JOURNAL_ENTRY_t *entry = uploadJournalEntryNew();
+    bool goodWrite = (entry != NULL);
+    
+    // Add a version to the request. "2" if sending a v5 distortion function file, "1" otherwise.
+    if (goodWrite) goodWrite = uploadJournalEntryAddField(entry, "version", (param->dist_function_version == 5 ? "2" : "1"));
+    
+    // The parameters file.
+    if (goodWrite) {
+        char paramFilename[32];
+        snprintf(paramFilename, sizeof(paramFilename), "%06d-camera_para.dat", ID);
+        goodWrite = uploadJournalEntryAddFile(entry, "file", paramFilename, paramBuf, (uint32_t)paramBufLen);
+    }
+    
+    // UTC date and time, in format "1999-12-31 23:59:59 UTC".
+    if (goodWrite) {
+        char timestamp[26+8] = "";
+        if (!strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S +0000", timeptr)) { // Use explicit "+0000" rather than %z because %z is undefined either UTC or local time zone when timestamp is created with gmtime().
+            ARLOGe("Error formatting time and date.\n");
             goodWrite = false;
+        } else {
+            goodWrite = uploadJournalEntryAddField(entry, "timestamp", timestamp);
         }
-        
-        // Add a version to the request. "2" if sending a v5 distortion function file, "1" otherwise.
-        if (goodWrite) fprintf(fp, "version,%d\n", param->dist_function_version == 5 ? 2 : 1);
-        
-        // File name.
-        if (goodWrite) fprintf(fp, "file,%s\n", paramPathname);
-        
-        // UTC date and time, in format "1999-12-31 23:59:59 UTC".
-        if (goodWrite) {
-            char timestamp[26+8] = "";
-            if (!strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S +0000", timeptr)) { // Use explicit "+0000" rather than %z because %z is undefined either UTC or local time zone when timestamp is created with gmtime().
-                ARLOGe("Error formatting time and date.\n");
-                goodWrite = false;
-            } else {
-                fprintf(fp, "timestamp,%s\n", timestamp);
-            }
-        }
-        
-        // OS: name/arch/version.
-        if (goodWrite) {
-            char *os_name = arUtilGetOSName();
-            char *os_arch = arUtilGetCPUName();
-            char *os_version = arUtilGetOSVersion();
-            fprintf(fp, "os_name,%s\nos_arch,%s\nos_version,%s\n", os_name, os_arch, os_version);
-            free(os_name);
-            free(os_arch);
-            free(os_version);
-        }
-        
-        // Camera identifier.
-        if (goodWrite) {
-            fprintf(fp, "device_id,%s\n", device_id);
-        }
-        
-        // Focal length in metres.
-        if (goodWrite) {
-            fprintf(fp, "focal_length,%s\n", focal_length);
-        }
-        
-        // Camera index.
-        if (goodWrite) {
-            char camera_index[12]; // 10 digits in INT32_MAX, plus sign, plus null.
-            snprintf(camera_index, 12, "%d", 0); // Always zero for desktop platforms.
-            fprintf(fp, "camera_index,%s\n", camera_index);
-        }
-        
-        // Front or rear facing.
-        if (goodWrite) {
-            char camera_face[6]; // "front" or "rear", plus null.
-            snprintf(camera_face, 6, "%s", (gCameraIsFrontFacing ? "front" : "rear"));
-            fprintf(fp, "camera_face,%s\n", camera_face);
-        }
-        
-        // Camera dimensions.
-        if (goodWrite) {
-            char camera_width[12]; // 10 digits in INT32_MAX, plus sign, plus null.
-            char camera_height[12]; // 10 digits in INT32_MAX, plus sign, plus null.
-            snprintf(camera_width, 12, "%d", vs->getVideoWidth());
-            snprintf(camera_height, 12, "%d", vs->getVideoHeight());
-            fprintf(fp, "camera_width,%s\n", camera_width);
-            fprintf(fp, "camera_height,%s\n", camera_height);
-        }
-        
-        // Calibration error.
-        if (goodWrite) {
-            char err_min_ascii[12];
-            char err_avg_ascii[12];
-            char err_max_ascii[12];
-            snprintf(err_min_ascii, 12, "%f", err_min);
-            snprintf(err_avg_ascii, 12, "%f", err_avg);
-            snprintf(err_max_ascii, 12, "%f", err_max);
-            fprintf(fp, "err_min,%s\n", err_min_ascii);
-            fprintf(fp, "err_avg,%s\n", err_avg_ascii);
-            fprintf(fp, "err_max,%s\n", err_max_ascii);
-        }
-        
-        // IP address will be derived from connect.
-        
-        // Hash the shared secret.
-        if (goodWrite) {
-            unsigned char ss_md5[MD5_DIGEST_LENGTH];
-            char ss_ascii[MD5_DIGEST_LENGTH*2 + 1]; // space for null terminator.
-            if (!MD5((unsigned char *)gCalibrationServerAuthenticationToken, (MD5_COUNT_t)strlen(gCalibrationServerAuthenticationToken), ss_md5)) {
-                ARLOGe("Error calculating md5.\n");
-                goodWrite = false;
-            } else {
-                for (i = 0; i < MD5_DIGEST_LENGTH; i++) snprintf(&(ss_ascii[i*2]), 3, "%.2hhx", ss_md5[i]);
-                fprintf(fp, "ss,%s\n", ss_ascii);
-            }
-        }
-        
-        // Done writing index file.
-        fclose(fp);
-        
-        if (goodWrite) {
-            // Rename the file with QUEUE_INDEX_FILE_EXTENSION file extension so it's picked up in uploader.
-            snprintf(indexUploadPathname, SAVEPARAM_PATHNAME_LEN, "%s." QUEUE_INDEX_FILE_EXTENSION, indexPathname);
-            if (rename(indexPathname, indexUploadPathname) < 0) {
-                ARLOGe("Error renaming temporary file '%s'.\n", indexPathname);
-                goodWrite = false;
-            } else {
-                // Kick off an upload handling cycle.
-                fileUploaderTickle(fileUploadHandle);
-            }
-        }
-        
-        if (!goodWrite) {
-            // If something went wrong, delete the index and param files.
-            if (indexPathname[0]) {
-                if (remove(indexPathname) < 0) {
-                    ARLOGe("Error removing temporary file '%s'.\n", indexPathname);
-                    ARLOGperror(NULL);
-                }
-            }
-            if (remove(paramPathname) < 0) {
-                ARLOGe("Error removing temporary file '%s'.\n", paramPathname);
-                ARLOGperror(NULL);
-            }
+    }
+    
+    // OS: name/arch/version.
+    if (goodWrite) {
+        char *os_name = arUtilGetOSName();
+        char *os_arch = arUtilGetCPUName();
+        char *os_version = arUtilGetOSVersion();
+        goodWrite = uploadJournalEntryAddField(entry, "os_name", os_name) && uploadJournalEntryAddField(entry, "os_arch", os_arch) && uploadJournalEntryAddField(entry, "os_version", os_version);
+        free(os_name);
+        free(os_arch);
+        free(os_version);
+    }
+    
+    // Camera identifier.
+    if (goodWrite) {
+        goodWrite = uploadJournalEntryAddField(entry, "device_id", device_id);
+    }
+    
+    // Focal length in metres.
+    if (goodWrite) {
+        goodWrite = uploadJournalEntryAddField(entry, "focal_length", focal_length);
+    }
+    
+    // Camera index.
+    if (goodWrite) {
+        char camera_index[12]; // 10 digits in INT32_MAX, plus sign, plus null.
+        snprintf(camera_index, 12, "%d", 0); // Always zero for desktop platforms.
+        goodWrite = uploadJournalEntryAddField(entry, "camera_index", camera_index);
+    }
+    
+    // Front or rear facing.
+    if (goodWrite) {
+        char camera_face[6]; // "front" or "rear", plus null.
+        snprintf(camera_face, 6, "%s", (gCameraIsFrontFacing ? "front" : "rear"));
+        goodWrite = uploadJournalEntryAddField(entry, "camera_face", camera_face);
+    }
+    
+    // Camera dimensions.
+    if (goodWrite) {
+        char camera_width[12]; // 10 digits in INT32_MAX, plus sign, plus null.
+        char camera_height[12]; // 10 digits in INT32_MAX, plus sign, plus null.
+        snprintf(camera_width, 12, "%d", vs->getVideoWidth());
+        snprintf(camera_height, 12, "%d", vs->getVideoHeight());
+        goodWrite = uploadJournalEntryAddField(entry, "camera_width", camera_width) && uploadJournalEntryAddField(entry, "camera_height", camera_height);
+    }
+    
+    // Calibration error.
+    if (goodWrite) {
+        char err_min_ascii[12];
+        char err_avg_ascii[12];
+        char err_max_ascii[12];
+        snprintf(err_min_ascii, 12, "%f", err_min);
+        snprintf(err_avg_ascii, 12, "%f", err_avg);
+        snprintf(err_max_ascii, 12, "%f", err_max);
+        goodWrite = uploadJournalEntryAddField(entry, "err_min", err_min_ascii) && uploadJournalEntryAddField(entry, "err_avg", err_avg_ascii) && uploadJournalEntryAddField(entry, "err_max", err_max_ascii);
+    }
+    
+    // IP address will be derived from connect.
+    
+    // Hash the shared secret.
+    if (goodWrite) {
+        unsigned char ss_md5[MD5_DIGEST_LENGTH];
+        char ss_ascii[MD5_DIGEST_LENGTH*2 + 1]; // space for null terminator.
+        if (!MD5((unsigned char *)gCalibrationServerAuthenticationToken, (MD5_COUNT_t)strlen(gCalibrationServerAuthenticationToken), ss_md5)) {
+            ARLOGe("Error calculating md5.\n");
+            goodWrite = false;
+        } else {
+            for (i = 0; i < MD5_DIGEST_LENGTH; i++) snprintf(&(ss_ascii[i*2]), 3, "%.2hhx", ss_md5[i]);
+            goodWrite = uploadJournalEntryAddField(entry, "ss", ss_ascii);
         }
-
-        free(device_id);
-        free(focal_length);
     }
+    
+    // The save queue appends the form to the upload journal (a single write) and kicks off an upload handling cycle.
+    if (goodWrite) {
+        job->uploader = fileUploadHandle;
+        job->uploadEntry = entry;
+    } else {
+        ARLOGe("Error queueing calibration for upload.\n");
+        uploadJournalEntryFree(&entry);
+    }
+    paramSaveQueueSubmit(gParamSaveQueue, &job);
+    
+    free(device_id);
+    free(name);
+    free(focal_length);
 }
 
 
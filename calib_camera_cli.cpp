@@ -0,0 +1,478 @@
+/*
+ *  calib_camera_cli.cpp
+ *  artoolkitX
+ *
+ *  Camera calibration utility, headless command-line version.
+ *
+ *  Run with "--help" parameter to see usage.
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *  Copyright 2015-2016 Daqri, LLC.
+ *  Copyright 2002-2015 ARToolworks, Inc.
+ *
+ *  Author(s): Hirokazu Kato, Philip Lamb
+ *
+ */
+
+// This front end drives the same Calibration class as the GUI, but has no SDL or OpenGL dependencies,
+// so it can run on servers and CI machines. Captures are triggered automatically whenever the pattern is
+// found (subject to the usual novelty gating), or on request via SIGUSR1 or commands on stdin:
+//     c (or capture)     Capture the most recent corner finder results.
+//     u (or uncapture)   Undo the most recent capture.
+//     q (or quit)        Cancel and exit.
+// Frames may also be replayed from a session recording (see -record and -replay), in which case every
+// frame is processed in order, so that a replay is repeatable.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <atomic>
+#include <ARX/AR/ar.h>
+#include <ARX/ARVideoSource.h>
+#include <ARX/ARUtil/time.h>
+
+#include "Calibration.hpp"
+#include "replaySource.h"
+#include "version.h"
+
+// ============================================================================
+//	Constants
+// ============================================================================
+
+#define      CALIB_IMAGE_NUM               10
+#define      SAVE_FILENAME                 "camera_para.dat"
+#define      METRICS_FILENAME_SUFFIX       ".txt"
+#define      AUTO_CAPTURE_INTERVAL_DEFAULT 1.0f
+
+// ============================================================================
+//	Global variables.
+// ============================================================================
+
+static volatile sig_atomic_t gSignalCaptureRequested = 0;
+static volatile sig_atomic_t gSignalQuitRequested = 0;
+static std::atomic<int> gCommandCaptureCount(0);
+static std::atomic<int> gCommandUncaptureCount(0);
+static std::atomic<bool> gCommandQuit(false);
+
+// ============================================================================
+//	Function prototypes
+// ============================================================================
+
+static void usage(char *com, int status);
+static void *stdinCommandThread(void *arg);
+static bool saveMetrics(const char *metricsPathname, const ARParam *param, ARdouble err_min, ARdouble err_avg, ARdouble err_max, int imageCount, Calibration::CalibrationPatternType patternType, cv::Size patternSize, float patternSpacing, long frameCount, double elapsed);
+
+static void signalHandler(int sig)
+{
+    if (sig == SIGUSR1) gSignalCaptureRequested = 1;
+    else gSignalQuitRequested = 1;
+}
+
+static double elapsedSince(const struct timeval *start)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return ((double)(now.tv_sec - start->tv_sec) + (double)(now.tv_usec - start->tv_usec)/1.0e6);
+}
+
+static const char *patternTypeName(Calibration::CalibrationPatternType patternType)
+{
+    switch (patternType) {
+        case Calibration::CalibrationPatternType::CHESSBOARD: return "chessboard";
+        case Calibration::CalibrationPatternType::CIRCLES_GRID: return "circles";
+        case Calibration::CalibrationPatternType::ASYMMETRIC_CIRCLES_GRID: return "acircles";
+    }
+    return "unknown";
+}
+
+int main(int argc, char *argv[])
+{
+    char           *vconf = NULL;
+    char           *outPathname = NULL;
+    char           *metricsPathname = NULL;
+    int             i;
+    int             gotTwoPartOption;
+    int             chessboardCornerNumX = 0;
+    int             chessboardCornerNumY = 0;
+    int             calibImageNum        = 0;
+    float           patternWidth         = 0.0f;
+    float           novelty              = CALIBRATION_CAPTURE_NOVELTY_THRESHOLD_DEFAULT;
+    bool            autoCapture          = false;
+    float           autoCaptureInterval  = AUTO_CAPTURE_INTERVAL_DEFAULT;
+    bool            readStdin            = true;
+    char           *recordPathname       = NULL;
+    bool            recordCompress       = true;
+    char           *replayPathname       = NULL;
+    float           replayFPS            = 0.0f;
+    Calibration::CalibrationPatternType patternType = Calibration::CalibrationPatternType::CHESSBOARD;
+
+#ifdef DEBUG
+    arLogLevel = AR_LOG_LEVEL_DEBUG;
+#endif
+
+    i = 1; // argv[0] is name of app, so start at 1.
+    while (i < argc) {
+        gotTwoPartOption = FALSE;
+        // Look for two-part options first.
+        if ((i + 1) < argc) {
+            if (strcmp(argv[i], "--vconf") == 0) {
+                i++;
+                vconf = argv[i];
+                gotTwoPartOption = TRUE;
+            }
+        }
+        if (!gotTwoPartOption) {
+            // Look for single-part options.
+            if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-help") == 0 || strcmp(argv[i], "-h") == 0) {
+                usage(argv[0], EXIT_SUCCESS);
+            } else if (strcmp(argv[i], "--version") == 0 || strcmp(argv[i], "-version") == 0 || strcmp(argv[i], "-v") == 0) {
+                ARPRINT("%s version %s\n", argv[0], VERSION_STRING);
+                exit(0);
+            } else if (strncmp(argv[i], "-cornerx=", 9) == 0) {
+                if (sscanf(&(argv[i][9]), "%d", &chessboardCornerNumX) != 1) usage(argv[0], EXIT_FAILURE);
+                if (chessboardCornerNumX <= 0) usage(argv[0], EXIT_FAILURE);
+            } else if (strncmp(argv[i], "-cornery=", 9) == 0) {
+                if (sscanf(&(argv[i][9]), "%d", &chessboardCornerNumY) != 1) usage(argv[0], EXIT_FAILURE);
+                if (chessboardCornerNumY <= 0) usage(argv[0], EXIT_FAILURE);
+            } else if (strncmp(argv[i], "-imagenum=", 10) == 0) {
+                if (sscanf(&(argv[i][10]), "%d", &calibImageNum) != 1) usage(argv[0], EXIT_FAILURE);
+                if (calibImageNum <= 0) usage(argv[0], EXIT_FAILURE);
+            } else if (strncmp(argv[i], "-pattwidth=", 11) == 0) {
+                if (sscanf(&(argv[i][11]), "%f", &patternWidth) != 1) usage(argv[0], EXIT_FAILURE);
+                if (patternWidth <= 0) usage(argv[0], EXIT_FAILURE);
+            } else if (strncmp(argv[i], "-patterntype=", 13) == 0) {
+                if (strcmp(&(argv[i][13]), "chessboard") == 0) patternType = Calibration::CalibrationPatternType::CHESSBOARD;
+                else if (strcmp(&(argv[i][13]), "circles") == 0) patternType = Calibration::CalibrationPatternType::CIRCLES_GRID;
+                else if (strcmp(&(argv[i][13]), "acircles") == 0) patternType = Calibration::CalibrationPatternType::ASYMMETRIC_CIRCLES_GRID;
+                else usage(argv[0], EXIT_FAILURE);
+            } else if (strncmp(argv[i], "-novelty=", 9) == 0) {
+                if (sscanf(&(argv[i][9]), "%f", &novelty) != 1) usage(argv[0], EXIT_FAILURE);
+                if (novelty < 0.0f) usage(argv[0], EXIT_FAILURE);
+            } else if (strcmp(argv[i], "-auto") == 0) {
+                autoCapture = true;
+            } else if (strncmp(argv[i], "-autointerval=", 14) == 0) {
+                if (sscanf(&(argv[i][14]), "%f", &autoCaptureInterval) != 1) usage(argv[0], EXIT_FAILURE);
+                if (autoCaptureInterval < 0.0f) usage(argv[0], EXIT_FAILURE);
+                autoCapture = true;
+            } else if (strcmp(argv[i], "-nostdin") == 0) {
+                readStdin = false;
+            } else if (strncmp(argv[i], "-outfile=", 9) == 0) {
+                outPathname = &(argv[i][9]);
+            } else if (strncmp(argv[i], "-metricsfile=", 13) == 0) {
+                metricsPathname = &(argv[i][13]);
+            } else if (strncmp(argv[i], "-record=", 8) == 0) {
+                recordPathname = &(argv[i][8]);
+            } else if (strcmp(argv[i], "-recordraw") == 0) {
+                recordCompress = false;
+            } else if (strncmp(argv[i], "-replay=", 8) == 0) {
+                replayPathname = &(argv[i][8]);
+            } else if (strncmp(argv[i], "-replayfps=", 11) == 0) {
+                if (sscanf(&(argv[i][11]), "%f", &replayFPS) != 1) usage(argv[0], EXIT_FAILURE);
+                if (replayFPS < 0.0f) usage(argv[0], EXIT_FAILURE);
+            } else {
+                ARLOGe("Error: invalid command line argument '%s'.\n", argv[i]);
+                usage(argv[0], EXIT_FAILURE);
+            }
+        }
+        i++;
+    }
+    // A replayed session brings its own pattern configuration.
+    REPLAY_SOURCE_t *replay = NULL;
+    if (replayPathname) {
+        if (!(replay = replaySourceOpenRecording(replayPathname))) {
+            ARLOGe("Error: Unable to open session recording '%s' for replay.\n", replayPathname);
+            exit(-1);
+        }
+        replaySourceSetFPS(replay, replayFPS);
+        int replayPatternType;
+        replaySourceGetPattern(replay, &replayPatternType, &chessboardCornerNumX, &chessboardCornerNumY, &patternWidth);
+        patternType = (Calibration::CalibrationPatternType)replayPatternType;
+    }
+    // Not every pattern type has defaults, in which case the size and spacing must be given.
+    cv::Size patternSize(0, 0);
+    float patternSpacing = 0.0f;
+    auto defaultSize = Calibration::CalibrationPatternSizes.find(patternType);
+    if (defaultSize != Calibration::CalibrationPatternSizes.end()) patternSize = defaultSize->second;
+    auto defaultSpacing = Calibration::CalibrationPatternSpacings.find(patternType);
+    if (defaultSpacing != Calibration::CalibrationPatternSpacings.end()) patternSpacing = defaultSpacing->second;
+    if (chessboardCornerNumX) patternSize.width = chessboardCornerNumX;
+    if (chessboardCornerNumY) patternSize.height = chessboardCornerNumY;
+    if (patternWidth != 0.0f) patternSpacing = patternWidth;
+    if (patternSize.width <= 0 || patternSize.height <= 0 || patternSpacing <= 0.0f) {
+        ARLOGe("Error: pattern type %s has no default size or spacing; specify -cornerx, -cornery and -pattwidth.\n", patternTypeName(patternType));
+        usage(argv[0], EXIT_FAILURE);
+    }
+    if (calibImageNum == 0) calibImageNum = CALIB_IMAGE_NUM;
+    char *metricsPathnameDefault = NULL;
+    if (!outPathname) outPathname = (char *)SAVE_FILENAME;
+    if (!metricsPathname) {
+        if (asprintf(&metricsPathnameDefault, "%s" METRICS_FILENAME_SUFFIX, outPathname) < 0) {
+            ARLOGperror(NULL);
+            exit(-1);
+        }
+        metricsPathname = metricsPathnameDefault;
+    }
+    ARPRINT("Calibration pattern type = %s\n", patternTypeName(patternType));
+    ARPRINT("Calibration pattern size = %dx%d\n", patternSize.width, patternSize.height);
+    ARPRINT("Calibration pattern spacing = %f\n", patternSpacing);
+    ARPRINT("Calibration image count = %d\n", calibImageNum);
+    ARPRINT("Capture novelty threshold = %f\n", novelty);
+    ARPRINT("Capture mode = %s\n", (autoCapture ? "automatic" : "on request"));
+    if (replay) ARPRINT("Replaying: %s (%d frames%s)\n", replayPathname, replaySourceGetFrameCount(replay), (replayFPS > 0.0f ? "" : ", as fast as possible"));
+    else ARPRINT("Video parameter: %s\n", (vconf ? vconf : ""));
+    ARPRINT("Output file: %s\n", outPathname);
+    ARPRINT("Metrics file: %s\n", metricsPathname);
+    if (recordPathname) ARPRINT("Session recording: %s%s\n", recordPathname, (recordCompress ? "" : " (uncompressed)"));
+
+    // Capture and quit requests.
+    signal(SIGUSR1, signalHandler);
+    signal(SIGINT, signalHandler);
+    signal(SIGTERM, signalHandler);
+    if (readStdin) {
+        pthread_t stdinThread;
+        pthread_attr_t pta;
+        pthread_attr_init(&pta);
+        pthread_attr_setdetachstate(&pta, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&stdinThread, &pta, stdinCommandThread, NULL) != 0) {
+            ARLOGe("Error: Unable to create stdin command thread.\n");
+        }
+        pthread_attr_destroy(&pta);
+    }
+
+    // Open the video source, unless replaying.
+    ARVideoSource *vs = NULL;
+    int videoWidth, videoHeight;
+    if (replay) {
+        videoWidth = replaySourceGetVideoWidth(replay);
+        videoHeight = replaySourceGetVideoHeight(replay);
+    } else {
+        vs = new ARVideoSource;
+        vs->configure((vconf ? vconf : ""), true, NULL, NULL, 0);
+        if (!vs->open()) {
+            ARLOGe("Error: Unable to open video source.\n");
+            delete vs;
+            free(metricsPathnameDefault);
+            exit(-1);
+        }
+        videoWidth = vs->getVideoWidth();
+        videoHeight = vs->getVideoHeight();
+    }
+    ARPRINT("Video %dx%d.\n", videoWidth, videoHeight);
+
+    Calibration *calibration = new Calibration(patternType, calibImageNum, patternSize, patternSpacing, videoWidth, videoHeight);
+    calibration->setCaptureNoveltyThreshold(novelty);
+    if (recordPathname && !calibration->startRecording(recordPathname, recordCompress)) {
+        ARLOGe("Error: Unable to record session to '%s'.\n", recordPathname);
+        delete calibration;
+        if (vs) {
+            vs->close();
+            delete vs;
+        }
+        replaySourceClose(&replay);
+        free(metricsPathnameDefault);
+        exit(-1);
+    }
+
+    // Main loop.
+    struct timeval startTime, lastAutoCaptureTime = {0, 0};
+    gettimeofday(&startTime, NULL);
+    long frameCount = 0;
+    long lastAutoCaptureFrame = -1;
+    int ret = 0;
+    if (!autoCapture) ARPRINT("Send SIGUSR1 or type 'c' and press [return] to capture, 'u' to undo a capture, 'q' to quit.\n");
+    while (calibration->calibImageCount() < calibration->calibImageCountMax()) {
+
+        if (gSignalQuitRequested || gCommandQuit) {
+            ARPRINT("Calibration canceled.\n");
+            ret = 1;
+            break;
+        }
+
+        bool newResults = false;
+        if (replay) {
+            // Every replayed frame is processed, in order, so that replays are repeatable.
+            const uint8_t *frame = replaySourceNextFrame(replay, NULL);
+            if (!frame) {
+                ARPRINT("End of replay. %d/%d captured.\n", calibration->calibImageCount(), calibration->calibImageCountMax());
+                if (!calibration->calibImageCount()) ret = 1;
+                break;
+            }
+            frameCount++;
+            calibration->frame(frame, true, &newResults);
+        } else if (vs->captureFrame()) {
+            frameCount++;
+            calibration->frame(vs, &newResults);
+        } else {
+            arUtilSleep(1); // 1 millisecond.
+        }
+
+        // Requested captures and uncaptures.
+        int captureCount = 0;
+        if (gSignalCaptureRequested) {
+            gSignalCaptureRequested = 0;
+            captureCount++;
+        }
+        captureCount += gCommandCaptureCount.exchange(0);
+        for (i = 0; i < captureCount; i++) {
+            if (!calibration->capture()) ARPRINT("Capture rejected: %s.\n", calibration->captureRejectReason().c_str());
+        }
+        int uncaptureCount = gCommandUncaptureCount.exchange(0);
+        for (i = 0; i < uncaptureCount; i++) {
+            if (calibration->uncapture()) ARPRINT("Capture undone. %d/%d captured.\n", calibration->calibImageCount(), calibration->calibImageCountMax());
+        }
+
+        // Automatic capture, each time new corner finder results are available, but no more often than the interval.
+        // When replaying, the interval is in replay time, or is ignored if replaying as fast as possible.
+        bool autoCaptureDue;
+        if (replay) autoCaptureDue = (replayFPS <= 0.0f || lastAutoCaptureFrame < 0 || (frameCount - lastAutoCaptureFrame)/replayFPS >= autoCaptureInterval);
+        else autoCaptureDue = (elapsedSince(&lastAutoCaptureTime) >= autoCaptureInterval);
+        if (autoCapture && newResults && autoCaptureDue) {
+            int cornerFoundAllFlag;
+            std::vector<cv::Point2f> corners;
+            ARUint8 *videoFrame;
+            calibration->cornerFinderResultsLockAndFetch(&cornerFoundAllFlag, corners, &videoFrame);
+            calibration->cornerFinderResultsUnlock();
+            if (cornerFoundAllFlag) {
+                gettimeofday(&lastAutoCaptureTime, NULL);
+                lastAutoCaptureFrame = frameCount;
+                calibration->capture();
+            }
+        }
+    }
+
+    if (ret == 0) {
+        ARParam param;
+        ARdouble err_min, err_avg, err_max;
+
+        ARPRINT("Calculating camera parameters...\n");
+        calibration->calib(&param, &err_min, &err_avg, &err_max);
+        ARPRINT("Camera parameters calculated (error min=%.3f, avg=%.3f, max=%.3f).\n", err_min, err_avg, err_max);
+
+        if (arParamSave(outPathname, 1, &param) < 0) {
+            ARLOGe("Error writing camera parameters to '%s'.\n", outPathname);
+            ret = -1;
+        } else {
+            ARPRINT("Saved camera parameters to '%s'.\n", outPathname);
+        }
+        if (!saveMetrics(metricsPathname, &param, err_min, err_avg, err_max, calibration->calibImageCount(), patternType, patternSize, patternSpacing, frameCount, elapsedSince(&startTime))) {
+            ret = -1;
+        } else {
+            ARPRINT("Saved calibration metrics to '%s'.\n", metricsPathname);
+        }
+    }
+
+    delete calibration;
+    if (vs) {
+        vs->close();
+        delete vs;
+    }
+    replaySourceClose(&replay);
+    free(metricsPathnameDefault);
+
+    return (ret);
+}
+
+// Write the calibration error and session metrics, one per line in "name,value" format.
+static bool saveMetrics(const char *metricsPathname, const ARParam *param, ARdouble err_min, ARdouble err_avg, ARdouble err_max, int imageCount, Calibration::CalibrationPatternType patternType, cv::Size patternSize, float patternSpacing, long frameCount, double elapsed)
+{
+    FILE *fp;
+
+    if (!(fp = fopen(metricsPathname, "wb"))) {
+        ARLOGe("Error opening metrics file '%s'.\n", metricsPathname);
+        ARLOGperror(NULL);
+        return false;
+    }
+    fprintf(fp, "version,%d\n", param->dist_function_version == 5 ? 2 : 1);
+    fprintf(fp, "camera_width,%d\n", param->xsize);
+    fprintf(fp, "camera_height,%d\n", param->ysize);
+    fprintf(fp, "err_min,%f\n", err_min);
+    fprintf(fp, "err_avg,%f\n", err_avg);
+    fprintf(fp, "err_max,%f\n", err_max);
+    fprintf(fp, "image_count,%d\n", imageCount);
+    fprintf(fp, "pattern_type,%s\n", patternTypeName(patternType));
+    fprintf(fp, "pattern_width,%d\n", patternSize.width);
+    fprintf(fp, "pattern_height,%d\n", patternSize.height);
+    fprintf(fp, "pattern_spacing,%f\n", patternSpacing);
+    fprintf(fp, "frame_count,%ld\n", frameCount);
+    fprintf(fp, "elapsed_seconds,%f\n", elapsed);
+    fprintf(fp, "frames_per_second,%f\n", (elapsed > 0.0 ? (double)frameCount/elapsed : 0.0));
+    if (fclose(fp) != 0) {
+        ARLOGe("Error writing metrics file '%s'.\n", metricsPathname);
+        ARLOGperror(NULL);
+        return false;
+    }
+    return true;
+}
+
+// Reads commands from stdin, one per line.
+static void *stdinCommandThread(void *arg)
+{
+    char buf[64];
+
+    while (fgets(buf, sizeof(buf), stdin)) {
+        // Remove NLs and CRs from end of string.
+        size_t l = strlen(buf);
+        while (l > 0 && (buf[l - 1] == '\n' || buf[l - 1] == '\r')) buf[--l] = '\0';
+
+        if (strcmp(buf, "c") == 0 || strcmp(buf, "capture") == 0) gCommandCaptureCount++;
+        else if (strcmp(buf, "u") == 0 || strcmp(buf, "uncapture") == 0) gCommandUncaptureCount++;
+        else if (strcmp(buf, "q") == 0 || strcmp(buf, "quit") == 0) gCommandQuit = true;
+        else if (buf[0]) ARPRINT("Unknown command '%s'.\n", buf);
+    }
+    return (NULL);
+}
+
+static void usage(char *com, int status)
+{
+    ARPRINT("Usage: %s [options]\n", com);
+    ARPRINT("Options:\n");
+    ARPRINT("  --vconf <video parameter for the camera>\n");
+    ARPRINT("  -patterntype=(chessboard|circles|acircles): specify the type of calibration pattern.\n");
+    ARPRINT("  -cornerx=n: specify the number of corners on chessboard in X direction.\n");
+    ARPRINT("  -cornery=n: specify the number of corners on chessboard in Y direction.\n");
+    ARPRINT("  -imagenum=n: specify the number of images captured for calibration.\n");
+    ARPRINT("  -pattwidth=n: specify the square width in the chessbaord.\n");
+    ARPRINT("  -novelty=f: specify the minimum pose novelty for a capture to be accepted. 0 disables.\n");
+    ARPRINT("  -auto: capture automatically whenever the pattern is found.\n");
+    ARPRINT("  -autointerval=f: capture automatically, at most once every f seconds (default %.1f).\n", AUTO_CAPTURE_INTERVAL_DEFAULT);
+    ARPRINT("  -nostdin: don't read capture commands from stdin.\n");
+    ARPRINT("  -outfile=path: specify the camera parameters file to write (default %s).\n", SAVE_FILENAME);
+    ARPRINT("  -metricsfile=path: specify the metrics file to write (default <outfile>%s).\n", METRICS_FILENAME_SUFFIX);
+    ARPRINT("  -record=path: record captured frames and corners to a session file.\n");
+    ARPRINT("  -recordraw: don't compress frames in the session file.\n");
+    ARPRINT("  -replay=path: take frames from a session recording instead of a camera.\n");
+    ARPRINT("  -replayfps=f: replay at f frames per second, rather than as fast as possible.\n");
+    ARPRINT("  -h -help --help: show this message\n");
+    ARPRINT("In non-automatic mode, send SIGUSR1, or type 'c' and [return], to capture.\n");
+    ARPRINT("Type 'u' and [return] to undo a capture, or 'q' and [return] to quit.\n");
+    exit(status);
+}
@@ -0,0 +1,274 @@
+/*
+ *  calib_db.c
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+// Compiles saved camera parameters files (camera_para-<device id>-0-<width>x<height>[-<focal length>].dat,
+// as written by the calibration utility) into a calibration database, and queries it. See calibrationDB.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/param.h> // MAXPATHLEN
+#include <ARX/AR/ar.h>
+
+#include "calibrationDB.h"
+#include "paramBuffer.h"
+#include "version.h"
+
+#define PARAM_FILENAME_PREFIX "camera_para-"
+#define PARAM_FILENAME_SUFFIX ".dat"
+
+typedef struct {
+    CALIBRATION_DB_ENTRY_t *entries;
+    int count;
+    int capacity;
+} ENTRIES_t;
+
+static void usage(char *com)
+{
+    ARPRINT("Usage: %s <command> <database> [arguments]\n", com);
+    ARPRINT("Commands:\n");
+    ARPRINT("  build <database> <file or directory>...: create the database from camera parameters files, replacing any existing database.\n");
+    ARPRINT("  add <database> <file or directory>...: add camera parameters files to the database, replacing existing entries with the same key.\n");
+    ARPRINT("  compact <database>: rewrite the database as a single segment.\n");
+    ARPRINT("  lookup <database> <device id> <width>x<height> [<focal length>]: print the camera parameters for a camera.\n");
+    ARPRINT("  list <database>: list the entries in the database.\n");
+    ARPRINT("  verify <database>: check the database for damage.\n");
+    ARPRINT("Camera parameters files are named as saved by the calibration utility, i.e.\n");
+    ARPRINT("  " PARAM_FILENAME_PREFIX "<device id>-0-<width>x<height>[-<focal length>]" PARAM_FILENAME_SUFFIX "\n");
+    exit(0);
+}
+
+// Get the key from a camera parameters filename. deviceID and focalLength are allocated.
+static bool keyFromFilename(const char *filename, CALIBRATION_DB_KEY_t *key_out)
+{
+    size_t prefixLen = strlen(PARAM_FILENAME_PREFIX), suffixLen = strlen(PARAM_FILENAME_SUFFIX);
+    size_t len = strlen(filename);
+    char *s, *p, *focalLength = NULL;
+    int width, height, index;
+    char c;
+
+    if (len <= prefixLen + suffixLen || strncmp(filename, PARAM_FILENAME_PREFIX, prefixLen) != 0 || strcmp(filename + len - suffixLen, PARAM_FILENAME_SUFFIX) != 0) return (false);
+    if (!(s = strdup(filename + prefixLen))) return (false);
+    s[len - prefixLen - suffixLen] = '\0';
+
+    // Parse from the end, since the device identifier may itself contain '-'.
+    if (!(p = strrchr(s, '-'))) goto bad;
+    if (sscanf(p + 1, "%dx%d%c", &width, &height, &c) != 2) {
+        focalLength = p + 1;
+        *p = '\0';
+        if (!(p = strrchr(s, '-')) || sscanf(p + 1, "%dx%d%c", &width, &height, &c) != 2) goto bad;
+    }
+    *p = '\0';
+    if (!(p = strrchr(s, '-')) || sscanf(p + 1, "%d%c", &index, &c) != 1) goto bad; // Camera index.
+    *p = '\0';
+    if (!s[0] || width <= 0 || height <= 0) goto bad;
+
+    key_out->deviceID = s;
+    key_out->width = width;
+    key_out->height = height;
+    key_out->focalLength = strdup(focalLength ? focalLength : "0.000");
+    return (true);
+bad:
+    free(s);
+    return (false);
+}
+
+static bool entriesAdd(ENTRIES_t *entries, const CALIBRATION_DB_ENTRY_t *entry)
+{
+    if (entries->count == entries->capacity) {
+        int capacity = (entries->capacity ? entries->capacity*2 : 256);
+        CALIBRATION_DB_ENTRY_t *e = (CALIBRATION_DB_ENTRY_t *)realloc(entries->entries, sizeof(CALIBRATION_DB_ENTRY_t)*capacity);
+        if (!e) {
+            ARLOGe("Out of memory!\n");
+            return (false);
+        }
+        entries->entries = e;
+        entries->capacity = capacity;
+    }
+    entries->entries[entries->count++] = *entry;
+    return (true);
+}
+
+static void entriesFree(ENTRIES_t *entries)
+{
+    int i;
+    for (i = 0; i < entries->count; i++) {
+        free((char *)entries->entries[i].key.deviceID);
+        free((char *)entries->entries[i].key.focalLength);
+    }
+    free(entries->entries);
+}
+
+// Read one camera parameters file. Files not named as a saved calibration are skipped.
+static bool readParamFile(const char *pathname, ENTRIES_t *entries)
+{
+    const char *filename = strrchr(pathname, '/');
+    filename = (filename ? filename + 1 : pathname);
+    CALIBRATION_DB_ENTRY_t entry;
+    unsigned char buf[PARAM_BUFFER_LEN_MAX + 1];
+    struct stat st;
+    FILE *fp;
+
+    if (!keyFromFilename(filename, &entry.key)) {
+        ARLOGw("Skipping '%s', as its name doesn't identify the camera.\n", pathname);
+        return (true);
+    }
+    if (!(fp = fopen(pathname, "rb"))) {
+        ARLOGe("Error opening '%s'.\n", pathname);
+        ARLOGperror(NULL);
+        goto bad;
+    }
+    size_t len = fread(buf, 1, sizeof(buf), fp);
+    entry.time = (fstat(fileno(fp), &st) == 0 ? st.st_mtime : 0);
+    fclose(fp);
+    if (!paramBufferRead(buf, len, &entry.param)) {
+        ARLOGe("Error: '%s' is not a camera parameters file.\n", pathname);
+        goto bad;
+    }
+    if (entry.param.xsize != entry.key.width || entry.param.ysize != entry.key.height) {
+        ARLOGw("Warning: '%s' holds parameters for %dx%d.\n", pathname, entry.param.xsize, entry.param.ysize);
+    }
+    if (entriesAdd(entries, &entry)) return (true);
+bad:
+    free((char *)entry.key.deviceID);
+    free((char *)entry.key.focalLength);
+    return (false);
+}
+
+// Read a camera parameters file, or all the camera parameters files in a directory.
+static bool readParamFiles(const char *pathname, ENTRIES_t *entries)
+{
+    struct stat st;
+    DIR *dir;
+    struct dirent *de;
+    bool ok = true;
+
+    if (stat(pathname, &st) < 0) {
+        ARLOGe("Error: unable to read '%s'.\n", pathname);
+        ARLOGperror(NULL);
+        return (false);
+    }
+    if (!S_ISDIR(st.st_mode)) return (readParamFile(pathname, entries));
+
+    if (!(dir = opendir(pathname))) {
+        ARLOGe("Error: unable to read directory '%s'.\n", pathname);
+        ARLOGperror(NULL);
+        return (false);
+    }
+    while (ok && (de = readdir(dir))) {
+        size_t len = strlen(de->d_name);
+        if (strncmp(de->d_name, PARAM_FILENAME_PREFIX, strlen(PARAM_FILENAME_PREFIX)) != 0 || len < strlen(PARAM_FILENAME_SUFFIX) || strcmp(de->d_name + len - strlen(PARAM_FILENAME_SUFFIX), PARAM_FILENAME_SUFFIX) != 0) continue;
+        char filePathname[MAXPATHLEN];
+        snprintf(filePathname, sizeof(filePathname), "%s/%s", pathname, de->d_name);
+        ok = readParamFile(filePathname, entries);
+    }
+    closedir(dir);
+    return (ok);
+}
+
+static bool listCallback(const CALIBRATION_DB_ENTRY_t *entry, void *userdata)
+{
+    char timestamp[32] = "-";
+    if (entry->time) strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&entry->time));
+    ARPRINT("%s\t%dx%d\t%s\t%d\t%s\n", entry->key.deviceID, entry->key.width, entry->key.height, entry->key.focalLength, entry->param.dist_function_version, timestamp);
+    (*(int *)userdata)++;
+    return (true);
+}
+
+int main(int argc, char *argv[])
+{
+    CALIBRATION_DB_t *db;
+    ENTRIES_t entries = {NULL, 0, 0};
+    int i;
+    bool ok = true;
+
+#ifdef DEBUG
+    arLogLevel = AR_LOG_LEVEL_DEBUG;
+#endif
+
+    if (argc >= 2 && (strcmp(argv[1], "--version") == 0 || strcmp(argv[1], "-version") == 0 || strcmp(argv[1], "-v") == 0)) {
+        ARPRINT("%s version %s\n", argv[0], VERSION_STRING);
+        exit(0);
+    }
+    if (argc < 3) usage(argv[0]);
+    const char *command = argv[1];
+    const char *dbPathname = argv[2];
+
+    if (strcmp(command, "build") == 0 || strcmp(command, "add") == 0) {
+        if (argc < 4) usage(argv[0]);
+        for (i = 3; i < argc && ok; i++) ok = readParamFiles(argv[i], &entries);
+        if (ok) {
+            if (command[0] == 'b') ok = calibrationDBBuild(dbPathname, entries.entries, entries.count);
+            else ok = calibrationDBAppend(dbPathname, entries.entries, entries.count);
+        }
+        if (ok) ARPRINT("%s %d calibrations to '%s'.\n", (command[0] == 'b' ? "Wrote" : "Added"), entries.count, dbPathname);
+        entriesFree(&entries);
+    } else if (strcmp(command, "compact") == 0) {
+        ok = calibrationDBCompact(dbPathname);
+    } else if (strcmp(command, "lookup") == 0) {
+        CALIBRATION_DB_KEY_t key;
+        ARParam param;
+        time_t calibrationTime;
+        if (argc < 5 || argc > 6) usage(argv[0]);
+        key.deviceID = argv[3];
+        if (sscanf(argv[4], "%dx%d", &key.width, &key.height) != 2) usage(argv[0]);
+        key.focalLength = (argc == 6 ? argv[5] : NULL);
+        if (!(db = calibrationDBOpen(dbPathname))) exit(1);
+        ok = calibrationDBLookup(db, &key, &param, &calibrationTime);
+        calibrationDBClose(&db);
+        if (!ok) {
+            ARLOGe("No calibration found.\n");
+        } else {
+            arParamDisp(&param);
+        }
+    } else if (strcmp(command, "list") == 0) {
+        int count = 0;
+        if (!(db = calibrationDBOpen(dbPathname))) exit(1);
+        calibrationDBForEach(db, listCallback, &count);
+        ARPRINT("%d calibrations in %d segments, generation %llu.\n", count, calibrationDBSegmentCount(db), (unsigned long long)calibrationDBGeneration(db));
+        calibrationDBClose(&db);
+    } else if (strcmp(command, "verify") == 0) {
+        if (!(db = calibrationDBOpen(dbPathname))) exit(1);
+        ok = calibrationDBVerify(db);
+        calibrationDBClose(&db);
+        if (ok) ARPRINT("OK.\n");
+    } else {
+        usage(argv[0]);
+    }
+
+    return (ok ? 0 : 1);
+}
@@ -0,0 +1,288 @@
+/*
+ *  calib_export.c
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+// Exports camera parameters files to OpenCV FileStorage YAML and/or JSON, holding the camera matrix and
+// distortion coefficients. Files are exported in parallel, as they are found, so large directories are
+// neither listed up front nor held in memory.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/param.h> // MAXPATHLEN
+#include <ARX/AR/ar.h>
+
+#include "paramBuffer.h"
+#include "paramExport.h"
+#include "version.h"
+
+#define PARAM_FILENAME_SUFFIX ".dat"
+#define EXPORT_BUFFER_LEN 4096
+#define THREADS_MAX 64
+
+// Source of files to export, shared by the worker threads.
+typedef struct {
+    pthread_mutex_t lock;
+    char          **paths;
+    int             pathCount;
+    int             pathIndex;
+    DIR            *dir;         // Directory being read, if any.
+    const char     *dirPath;
+    const char     *outDir;      // NULL to write alongside the input.
+    bool            yaml;
+    bool            json;
+    long            exported;
+    long            skipped;
+    long            failed;
+} EXPORT_t;
+
+static void usage(char *com, int status)
+{
+    ARPRINT("Usage: %s [options] <file or directory>...\n", com);
+    ARPRINT("Options:\n");
+    ARPRINT("  -format=(yaml|json|both): specify the output format (default yaml).\n");
+    ARPRINT("  -outdir=path: write exported files to this directory, instead of alongside the input.\n");
+    ARPRINT("  -threads=n: specify the number of files to export at once (default: number of CPUs).\n");
+    ARPRINT("  --version: Print version information.\n");
+    ARPRINT("  -h -help --help: show this message\n");
+    exit(status);
+}
+
+static bool hasSuffix(const char *s, const char *suffix)
+{
+    size_t len = strlen(s), suffixLen = strlen(suffix);
+    return (len > suffixLen && strcmp(s + len - suffixLen, suffix) == 0);
+}
+
+// Get the next file to export. Returns false when there are no more.
+static bool nextPath(EXPORT_t *e, char *path, size_t pathLen)
+{
+    struct stat st;
+    struct dirent *de;
+    bool found = false;
+
+    pthread_mutex_lock(&e->lock);
+    while (!found) {
+        if (e->dir) {
+            if ((de = readdir(e->dir))) {
+                if (hasSuffix(de->d_name, PARAM_FILENAME_SUFFIX)) {
+                    snprintf(path, pathLen, "%s/%s", e->dirPath, de->d_name);
+                    found = true;
+                }
+                continue;
+            }
+            closedir(e->dir);
+            e->dir = NULL;
+        }
+        if (e->pathIndex >= e->pathCount) break;
+        const char *p = e->paths[e->pathIndex++];
+        if (stat(p, &st) == 0 && S_ISDIR(st.st_mode)) {
+            if (!(e->dir = opendir(p))) {
+                ARLOGe("Error: unable to read directory '%s'.\n", p);
+                ARLOGperror(NULL);
+                e->failed++;
+            }
+            e->dirPath = p;
+        } else {
+            snprintf(path, pathLen, "%s", p);
+            found = true;
+        }
+    }
+    pthread_mutex_unlock(&e->lock);
+    return (found);
+}
+
+static bool writeFile(const char *path, const char *buf, size_t len)
+{
+    int fd;
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) return (false);
+    const char *p = buf;
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        p += n;
+        len -= (size_t)n;
+    }
+    return (close(fd) == 0 && len == 0);
+}
+
+// Export one file. Returns 1 if exported, 0 if skipped, -1 in case of error.
+static int exportFile(const EXPORT_t *e, const char *path)
+{
+    unsigned char paramBuf[PARAM_BUFFER_LEN_MAX + 1];
+    char buf[EXPORT_BUFFER_LEN];
+    char outPath[MAXPATHLEN];
+    ARParam param;
+    FILE *fp;
+    int i;
+
+    if (!(fp = fopen(path, "rb"))) {
+        ARLOGe("Error opening '%s'.\n", path);
+        ARLOGperror(NULL);
+        return (-1);
+    }
+    size_t len = fread(paramBuf, 1, sizeof(paramBuf), fp);
+    fclose(fp);
+    if (!paramBufferRead(paramBuf, len, &param)) {
+        ARLOGe("Error: '%s' is not a camera parameters file.\n", path);
+        return (-1);
+    }
+
+    // Output filename is the input filename with the extension replaced.
+    const char *filename = strrchr(path, '/');
+    filename = (filename ? filename + 1 : path);
+    int baseLen = (int)(hasSuffix(filename, PARAM_FILENAME_SUFFIX) ? strlen(filename) - strlen(PARAM_FILENAME_SUFFIX) : strlen(filename));
+    int dirLen = (int)(filename - path);
+
+    for (i = 0; i < 2; i++) {
+        PARAM_EXPORT_FORMAT format = (i == 0 ? PARAM_EXPORT_FORMAT_YAML : PARAM_EXPORT_FORMAT_JSON);
+        if ((i == 0 && !e->yaml) || (i == 1 && !e->json)) continue;
+        size_t outLen = paramExportWrite(&param, format, buf, sizeof(buf));
+        if (!outLen) {
+            ARLOGw("Skipping '%s', as its distortion function version (%d) isn't an OpenCV model.\n", path, param.dist_function_version);
+            return (0);
+        }
+        if (e->outDir) snprintf(outPath, sizeof(outPath), "%s/%.*s%s", e->outDir, baseLen, filename, (i == 0 ? ".yml" : ".json"));
+        else snprintf(outPath, sizeof(outPath), "%.*s%.*s%s", dirLen, path, baseLen, filename, (i == 0 ? ".yml" : ".json"));
+        if (!writeFile(outPath, buf, outLen)) {
+            ARLOGe("Error writing '%s'.\n", outPath);
+            ARLOGperror(NULL);
+            return (-1);
+        }
+    }
+    return (1);
+}
+
+static void *exportThread(void *arg)
+{
+    EXPORT_t *e = (EXPORT_t *)arg;
+    char path[MAXPATHLEN];
+    long exported = 0, skipped = 0, failed = 0;
+
+    while (nextPath(e, path, sizeof(path))) {
+        int result = exportFile(e, path);
+        if (result > 0) exported++;
+        else if (result == 0) skipped++;
+        else failed++;
+    }
+
+    pthread_mutex_lock(&e->lock);
+    e->exported += exported;
+    e->skipped += skipped;
+    e->failed += failed;
+    pthread_mutex_unlock(&e->lock);
+    return (NULL);
+}
+
+int main(int argc, char *argv[])
+{
+    EXPORT_t        e;
+    pthread_t       threads[THREADS_MAX];
+    int             threadCount = 0;
+    int             i;
+    struct timeval  start, end;
+
+#ifdef DEBUG
+    arLogLevel = AR_LOG_LEVEL_DEBUG;
+#endif
+
+    memset(&e, 0, sizeof(e));
+    e.yaml = true;
+    if (!(e.paths = (char **)calloc(argc, sizeof(char *)))) {
+        ARLOGe("Out of memory!\n");
+        exit(1);
+    }
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-help") == 0 || strcmp(argv[i], "-h") == 0) {
+            usage(argv[0], EXIT_SUCCESS);
+        } else if (strcmp(argv[i], "--version") == 0 || strcmp(argv[i], "-version") == 0 || strcmp(argv[i], "-v") == 0) {
+            ARPRINT("%s version %s\n", argv[0], VERSION_STRING);
+            exit(0);
+        } else if (strncmp(argv[i], "-format=", 8) == 0) {
+            if (strcmp(&(argv[i][8]), "yaml") == 0) { e.yaml = true; e.json = false; }
+            else if (strcmp(&(argv[i][8]), "json") == 0) { e.yaml = false; e.json = true; }
+            else if (strcmp(&(argv[i][8]), "both") == 0) { e.yaml = true; e.json = true; }
+            else usage(argv[0], EXIT_FAILURE);
+        } else if (strncmp(argv[i], "-outdir=", 8) == 0) {
+            e.outDir = &(argv[i][8]);
+        } else if (strncmp(argv[i], "-threads=", 9) == 0) {
+            if (sscanf(&(argv[i][9]), "%d", &threadCount) != 1) usage(argv[0], EXIT_FAILURE);
+            if (threadCount <= 0) usage(argv[0], EXIT_FAILURE);
+        } else if (argv[i][0] == '-') {
+            ARLOGe("Error: invalid command line argument '%s'.\n", argv[i]);
+            usage(argv[0], EXIT_FAILURE);
+        } else {
+            e.paths[e.pathCount++] = argv[i];
+        }
+    }
+    if (!e.pathCount) usage(argv[0], EXIT_FAILURE);
+    if (e.outDir && mkdir(e.outDir, 0755) < 0 && errno != EEXIST) {
+        ARLOGe("Error creating output directory '%s'.\n", e.outDir);
+        ARLOGperror(NULL);
+        exit(1);
+    }
+    if (!threadCount) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threadCount = (cpus > 0 ? (int)cpus : 1);
+    }
+    if (threadCount > THREADS_MAX) threadCount = THREADS_MAX;
+    pthread_mutex_init(&e.lock, NULL);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < threadCount; i++) {
+        if (pthread_create(&threads[i], NULL, exportThread, &e) != 0) {
+            ARLOGe("Error creating export thread.\n");
+            break;
+        }
+    }
+    threadCount = i;
+    if (!threadCount) exit(1);
+    for (i = 0; i < threadCount; i++) pthread_join(threads[i], NULL);
+    gettimeofday(&end, NULL);
+
+    double elapsed = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_usec - start.tv_usec)/1.0e6;
+    ARPRINT("Exported %ld files in %.3f seconds using %d threads (%ld skipped, %ld failed).\n", e.exported, elapsed, threadCount, e.skipped, e.failed);
+
+    pthread_mutex_destroy(&e.lock);
+    free(e.paths);
+    return (e.failed ? 1 : 0);
+}
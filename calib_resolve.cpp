@@ -0,0 +1,437 @@
+/*
+ *  calib_resolve.cpp
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+// Re-solves recorded calibration sessions (see sessionRecorder.h) offline, with a chosen distortion
+// function version and corner set, writing a camera parameters file per session and a CSV report of
+// reprojection errors. Sessions are shared out through a work queue file (see workQueue.h), to a
+// number of worker processes on this machine, and optionally to further runs of this utility on other
+// machines which name the same queue on a shared filesystem. Every run sharing a queue should be given
+// the same settings and output directory. Each worker limits OpenCV to a single thread, since the
+// workers already occupy every CPU.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/param.h> // MAXPATHLEN
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <ARX/AR/ar.h>
+#include <opencv2/core/core.hpp>
+
+#include "calc.hpp"
+#include "sessionRecorder.h"
+#include "workQueue.h"
+#include "version.h"
+
+// ============================================================================
+//	Constants
+// ============================================================================
+
+#define      PARAM_FILENAME_SUFFIX   ".dat"
+#define      REPORT_FILENAME_SUFFIX  ".csv"
+#define      LEASE_SECONDS_DEFAULT   600
+#define      JOBS_MAX                256
+#define      CAPTURES_MIN            3
+
+typedef struct {
+    const char *queuePathname;
+    const char *outDir;
+    int         distFunctionVersion;
+    bool        rawCorners;
+    int         leaseSeconds;
+} RESOLVE_SETTINGS_t;
+
+// ============================================================================
+//	Function prototypes
+// ============================================================================
+
+static void usage(char *com, int status);
+static bool addSessions(const char *path, std::vector<std::string>& sessions);
+static int resolveWorker(const RESOLVE_SETTINGS_t *settings);
+static bool resolveSession(const RESOLVE_SETTINGS_t *settings, const char *path, double result[WORK_QUEUE_RESULT_COUNT]);
+static bool writeReport(const char *reportPathname, const WORK_QUEUE_TASK_INFO_t *infos, int count);
+static void makeTmpPathname(char *tmpPathname, size_t len, const char *pathname);
+
+int main(int argc, char *argv[])
+{
+    RESOLVE_SETTINGS_t settings;
+    std::vector<std::string> sessions;
+    char           *reportPathname = NULL;
+    char            reportPathnameDefault[MAXPATHLEN];
+    int             jobs = 0;
+    pid_t           pids[JOBS_MAX];
+    int             i;
+    struct timeval  start, end;
+
+#ifdef DEBUG
+    arLogLevel = AR_LOG_LEVEL_DEBUG;
+#endif
+
+    settings.queuePathname = NULL;
+    settings.outDir = ".";
+    settings.distFunctionVersion = AR_DIST_FUNCTION_VERSION_DEFAULT;
+    settings.rawCorners = false;
+    settings.leaseSeconds = LEASE_SECONDS_DEFAULT;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-help") == 0 || strcmp(argv[i], "-h") == 0) {
+            usage(argv[0], EXIT_SUCCESS);
+        } else if (strcmp(argv[i], "--version") == 0 || strcmp(argv[i], "-version") == 0 || strcmp(argv[i], "-v") == 0) {
+            ARPRINT("%s version %s\n", argv[0], VERSION_STRING);
+            exit(0);
+        } else if (strncmp(argv[i], "-queue=", 7) == 0) {
+            settings.queuePathname = &(argv[i][7]);
+        } else if (strncmp(argv[i], "-outdir=", 8) == 0) {
+            settings.outDir = &(argv[i][8]);
+        } else if (strncmp(argv[i], "-report=", 8) == 0) {
+            reportPathname = &(argv[i][8]);
+        } else if (strncmp(argv[i], "-dist=", 6) == 0) {
+            if (sscanf(&(argv[i][6]), "%d", &settings.distFunctionVersion) != 1) usage(argv[0], EXIT_FAILURE);
+            if (settings.distFunctionVersion != 4 && settings.distFunctionVersion != 5) usage(argv[0], EXIT_FAILURE);
+        } else if (strncmp(argv[i], "-corners=", 9) == 0) {
+            if (strcmp(&(argv[i][9]), "refined") == 0) settings.rawCorners = false;
+            else if (strcmp(&(argv[i][9]), "raw") == 0) settings.rawCorners = true;
+            else usage(argv[0], EXIT_FAILURE);
+        } else if (strncmp(argv[i], "-jobs=", 6) == 0) {
+            if (sscanf(&(argv[i][6]), "%d", &jobs) != 1) usage(argv[0], EXIT_FAILURE);
+            if (jobs <= 0) usage(argv[0], EXIT_FAILURE);
+        } else if (strncmp(argv[i], "-lease=", 7) == 0) {
+            if (sscanf(&(argv[i][7]), "%d", &settings.leaseSeconds) != 1) usage(argv[0], EXIT_FAILURE);
+            if (settings.leaseSeconds <= 0) usage(argv[0], EXIT_FAILURE);
+        } else if (argv[i][0] == '-') {
+            ARLOGe("Error: invalid command line argument '%s'.\n", argv[i]);
+            usage(argv[0], EXIT_FAILURE);
+        } else {
+            if (!addSessions(argv[i], sessions)) exit(1);
+        }
+    }
+    if (!settings.queuePathname) usage(argv[0], EXIT_FAILURE);
+    if (!reportPathname) {
+        snprintf(reportPathnameDefault, sizeof(reportPathnameDefault), "%s%s", settings.queuePathname, REPORT_FILENAME_SUFFIX);
+        reportPathname = reportPathnameDefault;
+    }
+    if (mkdir(settings.outDir, 0755) < 0 && errno != EEXIST) {
+        ARLOGe("Error creating output directory '%s'.\n", settings.outDir);
+        ARLOGperror(NULL);
+        exit(1);
+    }
+
+    // Create the queue, unless another run already has, in which case join it.
+    if (sessions.size()) {
+        std::vector<const char *> tasks;
+        for (const std::string& s : sessions) tasks.push_back(s.c_str());
+        if (workQueueCreate(settings.queuePathname, tasks.data(), (int)tasks.size())) {
+            ARPRINT("Created queue '%s' of %d sessions.\n", settings.queuePathname, (int)tasks.size());
+        } else if (errno == EEXIST) {
+            ARLOGw("Queue '%s' already exists; joining it, and ignoring the sessions given.\n", settings.queuePathname);
+        } else {
+            ARLOGe("Error creating queue '%s'.\n", settings.queuePathname);
+            exit(1);
+        }
+    }
+
+    if (!jobs) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = (cpus > 0 ? (int)cpus : 1);
+    }
+    if (jobs > JOBS_MAX) jobs = JOBS_MAX;
+
+    // Workers are separate processes, forked before any use of OpenCV.
+    gettimeofday(&start, NULL);
+    fflush(NULL);
+    for (i = 0; i < jobs; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            int ret = resolveWorker(&settings);
+            fflush(NULL);
+            _exit(ret);
+        } else if (pid < 0) {
+            ARLOGe("Error starting worker process.\n");
+            ARLOGperror(NULL);
+            break;
+        }
+        pids[i] = pid;
+    }
+    jobs = i;
+    if (!jobs) exit(1);
+    int workersFailed = 0;
+    for (i = 0; i < jobs; i++) {
+        int status;
+        while (waitpid(pids[i], &status, 0) < 0 && errno == EINTR);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) workersFailed++;
+    }
+    gettimeofday(&end, NULL);
+
+    // Tally the whole queue, including sessions solved by other runs.
+    WORK_QUEUE_t *queue = workQueueOpen(settings.queuePathname);
+    if (!queue) {
+        ARLOGe("Error opening queue '%s'.\n", settings.queuePathname);
+        exit(1);
+    }
+    int count = workQueueTaskCount(queue);
+    std::vector<WORK_QUEUE_TASK_INFO_t> infos(count);
+    if (!workQueueGetTasks(queue, infos.data())) {
+        ARLOGe("Error reading queue '%s'.\n", settings.queuePathname);
+        workQueueClose(&queue);
+        exit(1);
+    }
+    int done = 0, failed = 0, waiting = 0;
+    for (i = 0; i < count; i++) {
+        if (infos[i].state == WORK_QUEUE_TASK_DONE) done++;
+        else if (infos[i].state == WORK_QUEUE_TASK_FAILED) failed++;
+        else waiting++;
+    }
+    double elapsed = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_usec - start.tv_usec)/1.0e6;
+    ARPRINT("Ran %d workers for %.3f seconds. Queue holds %d sessions: %d solved, %d failed, %d not yet finished.\n", jobs, elapsed, count, done, failed, waiting);
+    if (workersFailed) ARLOGe("Error: %d workers exited with an error.\n", workersFailed);
+
+    // The report is written once nothing is left, by whichever run finishes last.
+    bool ok = true;
+    if (waiting) {
+        ARPRINT("Not writing the report until the remaining sessions are finished elsewhere, or their leases expire and this is run again.\n");
+    } else {
+        ok = writeReport(reportPathname, infos.data(), count);
+        if (ok) ARPRINT("Wrote report '%s'.\n", reportPathname);
+    }
+    workQueueClose(&queue);
+    return ((ok && !workersFailed && !failed) ? 0 : 1);
+}
+
+static void usage(char *com, int status)
+{
+    ARPRINT("Usage: %s -queue=path [options] [<session file or directory>...]\n", com);
+    ARPRINT("Sessions given are put in a new queue. Without sessions, or if the queue exists, its\n");
+    ARPRINT("remaining sessions are solved, e.g. by a further machine sharing the filesystem.\n");
+    ARPRINT("Options:\n");
+    ARPRINT("  -queue=path: specify the work queue file.\n");
+    ARPRINT("  -outdir=path: write camera parameters files to this directory (default current directory).\n");
+    ARPRINT("  -report=path: specify the CSV report to write (default <queue>%s).\n", REPORT_FILENAME_SUFFIX);
+    ARPRINT("  -dist=(4|5): specify the distortion function version to solve for (default %d).\n", AR_DIST_FUNCTION_VERSION_DEFAULT);
+    ARPRINT("  -corners=(refined|raw): specify the recorded corners to solve from (default refined).\n");
+    ARPRINT("  -jobs=n: specify the number of worker processes (default: number of CPUs).\n");
+    ARPRINT("  -lease=n: specify the seconds after which an unfinished session is handed to another worker (default %d).\n", LEASE_SECONDS_DEFAULT);
+    ARPRINT("  --version: Print version information.\n");
+    ARPRINT("  -h -help --help: show this message\n");
+    exit(status);
+}
+
+// Add a session file, or every file in a directory, in name order.
+static bool addSessions(const char *path, std::vector<std::string>& sessions)
+{
+    struct stat st;
+    struct dirent *de;
+    DIR *dir;
+
+    if (stat(path, &st) < 0) {
+        ARLOGe("Error: unable to find '%s'.\n", path);
+        ARLOGperror(NULL);
+        return (false);
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        sessions.push_back(path);
+        return (true);
+    }
+    if (!(dir = opendir(path))) {
+        ARLOGe("Error: unable to read directory '%s'.\n", path);
+        ARLOGperror(NULL);
+        return (false);
+    }
+    std::vector<std::string> found;
+    while ((de = readdir(dir))) {
+        if (de->d_name[0] == '.') continue;
+        std::string p = std::string(path) + "/" + de->d_name;
+        if (stat(p.c_str(), &st) == 0 && S_ISREG(st.st_mode)) found.push_back(p);
+    }
+    closedir(dir);
+    std::sort(found.begin(), found.end());
+    sessions.insert(sessions.end(), found.begin(), found.end());
+    return (true);
+}
+
+static int resolveWorker(const RESOLVE_SETTINGS_t *settings)
+{
+    WORK_QUEUE_t *queue;
+    const char *task;
+    double result[WORK_QUEUE_RESULT_COUNT];
+    int index;
+    int ret = 0;
+
+    cv::setNumThreads(1);
+    if (!(queue = workQueueOpen(settings->queuePathname))) {
+        ARLOGe("Error opening queue '%s'.\n", settings->queuePathname);
+        return (1);
+    }
+    while ((index = workQueueClaim(queue, settings->leaseSeconds, &task)) >= 0) {
+        bool ok = resolveSession(settings, task, result);
+        if (!workQueueFinish(queue, index, ok, (ok ? result : NULL))) {
+            ARLOGe("Error recording the outcome of '%s' in the queue.\n", task);
+            ret = 1;
+            break;
+        }
+    }
+    if (index == WORK_QUEUE_CLAIM_ERROR) {
+        ARLOGe("Error claiming a session from the queue.\n");
+        ret = 1;
+    }
+    workQueueClose(&queue);
+    return (ret);
+}
+
+// Solve one session, and write its parameters file. On success, "result" receives the number of
+// captures used, and the minimum, average and maximum reprojection error.
+static bool resolveSession(const RESOLVE_SETTINGS_t *settings, const char *path, double result[WORK_QUEUE_RESULT_COUNT])
+{
+    SESSION_RECORDING_t *recording;
+    SESSION_RECORDING_INFO_t info;
+    SESSION_RECORDING_CAPTURE_t capture;
+    std::vector<std::vector<cv::Point2f> > cornerSet;
+    ARParam param;
+    ARdouble err_min, err_avg, err_max;
+    char outPath[MAXPATHLEN];
+    char tmpPath[MAXPATHLEN];
+    int i, j;
+
+    if (!(recording = sessionRecordingOpen(path))) return (false);
+    sessionRecordingGetInfo(recording, &info);
+    int cornerCount = info.patternWidth * info.patternHeight;
+    int captureCount = sessionRecordingCaptureCount(recording);
+    for (i = 0; i < captureCount; i++) {
+        if (!sessionRecordingGetCapture(recording, i, &capture)) continue;
+        if (capture.uncaptured || capture.cornerCount != cornerCount) continue;
+        const float *corners = (settings->rawCorners ? capture.cornersRaw : capture.cornersRefined);
+        std::vector<cv::Point2f> points(cornerCount);
+        for (j = 0; j < cornerCount; j++) points[j] = cv::Point2f(corners[j*2], corners[j*2 + 1]);
+        cornerSet.push_back(points);
+    }
+    sessionRecordingClose(&recording);
+    if (cornerSet.size() < CAPTURES_MIN) {
+        ARLOGe("Error: '%s' has %d usable captures; at least %d are needed.\n", path, (int)cornerSet.size(), CAPTURES_MIN);
+        return (false);
+    }
+
+    memset(&param, 0, sizeof(param));
+    try {
+        calc((int)cornerSet.size(), (Calibration::CalibrationPatternType)info.patternType, cv::Size(info.patternWidth, info.patternHeight), info.patternSpacing, cornerSet,
+             info.videoWidth, info.videoHeight, settings->distFunctionVersion, &param, &err_min, &err_avg, &err_max);
+    } catch (cv::Exception& e) {
+        ARLOGe("Error solving '%s': %s\n", path, e.what());
+        return (false);
+    }
+    if (!param.xsize || !std::isfinite(err_avg)) {
+        ARLOGe("Error solving '%s'.\n", path);
+        return (false);
+    }
+
+    // Output filename is the session filename with any extension replaced. The file is written under a
+    // temporary name, so that a worker which lost its lease can't leave a partial file.
+    const char *filename = strrchr(path, '/');
+    filename = (filename ? filename + 1 : path);
+    const char *ext = strrchr(filename, '.');
+    int baseLen = (int)(ext && ext != filename ? ext - filename : strlen(filename));
+    snprintf(outPath, sizeof(outPath), "%s/%.*s%s", settings->outDir, baseLen, filename, PARAM_FILENAME_SUFFIX);
+    makeTmpPathname(tmpPath, sizeof(tmpPath), outPath);
+    if (arParamSave(tmpPath, 1, &param) < 0 || rename(tmpPath, outPath) < 0) {
+        ARLOGe("Error writing '%s'.\n", outPath);
+        unlink(tmpPath);
+        return (false);
+    }
+
+    result[0] = (double)cornerSet.size();
+    result[1] = (double)err_min;
+    result[2] = (double)err_avg;
+    result[3] = (double)err_max;
+    ARPRINT("%s: solved from %d captures, error min %f, avg %f, max %f [pixel].\n", path, (int)cornerSet.size(), result[1], result[2], result[3]);
+    return (true);
+}
+
+// A temporary name for "pathname" unique to this process, including on other machines sharing the
+// output directory.
+static void makeTmpPathname(char *tmpPathname, size_t len, const char *pathname)
+{
+    char host[64] = "";
+
+    gethostname(host, sizeof(host) - 1);
+    snprintf(tmpPathname, len, "%s.%s.%ld.tmp", pathname, host, (long)getpid());
+}
+
+static void writeCSVString(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s; s++) {
+        if (*s == '"') fputc('"', fp);
+        fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+static bool writeReport(const char *reportPathname, const WORK_QUEUE_TASK_INFO_t *infos, int count)
+{
+    static const char *stateNames[] = {"pending", "claimed", "solved", "failed"};
+    char tmpPath[MAXPATHLEN];
+    FILE *fp;
+    int i;
+
+    makeTmpPathname(tmpPath, sizeof(tmpPath), reportPathname);
+    if (!(fp = fopen(tmpPath, "w"))) {
+        ARLOGe("Error opening report '%s'.\n", tmpPath);
+        ARLOGperror(NULL);
+        return (false);
+    }
+    fprintf(fp, "session,status,attempts,captures,err_min,err_avg,err_max,worker\n");
+    for (i = 0; i < count; i++) {
+        writeCSVString(fp, infos[i].task);
+        fprintf(fp, ",%s,%d,", stateNames[infos[i].state], infos[i].attempts);
+        if (infos[i].state == WORK_QUEUE_TASK_DONE) fprintf(fp, "%d,%f,%f,%f,", (int)infos[i].result[0], infos[i].result[1], infos[i].result[2], infos[i].result[3]);
+        else fprintf(fp, ",,,,");
+        writeCSVString(fp, infos[i].owner);
+        fputc('\n', fp);
+    }
+    bool ok = (fflush(fp) == 0 && !ferror(fp));
+    if (fclose(fp) != 0) ok = false;
+    if (!ok || rename(tmpPath, reportPathname) < 0) {
+        ARLOGe("Error writing report '%s'.\n", reportPathname);
+        unlink(tmpPath);
+        return (false);
+    }
+    return (true);
+}
@@ -0,0 +1,207 @@
+/*
+ *  calibrationCache.c
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+#include "calibrationCache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/param.h> // MAXPATHLEN
+#include <zlib.h>      // crc32()
+
+#include "paramBuffer.h"
+
+//
+// Entry file layout. All values little-endian.
+//   0: magic "ARXCALCA"
+//   8: uint32 version
+//  12: uint32 key length
+//  16: uint32 parameter length
+//  20: uint32 CRC-32 of everything following
+//  24: float64 average reprojection error
+//  32: uint64 time stored (seconds since the epoch)
+//  40: key, as written by keyString()
+//   -: parameter, as written by paramBufferWrite()
+//
+
+#define CACHE_MAGIC "ARXCALCA"
+#define CACHE_VERSION 1
+#define CACHE_HEADER_LEN 40
+#define CACHE_KEY_LEN_MAX 1024
+#define CACHE_FILE_EXTENSION "calib"
+
+static void put32(unsigned char *p, uint32_t v) { int i; for (i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8*i)); }
+static void put64(unsigned char *p, uint64_t v) { int i; for (i = 0; i < 8; i++) p[i] = (unsigned char)(v >> (8*i)); }
+static uint32_t get32(const unsigned char *p) { uint32_t v = 0; int i; for (i = 3; i >= 0; i--) v = (v << 8) | p[i]; return (v); }
+static uint64_t get64(const unsigned char *p) { uint64_t v = 0; int i; for (i = 7; i >= 0; i--) v = (v << 8) | p[i]; return (v); }
+
+// Canonical form of the key, which is both hashed to name the file and stored in it.
+static int keyString(const CALIBRATION_CACHE_KEY_t *key, char *buf, size_t bufLen)
+{
+    if (!key || !key->deviceID || !key->deviceID[0]) return (-1);
+    int len = snprintf(buf, bufLen, "%s\n%dx%d\n%s\n%d", key->deviceID, key->width, key->height, (key->focalLength ? key->focalLength : "0.000"), key->distFunctionVersion);
+    return (len < 0 || (size_t)len >= bufLen ? -1 : len);
+}
+
+// FNV-1a.
+static uint64_t keyHash(const char *s, int len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    int i;
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 0x100000001b3ULL;
+    }
+    return (h);
+}
+
+static void entryPathname(const char *cacheDir, const char *keyStr, int keyLen, char *buf, size_t bufLen)
+{
+    snprintf(buf, bufLen, "%s/%016" PRIx64 "." CACHE_FILE_EXTENSION, cacheDir, keyHash(keyStr, keyLen));
+}
+
+static bool writeFully(int fd, const void *buf, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return (false);
+        p += n;
+        len -= (size_t)n;
+    }
+    return (true);
+}
+
+bool calibrationCachePut(const char *cacheDir, const CALIBRATION_CACHE_KEY_t *key, const ARParam *param, ARdouble err_avg, const bool sync)
+{
+    char keyStr[CACHE_KEY_LEN_MAX];
+    unsigned char buf[CACHE_HEADER_LEN + CACHE_KEY_LEN_MAX + PARAM_BUFFER_LEN_MAX];
+    char pathname[MAXPATHLEN], tmpPathname[MAXPATHLEN];
+    int keyLen;
+    size_t paramLen;
+    double err = (double)err_avg;
+    uint64_t errBits;
+    int fd;
+
+    if (!cacheDir || !param) return (false);
+    if ((keyLen = keyString(key, keyStr, sizeof(keyStr))) < 0) {
+        ARLOGe("Error: invalid calibration cache key.\n");
+        return (false);
+    }
+    if (!(paramLen = paramBufferWrite(param, buf + CACHE_HEADER_LEN + keyLen, PARAM_BUFFER_LEN_MAX))) {
+        ARLOGe("Error serialising camera parameters.\n");
+        return (false);
+    }
+    memcpy(buf, CACHE_MAGIC, 8);
+    put32(buf + 8, CACHE_VERSION);
+    put32(buf + 12, (uint32_t)keyLen);
+    put32(buf + 16, (uint32_t)paramLen);
+    memcpy(&errBits, &err, 8);
+    put64(buf + 24, errBits);
+    put64(buf + 32, (uint64_t)time(NULL));
+    memcpy(buf + CACHE_HEADER_LEN, keyStr, keyLen);
+    size_t len = CACHE_HEADER_LEN + keyLen + paramLen;
+    put32(buf + 20, (uint32_t)crc32(0L, buf + 24, (uInt)(len - 24)));
+
+    if (mkdir(cacheDir, 0755) < 0 && errno != EEXIST) {
+        ARLOGe("Error creating calibration cache directory '%s'.\n", cacheDir);
+        ARLOGperror(NULL);
+        return (false);
+    }
+
+    // Write to a temporary file and rename over any existing entry, so a lookup never sees a partial entry.
+    entryPathname(cacheDir, keyStr, keyLen, pathname, sizeof(pathname));
+    snprintf(tmpPathname, sizeof(tmpPathname), "%s.tmp", pathname);
+    if ((fd = open(tmpPathname, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+        ARLOGe("Error creating calibration cache entry '%s'.\n", tmpPathname);
+        ARLOGperror(NULL);
+        return (false);
+    }
+    bool ok = writeFully(fd, buf, len) && (!sync || fsync(fd) == 0);
+    if (close(fd) < 0) ok = false;
+    if (!ok || rename(tmpPathname, pathname) < 0) {
+        ARLOGe("Error writing calibration cache entry '%s'.\n", pathname);
+        ARLOGperror(NULL);
+        unlink(tmpPathname);
+        return (false);
+    }
+    ARLOGd("Cached calibration in '%s'.\n", pathname);
+    return (true);
+}
+
+bool calibrationCacheGet(const char *cacheDir, const CALIBRATION_CACHE_KEY_t *key, ARParam *param_out, ARdouble *err_avg_out, time_t *time_out)
+{
+    char keyStr[CACHE_KEY_LEN_MAX];
+    unsigned char buf[CACHE_HEADER_LEN + CACHE_KEY_LEN_MAX + PARAM_BUFFER_LEN_MAX + 1];
+    char pathname[MAXPATHLEN];
+    int keyLen;
+    FILE *fp;
+
+    if (!cacheDir || !param_out || (keyLen = keyString(key, keyStr, sizeof(keyStr))) < 0) return (false);
+    entryPathname(cacheDir, keyStr, keyLen, pathname, sizeof(pathname));
+    if (!(fp = fopen(pathname, "rb"))) return (false); // Not cached.
+    size_t len = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+
+    if (len < CACHE_HEADER_LEN || memcmp(buf, CACHE_MAGIC, 8) != 0 || get32(buf + 8) != CACHE_VERSION) {
+        ARLOGw("Ignoring unrecognised calibration cache entry '%s'.\n", pathname);
+        return (false);
+    }
+    uint32_t entryKeyLen = get32(buf + 12);
+    uint32_t paramLen = get32(buf + 16);
+    if (entryKeyLen > CACHE_KEY_LEN_MAX || paramLen > PARAM_BUFFER_LEN_MAX || len != CACHE_HEADER_LEN + entryKeyLen + paramLen || get32(buf + 20) != (uint32_t)crc32(0L, buf + 24, (uInt)(len - 24))) {
+        ARLOGw("Ignoring corrupt calibration cache entry '%s'.\n", pathname);
+        return (false);
+    }
+    if (entryKeyLen != (uint32_t)keyLen || memcmp(buf + CACHE_HEADER_LEN, keyStr, keyLen) != 0) return (false); // Hash collision.
+    if (!paramBufferRead(buf + CACHE_HEADER_LEN + keyLen, paramLen, param_out)) {
+        ARLOGw("Ignoring corrupt calibration cache entry '%s'.\n", pathname);
+        return (false);
+    }
+    if (err_avg_out) {
+        uint64_t errBits = get64(buf + 24);
+        double err;
+        memcpy(&err, &errBits, 8);
+        *err_avg_out = (ARdouble)err;
+    }
+    if (time_out) *time_out = (time_t)get64(buf + 32);
+    return (true);
+}
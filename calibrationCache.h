@@ -0,0 +1,77 @@
+/*
+ *  calibrationCache.h
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+#ifndef CALIBRATIONCACHE_H
+#define CALIBRATIONCACHE_H
+
+//
+// Local cache of calibrations, so that a camera already calibrated on this machine can reuse its
+// calibration after a short validation rather than a full calibration run.
+//
+// Each calibration is stored in its own file in the cache directory. The file is named by a 64-bit
+// hash of the key (device identifier, video size, focal length and distortion function version),
+// so a lookup is a single open(), regardless of how many calibrations are cached. The file holds
+// the full key, which is compared on lookup, and is replaced atomically on each put.
+//
+
+#include <ARX/AR/ar.h>
+#include <stdbool.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    const char *deviceID;       // AR_VIDEO_PARAM_DEVICEID.
+    int         width;
+    int         height;
+    const char *focalLength;    // In metres, formatted as for upload, e.g. "0.000" if unknown.
+    int         distFunctionVersion;
+} CALIBRATION_CACHE_KEY_t;
+
+// Store "param" and its average reprojection error under "key", replacing any earlier calibration.
+// The cache directory is created if necessary. If "sync" is false, the entry is not synced to storage
+// before it replaces the earlier one, so may be lost in a system crash (and is then ignored on lookup).
+bool calibrationCachePut(const char *cacheDir, const CALIBRATION_CACHE_KEY_t *key, const ARParam *param, ARdouble err_avg, const bool sync);
+
+// Look up "key". Returns false if there is no cached calibration for it. On success, if non-NULL,
+// err_avg_out and time_out receive the error and time at which the calibration was stored.
+bool calibrationCacheGet(const char *cacheDir, const CALIBRATION_CACHE_KEY_t *key, ARParam *param_out, ARdouble *err_avg_out, time_t *time_out);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // !CALIBRATIONCACHE_H
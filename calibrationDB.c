@@ -0,0 +1,738 @@
+/*
+ *  calibrationDB.c
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+#include "calibrationDB.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>  // flock()
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/param.h> // MAXPATHLEN
+#include <zlib.h>      // crc32()
+
+#include "paramBuffer.h"
+
+//
+// File layout. All values little-endian.
+//
+// Two header slots, at offsets 0 and 64. An update writes the slot not holding the current header, so
+// a header torn by a crash leaves the previous one in place. The valid slot with the higher
+// generation is current.
+//   0: magic "ARXCALDB"
+//   8: uint32 version
+//  12: uint32 CRC-32 of bytes 16-63
+//  16: uint64 generation
+//  24: uint64 offset of segment table, or 0 if there are no segments
+//  32: uint32 segment count
+//  36: uint32 reserved
+//  40: uint64 record count, over all segments
+//  48: 16 bytes reserved
+//
+// Segment table, written after each new segment:
+//   0: magic "ARXCALST"
+//   8: uint32 segment count
+//  12: uint32 CRC-32 of offsets
+//  16: uint64 segment offsets, oldest first
+//
+// Segment:
+//   0: magic "ARXCALSG"
+//   8: uint32 record count
+//  12: uint32 string pool length
+//  16: uint32 CRC-32 of records and string pool
+//  20: uint32 reserved
+//  24: uint64 generation in which the segment was written
+//  32: records, sorted by key
+//   -: string pool, nul-terminated strings
+//
+// Record:
+//   0: uint32 device identifier offset in string pool
+//   4: uint32 device identifier length
+//   8: uint32 focal length offset in string pool
+//  12: uint32 focal length length
+//  16: int32 width
+//  20: int32 height
+//  24: int32 distortion function version
+//  28: uint32 reserved
+//  32: uint64 time (seconds since the epoch)
+//  40: float64 mat[3][4]
+// 136: float64 dist_factor[17]
+//
+
+#define DB_MAGIC "ARXCALDB"
+#define DB_VERSION 1
+#define DB_HEADER_LEN 64
+#define DB_DATA_OFFSET (2*DB_HEADER_LEN)
+#define TABLE_MAGIC "ARXCALST"
+#define TABLE_HEADER_LEN 16
+#define SEGMENT_MAGIC "ARXCALSG"
+#define SEGMENT_HEADER_LEN 32
+#define RECORD_LEN 272
+#define RECORD_DIST_FACTOR_NUM 17
+#define KEY_STRING_LEN_MAX 1024
+
+#if AR_DIST_FACTOR_NUM_MAX > RECORD_DIST_FACTOR_NUM
+#  error "Calibration database records have too few distortion factors for this version of artoolkitX."
+#endif
+
+typedef struct {
+    uint64_t generation;
+    uint64_t tableOffset;
+    uint32_t segmentCount;
+    uint64_t recordCount;
+} DB_HEADER_t;
+
+typedef struct {
+    const unsigned char *header;
+    const unsigned char *records;
+    uint32_t             count;
+    const char          *pool;
+    uint32_t             poolLen;
+} SEGMENT_t;
+
+struct _CALIBRATION_DB {
+    unsigned char *map;
+    size_t         mapLen;
+    DB_HEADER_t    header;
+    SEGMENT_t     *segments;
+};
+
+// A key with its string lengths, as compared.
+typedef struct {
+    const char *deviceID;
+    size_t      deviceIDLen;
+    int         width;
+    int         height;
+    const char *focalLength;
+    size_t      focalLengthLen;
+} KEY_t;
+
+static void put32(unsigned char *p, uint32_t v) { int i; for (i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8*i)); }
+static void put64(unsigned char *p, uint64_t v) { int i; for (i = 0; i < 8; i++) p[i] = (unsigned char)(v >> (8*i)); }
+static uint32_t get32(const unsigned char *p) { uint32_t v = 0; int i; for (i = 3; i >= 0; i--) v = (v << 8) | p[i]; return (v); }
+static uint64_t get64(const unsigned char *p) { uint64_t v = 0; int i; for (i = 7; i >= 0; i--) v = (v << 8) | p[i]; return (v); }
+static void putDouble(unsigned char *p, double d) { uint64_t v; memcpy(&v, &d, 8); put64(p, v); }
+static double getDouble(const unsigned char *p) { uint64_t v = get64(p); double d; memcpy(&d, &v, 8); return (d); }
+
+static size_t align8(size_t n) { return ((n + 7) & ~(size_t)7); }
+
+//
+// Keys.
+//
+
+// Camera parameters filenames replace path separators in the device identifier, so treat them as equal.
+static int keyChar(char c)
+{
+    return (c == '/' || c == '\\' ? '_' : (unsigned char)c);
+}
+
+static int keyCompare(const KEY_t *a, const KEY_t *b)
+{
+    size_t i, len = (a->deviceIDLen < b->deviceIDLen ? a->deviceIDLen : b->deviceIDLen);
+    for (i = 0; i < len; i++) {
+        int d = keyChar(a->deviceID[i]) - keyChar(b->deviceID[i]);
+        if (d) return (d);
+    }
+    if (a->deviceIDLen != b->deviceIDLen) return (a->deviceIDLen < b->deviceIDLen ? -1 : 1);
+    if (a->width != b->width) return (a->width < b->width ? -1 : 1);
+    if (a->height != b->height) return (a->height < b->height ? -1 : 1);
+    len = (a->focalLengthLen < b->focalLengthLen ? a->focalLengthLen : b->focalLengthLen);
+    int d = memcmp(a->focalLength, b->focalLength, len);
+    if (d) return (d);
+    if (a->focalLengthLen != b->focalLengthLen) return (a->focalLengthLen < b->focalLengthLen ? -1 : 1);
+    return (0);
+}
+
+static bool keyMake(const CALIBRATION_DB_KEY_t *key, KEY_t *key_out)
+{
+    if (!key || !key->deviceID || !key->deviceID[0] || key->width <= 0 || key->height <= 0) return (false);
+    key_out->deviceID = key->deviceID;
+    key_out->deviceIDLen = strlen(key->deviceID);
+    key_out->width = key->width;
+    key_out->height = key->height;
+    key_out->focalLength = (key->focalLength ? key->focalLength : "0.000");
+    key_out->focalLengthLen = strlen(key_out->focalLength);
+    return (key_out->deviceIDLen < KEY_STRING_LEN_MAX && key_out->focalLengthLen < KEY_STRING_LEN_MAX);
+}
+
+// Get the key of a record, checking that its strings lie within the pool.
+static bool recordKey(const SEGMENT_t *seg, const unsigned char *rec, KEY_t *key_out)
+{
+    uint32_t idOffset = get32(rec), idLen = get32(rec + 4);
+    uint32_t focalOffset = get32(rec + 8), focalLen = get32(rec + 12);
+    if (idLen >= seg->poolLen || idOffset >= seg->poolLen - idLen || seg->pool[idOffset + idLen] != '\0') return (false);
+    if (focalLen >= seg->poolLen || focalOffset >= seg->poolLen - focalLen || seg->pool[focalOffset + focalLen] != '\0') return (false);
+    key_out->deviceID = seg->pool + idOffset;
+    key_out->deviceIDLen = idLen;
+    key_out->width = (int32_t)get32(rec + 16);
+    key_out->height = (int32_t)get32(rec + 20);
+    key_out->focalLength = seg->pool + focalOffset;
+    key_out->focalLengthLen = focalLen;
+    return (true);
+}
+
+static void recordParam(const unsigned char *rec, ARParam *param_out)
+{
+    int i, j;
+    param_out->xsize = (int32_t)get32(rec + 16);
+    param_out->ysize = (int32_t)get32(rec + 20);
+    param_out->dist_function_version = (int32_t)get32(rec + 24);
+    for (i = 0; i < 3; i++) for (j = 0; j < 4; j++) param_out->mat[i][j] = (ARdouble)getDouble(rec + 40 + 8*(i*4 + j));
+    for (i = 0; i < AR_DIST_FACTOR_NUM_MAX; i++) param_out->dist_factor[i] = (ARdouble)getDouble(rec + 136 + 8*i);
+}
+
+// Binary search of one segment. Returns the record, or NULL if the key is not present.
+static const unsigned char *segmentFind(const SEGMENT_t *seg, const KEY_t *key)
+{
+    uint32_t lo = 0, hi = seg->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo)/2;
+        const unsigned char *rec = seg->records + (size_t)mid*RECORD_LEN;
+        KEY_t recKey;
+        if (!recordKey(seg, rec, &recKey)) return (NULL); // Corrupt.
+        int d = keyCompare(key, &recKey);
+        if (!d) return (rec);
+        if (d < 0) hi = mid;
+        else lo = mid + 1;
+    }
+    return (NULL);
+}
+
+// Search segments from newest to oldest, not including segment "below" and older.
+static const unsigned char *dbFind(const CALIBRATION_DB_t *db, const KEY_t *key, int below)
+{
+    int i;
+    for (i = (int)db->header.segmentCount - 1; i > below; i--) {
+        const unsigned char *rec = segmentFind(&db->segments[i], key);
+        if (rec) return (rec);
+    }
+    return (NULL);
+}
+
+//
+// Reading.
+//
+
+static bool headerRead(const unsigned char *p, DB_HEADER_t *header_out)
+{
+    if (memcmp(p, DB_MAGIC, 8) != 0 || get32(p + 8) != DB_VERSION) return (false);
+    if (get32(p + 12) != (uint32_t)crc32(0L, p + 16, DB_HEADER_LEN - 16)) return (false);
+    header_out->generation = get64(p + 16);
+    header_out->tableOffset = get64(p + 24);
+    header_out->segmentCount = get32(p + 32);
+    header_out->recordCount = get64(p + 40);
+    return (true);
+}
+
+static void headerWrite(unsigned char *p, const DB_HEADER_t *header)
+{
+    memset(p, 0, DB_HEADER_LEN);
+    memcpy(p, DB_MAGIC, 8);
+    put32(p + 8, DB_VERSION);
+    put64(p + 16, header->generation);
+    put64(p + 24, header->tableOffset);
+    put32(p + 32, header->segmentCount);
+    put64(p + 40, header->recordCount);
+    put32(p + 12, (uint32_t)crc32(0L, p + 16, DB_HEADER_LEN - 16));
+}
+
+// Map the database open on "fd". An empty file is an empty database.
+static CALIBRATION_DB_t *dbMap(int fd)
+{
+    struct stat st;
+    CALIBRATION_DB_t *db;
+    uint32_t i;
+
+    if (fstat(fd, &st) < 0) {
+        ARLOGperror(NULL);
+        return (NULL);
+    }
+    if (!(db = (CALIBRATION_DB_t *)calloc(1, sizeof(CALIBRATION_DB_t)))) {
+        ARLOGe("Out of memory!\n");
+        return (NULL);
+    }
+    if (st.st_size == 0) return (db);
+
+    db->mapLen = (size_t)st.st_size;
+    if (db->mapLen < DB_DATA_OFFSET) goto bad;
+    db->map = (unsigned char *)mmap(NULL, db->mapLen, PROT_READ, MAP_SHARED, fd, 0);
+    if (db->map == MAP_FAILED) {
+        ARLOGperror(NULL);
+        db->map = NULL;
+        free(db);
+        return (NULL);
+    }
+
+    DB_HEADER_t h0, h1;
+    bool ok0 = headerRead(db->map, &h0);
+    bool ok1 = headerRead(db->map + DB_HEADER_LEN, &h1);
+    if (!ok0 && !ok1) goto bad;
+    db->header = (ok0 && (!ok1 || h0.generation > h1.generation) ? h0 : h1);
+    if (!db->header.segmentCount) return (db);
+
+    // Check the segment table and segment bounds, but not the segment contents.
+    const unsigned char *table = db->map + db->header.tableOffset;
+    uint32_t count = db->header.segmentCount;
+    if (db->header.tableOffset < DB_DATA_OFFSET || db->header.tableOffset > db->mapLen - TABLE_HEADER_LEN || count > (db->mapLen - db->header.tableOffset - TABLE_HEADER_LEN)/8) goto bad;
+    if (memcmp(table, TABLE_MAGIC, 8) != 0 || get32(table + 8) != count || get32(table + 12) != (uint32_t)crc32(0L, table + TABLE_HEADER_LEN, count*8)) goto bad;
+    if (!(db->segments = (SEGMENT_t *)calloc(count, sizeof(SEGMENT_t)))) {
+        ARLOGe("Out of memory!\n");
+        goto bad;
+    }
+    for (i = 0; i < count; i++) {
+        uint64_t offset = get64(table + TABLE_HEADER_LEN + 8*i);
+        if (offset < DB_DATA_OFFSET || offset > db->mapLen - SEGMENT_HEADER_LEN) goto bad;
+        const unsigned char *seg = db->map + offset;
+        if (memcmp(seg, SEGMENT_MAGIC, 8) != 0) goto bad;
+        uint64_t recordCount = get32(seg + 8), poolLen = get32(seg + 12);
+        if (SEGMENT_HEADER_LEN + recordCount*RECORD_LEN + poolLen > db->mapLen - offset) goto bad;
+        db->segments[i].header = seg;
+        db->segments[i].records = seg + SEGMENT_HEADER_LEN;
+        db->segments[i].count = (uint32_t)recordCount;
+        db->segments[i].pool = (const char *)(seg + SEGMENT_HEADER_LEN + recordCount*RECORD_LEN);
+        db->segments[i].poolLen = (uint32_t)poolLen;
+    }
+    return (db);
+
+bad:
+    ARLOGe("Error: not a calibration database, or database is damaged.\n");
+    calibrationDBClose(&db);
+    return (NULL);
+}
+
+CALIBRATION_DB_t *calibrationDBOpen(const char *path)
+{
+    int fd;
+    if (!path) return (NULL);
+    if ((fd = open(path, O_RDONLY)) == -1) {
+        ARLOGe("Error opening calibration database '%s'.\n", path);
+        ARLOGperror(NULL);
+        return (NULL);
+    }
+    CALIBRATION_DB_t *db = dbMap(fd);
+    close(fd); // The mapping remains.
+    return (db);
+}
+
+void calibrationDBClose(CALIBRATION_DB_t **db_p)
+{
+    if (!db_p || !*db_p) return;
+    if ((*db_p)->map) munmap((*db_p)->map, (*db_p)->mapLen);
+    free((*db_p)->segments);
+    free(*db_p);
+    *db_p = NULL;
+}
+
+bool calibrationDBLookup(const CALIBRATION_DB_t *db, const CALIBRATION_DB_KEY_t *key, ARParam *param_out, time_t *time_out)
+{
+    KEY_t k;
+    if (!db || !param_out || !keyMake(key, &k)) return (false);
+    const unsigned char *rec = dbFind(db, &k, -1);
+    if (!rec) return (false);
+    recordParam(rec, param_out);
+    if (time_out) *time_out = (time_t)get64(rec + 32);
+    return (true);
+}
+
+uint64_t calibrationDBGeneration(const CALIBRATION_DB_t *db)
+{
+    return (db ? db->header.generation : 0);
+}
+
+int calibrationDBSegmentCount(const CALIBRATION_DB_t *db)
+{
+    return (db ? (int)db->header.segmentCount : 0);
+}
+
+void calibrationDBForEach(const CALIBRATION_DB_t *db, bool (*callback)(const CALIBRATION_DB_ENTRY_t *entry, void *userdata), void *userdata)
+{
+    int s;
+    uint32_t i;
+    if (!db || !callback) return;
+    for (s = (int)db->header.segmentCount - 1; s >= 0; s--) {
+        const SEGMENT_t *seg = &db->segments[s];
+        for (i = 0; i < seg->count; i++) {
+            const unsigned char *rec = seg->records + (size_t)i*RECORD_LEN;
+            KEY_t k;
+            if (!recordKey(seg, rec, &k)) continue;
+            if (dbFind(db, &k, s)) continue; // Replaced in a newer segment.
+            CALIBRATION_DB_ENTRY_t entry;
+            entry.key.deviceID = k.deviceID;
+            entry.key.width = k.width;
+            entry.key.height = k.height;
+            entry.key.focalLength = k.focalLength;
+            recordParam(rec, &entry.param);
+            entry.time = (time_t)get64(rec + 32);
+            if (!callback(&entry, userdata)) return;
+        }
+    }
+}
+
+static bool countCallback(const CALIBRATION_DB_ENTRY_t *entry, void *userdata)
+{
+    (void)entry;
+    (*(int *)userdata)++;
+    return (true);
+}
+
+int calibrationDBEntryCount(const CALIBRATION_DB_t *db)
+{
+    int count = 0;
+    calibrationDBForEach(db, countCallback, &count);
+    return (count);
+}
+
+bool calibrationDBVerify(const CALIBRATION_DB_t *db)
+{
+    uint32_t s;
+    if (!db) return (false);
+    for (s = 0; s < db->header.segmentCount; s++) {
+        const SEGMENT_t *seg = &db->segments[s];
+        size_t len = (size_t)seg->count*RECORD_LEN + seg->poolLen;
+        if (get32(seg->header + 16) != (uint32_t)crc32(0L, seg->records, (uInt)len)) {
+            ARLOGe("Calibration database segment %u is damaged.\n", s);
+            return (false);
+        }
+    }
+    return (true);
+}
+
+//
+// Writing.
+//
+
+typedef struct {
+    KEY_t key;
+    int   index;
+} SORT_ENTRY_t;
+
+static int sortEntryCompare(const void *a, const void *b)
+{
+    const SORT_ENTRY_t *ea = (const SORT_ENTRY_t *)a, *eb = (const SORT_ENTRY_t *)b;
+    int d = keyCompare(&ea->key, &eb->key);
+    if (d) return (d);
+    return (ea->index - eb->index);
+}
+
+static bool writeFullyAt(int fd, const void *buf, size_t len, off_t offset)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+    while (len) {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return (false);
+        p += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return (true);
+}
+
+// Encode "entries" as a segment, sorted and with duplicate keys removed. The length is a multiple of 8.
+static unsigned char *segmentEncode(const CALIBRATION_DB_ENTRY_t *entries, int count, uint64_t generation, size_t *len_out, uint32_t *recordCount_out)
+{
+    SORT_ENTRY_t *sorted;
+    int i, j, n;
+    size_t poolLen = 0;
+
+    if (!(sorted = (SORT_ENTRY_t *)malloc(sizeof(SORT_ENTRY_t)*(count ? count : 1)))) {
+        ARLOGe("Out of memory!\n");
+        return (NULL);
+    }
+    for (i = 0; i < count; i++) {
+        if (!keyMake(&entries[i].key, &sorted[i].key) || !paramBufferLen(entries[i].param.dist_function_version)) {
+            ARLOGe("Error: invalid calibration database entry %d.\n", i);
+            free(sorted);
+            return (NULL);
+        }
+        sorted[i].index = i;
+    }
+    qsort(sorted, count, sizeof(SORT_ENTRY_t), sortEntryCompare);
+    // Keep the last of each run of equal keys.
+    for (i = 0, n = 0; i < count; i++) {
+        if (i + 1 < count && keyCompare(&sorted[i].key, &sorted[i + 1].key) == 0) continue;
+        sorted[n++] = sorted[i];
+        poolLen += sorted[i].key.deviceIDLen + 1 + sorted[i].key.focalLengthLen + 1;
+    }
+
+    size_t len = align8(SEGMENT_HEADER_LEN + (size_t)n*RECORD_LEN + poolLen);
+    unsigned char *buf = (unsigned char *)calloc(1, len);
+    if (!buf) {
+        ARLOGe("Out of memory!\n");
+        free(sorted);
+        return (NULL);
+    }
+    unsigned char *records = buf + SEGMENT_HEADER_LEN;
+    char *pool = (char *)(records + (size_t)n*RECORD_LEN);
+    uint32_t poolOffset = 0;
+    for (i = 0; i < n; i++) {
+        const CALIBRATION_DB_ENTRY_t *e = &entries[sorted[i].index];
+        const KEY_t *k = &sorted[i].key;
+        unsigned char *rec = records + (size_t)i*RECORD_LEN;
+
+        // Store the device identifier as it appears in camera parameters filenames.
+        put32(rec, poolOffset);
+        put32(rec + 4, (uint32_t)k->deviceIDLen);
+        for (j = 0; j < (int)k->deviceIDLen; j++) pool[poolOffset + j] = (char)keyChar(k->deviceID[j]);
+        poolOffset += (uint32_t)k->deviceIDLen + 1;
+        put32(rec + 8, poolOffset);
+        put32(rec + 12, (uint32_t)k->focalLengthLen);
+        memcpy(pool + poolOffset, k->focalLength, k->focalLengthLen);
+        poolOffset += (uint32_t)k->focalLengthLen + 1;
+
+        put32(rec + 16, (uint32_t)k->width);
+        put32(rec + 20, (uint32_t)k->height);
+        put32(rec + 24, (uint32_t)e->param.dist_function_version);
+        put64(rec + 32, (uint64_t)e->time);
+        for (j = 0; j < 12; j++) putDouble(rec + 40 + 8*j, (double)e->param.mat[j/4][j%4]);
+        for (j = 0; j < AR_DIST_FACTOR_NUM_MAX; j++) putDouble(rec + 136 + 8*j, (double)e->param.dist_factor[j]);
+    }
+    free(sorted);
+
+    memcpy(buf, SEGMENT_MAGIC, 8);
+    put32(buf + 8, (uint32_t)n);
+    put32(buf + 12, (uint32_t)poolLen);
+    put32(buf + 16, (uint32_t)crc32(0L, records, (uInt)((size_t)n*RECORD_LEN + poolLen)));
+    put64(buf + 24, generation);
+    *len_out = len;
+    *recordCount_out = (uint32_t)n;
+    return (buf);
+}
+
+static unsigned char *tableEncode(const CALIBRATION_DB_t *db, uint64_t newSegmentOffset, size_t *len_out)
+{
+    uint32_t i, count = db->header.segmentCount + 1;
+    size_t len = TABLE_HEADER_LEN + 8*(size_t)count;
+    unsigned char *buf = (unsigned char *)malloc(len);
+    if (!buf) {
+        ARLOGe("Out of memory!\n");
+        return (NULL);
+    }
+    memcpy(buf, TABLE_MAGIC, 8);
+    put32(buf + 8, count);
+    for (i = 0; i < db->header.segmentCount; i++) put64(buf + TABLE_HEADER_LEN + 8*i, (uint64_t)(db->segments[i].header - db->map));
+    put64(buf + TABLE_HEADER_LEN + 8*i, newSegmentOffset);
+    put32(buf + 12, (uint32_t)crc32(0L, buf + TABLE_HEADER_LEN, count*8));
+    *len_out = len;
+    return (buf);
+}
+
+// Append a segment to the database open on "fd" and commit it by writing the spare header slot.
+// Nothing an existing reader refers to is modified.
+static bool dbAppendSegment(int fd, const CALIBRATION_DB_t *db, const CALIBRATION_DB_ENTRY_t *entries, int count)
+{
+    struct stat st;
+    size_t segmentLen, tableLen;
+    uint32_t recordCount;
+    unsigned char headerBuf[DB_HEADER_LEN];
+    bool ok = false;
+
+    if (fstat(fd, &st) < 0) return (false);
+    uint64_t segmentOffset = align8(st.st_size < DB_DATA_OFFSET ? DB_DATA_OFFSET : (size_t)st.st_size);
+    DB_HEADER_t header = db->header;
+    header.generation++;
+
+    unsigned char *segment = segmentEncode(entries, count, header.generation, &segmentLen, &recordCount);
+    if (!segment) return (false);
+    unsigned char *table = tableEncode(db, segmentOffset, &tableLen);
+    if (!table) goto done;
+
+    header.tableOffset = segmentOffset + segmentLen;
+    header.segmentCount++;
+    header.recordCount += recordCount;
+    headerWrite(headerBuf, &header);
+
+    // Data must be durable before the header refers to it.
+    if (!writeFullyAt(fd, segment, segmentLen, (off_t)segmentOffset) || !writeFullyAt(fd, table, tableLen, (off_t)header.tableOffset) || fsync(fd) < 0) goto done;
+    if (!writeFullyAt(fd, headerBuf, DB_HEADER_LEN, (off_t)((header.generation % 2)*DB_HEADER_LEN)) || fsync(fd) < 0) goto done;
+    ok = true;
+
+done:
+    if (!ok) ARLOGperror(NULL);
+    free(segment);
+    free(table);
+    return (ok);
+}
+
+// Write a new database holding only "entries" to a temporary file, and rename it over "path".
+static bool dbWriteNew(const char *path, const CALIBRATION_DB_ENTRY_t *entries, int count, uint64_t generation)
+{
+    char tmpPathname[MAXPATHLEN];
+    CALIBRATION_DB_t empty;
+    int fd;
+
+    snprintf(tmpPathname, sizeof(tmpPathname), "%s.tmp", path);
+    if ((fd = open(tmpPathname, O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1) {
+        ARLOGe("Error creating calibration database '%s'.\n", tmpPathname);
+        ARLOGperror(NULL);
+        return (false);
+    }
+    memset(&empty, 0, sizeof(empty));
+    empty.header.generation = generation;
+    bool ok = dbAppendSegment(fd, &empty, entries, count);
+    if (close(fd) < 0) ok = false;
+    if (!ok || rename(tmpPathname, path) < 0) {
+        ARLOGe("Error writing calibration database '%s'.\n", path);
+        ARLOGperror(NULL);
+        unlink(tmpPathname);
+        return (false);
+    }
+    return (true);
+}
+
+// Open and lock the database file at "path", creating it if necessary. Because compaction replaces the
+// file, check after locking that "path" still refers to the file locked.
+static int dbLock(const char *path)
+{
+    struct stat st, pathSt;
+    int fd;
+    while (1) {
+        if ((fd = open(path, O_RDWR | O_CREAT, 0644)) == -1) break;
+        if (flock(fd, LOCK_EX) < 0 || fstat(fd, &st) < 0) {
+            close(fd);
+            break;
+        }
+        if (stat(path, &pathSt) == 0 && pathSt.st_dev == st.st_dev && pathSt.st_ino == st.st_ino) return (fd);
+        close(fd);
+    }
+    ARLOGe("Error opening calibration database '%s'.\n", path);
+    ARLOGperror(NULL);
+    return (-1);
+}
+
+typedef struct {
+    CALIBRATION_DB_ENTRY_t *entries;
+    int count;
+    int capacity;
+} ENTRY_LIST_t;
+
+static bool entryListAdd(ENTRY_LIST_t *list, const CALIBRATION_DB_ENTRY_t *entry)
+{
+    if (list->count == list->capacity) {
+        int capacity = (list->capacity ? list->capacity*2 : 64);
+        CALIBRATION_DB_ENTRY_t *entries = (CALIBRATION_DB_ENTRY_t *)realloc(list->entries, sizeof(CALIBRATION_DB_ENTRY_t)*capacity);
+        if (!entries) {
+            ARLOGe("Out of memory!\n");
+            return (false);
+        }
+        list->entries = entries;
+        list->capacity = capacity;
+    }
+    list->entries[list->count++] = *entry;
+    return (true);
+}
+
+// Strings in entries from a database point into its mapping, so remain valid until it is closed.
+static bool collectCallback(const CALIBRATION_DB_ENTRY_t *entry, void *userdata)
+{
+    return (entryListAdd((ENTRY_LIST_t *)userdata, entry));
+}
+
+// Rewrite the locked database "db" as a single segment, with "entries" added.
+static bool dbCompact(const char *path, const CALIBRATION_DB_t *db, const CALIBRATION_DB_ENTRY_t *entries, int count)
+{
+    ENTRY_LIST_t list = {NULL, 0, 0};
+    int i;
+    bool ok = false;
+
+    calibrationDBForEach(db, collectCallback, &list);
+    for (i = 0; i < count; i++) {
+        if (!entryListAdd(&list, &entries[i])) goto done;
+    }
+    ok = dbWriteNew(path, list.entries, list.count, db->header.generation);
+done:
+    free(list.entries);
+    return (ok);
+}
+
+bool calibrationDBAppend(const char *path, const CALIBRATION_DB_ENTRY_t *entries, int count)
+{
+    int fd;
+    CALIBRATION_DB_t *db;
+    bool ok;
+
+    if (!path || (count && !entries) || count < 0) return (false);
+    if ((fd = dbLock(path)) == -1) return (false);
+    if (!(db = dbMap(fd))) {
+        close(fd);
+        return (false);
+    }
+    if (db->header.segmentCount + 1 >= CALIBRATION_DB_SEGMENT_COUNT_MAX) ok = dbCompact(path, db, entries, count);
+    else ok = dbAppendSegment(fd, db, entries, count);
+    calibrationDBClose(&db);
+    close(fd);
+    return (ok);
+}
+
+bool calibrationDBBuild(const char *path, const CALIBRATION_DB_ENTRY_t *entries, int count)
+{
+    int fd;
+    CALIBRATION_DB_t *db;
+    uint64_t generation = 0;
+    bool ok;
+
+    if (!path || (count && !entries) || count < 0) return (false);
+    if ((fd = dbLock(path)) == -1) return (false);
+    // Continue the generation count of any existing database, so readers can tell it has changed.
+    if ((db = dbMap(fd))) {
+        generation = db->header.generation;
+        calibrationDBClose(&db);
+    }
+    ok = dbWriteNew(path, entries, count, generation);
+    close(fd);
+    return (ok);
+}
+
+bool calibrationDBCompact(const char *path)
+{
+    int fd;
+    CALIBRATION_DB_t *db;
+    bool ok;
+
+    if (!path) return (false);
+    if ((fd = dbLock(path)) == -1) return (false);
+    if (!(db = dbMap(fd))) {
+        close(fd);
+        return (false);
+    }
+    ok = dbCompact(path, db, NULL, 0);
+    calibrationDBClose(&db);
+    close(fd);
+    return (ok);
+}
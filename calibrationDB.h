@@ -0,0 +1,117 @@
+/*
+ *  calibrationDB.h
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+#ifndef CALIBRATIONDB_H
+#define CALIBRATIONDB_H
+
+//
+// A compact, memory-mappable database of camera calibrations, for serving large numbers of
+// calibrations to runtime clients without loading individual camera parameters files.
+//
+// Entries are keyed by device identifier, video size and focal length. The file is made up of one or
+// more segments, each holding fixed-length records sorted by key, so a lookup is a binary search of
+// each segment, with records read in place from the mapping. New entries are added by appending a
+// segment, rather than rewriting the file; entries in later segments replace those in earlier ones.
+// When the number of segments reaches CALIBRATION_DB_SEGMENT_COUNT_MAX, an append compacts the file
+// back into a single segment.
+//
+// Appends and compactions are serialised with an advisory lock on the file, and never modify data
+// that an open database refers to, so a database may be read while it is being updated. A reader sees
+// the database as it was when opened.
+//
+
+#include <ARX/AR/ar.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CALIBRATION_DB_SEGMENT_COUNT_MAX 16
+
+typedef struct {
+    const char *deviceID;       // As for AR_VIDEO_PARAM_DEVICEID. '/' and '\' match '_', as in camera parameters filenames.
+    int         width;
+    int         height;
+    const char *focalLength;    // In metres, formatted as for upload. NULL is equivalent to "0.000", i.e. unknown.
+} CALIBRATION_DB_KEY_t;
+
+typedef struct {
+    CALIBRATION_DB_KEY_t key;
+    ARParam              param;
+    time_t               time;  // Time the calibration was made, or 0 if not known.
+} CALIBRATION_DB_ENTRY_t;
+
+typedef struct _CALIBRATION_DB CALIBRATION_DB_t;
+
+// Open and map the database at "path" for lookups. Returns NULL in case of error.
+CALIBRATION_DB_t *calibrationDBOpen(const char *path);
+
+void calibrationDBClose(CALIBRATION_DB_t **db_p);
+
+// Look up "key". Returns false if the database has no calibration for it.
+bool calibrationDBLookup(const CALIBRATION_DB_t *db, const CALIBRATION_DB_KEY_t *key, ARParam *param_out, time_t *time_out);
+
+// Number of times the database had been written when it was opened.
+uint64_t calibrationDBGeneration(const CALIBRATION_DB_t *db);
+
+int calibrationDBSegmentCount(const CALIBRATION_DB_t *db);
+
+// Number of current (i.e. not replaced) entries. This requires a lookup per record, so isn't constant time.
+int calibrationDBEntryCount(const CALIBRATION_DB_t *db);
+
+// Call "callback" once for each current entry. The entry and the strings in its key are valid only for
+// the duration of the call. Iteration stops early if "callback" returns false.
+void calibrationDBForEach(const CALIBRATION_DB_t *db, bool (*callback)(const CALIBRATION_DB_ENTRY_t *entry, void *userdata), void *userdata);
+
+// Check the checksums of all segments. Lookups don't, so that opening a database is fast.
+bool calibrationDBVerify(const CALIBRATION_DB_t *db);
+
+// Add "entries" to the database at "path", creating it if it doesn't exist. Where "entries" contains the
+// same key more than once, the last one is used.
+bool calibrationDBAppend(const char *path, const CALIBRATION_DB_ENTRY_t *entries, int count);
+
+// Replace the database at "path" with one holding only "entries".
+bool calibrationDBBuild(const char *path, const CALIBRATION_DB_ENTRY_t *entries, int count);
+
+// Rewrite the database at "path" as a single segment, dropping replaced entries.
+bool calibrationDBCompact(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // !CALIBRATIONDB_H
@@ -0,0 +1,128 @@
+/*
+ *  calibrationUploadKey.c
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+#include "calibrationUploadKey.h"
+#include "paramBuffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+// Parameters of at least this magnitude are taken to be in pixels.
+#define PIXEL_VALUE_MIN 10.0
+
+static uint64_t fnv1a(uint64_t h, const void *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    while (len--) {
+        h ^= *p++;
+        h *= FNV_PRIME;
+    }
+    return (h);
+}
+
+static uint64_t hashString(uint64_t h, const char *s)
+{
+    return (fnv1a(h, s, strlen(s) + 1)); // Include the nul, so that adjacent strings can't run together.
+}
+
+static uint64_t hashInt(uint64_t h, int64_t i)
+{
+    unsigned char b[8];
+    int n;
+    for (n = 0; n < 8; n++) b[n] = (unsigned char)((uint64_t)i >> (8*n));
+    return (fnv1a(h, b, 8));
+}
+
+static uint64_t hashQuantised(uint64_t h, double v)
+{
+    double quantum = (fabs(v) >= PIXEL_VALUE_MIN ? CALIBRATION_UPLOAD_KEY_PIXEL_QUANTUM : CALIBRATION_UPLOAD_KEY_COEFF_QUANTUM);
+    return (hashInt(h, (int64_t)llround(v / quantum)));
+}
+
+bool calibrationUploadKey(const UPLOAD_JOURNAL_ENTRY_t *entry, uint64_t *key_out, double *rank_out)
+{
+    const char *device_id = NULL, *camera_index = "", *camera_face = "", *camera_width = NULL, *camera_height = NULL, *focal_length = NULL, *err_avg = NULL;
+    const unsigned char *paramBuf = NULL;
+    uint32_t paramBufLen = 0;
+    ARParam param;
+    int i, j;
+
+    if (!entry || !key_out || !rank_out) return (false);
+
+    for (i = 0; i < uploadJournalEntryFieldCount(entry); i++) {
+        const char *name, *filename;
+        const void *value;
+        uint32_t valueLen;
+        if (!uploadJournalEntryGetField(entry, i, &name, &filename, &value, &valueLen)) return (false);
+        if (filename) {
+            if (strcmp(name, "file") == 0) {
+                paramBuf = (const unsigned char *)value;
+                paramBufLen = valueLen;
+            }
+            continue;
+        }
+        if (strcmp(name, "device_id") == 0) device_id = (const char *)value;
+        else if (strcmp(name, "camera_index") == 0) camera_index = (const char *)value;
+        else if (strcmp(name, "camera_face") == 0) camera_face = (const char *)value;
+        else if (strcmp(name, "camera_width") == 0) camera_width = (const char *)value;
+        else if (strcmp(name, "camera_height") == 0) camera_height = (const char *)value;
+        else if (strcmp(name, "focal_length") == 0) focal_length = (const char *)value;
+        else if (strcmp(name, "err_avg") == 0) err_avg = (const char *)value;
+    }
+    if (!device_id || !camera_width || !camera_height || !focal_length || !err_avg || !paramBuf) return (false);
+    if (!paramBufferRead(paramBuf, paramBufLen, &param)) return (false);
+
+    uint64_t h = FNV_OFFSET_BASIS;
+    h = hashString(h, device_id);
+    h = hashString(h, camera_index);
+    h = hashString(h, camera_face);
+    h = hashInt(h, atoi(camera_width));
+    h = hashInt(h, atoi(camera_height));
+    h = hashInt(h, llround(strtod(focal_length, NULL) * 1000.0)); // Focal length in mm.
+    h = hashInt(h, param.xsize);
+    h = hashInt(h, param.ysize);
+    h = hashInt(h, param.dist_function_version);
+    for (i = 0; i < 3; i++) for (j = 0; j < 4; j++) h = hashQuantised(h, param.mat[i][j]);
+    int distFactorCount = (int)(paramBufLen/sizeof(double)) - 1 - 3*4; // Less xsize and ysize (one double's worth), and mat.
+    for (i = 0; i < distFactorCount; i++) h = hashQuantised(h, param.dist_factor[i]);
+
+    *key_out = (h ? h : 1); // 0 means "no key".
+    *rank_out = strtod(err_avg, NULL);
+    return (true);
+}
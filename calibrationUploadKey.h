@@ -0,0 +1,69 @@
+/*
+ *  calibrationUploadKey.h
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+#ifndef CALIBRATIONUPLOADKEY_H
+#define CALIBRATIONUPLOADKEY_H
+
+//
+// Deduplication key for calibration forms queued for upload.
+//
+// Two forms get the same key if they are for the same camera (device_id, camera_index and
+// camera_face), at the same resolution and focal length, and their camera parameters agree once
+// quantised. Pixel-valued parameters (focal lengths and principal point) are quantised to
+// CALIBRATION_UPLOAD_KEY_PIXEL_QUANTUM and the remainder (distortion coefficients and scale) to
+// CALIBRATION_UPLOAD_KEY_COEFF_QUANTUM, so repeated calibrations of one camera normally collide,
+// while those of different cameras don't. A form's rank is its err_avg.
+//
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "uploadJournal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CALIBRATION_UPLOAD_KEY_PIXEL_QUANTUM 2.0
+#define CALIBRATION_UPLOAD_KEY_COEFF_QUANTUM 0.01
+
+// Computes the key and rank for a calibration form. Returns false if the form lacks any of the
+// fields needed, in which case it should be queued without a key. Suitable for use with
+// fileUploaderSetDedupKeyFunction().
+bool calibrationUploadKey(const UPLOAD_JOURNAL_ENTRY_t *entry, uint64_t *key_out, double *rank_out);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // !CALIBRATIONUPLOADKEY_H
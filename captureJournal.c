@@ -0,0 +1,272 @@
+/*
+ *  captureJournal.c
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+#include "captureJournal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h> // crc32()
+#include <ARX/AR/ar.h>
+
+//
+// Journal layout. All values little-endian.
+//
+// Header:
+//   0: magic "ARXCALCJ"
+//   8: uint32 version
+//  12: uint32 header length, including key
+//  16: uint32 CRC-32 of bytes 20 to end of header
+//  20: int32 pattern type
+//  24: int32 pattern width
+//  28: int32 pattern height
+//  32: float32 pattern spacing
+//  36: int32 video width
+//  40: int32 video height
+//  44: uint32 key length
+//  48: key
+//
+// Record:
+//   0: uint32 type
+//   4: uint32 corner count, 0 for an uncapture
+//   8: uint32 CRC-32 of bytes 12 to end of record
+//  12: uint32 sequence number
+//  16: float32 corners, (x, y) pairs
+//
+
+#define JOURNAL_MAGIC "ARXCALCJ"
+#define JOURNAL_VERSION 1
+#define JOURNAL_HEADER_LEN 48
+#define JOURNAL_KEY_LEN_MAX 1024
+#define RECORD_HEADER_LEN 16
+#define RECORD_TYPE_CAPTURE 1
+#define RECORD_TYPE_UNCAPTURE 2
+
+struct _CAPTURE_JOURNAL {
+    int            fd;
+    uint32_t       headerLen;
+    int            cornerCount;
+    uint32_t       sequence;
+    unsigned char *record;       // Preallocated, so an append only has to fill and write it.
+    size_t         recordLen;
+    float         *resumeCorners; // Captures loaded at open.
+    int            resumeCount;
+};
+
+static void put32(unsigned char *p, uint32_t v) { int i; for (i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8*i)); }
+static uint32_t get32(const unsigned char *p) { uint32_t v = 0; int i; for (i = 3; i >= 0; i--) v = (v << 8) | p[i]; return (v); }
+static void putFloat(unsigned char *p, float f) { uint32_t v; memcpy(&v, &f, 4); put32(p, v); }
+static float getFloat(const unsigned char *p) { uint32_t v = get32(p); float f; memcpy(&f, &v, 4); return (f); }
+
+static bool writeFully(int fd, const void *buf, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return (false);
+        p += n;
+        len -= (size_t)n;
+    }
+    return (true);
+}
+
+static size_t headerMake(const CAPTURE_JOURNAL_CONFIG_t *config, unsigned char *buf)
+{
+    size_t keyLen = strlen(config->key);
+    memcpy(buf, JOURNAL_MAGIC, 8);
+    put32(buf + 8, JOURNAL_VERSION);
+    put32(buf + 12, (uint32_t)(JOURNAL_HEADER_LEN + keyLen));
+    put32(buf + 20, (uint32_t)config->patternType);
+    put32(buf + 24, (uint32_t)config->patternWidth);
+    put32(buf + 28, (uint32_t)config->patternHeight);
+    putFloat(buf + 32, config->patternSpacing);
+    put32(buf + 36, (uint32_t)config->videoWidth);
+    put32(buf + 40, (uint32_t)config->videoHeight);
+    put32(buf + 44, (uint32_t)keyLen);
+    memcpy(buf + JOURNAL_HEADER_LEN, config->key, keyLen);
+    put32(buf + 16, (uint32_t)crc32(0L, buf + 20, (uInt)(JOURNAL_HEADER_LEN + keyLen - 20)));
+    return (JOURNAL_HEADER_LEN + keyLen);
+}
+
+// Replay the records following the header in "buf", loading the captures still current. Returns the
+// length of the valid part of the journal.
+static size_t replay(CAPTURE_JOURNAL_t *journal, const unsigned char *buf, size_t len)
+{
+    size_t offset = journal->headerLen;
+    int i;
+
+    while (len - offset >= RECORD_HEADER_LEN) {
+        const unsigned char *r = buf + offset;
+        uint32_t type = get32(r), count = get32(r + 4);
+        if ((type == RECORD_TYPE_CAPTURE && count != (uint32_t)journal->cornerCount) || (type == RECORD_TYPE_UNCAPTURE && count != 0) || (type != RECORD_TYPE_CAPTURE && type != RECORD_TYPE_UNCAPTURE)) break;
+        size_t recordLen = RECORD_HEADER_LEN + (size_t)count*8;
+        if (len - offset < recordLen || get32(r + 8) != (uint32_t)crc32(0L, r + 12, (uInt)(recordLen - 12))) break;
+        if (type == RECORD_TYPE_CAPTURE) {
+            float *corners = (float *)realloc(journal->resumeCorners, sizeof(float)*2*journal->cornerCount*(journal->resumeCount + 1));
+            if (!corners) break;
+            journal->resumeCorners = corners;
+            corners += 2*journal->cornerCount*journal->resumeCount;
+            for (i = 0; i < 2*journal->cornerCount; i++) corners[i] = getFloat(r + RECORD_HEADER_LEN + 4*i);
+            journal->resumeCount++;
+        } else if (journal->resumeCount > 0) {
+            journal->resumeCount--;
+        }
+        journal->sequence = get32(r + 12) + 1;
+        offset += recordLen;
+    }
+    return (offset);
+}
+
+CAPTURE_JOURNAL_t *captureJournalOpen(const char *pathname, const CAPTURE_JOURNAL_CONFIG_t *config)
+{
+    CAPTURE_JOURNAL_t *journal;
+    unsigned char header[JOURNAL_HEADER_LEN + JOURNAL_KEY_LEN_MAX];
+    struct stat st;
+    size_t validLen = 0;
+
+    if (!pathname || !config || !config->key || strlen(config->key) >= JOURNAL_KEY_LEN_MAX || config->patternWidth <= 0 || config->patternHeight <= 0) return (NULL);
+
+    if (!(journal = (CAPTURE_JOURNAL_t *)calloc(1, sizeof(CAPTURE_JOURNAL_t)))) {
+        ARLOGe("Out of memory!\n");
+        return (NULL);
+    }
+    journal->cornerCount = config->patternWidth*config->patternHeight;
+    journal->headerLen = (uint32_t)headerMake(config, header);
+    journal->recordLen = RECORD_HEADER_LEN + (size_t)journal->cornerCount*8;
+    if (!(journal->record = (unsigned char *)malloc(journal->recordLen))) {
+        ARLOGe("Out of memory!\n");
+        free(journal);
+        return (NULL);
+    }
+
+    if ((journal->fd = open(pathname, O_RDWR | O_CREAT | O_APPEND, 0644)) == -1) {
+        ARLOGe("Error opening capture journal '%s'.\n", pathname);
+        ARLOGperror(NULL);
+        goto bad;
+    }
+
+    // If the journal is for this configuration, replay it.
+    if (fstat(journal->fd, &st) == 0 && (size_t)st.st_size >= journal->headerLen) {
+        size_t len = (size_t)st.st_size;
+        unsigned char *buf = (unsigned char *)malloc(len);
+        if (buf && pread(journal->fd, buf, len, 0) == (ssize_t)len && memcmp(buf, header, journal->headerLen) == 0) {
+            validLen = replay(journal, buf, len);
+            if (validLen < len) ARLOGw("Discarding %ld bytes of damaged capture journal '%s'.\n", (long)(len - validLen), pathname);
+        }
+        free(buf);
+    }
+    if (!validLen) {
+        if (ftruncate(journal->fd, 0) < 0 || !writeFully(journal->fd, header, journal->headerLen)) goto bad;
+    } else if (ftruncate(journal->fd, (off_t)validLen) < 0) {
+        goto bad;
+    }
+    if (journal->resumeCount) ARLOGi("Capture journal '%s' holds %d captures.\n", pathname, journal->resumeCount);
+    return (journal);
+
+bad:
+    ARLOGe("Error initialising capture journal '%s'.\n", pathname);
+    captureJournalClose(&journal);
+    return (NULL);
+}
+
+void captureJournalClose(CAPTURE_JOURNAL_t **journal_p)
+{
+    if (!journal_p || !*journal_p) return;
+    if ((*journal_p)->fd != -1) close((*journal_p)->fd);
+    free((*journal_p)->record);
+    free((*journal_p)->resumeCorners);
+    free(*journal_p);
+    *journal_p = NULL;
+}
+
+int captureJournalResumeCount(const CAPTURE_JOURNAL_t *journal)
+{
+    return (journal ? journal->resumeCount : 0);
+}
+
+const float *captureJournalResumeCapture(const CAPTURE_JOURNAL_t *journal, int index)
+{
+    if (!journal || index < 0 || index >= journal->resumeCount) return (NULL);
+    return (journal->resumeCorners + 2*journal->cornerCount*index);
+}
+
+static bool appendRecord(CAPTURE_JOURNAL_t *journal, uint32_t type, const float *corners, int cornerCount)
+{
+    unsigned char *r = journal->record;
+    size_t len = RECORD_HEADER_LEN + (size_t)cornerCount*8;
+    int i;
+
+    put32(r, type);
+    put32(r + 4, (uint32_t)cornerCount);
+    put32(r + 12, journal->sequence);
+    for (i = 0; i < 2*cornerCount; i++) putFloat(r + RECORD_HEADER_LEN + 4*i, corners[i]);
+    put32(r + 8, (uint32_t)crc32(0L, r + 12, (uInt)(len - 12)));
+    if (!writeFully(journal->fd, r, len)) {
+        ARLOGe("Error writing capture journal.\n");
+        ARLOGperror(NULL);
+        return (false);
+    }
+    journal->sequence++;
+    return (true);
+}
+
+bool captureJournalAddCapture(CAPTURE_JOURNAL_t *journal, const float *corners, int cornerCount)
+{
+    if (!journal || !corners || cornerCount != journal->cornerCount) return (false);
+    return (appendRecord(journal, RECORD_TYPE_CAPTURE, corners, cornerCount));
+}
+
+bool captureJournalUncapture(CAPTURE_JOURNAL_t *journal)
+{
+    if (!journal) return (false);
+    return (appendRecord(journal, RECORD_TYPE_UNCAPTURE, NULL, 0));
+}
+
+bool captureJournalUncaptureAll(CAPTURE_JOURNAL_t *journal)
+{
+    if (!journal) return (false);
+    if (ftruncate(journal->fd, (off_t)journal->headerLen) < 0) {
+        ARLOGe("Error truncating capture journal.\n");
+        ARLOGperror(NULL);
+        return (false);
+    }
+    return (true);
+}
@@ -0,0 +1,97 @@
+/*
+ *  captureJournal.h
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+#ifndef CAPTUREJOURNAL_H
+#define CAPTUREJOURNAL_H
+
+//
+// Journal of the captures in a calibration run in progress, so that a run interrupted by a crash or
+// camera disconnection can be resumed.
+//
+// Each capture and uncapture is appended to the journal as a single checksummed record, holding only
+// the corner positions, with a single write() call. Records are not synced to storage, so an append
+// costs only a few microseconds. They survive a crash of the app, but not necessarily of the system.
+// Uncapturing all captures truncates the journal.
+//
+// The journal begins with the configuration of the run: the pattern, video size and a key identifying
+// the camera. When a journal is opened with the same configuration, it is replayed, and the captures
+// it holds are available for resuming the run. Otherwise, it is started afresh. A torn or corrupt
+// final record, e.g. from a crash mid-write, is discarded.
+//
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    int         patternType;
+    int         patternWidth;
+    int         patternHeight;
+    float       patternSpacing;
+    int         videoWidth;
+    int         videoHeight;
+    const char *key;            // Identifies the camera, e.g. its AR_VIDEO_PARAM_DEVICEID.
+} CAPTURE_JOURNAL_CONFIG_t;
+
+typedef struct _CAPTURE_JOURNAL CAPTURE_JOURNAL_t;
+
+// Open the journal at "pathname" for a run with configuration "config", loading its captures if it is
+// for the same configuration. Returns NULL in case of error.
+CAPTURE_JOURNAL_t *captureJournalOpen(const char *pathname, const CAPTURE_JOURNAL_CONFIG_t *config);
+
+// Close the journal. Its contents remain for a later run to resume.
+void captureJournalClose(CAPTURE_JOURNAL_t **journal_p);
+
+// Number of captures loaded when the journal was opened.
+int captureJournalResumeCount(const CAPTURE_JOURNAL_t *journal);
+
+// Get the corners of loaded capture "index", oldest first, as patternWidth*patternHeight (x, y) pairs.
+const float *captureJournalResumeCapture(const CAPTURE_JOURNAL_t *journal, int index);
+
+// Append a capture. "cornerCount" must be patternWidth*patternHeight.
+bool captureJournalAddCapture(CAPTURE_JOURNAL_t *journal, const float *corners, int cornerCount);
+
+// Append the undoing of the most recent capture.
+bool captureJournalUncapture(CAPTURE_JOURNAL_t *journal);
+
+// Discard all captures.
+bool captureJournalUncaptureAll(CAPTURE_JOURNAL_t *journal);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // !CAPTUREJOURNAL_H
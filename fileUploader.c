@@ -37,31 +37,113 @@
 
 
 #include "fileUploader.h"
+#include "uploadQueue.h"
+#include "uploadJournal.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <stdbool.h>
+#include <time.h>
+#include <unistd.h> // getpid()
 #include <curl/curl.h>
-#include <dirent.h> // opendir(), readdir(), closedir()
+#include <zlib.h>
 #include <sys/param.h> // MAXPATHLEN
 #include <sys/stat.h> // struct stat, stat()
 #include <pthread.h>
+#include <stdatomic.h>
 
 #include <ARX/AR/ar.h>
-#include <ARX/ARUtil/thread_sub.h>
 #include <ARX/ARUtil/file_utils.h> // mkdir_p()
 
 
-static void *fileUploader(THREAD_HANDLE_T *threadHandle);
+#define RETRY_STATE_FILENAME "retry-state"
+#define JOURNAL_FILENAME "queue.journal"
+#define UPLOAD_RESPONSE_LEN_MAX 8192 // Enough for a batch response of FILE_UPLOADER_BATCH_ENTRIES_LIMIT lines.
+#define THROTTLE_TICK_MS 10 // Shortest pass through the transfer loop while bandwidth is capped.
+
+static void *fileUploader(void *arg);
+
+// Failure state for the upload destination. Persisted in the queue directory, so that backoff
+// survives restarts.
+typedef struct {
+    int                  failures; // Number of consecutive failed upload runs.
+    time_t               nextAttemptTime; // Wall-clock time of next automatic retry, valid if pending.
+    bool                 pending;
+} FILE_UPLOAD_RETRY_STATE_t;
+
+// One in-progress transfer. The easy handle is kept for the life of the upload thread.
+typedef struct {
+    FILE_UPLOAD_HANDLE_t *fileUploaderHandle;
+    CURL                *curlHandle;
+    struct curl_httppost *post;
+    bool                 busy;
+    bool                 batch;
+    int                  entryCount; // 1, unless this transfer is a batch.
+    uint64_t             entryIDs[FILE_UPLOADER_BATCH_ENTRIES_LIMIT];
+    UPLOAD_JOURNAL_ENTRY_t *entry; // Form data, referenced by the form until the transfer completes.
+    unsigned char       *batchBody; // Compressed batch body, if this transfer is a batch.
+    struct curl_slist   *batchHeaders;
+    char                 response[UPLOAD_RESPONSE_LEN_MAX];
+    size_t               responseLen;
+    char                 errorBuf[CURL_ERROR_SIZE];
+    struct timeval       startTime;
+    double               sentTime; // Seconds from startTime until the whole body was sent, or 0.0 if not yet.
+    double               responseTime; // Seconds from startTime until the first response header, or 0.0 if none yet.
+    curl_off_t           bytesSent; // Updated by uploadSlotProgress().
+    curl_off_t           bytesCounted; // Portion of bytesSent already taken from the bandwidth token bucket.
+    bool                 paused;
+} FILE_UPLOAD_SLOT_t;
+
+// Upload status, as shown to the user. Snapshots are published by the upload thread and read
+// without locking by the (single) thread calling fileUploaderStatusGet().
+typedef struct {
+    char                 message[UPLOAD_STATUS_BUFFER_LEN];
+    bool                 busy;
+    bool                 hide; // If true, the status is to be hidden from hideAtTime.
+    struct timeval       hideAtTime;
+} FILE_UPLOAD_STATUS_t;
+
+#define STATUS_INDEX_MASK 0x3u
+#define STATUS_FRESH 0x4u // Set in statusMiddle when the middle buffer holds an unread snapshot.
+
+// Growable buffer for assembling a batch body.
+typedef struct {
+    unsigned char       *buf;
+    size_t               len;
+    size_t               size;
+} BATCH_BUFFER_t;
 
 struct _FILE_UPLOAD_HANDLE {
     char                *queueDirPath;
     char                *formExtension;
     char                *formPostURL;
-    THREAD_HANDLE_T     *uploadThread;
-    char				 uploadStatus[UPLOAD_STATUS_BUFFER_LEN];
-    bool                 uploadStatusHide; // Should check whether time for upload status to be hidden has arrived.
-    struct timeval       uploadStatusHideAtTime; // The time at which upload status should be hidden.
+    UPLOAD_JOURNAL_t    *journal;
+    pthread_t            uploadThread;
+    bool                 uploadThreadRunning;
+    pthread_cond_t       wakeCond; // Signalled (with uploadStatusLock held) on tickle and quit.
+    bool                 wake; // Protected by uploadStatusLock.
+    bool                 quit; // Protected by uploadStatusLock.
+    atomic_bool          abortTransfers; // Set by fileUploaderFinal(). Checked by transfers in progress.
+    FILE_UPLOAD_RETRY_STATE_t retry; // Protected by uploadStatusLock.
+    unsigned int         randSeed; // Used only on the upload thread.
+    int                  maxConcurrentUploads; // Protected by uploadStatusLock.
+    char                *batchPostURL; // NULL if batching is off. Protected by uploadStatusLock.
+    size_t               maxBatchBytes; // Protected by uploadStatusLock.
+    long                 maxBytesPerSecond; // 0 if unlimited. Protected by uploadStatusLock.
+    FILE_UPLOAD_DEDUP_KEY_FUNCTION_t dedupKeyFunction; // Protected by uploadStatusLock.
+    FILE_UPLOAD_TRANSFER_METRICS_CALLBACK_t metricsCallback; // Protected by uploadStatusLock.
+    void                *metricsCallbackUserdata; // Protected by uploadStatusLock.
+    FILE_UPLOAD_STATUS_CALLBACK_t statusCallback; // Protected by uploadStatusLock.
+    void                *statusCallbackUserdata; // Protected by uploadStatusLock.
+    // Status snapshots are triple-buffered. The upload thread fills the back buffer and swaps it
+    // with the middle one, and the reader swaps the middle buffer with the front one if it holds
+    // a newer snapshot. Each side owns its own buffer outright, so neither ever waits for the other.
+    FILE_UPLOAD_STATUS_t status[3];
+    atomic_uint          statusMiddle; // Index of the middle buffer, plus STATUS_FRESH.
+    unsigned int         statusBack; // Used only on the upload thread.
+    unsigned int         statusFront; // Used only by fileUploaderStatusGet().
     struct timeval       uploadStatusHideAfterSecs; // The number of seconds the user asked  for the status to be shown.
     pthread_mutex_t      uploadStatusLock;
 };
@@ -88,38 +170,245 @@ static char *get_buff(char *buf, int n, FILE *fp, int skipblanks)
     return (ret);
 }
 
-static bool getNextFileInQueueWithExtension(const char *queueDir, const char *ext, char *buf, int len)
+static bool entryInFlight(const FILE_UPLOAD_SLOT_t *slots, int slotCount, uint64_t id)
 {
-	DIR *dirp ;
-	struct dirent *direntp;
+    int i, j;
 
-	if (!buf || !ext) return (false);
+    for (i = 0; i < slotCount; i++) {
+        if (!slots[i].busy) continue;
+        for (j = 0; j < slots[i].entryCount; j++) {
+            if (slots[i].entryIDs[j] == id) return (true);
+        }
+    }
+    return (false);
+}
 
-	if (!(dirp = opendir(queueDir))) {
-		ARLOGe("Error opening upload queue dir '%s'.\n", queueDir);
-        ARLOGperror(NULL);
-    	return (false);
-	}
+// Finds the oldest journal entry, starting from journal index "*index_p", which is not already being
+// uploaded by one of the slots. On return, "*index_p" holds the index following the entry found.
+// Only this thread removes entries from the journal, so indices are stable while a run is in progress.
+static bool getNextEntry(UPLOAD_JOURNAL_t *journal, const FILE_UPLOAD_SLOT_t *slots, int slotCount, int *index_p, uint64_t *id_out)
+{
+    uint64_t id;
 
-	*buf = '\0';
-	while ((direntp = readdir(dirp))) {
-		char *ext0 = arUtilGetFileExtensionFromPath(direntp->d_name, true);
-		if (!ext0) continue;
-		if (strcmp(ext0, ext) == 0) {
-    		free(ext0);
-    		snprintf(buf, len, "%s/%s", queueDir, direntp->d_name);
-    		break;
-		}
-		free(ext0);
-	}
+    while (uploadJournalGetID(journal, *index_p, &id)) {
+        (*index_p)++;
+        if (!entryInFlight(slots, slotCount, id)) {
+            *id_out = id;
+            return (true);
+        }
+    }
+    return (false);
+}
 
-	closedir(dirp);
+static void *readFile(const char *pathname, uint32_t *len_out)
+{
+    FILE *fp;
+    long len;
+    void *data = NULL;
+
+    if (!(fp = fopen(pathname, "rb"))) return (NULL);
+    if (fseek(fp, 0L, SEEK_END) == 0 && (len = ftell(fp)) >= 0 && fseek(fp, 0L, SEEK_SET) == 0) {
+        if ((data = malloc(len ? len : 1))) {
+            if (fread(data, 1, len, fp) != (size_t)len) {
+                free(data);
+                data = NULL;
+            } else {
+                *len_out = (uint32_t)len;
+            }
+        }
+    }
+    fclose(fp);
+    return (data);
+}
+
+// Appends "entry" to the journal, keyed by "keyFunction" if it is non-NULL and yields a key.
+static bool journalAppend(UPLOAD_JOURNAL_t *journal, const UPLOAD_JOURNAL_ENTRY_t *entry, FILE_UPLOAD_DEDUP_KEY_FUNCTION_t keyFunction)
+{
+    uint64_t key;
+    double rank;
 
-	return (*buf != '\0');
+    if (keyFunction && (*keyFunction)(entry, &key, &rank) && key) return (uploadJournalAppendKeyed(journal, entry, key, rank, NULL));
+    return (uploadJournalAppend(journal, entry, NULL));
+}
+
+// Moves an index file in the legacy format (and the file it references) into the journal.
+// The legacy files are removed only once the journal entry is synced.
+static bool importLegacyIndexFile(UPLOAD_JOURNAL_t *journal, FILE_UPLOAD_DEDUP_KEY_FUNCTION_t keyFunction, const char *indexPathname, char *buf, int bufLen)
+{
+    FILE *fp;
+    char filePathname[MAXPATHLEN] = "";
+    bool ok = true;
+
+    if (!(fp = fopen(indexPathname, "rb"))) {
+        ARLOGe("Error opening upload queue file '%s'.\n", indexPathname);
+        return (false);
+    }
+    UPLOAD_JOURNAL_ENTRY_t *entry = uploadJournalEntryNew();
+    if (!entry) {
+        fclose(fp);
+        return (false);
+    }
+
+    // Read lines from the file, creating a field for each one.
+    while (ok && get_buff(buf, bufLen, fp, true)) {
+
+        // Locate first comma on line, and split the string there.
+        char *commaPos;
+        if (!(commaPos = strchr(buf, ','))) continue; // No comma found! Skip line.
+        *commaPos = '\0';
+
+        if (strcmp(buf, "file") == 0) {
+            uint32_t len = 0;
+            void *data = readFile(commaPos + 1, &len);
+            if (!data) {
+                ARLOGe("Error reading file '%s' referenced from upload queue file '%s'.\n", commaPos + 1, indexPathname);
+                ok = false;
+            } else {
+                strncpy(filePathname, commaPos + 1, MAXPATHLEN - 1);
+                ok = uploadJournalEntryAddFile(entry, buf, arUtilGetFileNameFromPath(commaPos + 1), data, len);
+                free(data);
+            }
+        } else {
+            ok = uploadJournalEntryAddField(entry, buf, commaPos + 1);
+        }
+    }
+    fclose(fp);
+
+    if (ok && !uploadJournalEntryFieldCount(entry)) {
+        ARLOGe("Error reading form data from file '%s'.\n", indexPathname);
+        ok = false;
+    }
+    if (ok) ok = journalAppend(journal, entry, keyFunction) && uploadJournalSync(journal);
+    uploadJournalEntryFree(&entry);
+    if (!ok) return (false);
+
+    if (remove(indexPathname) < 0) {
+        ARLOGe("Error removing index file '%s' after import.\n", indexPathname);
+        ARLOGperror(NULL);
+    }
+    if (filePathname[0] && remove(filePathname) < 0) {
+        ARLOGe("Error removing file '%s' after import.\n", filePathname);
+        ARLOGperror(NULL);
+    }
+    return (true);
 }
 
 // ---------------------------------------------------------------------------
 
+// Read persisted retry state for this handle's destination. Absence of state is not an error.
+static void retryStateLoad(FILE_UPLOAD_HANDLE_t *handle)
+{
+    char path[MAXPATHLEN];
+    char buf[1024];
+    FILE *fp;
+
+    if (!handle->queueDirPath) return;
+    snprintf(path, sizeof(path), "%s/" RETRY_STATE_FILENAME, handle->queueDirPath);
+    if (!(fp = fopen(path, "rb"))) return;
+    while (get_buff(buf, sizeof(buf), fp, true)) {
+        long nextAttemptTime;
+        int failures, n = 0;
+        if (sscanf(buf, "%ld,%d,%n", &nextAttemptTime, &failures, &n) < 2 || !n) continue;
+        if (strcmp(buf + n, handle->formPostURL) != 0) continue;
+        handle->retry.failures = failures;
+        handle->retry.nextAttemptTime = (time_t)nextAttemptTime;
+        handle->retry.pending = (failures > 0);
+        break;
+    }
+    fclose(fp);
+}
+
+// Write retry state for this handle's destination, preserving state for other destinations.
+static void retryStateSave(FILE_UPLOAD_HANDLE_t *handle, FILE_UPLOAD_RETRY_STATE_t retry)
+{
+    char path[MAXPATHLEN];
+    char pathTemp[MAXPATHLEN];
+    char buf[1024];
+    FILE *fp, *fpTemp;
+
+    if (!handle->queueDirPath) return;
+    snprintf(path, sizeof(path), "%s/" RETRY_STATE_FILENAME, handle->queueDirPath);
+    snprintf(pathTemp, sizeof(pathTemp), "%s/" RETRY_STATE_FILENAME ".tmp", handle->queueDirPath);
+    if (!(fpTemp = fopen(pathTemp, "wb"))) {
+        ARLOGe("Error opening retry state file '%s'.\n", pathTemp);
+        ARLOGperror(NULL);
+        return;
+    }
+    if ((fp = fopen(path, "rb"))) {
+        while (get_buff(buf, sizeof(buf), fp, true)) {
+            long nextAttemptTime;
+            int failures, n = 0;
+            if (sscanf(buf, "%ld,%d,%n", &nextAttemptTime, &failures, &n) < 2 || !n) continue;
+            if (strcmp(buf + n, handle->formPostURL) == 0) continue;
+            fprintf(fpTemp, "%s\n", buf);
+        }
+        fclose(fp);
+    }
+    if (retry.pending) fprintf(fpTemp, "%ld,%d,%s\n", (long)retry.nextAttemptTime, retry.failures, handle->formPostURL);
+    if (fclose(fpTemp) != 0 || rename(pathTemp, path) < 0) {
+        ARLOGe("Error writing retry state file '%s'.\n", path);
+        ARLOGperror(NULL);
+    }
+}
+
+// Exponential backoff with jitter. The delay for the nth consecutive failure is drawn uniformly from
+// [d/2, d], where d = base * 2^(n-1), capped at the maximum.
+static int retryBackoffSecs(FILE_UPLOAD_HANDLE_t *handle, int failures)
+{
+    long d = FILE_UPLOADER_RETRY_BACKOFF_BASE_SECS;
+    while (--failures > 0 && d < FILE_UPLOADER_RETRY_BACKOFF_MAX_SECS) d *= 2;
+    if (d > FILE_UPLOADER_RETRY_BACKOFF_MAX_SECS) d = FILE_UPLOADER_RETRY_BACKOFF_MAX_SECS;
+    return ((int)(d/2 + rand_r(&(handle->randSeed)) % (d/2 + 1)));
+}
+
+// Publishes a new status snapshot. Call only on the upload thread.
+static void statusPublish(FILE_UPLOAD_HANDLE_t *handle, bool busy, bool hide, const char *format, ...)
+{
+    FILE_UPLOAD_STATUS_t *status = &(handle->status[handle->statusBack]);
+    va_list ap;
+
+    va_start(ap, format);
+    vsnprintf(status->message, UPLOAD_STATUS_BUFFER_LEN, format, ap);
+    va_end(ap);
+    status->busy = busy;
+    status->hide = hide;
+    if (hide) {
+        gettimeofday(&(status->hideAtTime), NULL);
+        timeradd(&(status->hideAtTime), &(handle->uploadStatusHideAfterSecs), &(status->hideAtTime));
+    }
+    handle->statusBack = atomic_exchange_explicit(&(handle->statusMiddle), handle->statusBack | STATUS_FRESH, memory_order_acq_rel) & STATUS_INDEX_MASK;
+
+    pthread_mutex_lock(&(handle->uploadStatusLock));
+    FILE_UPLOAD_STATUS_CALLBACK_t statusCallback = handle->statusCallback;
+    void *statusCallbackUserdata = handle->statusCallbackUserdata;
+    pthread_mutex_unlock(&(handle->uploadStatusLock));
+    if (statusCallback) (*statusCallback)(statusCallbackUserdata);
+}
+
+// Blocks until a tickle, a due retry, or quit. Returns false on quit, otherwise returns true.
+static bool fileUploaderWaitForWork(FILE_UPLOAD_HANDLE_t *handle)
+{
+    bool ret;
+
+    pthread_mutex_lock(&(handle->uploadStatusLock));
+    while (!handle->quit && !handle->wake) {
+        if (handle->retry.pending) {
+            struct timespec ts;
+            ts.tv_sec = handle->retry.nextAttemptTime;
+            ts.tv_nsec = 0;
+            if (time(NULL) >= ts.tv_sec) break;
+            pthread_cond_timedwait(&(handle->wakeCond), &(handle->uploadStatusLock), &ts);
+        } else {
+            pthread_cond_wait(&(handle->wakeCond), &(handle->uploadStatusLock));
+        }
+    }
+    ret = !handle->quit;
+    if (ret) handle->wake = false;
+    pthread_mutex_unlock(&(handle->uploadStatusLock));
+
+    return (ret);
+}
+
 FILE_UPLOAD_HANDLE_t *fileUploaderInit(const char *queueDirPath, const char *formExtension, const char *formPostURL, const float statusHideAfterSecs)
 {
     FILE_UPLOAD_HANDLE_t *handle;
@@ -140,6 +429,20 @@ FILE_UPLOAD_HANDLE_t *fileUploaderInit(const char *queueDirPath, const char *for
 	suseconds_t usecs = (suseconds_t)((statusHideAfterSecs - (float)secs)*1000000.0f);
     handle->uploadStatusHideAfterSecs.tv_sec = secs;
     handle->uploadStatusHideAfterSecs.tv_usec = usecs;
+    handle->statusFront = 0;
+    atomic_init(&(handle->statusMiddle), 1);
+    atomic_init(&(handle->abortTransfers), false);
+    handle->statusBack = 2;
+
+    handle->maxConcurrentUploads = FILE_UPLOADER_MAX_CONCURRENT_UPLOADS_DEFAULT;
+    handle->randSeed = (unsigned int)time(NULL) ^ (unsigned int)getpid();
+    retryStateLoad(handle);
+
+    if (queueDirPath) {
+        char journalPathname[MAXPATHLEN];
+        snprintf(journalPathname, sizeof(journalPathname), "%s/" JOURNAL_FILENAME, queueDirPath);
+        handle->journal = uploadJournalOpen(journalPathname); // Errors are reported by uploadJournalOpen().
+    }
 
     // CURL init.
     if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
@@ -149,9 +452,14 @@ FILE_UPLOAD_HANDLE_t *fileUploaderInit(const char *queueDirPath, const char *for
     }
     
     pthread_mutex_init(&(handle->uploadStatusLock), NULL);
+    pthread_cond_init(&(handle->wakeCond), NULL);
 
     // Spawn the file upload worker thread.
-    handle->uploadThread = threadInit(0, handle, fileUploader);
+    if (pthread_create(&(handle->uploadThread), NULL, fileUploader, handle) != 0) {
+        ARLOGe("Error creating file upload thread.\n");
+    } else {
+        handle->uploadThreadRunning = true;
+    }
     
     return (handle);
 }
@@ -160,11 +468,18 @@ void fileUploaderFinal(FILE_UPLOAD_HANDLE_t **handle_p)
 {
     if (!handle_p || !*handle_p) return;
     
-    if ((*handle_p)->uploadThread) {
-    	threadWaitQuit((*handle_p)->uploadThread);
-    	threadFree(&((*handle_p)->uploadThread));
+    if ((*handle_p)->uploadThreadRunning) {
+        // Abandon transfers in progress rather than waiting for them. Their entries remain queued.
+        atomic_store(&((*handle_p)->abortTransfers), true);
+        pthread_mutex_lock(&((*handle_p)->uploadStatusLock));
+        (*handle_p)->quit = true;
+        pthread_cond_signal(&((*handle_p)->wakeCond));
+        pthread_mutex_unlock(&((*handle_p)->uploadStatusLock));
+        pthread_join((*handle_p)->uploadThread, NULL);
     }
 
+    uploadJournalClose(&((*handle_p)->journal));
+    pthread_cond_destroy(&((*handle_p)->wakeCond));
     pthread_mutex_destroy(&((*handle_p)->uploadStatusLock));
 
     // CURL final.
@@ -173,6 +488,7 @@ void fileUploaderFinal(FILE_UPLOAD_HANDLE_t **handle_p)
     if ((*handle_p)->queueDirPath) free((*handle_p)->queueDirPath);
     free((*handle_p)->formExtension);
     free((*handle_p)->formPostURL);
+    free((*handle_p)->batchPostURL);
     free(*handle_p);
     *handle_p = NULL;
 }
@@ -200,243 +516,859 @@ bool fileUploaderCreateQueueDir(const char *queueDirPath)
     return (true);
 }
 
+bool fileUploaderSetMaxConcurrentUploads(FILE_UPLOAD_HANDLE_t *handle, int maxConcurrentUploads)
+{
+    if (!handle) return (false);
+    if (maxConcurrentUploads < 1 || maxConcurrentUploads > FILE_UPLOADER_MAX_CONCURRENT_UPLOADS_LIMIT) {
+        ARLOGe("Error: max concurrent uploads must be in range [1, %d].\n", FILE_UPLOADER_MAX_CONCURRENT_UPLOADS_LIMIT);
+        return (false);
+    }
+
+    pthread_mutex_lock(&(handle->uploadStatusLock));
+    handle->maxConcurrentUploads = maxConcurrentUploads;
+    pthread_mutex_unlock(&(handle->uploadStatusLock));
+
+    return (true);
+}
+
+bool fileUploaderSetBatchUploads(FILE_UPLOAD_HANDLE_t *handle, const char *batchPostURL, size_t maxBatchBytes)
+{
+    if (!handle) return (false);
+
+    char *url = NULL;
+    if (batchPostURL && !(url = strdup(batchPostURL))) {
+        ARLOGe("Out of memory!\n");
+        return (false);
+    }
+
+    pthread_mutex_lock(&(handle->uploadStatusLock));
+    free(handle->batchPostURL);
+    handle->batchPostURL = url;
+    handle->maxBatchBytes = (maxBatchBytes ? maxBatchBytes : FILE_UPLOADER_BATCH_BYTES_MAX_DEFAULT);
+    pthread_mutex_unlock(&(handle->uploadStatusLock));
+
+    return (true);
+}
+
+bool fileUploaderSetMaxBytesPerSecond(FILE_UPLOAD_HANDLE_t *handle, long maxBytesPerSecond)
+{
+    if (!handle) return (false);
+    if (maxBytesPerSecond < 0) {
+        ARLOGe("Error: max bytes per second must not be negative.\n");
+        return (false);
+    }
+
+    pthread_mutex_lock(&(handle->uploadStatusLock));
+    handle->maxBytesPerSecond = maxBytesPerSecond;
+    pthread_mutex_unlock(&(handle->uploadStatusLock));
+
+    return (true);
+}
+
+bool fileUploaderSetTransferMetricsCallback(FILE_UPLOAD_HANDLE_t *handle, FILE_UPLOAD_TRANSFER_METRICS_CALLBACK_t callback, void *userdata)
+{
+    if (!handle) return (false);
+
+    pthread_mutex_lock(&(handle->uploadStatusLock));
+    handle->metricsCallback = callback;
+    handle->metricsCallbackUserdata = userdata;
+    pthread_mutex_unlock(&(handle->uploadStatusLock));
+
+    return (true);
+}
+
+bool fileUploaderSetStatusCallback(FILE_UPLOAD_HANDLE_t *handle, FILE_UPLOAD_STATUS_CALLBACK_t callback, void *userdata)
+{
+    if (!handle) return (false);
+
+    pthread_mutex_lock(&(handle->uploadStatusLock));
+    handle->statusCallback = callback;
+    handle->statusCallbackUserdata = userdata;
+    pthread_mutex_unlock(&(handle->uploadStatusLock));
+
+    return (true);
+}
+
+bool fileUploaderSetDedupKeyFunction(FILE_UPLOAD_HANDLE_t *handle, FILE_UPLOAD_DEDUP_KEY_FUNCTION_t keyFunction)
+{
+    if (!handle) return (false);
+
+    pthread_mutex_lock(&(handle->uploadStatusLock));
+    handle->dedupKeyFunction = keyFunction;
+    pthread_mutex_unlock(&(handle->uploadStatusLock));
+
+    return (true);
+}
+
+bool fileUploaderEnqueue(FILE_UPLOAD_HANDLE_t *handle, const UPLOAD_JOURNAL_ENTRY_t *entry)
+{
+    if (!handle || !entry) return (false);
+    if (!handle->journal) {
+        ARLOGe("Error: upload journal not available.\n");
+        return (false);
+    }
+    pthread_mutex_lock(&(handle->uploadStatusLock));
+    FILE_UPLOAD_DEDUP_KEY_FUNCTION_t keyFunction = handle->dedupKeyFunction;
+    pthread_mutex_unlock(&(handle->uploadStatusLock));
+    if (!journalAppend(handle->journal, entry, keyFunction)) return (false);
+    return (fileUploaderTickle(handle));
+}
+
+bool fileUploaderSync(FILE_UPLOAD_HANDLE_t *handle)
+{
+    if (!handle || !handle->journal) return (false);
+    return (uploadJournalSync(handle->journal));
+}
+
 bool fileUploaderTickle(FILE_UPLOAD_HANDLE_t *handle)
 {
 	if (!handle) return (false);
 
-	threadStartSignal(handle->uploadThread);
+	// Wakes the uploader immediately, even if a retry is scheduled for later.
+	pthread_mutex_lock(&(handle->uploadStatusLock));
+	handle->wake = true;
+	pthread_cond_signal(&(handle->wakeCond));
+	pthread_mutex_unlock(&(handle->uploadStatusLock));
 
 	return (true);
 }
 
-static void *fileUploader(THREAD_HANDLE_T *threadHandle)
+int fileUploaderPendingCount(FILE_UPLOAD_HANDLE_t *handle)
+{
+    if (!handle || !handle->journal) return (-1);
+    return (uploadJournalCount(handle->journal));
+}
+
+static double secondsSince(const struct timeval *start)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return ((double)(now.tv_sec - start->tv_sec) + (double)(now.tv_usec - start->tv_usec)*1.0e-6);
+}
+
+// Called by libcurl at least once a second during each transfer, and whenever data is sent.
+// Records progress for bandwidth accounting and metrics. Returning non-zero aborts the transfer.
+static int uploadSlotProgress(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+    FILE_UPLOAD_SLOT_t *slot = (FILE_UPLOAD_SLOT_t *)clientp;
+    (void)dltotal;
+    (void)dlnow;
+    slot->bytesSent = ulnow;
+    if (ultotal > 0 && ulnow == ultotal && slot->sentTime == 0.0) slot->sentTime = secondsSince(&(slot->startTime));
+    return (atomic_load(&(slot->fileUploaderHandle->abortTransfers)) ? 1 : 0);
+}
+
+// Notes the arrival of the response, for metrics. (CURLINFO_STARTTRANSFER_TIME can't be used
+// for this, as for a POST some libcurl versions set it when sending starts.) Headers arriving
+// before the body has been sent (i.e. "100 Continue") are not the response.
+static size_t uploadSlotHeader(char *buffer, size_t size, size_t nitems, void *userdata)
+{
+    FILE_UPLOAD_SLOT_t *slot = (FILE_UPLOAD_SLOT_t *)userdata;
+    (void)buffer;
+    if (slot->sentTime > 0.0 && slot->responseTime == 0.0) slot->responseTime = secondsSince(&(slot->startTime));
+    return (size * nitems);
+}
+
+// Keeps the start of the server's response, which carries the per-form results of a batch.
+static size_t uploadSlotWrite(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    FILE_UPLOAD_SLOT_t *slot = (FILE_UPLOAD_SLOT_t *)userdata;
+    size_t len = size * nmemb;
+    size_t n = MIN(len, UPLOAD_RESPONSE_LEN_MAX - 1 - slot->responseLen);
+    memcpy(slot->response + slot->responseLen, ptr, n);
+    slot->responseLen += n;
+    slot->response[slot->responseLen] = '\0';
+    return (len);
+}
+
+// Pauses or resumes sending on all transfers in progress.
+static void uploadSlotsPause(FILE_UPLOAD_SLOT_t *slots, int slotCount, bool pause)
+{
+    int i;
+
+    for (i = 0; i < slotCount; i++) {
+        if (!slots[i].busy || slots[i].paused == pause) continue;
+        curl_easy_pause(slots[i].curlHandle, (pause ? CURLPAUSE_SEND : CURLPAUSE_CONT));
+        slots[i].paused = pause;
+    }
+}
+
+// Marks the transfer as started, for metrics and bandwidth accounting.
+static void uploadSlotBegin(FILE_UPLOAD_SLOT_t *slot)
+{
+    gettimeofday(&(slot->startTime), NULL);
+    slot->sentTime = slot->responseTime = 0.0;
+    slot->bytesSent = slot->bytesCounted = 0;
+    slot->paused = false;
+}
+
+// Fills "m" with the timing breakdown of the completed transfer in "slot". libcurl reports each
+// time as the total from the start of the transfer, so phases are found by differences. The ends
+// of sending and of waiting for the server are taken from the slot's own timestamps, which are
+// measured from slightly earlier than libcurl's, so are clamped.
+static void uploadSlotMetrics(FILE_UPLOAD_SLOT_t *slot, CURLcode result, FILE_UPLOAD_TRANSFER_METRICS_t *m)
+{
+    double nameLookup = 0.0, connect = 0.0, appConnect = 0.0, preTransfer = 0.0, total = 0.0;
+    curl_off_t sizeUpload = 0;
+
+    curl_easy_getinfo(slot->curlHandle, CURLINFO_NAMELOOKUP_TIME, &nameLookup);
+    curl_easy_getinfo(slot->curlHandle, CURLINFO_CONNECT_TIME, &connect);
+    curl_easy_getinfo(slot->curlHandle, CURLINFO_APPCONNECT_TIME, &appConnect);
+    curl_easy_getinfo(slot->curlHandle, CURLINFO_PRETRANSFER_TIME, &preTransfer);
+    curl_easy_getinfo(slot->curlHandle, CURLINFO_TOTAL_TIME, &total);
+    curl_easy_getinfo(slot->curlHandle, CURLINFO_SIZE_UPLOAD_T, &sizeUpload);
+
+    memset(m, 0, sizeof(*m));
+    m->forms = slot->entryCount;
+    m->curlResult = (int)result;
+    curl_easy_getinfo(slot->curlHandle, CURLINFO_RESPONSE_CODE, &(m->httpStatus));
+    m->bytesSent = (long)sizeUpload;
+    m->dnsTime = nameLookup;
+    m->connectTime = MAX(connect - nameLookup, 0.0);
+    if (appConnect > 0.0) m->tlsTime = MAX(appConnect - connect, 0.0);
+    double response = (slot->responseTime > 0.0 ? MIN(slot->responseTime, total) : total);
+    double sent = (slot->sentTime > 0.0 ? MIN(slot->sentTime, response) : response);
+    if (sent > preTransfer) m->transferTime = sent - preTransfer;
+    m->serverTime = response - sent;
+    m->totalTime = total;
+}
+
+static void uploadSlotFinish(CURLM *curlMultiHandle, FILE_UPLOAD_SLOT_t *slot)
+{
+    curl_multi_remove_handle(curlMultiHandle, slot->curlHandle);
+    if (slot->paused) {
+        curl_easy_pause(slot->curlHandle, CURLPAUSE_CONT); // Don't leave the next transfer on this handle paused.
+        slot->paused = false;
+    }
+    curl_formfree(slot->post); // Free the form resources, regardless of outcome.
+    slot->post = NULL;
+    uploadJournalEntryFree(&(slot->entry));
+    free(slot->batchBody);
+    slot->batchBody = NULL;
+    curl_slist_free_all(slot->batchHeaders);
+    slot->batchHeaders = NULL;
+    slot->busy = false;
+}
+
+static bool batchAppend(BATCH_BUFFER_t *b, const void *data, size_t len)
+{
+    if (b->len + len > b->size) {
+        size_t size = MAX(b->size * 2, b->len + len);
+        unsigned char *buf = (unsigned char *)realloc(b->buf, size);
+        if (!buf) {
+            ARLOGe("Out of memory!\n");
+            return (false);
+        }
+        b->buf = buf;
+        b->size = size;
+    }
+    memcpy(b->buf + b->len, data, len);
+    b->len += len;
+    return (true);
+}
+
+// Appends the fields of "entry" as multipart parts, with names prefixed by "item".
+static bool batchAppendEntry(BATCH_BUFFER_t *b, const char *boundary, int item, const UPLOAD_JOURNAL_ENTRY_t *entry)
+{
+    char header[1024];
+    int i, len;
+
+    for (i = 0; i < uploadJournalEntryFieldCount(entry); i++) {
+        const char *name, *filename;
+        const void *value;
+        uint32_t valueLen;
+        if (!uploadJournalEntryGetField(entry, i, &name, &filename, &value, &valueLen)) return (false);
+        if (filename) {
+            len = snprintf(header, sizeof(header), "--%s\r\nContent-Disposition: form-data; name=\"%d.%s\"; filename=\"%s\"\r\nContent-Type: application/octet-stream\r\n\r\n", boundary, item, name, filename);
+        } else {
+            len = snprintf(header, sizeof(header), "--%s\r\nContent-Disposition: form-data; name=\"%d.%s\"\r\n\r\n", boundary, item, name);
+        }
+        if (len < 0 || len >= (int)sizeof(header)) {
+            ARLOGe("Error: form field name too long.\n");
+            return (false);
+        }
+        if (!batchAppend(b, header, len) || !batchAppend(b, value, valueLen) || !batchAppend(b, "\r\n", 2)) return (false);
+    }
+    return (true);
+}
+
+// gzip-compress "len" bytes of "in". Returns a malloc'ed buffer, or NULL in case of error.
+static unsigned char *gzipBuffer(const unsigned char *in, size_t len, size_t *len_out)
+{
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) { // windowBits + 16 selects gzip framing.
+        ARLOGe("Error initialising zlib.\n");
+        return (NULL);
+    }
+    uLong outSize = deflateBound(&strm, (uLong)len) + 32; // deflateBound() doesn't allow for the gzip header.
+    unsigned char *out = (unsigned char *)malloc(outSize);
+    if (!out) {
+        ARLOGe("Out of memory!\n");
+        deflateEnd(&strm);
+        return (NULL);
+    }
+    strm.next_in = (Bytef *)in;
+    strm.avail_in = (uInt)len;
+    strm.next_out = out;
+    strm.avail_out = (uInt)outSize;
+    if (deflate(&strm, Z_FINISH) != Z_STREAM_END) {
+        ARLOGe("Error compressing upload batch.\n");
+        free(out);
+        deflateEnd(&strm);
+        return (NULL);
+    }
+    *len_out = strm.total_out;
+    deflateEnd(&strm);
+    return (out);
+}
+
+// Reads the form for journal entry "slot->entryIDs[0]" and adds the transfer to the multi handle.
+// Returns 0 if the transfer was started, or an error code as for the run.
+static int uploadSlotStart(FILE_UPLOAD_HANDLE_t *fileUploaderHandle, CURLM *curlMultiHandle, FILE_UPLOAD_SLOT_t *slot)
+{
+    CURLcode curlErr;
+    CURLMcode curlMErr;
+    int i;
+
+    if (!(slot->entry = uploadJournalRead(fileUploaderHandle->journal, slot->entryIDs[0]))) {
+        return (-1);
+    }
+
+    // Build the form. File contents are referenced from the entry rather than copied.
+    struct curl_httppost* last = NULL;
+    slot->post = NULL;
+    for (i = 0; i < uploadJournalEntryFieldCount(slot->entry); i++) {
+        const char *name, *filename;
+        const void *value;
+        uint32_t valueLen;
+        if (!uploadJournalEntryGetField(slot->entry, i, &name, &filename, &value, &valueLen)) break;
+        if (filename) {
+            curl_formadd(&(slot->post), &last, CURLFORM_COPYNAME, name, CURLFORM_BUFFER, filename, CURLFORM_BUFFERPTR, value, CURLFORM_BUFFERLENGTH, (long)valueLen, CURLFORM_CONTENTTYPE, "application/octet-stream", CURLFORM_END);
+        } else {
+            curl_formadd(&(slot->post), &last, CURLFORM_COPYNAME, name, CURLFORM_COPYCONTENTS, (const char *)value, CURLFORM_CONTENTSLENGTH, (long)valueLen, CURLFORM_END);
+        }
+    }
+
+    // Check that we read at least 1 form parameter.
+    if (!slot->post) {
+        ARLOGe("Error reading CURL form data from upload journal entry %llu.\n", (unsigned long long)slot->entryIDs[0]);
+        uploadJournalEntryFree(&(slot->entry));
+        return (-1);
+    }
+
+    curlErr = curl_easy_setopt(slot->curlHandle, CURLOPT_URL, fileUploaderHandle->formPostURL);
+    if (curlErr != CURLE_OK) {
+        ARLOGe("Error setting CURL URL: %s (%d)\n", curl_easy_strerror(curlErr), curlErr);
+        curl_formfree(slot->post);
+        slot->post = NULL;
+        uploadJournalEntryFree(&(slot->entry));
+        return (-1);
+    }
+
+    curlErr = curl_easy_setopt(slot->curlHandle, CURLOPT_HTTPPOST, slot->post); // Automatically sets CURLOPT_NOBODY to 0.
+    if (curlErr != CURLE_OK) {
+        ARLOGe("Error setting CURL form data: %s (%d)\n", curl_easy_strerror(curlErr), curlErr);
+        curl_formfree(slot->post);
+        slot->post = NULL;
+        uploadJournalEntryFree(&(slot->entry));
+        return (-1);
+    }
+    curl_easy_setopt(slot->curlHandle, CURLOPT_HTTPHEADER, NULL); // In case the handle last carried a batch.
+    slot->batch = false;
+
+    *(slot->errorBuf) = '\0';
+    slot->responseLen = 0;
+    uploadSlotBegin(slot);
+    curlMErr = curl_multi_add_handle(curlMultiHandle, slot->curlHandle);
+    if (curlMErr != CURLM_OK) {
+        ARLOGe("Error adding CURL transfer: %s (%d)\n", curl_multi_strerror(curlMErr), curlMErr);
+        curl_formfree(slot->post);
+        slot->post = NULL;
+        uploadJournalEntryFree(&(slot->entry));
+        return (-1);
+    }
+
+    slot->busy = true;
+    return (0);
+}
+
+// Packs journal entry "slot->entryIDs[0]" and as many following entries as fit within "maxBatchBytes"
+// into a compressed batch body, and adds the transfer to the multi handle. Entries are looked for
+// from journal index "index" onwards. Returns 0 if the transfer was started, or an error code as for the run.
+static int uploadSlotStartBatch(FILE_UPLOAD_HANDLE_t *fileUploaderHandle, CURLM *curlMultiHandle, FILE_UPLOAD_SLOT_t *slot, const FILE_UPLOAD_SLOT_t *slots, int slotCount, int index, const char *batchPostURL, size_t maxBatchBytes)
+{
+    BATCH_BUFFER_t b = {NULL, 0, 0};
+    char boundary[41];
+    char header[128];
+    char countStr[12];
+    UPLOAD_JOURNAL_ENTRY_t *entry;
+    size_t compressedLen;
+    uint64_t id;
+    CURLcode curlErr;
+    CURLMcode curlMErr;
+    int i, len;
+
+    // Random boundary, long enough that a collision with the parameter file contents is not a practical concern.
+    for (i = 0; i < (int)sizeof(boundary) - 1; i++) boundary[i] = "0123456789abcdefghijklmnopqrstuvwxyz"[rand_r(&(fileUploaderHandle->randSeed)) % 36];
+    boundary[i] = '\0';
+
+    // The count field is written last (below), once the number of entries is known, so reserve its space now.
+    len = snprintf(header, sizeof(header), "--%s\r\nContent-Disposition: form-data; name=\"count\"\r\n\r\n", boundary);
+    if (!batchAppend(&b, header, len) || !batchAppend(&b, "          \r\n", 12)) goto bail;
+    size_t countOffset = len;
+
+    slot->entryCount = 0;
+    id = slot->entryIDs[0];
+    do {
+        if (!(entry = uploadJournalRead(fileUploaderHandle->journal, id))) {
+            if (!slot->entryCount) goto bail;
+            break;
+        }
+        size_t mark = b.len;
+        bool ok = batchAppendEntry(&b, boundary, slot->entryCount, entry);
+        uploadJournalEntryFree(&entry);
+        if (!ok) goto bail;
+        if (b.len > maxBatchBytes && slot->entryCount > 0) {
+            b.len = mark; // Doesn't fit. It will go in the next batch.
+            break;
+        }
+        slot->entryIDs[slot->entryCount++] = id;
+    } while (slot->entryCount < FILE_UPLOADER_BATCH_ENTRIES_LIMIT && getNextEntry(fileUploaderHandle->journal, slots, slotCount, &index, &id));
+
+    len = snprintf(countStr, sizeof(countStr), "%d", slot->entryCount);
+    memcpy(b.buf + countOffset, countStr, len);
+    len = snprintf(header, sizeof(header), "--%s--\r\n", boundary);
+    if (!batchAppend(&b, header, len)) goto bail;
+
+    if (!(slot->batchBody = gzipBuffer(b.buf, b.len, &compressedLen))) goto bail;
+    ARLOGd("Upload batch of %d forms, %zu bytes, %zu compressed.\n", slot->entryCount, b.len, compressedLen);
+    free(b.buf);
+    b.buf = NULL;
+
+    snprintf(header, sizeof(header), "Content-Type: multipart/form-data; boundary=%s", boundary);
+    slot->batchHeaders = curl_slist_append(NULL, header);
+    if (slot->batchHeaders) slot->batchHeaders = curl_slist_append(slot->batchHeaders, "Content-Encoding: gzip");
+    if (!slot->batchHeaders) {
+        ARLOGe("Out of memory!\n");
+        goto bail;
+    }
+
+    curlErr = curl_easy_setopt(slot->curlHandle, CURLOPT_URL, batchPostURL);
+    if (curlErr == CURLE_OK) curlErr = curl_easy_setopt(slot->curlHandle, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)compressedLen);
+    if (curlErr == CURLE_OK) curlErr = curl_easy_setopt(slot->curlHandle, CURLOPT_POSTFIELDS, slot->batchBody); // Supersedes any previous CURLOPT_HTTPPOST.
+    if (curlErr == CURLE_OK) curlErr = curl_easy_setopt(slot->curlHandle, CURLOPT_HTTPHEADER, slot->batchHeaders);
+    if (curlErr != CURLE_OK) {
+        ARLOGe("Error setting CURL batch options: %s (%d)\n", curl_easy_strerror(curlErr), curlErr);
+        goto bail;
+    }
+
+    *(slot->errorBuf) = '\0';
+    slot->responseLen = 0;
+    uploadSlotBegin(slot);
+    curlMErr = curl_multi_add_handle(curlMultiHandle, slot->curlHandle);
+    if (curlMErr != CURLM_OK) {
+        ARLOGe("Error adding CURL transfer: %s (%d)\n", curl_multi_strerror(curlMErr), curlMErr);
+        goto bail;
+    }
+
+    slot->batch = true;
+    slot->busy = true;
+    return (0);
+
+bail:
+    free(b.buf);
+    free(slot->batchBody);
+    slot->batchBody = NULL;
+    curl_slist_free_all(slot->batchHeaders);
+    slot->batchHeaders = NULL;
+    slot->entryCount = 0;
+    return (-1);
+}
+
+// Marks as done the forms of a completed batch that the server accepted. Returns the number accepted.
+static int uploadSlotBatchResults(FILE_UPLOAD_HANDLE_t *fileUploaderHandle, FILE_UPLOAD_SLOT_t *slot)
+{
+    bool accepted[FILE_UPLOADER_BATCH_ENTRIES_LIMIT] = {false};
+    int item, status, n, count = 0;
+    const char *p = slot->response;
+
+    while (*p) {
+        if (sscanf(p, "%d %d", &item, &status) == 2 && item >= 0 && item < slot->entryCount && status == 200) accepted[item] = true;
+        p += strcspn(p, "\n");
+        if (*p) p++;
+    }
+    for (n = 0; n < slot->entryCount; n++) {
+        if (!accepted[n]) continue;
+        uploadJournalMarkDone(fileUploaderHandle->journal, slot->entryIDs[n]);
+        count++;
+    }
+    return (count);
+}
+
+static void *fileUploader(void *arg)
 {
     FILE_UPLOAD_HANDLE_t *fileUploaderHandle;
-    char *indexUploadPathname;
-    char *filePathname;
 #define BUFSIZE 1024
 	char *buf;
-    CURL *curlHandle = NULL;
+    char *indexPathname;
+    FILE_UPLOAD_SLOT_t *slots;
+    CURLM *curlMultiHandle = NULL;
+    CURLSH *curlShareHandle = NULL;
+    UPLOAD_QUEUE_t *queue = NULL;
     CURLcode curlErr;
-	char curlErrorBuf[CURL_ERROR_SIZE];
-	long http_response;
-
+    CURLMcode curlMErr;
+    int i;
 
     ARLOGi("Start fileUploader thread.\n");
-    fileUploaderHandle = (FILE_UPLOAD_HANDLE_t *)threadGetArg(threadHandle);
-    arMalloc(indexUploadPathname, char, MAXPATHLEN);
-    arMalloc(filePathname, char, MAXPATHLEN);
+    fileUploaderHandle = (FILE_UPLOAD_HANDLE_t *)arg;
     arMalloc(buf, char, BUFSIZE);
+    arMalloc(indexPathname, char, MAXPATHLEN);
+    arMallocClear(slots, FILE_UPLOAD_SLOT_t, FILE_UPLOADER_MAX_CONCURRENT_UPLOADS_LIMIT);
 
-    while (threadStartWait(threadHandle) == 0) {
+    while (fileUploaderWaitForWork(fileUploaderHandle)) {
     	ARLOGd("file uploader is GO\n");
+    	statusPublish(fileUploaderHandle, true, false, "Looking for files to upload...");
     	pthread_mutex_lock(&(fileUploaderHandle->uploadStatusLock));
-    	snprintf(fileUploaderHandle->uploadStatus, UPLOAD_STATUS_BUFFER_LEN, "Looking for files to upload...");
+    	int maxConcurrentUploads = fileUploaderHandle->maxConcurrentUploads;
+    	char *batchPostURL = (fileUploaderHandle->batchPostURL ? strdup(fileUploaderHandle->batchPostURL) : NULL);
+    	size_t maxBatchBytes = fileUploaderHandle->maxBatchBytes;
+    	long maxBytesPerSecond = fileUploaderHandle->maxBytesPerSecond;
+    	FILE_UPLOAD_TRANSFER_METRICS_CALLBACK_t metricsCallback = fileUploaderHandle->metricsCallback;
+    	void *metricsCallbackUserdata = fileUploaderHandle->metricsCallbackUserdata;
+    	FILE_UPLOAD_DEDUP_KEY_FUNCTION_t dedupKeyFunction = fileUploaderHandle->dedupKeyFunction;
     	pthread_mutex_unlock(&(fileUploaderHandle->uploadStatusLock));
 
     	int uploadsDone = 0;
+    	int uploadsStarted = 0;
+    	int uploadsStartedShown = 0;
+    	int uploadsInProgress = 0;
     	int errorCode = 0;
+    	bool aborted = false;
+    	// Bandwidth token bucket, in bytes. Refilled at maxBytesPerSecond, up to one second's worth.
+    	double uploadTokens = (double)maxBytesPerSecond;
+    	struct timeval uploadTokensTime;
+    	gettimeofday(&uploadTokensTime, NULL);
+
+        if (!fileUploaderHandle->journal) {
+            errorCode = -1;
+            goto done;
+        }
 
-    	// Look for at least one unhandled uploadQueueFileName in the queue directory.
-    	while (getNextFileInQueueWithExtension(fileUploaderHandle->queueDirPath, fileUploaderHandle->formExtension, indexUploadPathname, MAXPATHLEN)) {
-
-        	pthread_mutex_lock(&(fileUploaderHandle->uploadStatusLock));
-        	snprintf(fileUploaderHandle->uploadStatus, UPLOAD_STATUS_BUFFER_LEN, "Uploading file %d", uploadsDone + 1);
-        	pthread_mutex_unlock(&(fileUploaderHandle->uploadStatusLock));
-
-        	FILE *fp;
-    		if (!(fp = fopen(indexUploadPathname, "rb"))) {
-            	ARLOGe("Error opening upload queue file '%s'.\n", indexUploadPathname);
-            	errorCode = -1;
-    	    	break;
-    		}
-
-    	    //
-    	    // cURL upload.
-    	    //
-
-    	    if (!curlHandle) {
-    	    	curlHandle = curl_easy_init();
-        	    if (!curlHandle) {
-        	    	ARLOGe("Error initialising CURL.\n");
-            	    errorCode = -1;
-        	    	break;
-        	    }
-        	    curlErr = curl_easy_setopt(curlHandle, CURLOPT_ERRORBUFFER, curlErrorBuf);
-        	    if (curlErr != CURLE_OK) {
-        	    	ARLOGe("Error setting CURL error buffer: %s (%d)\n", curl_easy_strerror(curlErr), curlErr);
-            	    errorCode = -1;
-        	    	break;
-        	    }
-        	    
-                // First, attempt a connection to a well-known site. If this fails, assume we have no
-                // internet access at all.
-                curlErr = curl_easy_setopt(curlHandle, CURLOPT_URL, "http://www.google.com");
-                if (curlErr != CURLE_OK) {
-                    ARLOGe("Error setting CURL URL: %s (%d)\n", curl_easy_strerror(curlErr), curlErr);
-            	    errorCode = -1;
-                    break;
-                }
-                curlErr = curl_easy_setopt(curlHandle, CURLOPT_NOBODY, 1L); // Headers only.
-                if (curlErr != CURLE_OK) {
-                    ARLOGe("Error setting CURL URL: %s (%d)\n", curl_easy_strerror(curlErr), curlErr);
-            	    errorCode = -1;
-                    break;
-                }
-                curlErr = curl_easy_perform(curlHandle);
-                if (curlErr != CURLE_OK) {
-                    // No need to report error, since we expect it (e.g.) when wifi and cell data are off.
-                    // Typical first error in these cases is failure to resolve the hostname.
-                    //LOGE("Error performing CURL network test: %s (%d). %s.\n", curl_easy_strerror(curlErr), curlErr, curlErrorBuf);
-                    errorCode = 1;
-                    break;
-                }
-    	    }
+        // Import any index files in the older one-file-per-entry format into the journal.
+        // The queue directory is scanned only once. After that, only changes are read.
+        if (!queue) {
+            queue = uploadQueueInit(fileUploaderHandle->queueDirPath, fileUploaderHandle->formExtension);
+        } else {
+            uploadQueueRefresh(queue);
+        }
+        if (queue) {
+            const char *name;
+            while ((name = uploadQueueGet(queue, 0))) {
+                snprintf(indexPathname, MAXPATHLEN, "%s/%s", fileUploaderHandle->queueDirPath, name);
+                if (importLegacyIndexFile(fileUploaderHandle->journal, dedupKeyFunction, indexPathname, buf, BUFSIZE)) ARLOGi("Imported '%s' into upload journal.\n", name);
+                uploadQueueRemove(queue, name); // If import failed, it will be retried at next launch.
+            }
+        }
+
+        // Drop forms superseded by a better one with the same key. No transfers are in progress between runs.
+        int coalesced = uploadJournalCoalesce(fileUploaderHandle->journal);
+        if (coalesced > 0) {
+            ARLOGi("Dropped %d duplicate form%s from upload queue.\n", coalesced, (coalesced > 1 ? "s" : ""));
+            uploadJournalSync(fileUploaderHandle->journal);
+        }
 
-    		// Network OK, so proceed with upload.
-    	    curlErr = curl_easy_setopt(curlHandle, CURLOPT_URL, fileUploaderHandle->formPostURL);
-    	    if (curlErr != CURLE_OK) {
-    	    	ARLOGe("Error setting CURL URL: %s (%d)\n", curl_easy_strerror(curlErr), curlErr);
-            	errorCode = -1;
-    	    	break;
-    	    }
+        if (!uploadJournalCount(fileUploaderHandle->journal)) goto done;
+
+        //
+        // cURL setup. The multi handle owns the connection cache, so it is kept for the life of the
+        // thread, allowing connections to the server to be reused across files and across runs.
+        // TLS sessions and DNS lookups are shared between the easy handles via the share handle.
+        //
+
+        if (!curlMultiHandle) {
+            curlShareHandle = curl_share_init();
+            if (curlShareHandle) {
+                curl_share_setopt(curlShareHandle, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+                curl_share_setopt(curlShareHandle, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+            }
+            curlMultiHandle = curl_multi_init();
+            if (!curlMultiHandle) {
+                ARLOGe("Error initialising CURL.\n");
+                errorCode = -1;
+                goto done;
+            }
+            curl_multi_setopt(curlMultiHandle, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX); // Multiplex over a single connection if the server supports HTTP/2.
+        }
+        curl_multi_setopt(curlMultiHandle, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long)maxConcurrentUploads);
+        curl_multi_setopt(curlMultiHandle, CURLMOPT_MAXCONNECTS, (long)maxConcurrentUploads);
+
+        for (i = 0; i < maxConcurrentUploads; i++) {
+            if (slots[i].curlHandle) continue;
+            slots[i].curlHandle = curl_easy_init();
+            if (!slots[i].curlHandle) {
+                ARLOGe("Error initialising CURL.\n");
+                errorCode = -1;
+                goto done;
+            }
+            curlErr = curl_easy_setopt(slots[i].curlHandle, CURLOPT_ERRORBUFFER, slots[i].errorBuf);
+            if (curlErr != CURLE_OK) {
+                ARLOGe("Error setting CURL error buffer: %s (%d)\n", curl_easy_strerror(curlErr), curlErr);
+                errorCode = -1;
+                goto done;
+            }
+            slots[i].fileUploaderHandle = fileUploaderHandle;
+            curl_easy_setopt(slots[i].curlHandle, CURLOPT_PRIVATE, &(slots[i]));
+            curl_easy_setopt(slots[i].curlHandle, CURLOPT_WRITEFUNCTION, uploadSlotWrite);
+            curl_easy_setopt(slots[i].curlHandle, CURLOPT_WRITEDATA, &(slots[i]));
+            curl_easy_setopt(slots[i].curlHandle, CURLOPT_HEADERFUNCTION, uploadSlotHeader);
+            curl_easy_setopt(slots[i].curlHandle, CURLOPT_HEADERDATA, &(slots[i]));
+            if (curlShareHandle) curl_easy_setopt(slots[i].curlHandle, CURLOPT_SHARE, curlShareHandle);
+            curl_easy_setopt(slots[i].curlHandle, CURLOPT_PIPEWAIT, 1L); // Prefer waiting for a multiplexable connection over opening a new one.
+
+            // Bound the time a stalled server can hold a transfer (and therefore fileUploaderFinal()).
+            curl_easy_setopt(slots[i].curlHandle, CURLOPT_CONNECTTIMEOUT, (long)FILE_UPLOADER_CONNECT_TIMEOUT_SECS);
+            curl_easy_setopt(slots[i].curlHandle, CURLOPT_LOW_SPEED_LIMIT, 1L);
+            curl_easy_setopt(slots[i].curlHandle, CURLOPT_LOW_SPEED_TIME, (long)FILE_UPLOADER_STALL_TIMEOUT_SECS);
+            curl_easy_setopt(slots[i].curlHandle, CURLOPT_TIMEOUT, (long)FILE_UPLOADER_TRANSFER_TIMEOUT_SECS);
+            curl_easy_setopt(slots[i].curlHandle, CURLOPT_XFERINFOFUNCTION, uploadSlotProgress);
+            curl_easy_setopt(slots[i].curlHandle, CURLOPT_XFERINFODATA, &(slots[i]));
+            curl_easy_setopt(slots[i].curlHandle, CURLOPT_NOPROGRESS, 0L);
 
             // The commented-out section below disables SSL peer verification. Uncommenting this will make
             // https connections insecure, but will allow (for example) connections to a server using a
             // self-signed SSL certificate and when you have not provided CURL with a CAfile via
             // 'curl_easy_setopt(curlHandle, CURLOPT_CAPATH, capath);'.
             // (default capath: /etc/ssl/certs/ca-certificates.crt)
-    	    //curlErr = curl_easy_setopt(curlHandle, CURLOPT_SSL_VERIFYPEER, 0L);
-    	    //if (curlErr != CURLE_OK) {
-    	    //	ARLOGe("Error setting CURL SSL options: %s (%d)\n", curl_easy_strerror(curlErr), curlErr);
+            //curlErr = curl_easy_setopt(slots[i].curlHandle, CURLOPT_SSL_VERIFYPEER, 0L);
+            //if (curlErr != CURLE_OK) {
+            //	ARLOGe("Error setting CURL SSL options: %s (%d)\n", curl_easy_strerror(curlErr), curlErr);
             //	errorCode = -1;
-    	    //	break;
-    	    //}
-
-    	    // Build the form.
-    	    struct curl_httppost* post = NULL;
-    	    struct curl_httppost* last = NULL;
-
-    	    // Read lines from the file, creating curl parameters for each one.
-    	    *filePathname = '\0';
-    		while (get_buff(buf, BUFSIZE, fp, true)) {
-
-    			// Locate first comma on line, and split the string there.
-    			char *commaPos;
-    			if (!(commaPos = strchr(buf, ','))) continue; // No comma found! Skip line.
-    			*commaPos = '\0';
-
-    			if (strcmp(buf, "file") == 0) { // Handle the 'file' parameter by using CURLFORM_FILE. All other params use CURLFORM_COPYCONTENTS.
-    				strcpy(filePathname, commaPos + 1);
-    				curl_formadd(&post, &last, CURLFORM_COPYNAME, buf, CURLFORM_FILE, commaPos + 1, CURLFORM_FILENAME, arUtilGetFileNameFromPath(commaPos + 1), CURLFORM_CONTENTTYPE, "application/octet-stream", CURLFORM_END);
-    			} else {
-    				curl_formadd(&post, &last, CURLFORM_COPYNAME, buf, CURLFORM_COPYCONTENTS, commaPos + 1, CURLFORM_END);
-    			}
-    		}
-
-    		fclose(fp);
-
-    		// Check that we read at least 1 form parameter.
-    		if (!post) {
-    			ARLOGe("Error reading CURL form data from file '%s'.\n", indexUploadPathname);
-            	errorCode = -1;
-    			break;
-    		}
-
-    	    curlErr = curl_easy_setopt(curlHandle, CURLOPT_HTTPPOST, post); // Automatically sets CURLOPT_NOBODY to 0.
-    		if (curlErr != CURLE_OK) {
-    			ARLOGe("Error setting CURL form data: %s (%d)\n", curl_easy_strerror(curlErr), curlErr);
-            	errorCode = -1;
-    			break;
-    		}
-
-    		// Perform the transfer. Blocks until complete.
-    	    curlErr = curl_easy_perform(curlHandle);
-    	    curl_formfree(post); // Free the form resources, regardless of outcome.
-    		if (curlErr != CURLE_OK) {
-    			ARLOGe("Error performing CURL operation: %s (%d). %s.\n", curl_easy_strerror(curlErr), curlErr, curlErrorBuf);
-    			errorCode = 2;
-    			break;
-    		}
-
-    		curl_easy_getinfo (curlHandle, CURLINFO_RESPONSE_CODE, &http_response);
-    		if (http_response != 200) {
-    			ARLOGe("Parameter file upload failed: server returned response %ld.\n", http_response);
-    			errorCode = 3;
-    			break;
-    		}
-
-    		// Uploaded OK, so delete uploaded parameters file and index.
-    		if (remove(indexUploadPathname) < 0) {
-    			ARLOGe("Error removing index file '%s' after upload.\n", indexUploadPathname);
-    			ARLOGperror(NULL);
-    		}
-    		if (remove(filePathname) < 0) {
-    			ARLOGe("Error removing file '%s' after upload.\n", filePathname);
-    			ARLOGperror(NULL);
-    		}
-
-    		uploadsDone++;
-    	} // while(getNextFileInQueueWithExtension)
+            //	goto done;
+            //}
+        }
+        // Per transfer, libcurl holds the send rate to the cap. The token bucket (below) holds the total across transfers to it.
+        for (i = 0; i < maxConcurrentUploads; i++) {
+            curl_easy_setopt(slots[i].curlHandle, CURLOPT_MAX_SEND_SPEED_LARGE, (curl_off_t)maxBytesPerSecond);
+        }
 
-        pthread_mutex_lock(&(fileUploaderHandle->uploadStatusLock));
+        // Keep up to maxConcurrentUploads transfers in progress.
+        // After any error, no new transfers are started, but those in progress are allowed to complete.
+        // On quit, transfers in progress are abandoned (below), and uploadSlotProgress() aborts any
+        // which are part way through a call to curl_multi_perform().
+        // While the bandwidth token bucket is empty, sending is paused and no new transfers are started.
+        do {
+            if (atomic_load(&(fileUploaderHandle->abortTransfers))) {
+                aborted = true;
+                break;
+            }
+            int waitMs = FILE_UPLOADER_ABORT_POLL_MS;
+            bool throttled = false;
+            if (maxBytesPerSecond) {
+                uploadTokens = MIN(uploadTokens + secondsSince(&uploadTokensTime)*(double)maxBytesPerSecond, (double)maxBytesPerSecond);
+                gettimeofday(&uploadTokensTime, NULL);
+                throttled = (uploadTokens < 0.0);
+                if (throttled) waitMs = MIN(waitMs, (int)(-uploadTokens*1000.0/(double)maxBytesPerSecond) + 1);
+                uploadSlotsPause(slots, maxConcurrentUploads, throttled);
+            }
+            for (i = 0; i < maxConcurrentUploads && !errorCode && !throttled; i++) {
+                if (slots[i].busy) continue;
+                int index = 0;
+                if (!getNextEntry(fileUploaderHandle->journal, slots, maxConcurrentUploads, &index, &(slots[i].entryIDs[0]))) break;
+                slots[i].entryCount = 1;
+                if (batchPostURL) errorCode = uploadSlotStartBatch(fileUploaderHandle, curlMultiHandle, &(slots[i]), slots, maxConcurrentUploads, index, batchPostURL, maxBatchBytes);
+                else errorCode = uploadSlotStart(fileUploaderHandle, curlMultiHandle, &(slots[i]));
+                if (!errorCode) {
+                    uploadsStarted += slots[i].entryCount;
+                    uploadsInProgress++;
+                }
+            }
+            if (!uploadsInProgress) {
+                if (!throttled || errorCode) break;
+                usleep(waitMs*1000); // Nothing to do until the bucket refills.
+                continue;
+            }
+
+            if (uploadsStarted != uploadsStartedShown) {
+                statusPublish(fileUploaderHandle, true, false, "Uploading file %d", uploadsStarted);
+                uploadsStartedShown = uploadsStarted;
+            }
+
+            int running;
+            curlMErr = curl_multi_perform(curlMultiHandle, &running);
+            if (curlMErr != CURLM_OK) {
+                ARLOGe("Error performing CURL operation: %s (%d).\n", curl_multi_strerror(curlMErr), curlMErr);
+                errorCode = -1;
+                break;
+            }
+
+            // Take what was sent from the token bucket, and pause sending if it is now empty.
+            if (maxBytesPerSecond) {
+                for (i = 0; i < maxConcurrentUploads; i++) {
+                    if (!slots[i].busy) continue;
+                    uploadTokens -= (double)(slots[i].bytesSent - slots[i].bytesCounted);
+                    slots[i].bytesCounted = slots[i].bytesSent;
+                }
+                throttled = (uploadTokens < 0.0);
+                if (throttled) {
+                    uploadSlotsPause(slots, maxConcurrentUploads, true);
+                    waitMs = MIN(waitMs, (int)(-uploadTokens*1000.0/(double)maxBytesPerSecond) + 1);
+                }
+            }
+
+            // Collect completed transfers.
+            CURLMsg *msg;
+            int msgsInQueue;
+            while ((msg = curl_multi_info_read(curlMultiHandle, &msgsInQueue))) {
+                if (msg->msg != CURLMSG_DONE) continue;
+                FILE_UPLOAD_SLOT_t *slot = NULL;
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&slot);
+                curlErr = msg->data.result;
+                uploadSlotFinish(curlMultiHandle, slot); // Invalidates msg.
+                uploadsInProgress--;
+                if (curlErr == CURLE_ABORTED_BY_CALLBACK) continue; // Quitting.
+
+                FILE_UPLOAD_TRANSFER_METRICS_t metrics;
+                uploadSlotMetrics(slot, curlErr, &metrics);
+                ARLOGi("Upload of %d form%s: result %d, HTTP %ld, %ld bytes. DNS %.3f s, connect %.3f s, TLS %.3f s, transfer %.3f s, server %.3f s, total %.3f s.\n",
+                       metrics.forms, (metrics.forms > 1 ? "s" : ""), metrics.curlResult, metrics.httpStatus, metrics.bytesSent,
+                       metrics.dnsTime, metrics.connectTime, metrics.tlsTime, metrics.transferTime, metrics.serverTime, metrics.totalTime);
+                if (metricsCallback) (*metricsCallback)(&metrics, metricsCallbackUserdata);
+
+                if (curlErr != CURLE_OK) {
+                    ARLOGe("Error performing CURL operation: %s (%d). %s.\n", curl_easy_strerror(curlErr), curlErr, slot->errorBuf);
+                    if (curlErr == CURLE_COULDNT_RESOLVE_HOST || curlErr == CURLE_COULDNT_RESOLVE_PROXY || curlErr == CURLE_COULDNT_CONNECT) errorCode = 1;
+                    else errorCode = 2;
+                    continue;
+                }
+                long http_response;
+                curl_easy_getinfo(slot->curlHandle, CURLINFO_RESPONSE_CODE, &http_response);
+                if (http_response != 200) {
+                    ARLOGe("Parameter file upload failed: server returned response %ld.\n", http_response);
+                    errorCode = 3;
+                    continue;
+                }
+
+                // Uploaded OK, so remove from the journal.
+                if (slot->batch) {
+                    int accepted = uploadSlotBatchResults(fileUploaderHandle, slot);
+                    if (accepted < slot->entryCount) {
+                        ARLOGe("Server accepted %d of %d forms in upload batch.\n", accepted, slot->entryCount);
+                        errorCode = 3;
+                    }
+                    uploadsDone += accepted;
+                } else {
+                    uploadJournalMarkDone(fileUploaderHandle->journal, slot->entryIDs[0]);
+                    uploadsDone++;
+                }
+            }
 
-        // Set the "hide after" time.
-        struct timeval time;
-        gettimeofday(&time, NULL);
-        fileUploaderHandle->uploadStatusHide = true;
-
-        if (uploadsDone || errorCode) {
-            if (uploadsDone) snprintf(fileUploaderHandle->uploadStatus, UPLOAD_STATUS_BUFFER_LEN, "Uploaded %d file%s", uploadsDone, (uploadsDone > 1 ? "s" : ""));
-            else {
-                switch (errorCode) {
-                    case 1: snprintf(fileUploaderHandle->uploadStatus, UPLOAD_STATUS_BUFFER_LEN, "No Internet access. Uploads postponed."); break;
-                    case 2: snprintf(fileUploaderHandle->uploadStatus, UPLOAD_STATUS_BUFFER_LEN, "Network error while uploading. Uploads postponed."); break;
-                    case 3: snprintf(fileUploaderHandle->uploadStatus, UPLOAD_STATUS_BUFFER_LEN, "Server error while uploading. Uploads postponed."); break;
-                    default: snprintf(fileUploaderHandle->uploadStatus, UPLOAD_STATUS_BUFFER_LEN, "Internal error while uploading. Uploads postponed."); break;
+            if (running && throttled) {
+                usleep(waitMs*1000); // curl_multi_wait() returns at once while sending is paused. Responses wait until the bucket refills.
+            } else if (running) {
+                struct timeval waitStart;
+                gettimeofday(&waitStart, NULL);
+                curlMErr = curl_multi_wait(curlMultiHandle, NULL, 0, waitMs, NULL);
+                if (curlMErr != CURLM_OK) {
+                    ARLOGe("Error waiting for CURL operation: %s (%d).\n", curl_multi_strerror(curlMErr), curlMErr);
+                    errorCode = -1;
+                    break;
+                }
+                // Likewise, libcurl's own rate limit holds back sockets that are ready, so don't spin.
+                if (maxBytesPerSecond) {
+                    int waitedMs = (int)(secondsSince(&waitStart)*1000.0);
+                    if (waitedMs < THROTTLE_TICK_MS) usleep((THROTTLE_TICK_MS - waitedMs)*1000);
                 }
             }
+        } while (true);
 
-            // Adjust the "hide after" time.
-            timeradd(&time, &(fileUploaderHandle->uploadStatusHideAfterSecs), &(fileUploaderHandle->uploadStatusHideAtTime));
+done:
+        // Abandon any transfers still in progress (only after an internal error, or on quit).
+        for (i = 0; i < FILE_UPLOADER_MAX_CONCURRENT_UPLOADS_LIMIT; i++) {
+            if (slots[i].busy) uploadSlotFinish(curlMultiHandle, &(slots[i]));
         }
+
+        // Reclaim space used by uploaded entries, or at least make sure everything is synced.
+        if (uploadsDone) uploadJournalCompact(fileUploaderHandle->journal);
+        else uploadJournalSync(fileUploaderHandle->journal);
+
+        // Schedule a retry if anything is left in the queue after an error.
+        // An interrupted run is neither a success nor a failure, so leaves the retry state as it was.
+        FILE_UPLOAD_RETRY_STATE_t retry = {0, 0, false};
+        int retrySecs = 0;
+        if (aborted) {
+            errorCode = 4;
+            retry = fileUploaderHandle->retry;
+        } else if (errorCode && uploadJournalCount(fileUploaderHandle->journal)) {
+            retry.failures = fileUploaderHandle->retry.failures + 1; // Only ever written on this thread.
+            retrySecs = retryBackoffSecs(fileUploaderHandle, retry.failures);
+            retry.nextAttemptTime = time(NULL) + retrySecs;
+            retry.pending = true;
+            ARLOGi("Upload failed %d time%s; retrying in %d seconds.\n", retry.failures, (retry.failures > 1 ? "s" : ""), retrySecs);
+        }
+        bool retryChanged = (retry.pending != fileUploaderHandle->retry.pending || retry.failures != fileUploaderHandle->retry.failures || retry.nextAttemptTime != fileUploaderHandle->retry.nextAttemptTime);
+
+        pthread_mutex_lock(&(fileUploaderHandle->uploadStatusLock));
+        fileUploaderHandle->retry = retry;
         pthread_mutex_unlock(&(fileUploaderHandle->uploadStatusLock));
 
+        // Show the outcome for uploadStatusHideAfterSecs.
+        if (uploadsDone) statusPublish(fileUploaderHandle, false, true, "Uploaded %d file%s", uploadsDone, (uploadsDone > 1 ? "s" : ""));
+        else if (errorCode) {
+            const char *errorString;
+            switch (errorCode) {
+                case 1: errorString = "Upload server unreachable."; break;
+                case 2: errorString = "Network error while uploading."; break;
+                case 3: errorString = "Server error while uploading."; break;
+                case 4: errorString = "Uploads interrupted."; break;
+                default: errorString = "Internal error while uploading."; break;
+            }
+            if (retry.pending) statusPublish(fileUploaderHandle, false, true, "%s Retrying in %d s.", errorString, retrySecs);
+            else statusPublish(fileUploaderHandle, false, true, "%s Uploads postponed.", errorString);
+        } else statusPublish(fileUploaderHandle, false, false, "");
+
+        if (retryChanged) retryStateSave(fileUploaderHandle, retry);
+        free(batchPostURL);
+
        	ARLOGd("file uploader is DONE\n");
-        threadEndSignal(threadHandle);
     }
 
-    // Cleanup curl handle before thread exit.
-	if (curlHandle) {
-	    curl_easy_cleanup(curlHandle);
-	    curlHandle = NULL;
-	}
+    // Cleanup curl handles before thread exit.
+    for (i = 0; i < FILE_UPLOADER_MAX_CONCURRENT_UPLOADS_LIMIT; i++) {
+        if (slots[i].curlHandle) {
+            curl_easy_cleanup(slots[i].curlHandle);
+            slots[i].curlHandle = NULL;
+        }
+    }
+    if (curlMultiHandle) {
+        curl_multi_cleanup(curlMultiHandle);
+        curlMultiHandle = NULL;
+    }
+    if (curlShareHandle) {
+        curl_share_cleanup(curlShareHandle);
+        curlShareHandle = NULL;
+    }
 
+    uploadQueueFinal(&queue);
+    free(slots);
+    free(indexPathname);
     free(buf);
-    free(filePathname);
-    free(indexUploadPathname);
     ARLOGi("End fileUploader thread.\n");
     return (NULL);
 }
 
 int fileUploaderStatusGet(FILE_UPLOAD_HANDLE_t *handle, char statusBuf[UPLOAD_STATUS_BUFFER_LEN], struct timeval *currentTime_p)
 {
-	int ret = 0;
-
 	if (!handle) return (-1);
 
-	pthread_mutex_lock(&(handle->uploadStatusLock));
-	if (*(handle->uploadStatus)) {
-		if (handle->uploadStatusHide && currentTime_p->tv_sec >= handle->uploadStatusHideAtTime.tv_sec && currentTime_p->tv_usec >= handle->uploadStatusHideAtTime.tv_usec) {
-			*(handle->uploadStatus) = '\0';
-			handle->uploadStatusHide = false;
-		} else {
-			strncpy(statusBuf, handle->uploadStatus, UPLOAD_STATUS_BUFFER_LEN);
-			if (threadGetStatus(handle->uploadThread) == 0) ret = 1;
-			else ret = 2;
-		}
+	// Take the latest snapshot, if there is one we haven't seen. Never blocks.
+	if (atomic_load_explicit(&(handle->statusMiddle), memory_order_relaxed) & STATUS_FRESH) {
+		handle->statusFront = atomic_exchange_explicit(&(handle->statusMiddle), handle->statusFront, memory_order_acq_rel) & STATUS_INDEX_MASK;
 	}
-	pthread_mutex_unlock(&(handle->uploadStatusLock));
+	const FILE_UPLOAD_STATUS_t *status = &(handle->status[handle->statusFront]);
 
-	return (ret);
+	if (!*(status->message)) return (0);
+	if (status->hide && !timercmp(currentTime_p, &(status->hideAtTime), <)) return (0);
+	strncpy(statusBuf, status->message, UPLOAD_STATUS_BUFFER_LEN);
+	return (status->busy ? 1 : 2);
 }
@@ -42,15 +42,51 @@
 //
 // HTML form and file uploader via HTTP POST.
 //
-// When tickled, each index file in "queueDirPath" with extension "formExtension" will be opened
-// and read for form data to be uploaded to URL "formPostURL" via HTTP POST.
-// The format of the index file is 1 form field per line. From the beginning of the line up to
-// the first ',' character is taken as the field name. The rest of the line after the ','
-// up to the end-of-line is taken as the field contents.
+// Forms are queued with fileUploaderEnqueue(), which appends them to an append-only journal
+// (see uploadJournal.h) in "queueDirPath", and are uploaded to URL "formPostURL" via HTTP POST.
+// Each text field in the entry is sent as a form field. Each file field is sent as a file upload
+// under the field's name, with the field's filename supplied as the filename portion of the field.
+// Entries are removed from the journal once the server has responded with HTTP status 200.
+//
+// For compatibility, index files with extension "formExtension" found in "queueDirPath" are
+// imported into the journal when the uploader runs. The format of the index file is 1 form field
+// per line. From the beginning of the line up to the first ',' character is taken as the field name.
+// The rest of the line after the ',' up to the end-of-line is taken as the field contents.
 // A field with the name 'file' is treated differently. If such a field is found, the field
-// contents are taken as the pathname to a file to be uploaded. The file will be uploaded
-// under a field named 'file', with its filename (not including any other path component)
-// supplied as the filename portion of the field.
+// contents are taken as the pathname to a file to be uploaded.
+//
+// Optionally, forms can instead be sent several at a time (see fileUploaderSetBatchUploads()).
+// The forms are packed into a single multipart/form-data body, which is gzip-compressed and posted
+// with "Content-Encoding: gzip" to a separate batch URL. The body begins with a text field "count"
+// holding the number of forms in the batch, followed by the fields of each form in turn, with each
+// field name prefixed by the form's index in the batch and a '.', e.g. "0.version", "0.file",
+// "1.version". Forms are added to the batch until its uncompressed size would exceed the batch size
+// limit, but a batch always contains at least one form. The server responds with HTTP status 200 and
+// a text/plain body with one line per form, "<index> <status>", where status 200 means the form was
+// accepted. Forms with any other status, or for which no line is returned, are retried later.
+// Batching is off by default, since servers must specifically support it.
+//
+// If uploads fail, the uploader retries on its own, with exponential backoff (plus random jitter)
+// between FILE_UPLOADER_RETRY_BACKOFF_BASE_SECS and FILE_UPLOADER_RETRY_BACKOFF_MAX_SECS. The failure
+// count and time of the next retry are kept per destination URL in the file "retry-state" in the queue
+// directory, so that backoff continues across restarts. A tickle always triggers an immediate attempt.
+//
+// Transfers time out if the connection can't be made within FILE_UPLOADER_CONNECT_TIMEOUT_SECS,
+// if no data moves for FILE_UPLOADER_STALL_TIMEOUT_SECS, or after FILE_UPLOADER_TRANSFER_TIMEOUT_SECS
+// in total. fileUploaderFinal() aborts any transfers in progress rather than waiting for them, and
+// normally returns within about FILE_UPLOADER_ABORT_POLL_MS. Forms whose transfer was aborted stay
+// in the queue and are sent again next time.
+//
+// If a deduplication key function is set (see fileUploaderSetDedupKeyFunction()), each form is
+// queued with the key and rank it returns, and at the start of each run, queued forms sharing a
+// key are reduced to the one with the lowest rank.
+//
+// Upload bandwidth can be capped (see fileUploaderSetMaxBytesPerSecond()). Each transfer is held
+// to the cap by libcurl, and a token bucket shared by all transfers pauses them while the total
+// sent runs ahead of the cap.
+//
+// After each transfer, a timing breakdown is logged, and passed to the callback set with
+// fileUploaderSetTransferMetricsCallback(), if any.
 //
 // Uses libcURL internally.
 // Don't forget to add library load calls on the Java side:
@@ -63,6 +99,8 @@
 
 #include <sys/time.h> // struct timeval, gettimeofday(), timeradd()
 #include <stdbool.h>
+#include <stddef.h> // size_t
+#include "uploadJournal.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -70,6 +108,38 @@ extern "C" {
 
 #define UPLOAD_STATUS_BUFFER_LEN 128
 
+#define FILE_UPLOADER_MAX_CONCURRENT_UPLOADS_DEFAULT 4
+#define FILE_UPLOADER_MAX_CONCURRENT_UPLOADS_LIMIT 16
+#define FILE_UPLOADER_RETRY_BACKOFF_BASE_SECS 15
+#define FILE_UPLOADER_RETRY_BACKOFF_MAX_SECS 3600
+#define FILE_UPLOADER_CONNECT_TIMEOUT_SECS 15
+#define FILE_UPLOADER_STALL_TIMEOUT_SECS 30
+#define FILE_UPLOADER_TRANSFER_TIMEOUT_SECS 300
+#define FILE_UPLOADER_ABORT_POLL_MS 100
+#define FILE_UPLOADER_BATCH_BYTES_MAX_DEFAULT (1024*1024) // Uncompressed.
+#define FILE_UPLOADER_BATCH_ENTRIES_LIMIT 256
+
+// Timing breakdown of one completed (or failed) transfer. Times are in seconds.
+typedef struct {
+    int                  forms; // Number of forms carried by the transfer.
+    int                  curlResult; // CURLcode.
+    long                 httpStatus; // 0 if no response was received.
+    long                 bytesSent;
+    double               dnsTime; // Name lookup.
+    double               connectTime; // TCP connect, after name lookup.
+    double               tlsTime; // TLS handshake, after connect. 0 for http.
+    double               transferTime; // Sending the request and body.
+    double               serverTime; // From the end of the body to the first byte of the response.
+    double               totalTime;
+} FILE_UPLOAD_TRANSFER_METRICS_t;
+
+// Computes a deduplication key (non-zero) and rank (lower is better) for a form. Returns false if the form has no key.
+typedef bool (*FILE_UPLOAD_DEDUP_KEY_FUNCTION_t)(const UPLOAD_JOURNAL_ENTRY_t *entry, uint64_t *key_out, double *rank_out);
+
+typedef void (*FILE_UPLOAD_TRANSFER_METRICS_CALLBACK_t)(const FILE_UPLOAD_TRANSFER_METRICS_t *metrics, void *userdata);
+
+typedef void (*FILE_UPLOAD_STATUS_CALLBACK_t)(void *userdata);
+
 // Check for existence of queue directory, and create if not already existing.
 // Returns false if directory could not be created, true otherwise.
 // This needs to be done no later than before the first call to fileUploaderTickle().
@@ -81,8 +151,49 @@ FILE_UPLOAD_HANDLE_t *fileUploaderInit(const char *queueDirPath, const char *for
 
 void fileUploaderFinal(FILE_UPLOAD_HANDLE_t **handle_p);
 
+// Set the maximum number of files uploaded concurrently, in range [1, FILE_UPLOADER_MAX_CONCURRENT_UPLOADS_LIMIT].
+// Default is FILE_UPLOADER_MAX_CONCURRENT_UPLOADS_DEFAULT. Takes effect from the next tickle.
+// Transfers share a connection cache (and TLS sessions), so connections to the server are reused
+// from one file to the next, and multiplexed over a single connection when the server supports HTTP/2.
+bool fileUploaderSetMaxConcurrentUploads(FILE_UPLOAD_HANDLE_t *handle, int maxConcurrentUploads);
+
+// Send forms in batches to "batchPostURL", or pass NULL (the default) to send forms one per request
+// to "formPostURL". "maxBatchBytes" limits the uncompressed size of a batch; pass 0 for
+// FILE_UPLOADER_BATCH_BYTES_MAX_DEFAULT. At most FILE_UPLOADER_BATCH_ENTRIES_LIMIT forms are sent
+// per batch. Takes effect from the next tickle.
+bool fileUploaderSetBatchUploads(FILE_UPLOAD_HANDLE_t *handle, const char *batchPostURL, size_t maxBatchBytes);
+
+// Limit total upload bandwidth to "maxBytesPerSecond", or pass 0 (the default) for no limit.
+// Takes effect from the next tickle.
+bool fileUploaderSetMaxBytesPerSecond(FILE_UPLOAD_HANDLE_t *handle, long maxBytesPerSecond);
+
+// Set a function to be called with the timing breakdown of each transfer, or NULL for none.
+// The callback is called on the upload thread.
+bool fileUploaderSetTransferMetricsCallback(FILE_UPLOAD_HANDLE_t *handle, FILE_UPLOAD_TRANSFER_METRICS_CALLBACK_t callback, void *userdata);
+
+// Set a function to be called whenever a new status is published, e.g. to wake the render thread
+// to call fileUploaderStatusGet(), or NULL for none. The callback is called on the upload thread.
+bool fileUploaderSetStatusCallback(FILE_UPLOAD_HANDLE_t *handle, FILE_UPLOAD_STATUS_CALLBACK_t callback, void *userdata);
+
+// Set the function used to key forms as they are queued, or NULL (the default) for no deduplication.
+// Forms already queued keep the key they were queued with.
+bool fileUploaderSetDedupKeyFunction(FILE_UPLOAD_HANDLE_t *handle, FILE_UPLOAD_DEDUP_KEY_FUNCTION_t keyFunction);
+
+// Append a form to the upload queue, and tickle the uploader. The entry is not consumed.
+bool fileUploaderEnqueue(FILE_UPLOAD_HANDLE_t *handle, const UPLOAD_JOURNAL_ENTRY_t *entry);
+
 bool fileUploaderTickle(FILE_UPLOAD_HANDLE_t *handle);
 
+// Sync queued forms to storage now, rather than per the journal's batched sync policy, e.g. at the
+// end of a batch of fileUploaderEnqueue() calls.
+bool fileUploaderSync(FILE_UPLOAD_HANDLE_t *handle);
+
+// Number of forms queued and not yet successfully uploaded, or -1 in case of error.
+int fileUploaderPendingCount(FILE_UPLOAD_HANDLE_t *handle);
+
+// Get the status message to show to the user, if any. Doesn't lock, so it is safe to call every
+// frame, but it must only be called from one thread (normally the render thread).
+// Returns:
 // -1 = An error.
 // 0 = no background tasks or messages.
 // 1 = background task currently in progress.
@@ -66,6 +66,17 @@ static bool gStop;
 static FLOW_CALLBACK_t gCallback = NULL;
 static void *gCallbackUserdata = NULL;
 
+// Update notification.
+static FLOW_UPDATE_CALLBACK_t gUpdateCallback = NULL;
+static void *gUpdateCallbackUserdata = NULL;
+
+// Calibration offered for reuse.
+static bool gReuseParamValid = false;
+static ARParam gReuseParam;
+static ARdouble gReuseErrorMax = 0.0;
+static FLOW_REUSE_CALLBACK_t gReuseCallback = NULL;
+static void *gReuseCallbackUserdata = NULL;
+
 // Logging macros
 #define  LOG_TAG    "flow"
 
@@ -83,6 +94,7 @@ static Calibration *gFlowCalib = nullptr;
 
 static void *flowThread(void *arg);
 static void flowSetEventMask(const EVENT_t eventMask);
+static void flowNotifyUpdate(void);
 
 //
 // Functions.
@@ -109,6 +121,30 @@ bool flowInitAndStart(Calibration *calib, FLOW_CALLBACK_t callback, void *callba
     return (true);
 }
 
+void flowSetUpdateCallback(FLOW_UPDATE_CALLBACK_t updateCallback, void *updateCallback_userdata)
+{
+    gUpdateCallback = updateCallback;
+    gUpdateCallbackUserdata = updateCallback_userdata;
+}
+
+void flowSetReuseCandidate(const ARParam *param, ARdouble errorMax, FLOW_REUSE_CALLBACK_t reuseCallback, void *reuseCallback_userdata)
+{
+    if (!param) {
+        gReuseParamValid = false;
+        return;
+    }
+    gReuseParam = *param;
+    gReuseErrorMax = errorMax;
+    gReuseCallback = reuseCallback;
+    gReuseCallbackUserdata = reuseCallback_userdata;
+    gReuseParamValid = true;
+}
+
+static void flowNotifyUpdate(void)
+{
+    if (gUpdateCallback) (*gUpdateCallback)(gUpdateCallbackUserdata);
+}
+
 bool flowStopAndFinal()
 {
 	void *exit_status_p;		 // Pointer to return value from thread, will be filled in by pthread_join().
@@ -163,6 +199,7 @@ static void flowStateSet(FLOW_STATE state)
 	pthread_mutex_lock(&gStateLock);
 	gState = state;
 	pthread_mutex_unlock(&gStateLock);
+	flowNotifyUpdate();
 }
 
 static void flowSetEventMask(const EVENT_t eventMask)
@@ -195,6 +232,9 @@ static EVENT_t flowWaitForEvent(void)
 {
 	EVENT_t ret;
 
+	// Messages and status are always updated before waiting, so this is the time to have them drawn.
+	flowNotifyUpdate();
+
 	pthread_mutex_lock(&gEventLock);
 	while (gEvent == EVENT_NONE && !gStop) {
 #ifdef ANDROID
@@ -217,6 +257,7 @@ static void flowThreadCleanup(void *arg)
 	pthread_mutex_unlock(&gStateLock);
     // Clear status bar.
     statusBarMessage[0] = '\0';
+    flowNotifyUpdate();
 }
 
 static void *flowThread(void *arg)
@@ -235,7 +276,15 @@ static void *flowThread(void *arg)
 
 	while (!gStop) {
 
-		if (flowStateGet() == FLOW_STATE_WELCOME) {
+		if (flowStateGet() == FLOW_STATE_WELCOME && gFlowCalib->calibImageCount() > 0) {
+			// Captures were resumed from an interrupted run.
+			unsigned char *buf;
+			asprintf((char **)&buf, "Welcome to artoolkitX Camera Calibrator\n(c)2018 Realmax, Inc. & (c)2017 DAQRI LLC.\n\nAn interrupted calibration run was found, with %d of %d images captured. Press 'space' to continue it. Pressing 'esc' before capturing another image will discard it.\n\nPress 'p' for settings and help.", gFlowCalib->calibImageCount(), gFlowCalib->calibImageCountMax());
+			EdenMessageShow(buf);
+			free(buf);
+		} else if (flowStateGet() == FLOW_STATE_WELCOME && gReuseParamValid) {
+			EdenMessageShow((const unsigned char *)"Welcome to artoolkitX Camera Calibrator\n(c)2018 Realmax, Inc. & (c)2017 DAQRI LLC.\n\nThis camera has been calibrated before. Press 'space' to begin a run. If the first images captured confirm the saved calibration, it will be reused.\n\nPress 'p' for settings and help.");
+		} else if (flowStateGet() == FLOW_STATE_WELCOME) {
 			EdenMessageShow((const unsigned char *)"Welcome to artoolkitX Camera Calibrator\n(c)2018 Realmax, Inc. & (c)2017 DAQRI LLC.\n\nPress 'space' to begin a calibration run.\n\nPress 'p' for settings and help.");
 		} else {
 			EdenMessageShow((const unsigned char *)"Press 'space' to begin a calibration run.\n\nPress 'p' for settings and help.");
@@ -257,14 +306,36 @@ static void *flowThread(void *arg)
 		flowStateSet(FLOW_STATE_CAPTURING);
 		flowSetEventMask((EVENT_t)(EVENT_TOUCH|EVENT_BACK_BUTTON));
 
+		bool captureRejected = false;
+		bool reuseValidated = false;
+		bool reuseValidationDone = !gReuseParamValid;
+		ARdouble reuseErrAvg = 0.0, reuseErrMax = 0.0;
 		do {
-			snprintf((char *)statusBarMessage, STATUS_BAR_MESSAGE_BUFFER_LEN, "Capturing image %d/%d", gFlowCalib->calibImageCount() + 1, gFlowCalib->calibImageCountMax());
+			// Once enough images are captured, check whether the calibration offered for reuse fits them.
+			if (!reuseValidationDone && gFlowCalib->calibImageCount() >= FLOW_REUSE_VALIDATION_IMAGE_COUNT) {
+				reuseValidationDone = true;
+				if (gFlowCalib->validate(&gReuseParam, &reuseErrAvg, &reuseErrMax)) {
+					ARLOGi("Saved calibration validation error avg=%.3f, max=%.3f (limit %.3f).\n", reuseErrAvg, reuseErrMax, gReuseErrorMax);
+					if (reuseErrAvg <= gReuseErrorMax) {
+						reuseValidated = true;
+						break;
+					}
+				}
+				snprintf((char *)statusBarMessage, STATUS_BAR_MESSAGE_BUFFER_LEN, "Capturing image %d/%d (saved calibration doesn't fit, so continuing with full calibration)", gFlowCalib->calibImageCount() + 1, gFlowCalib->calibImageCountMax());
+			} else if (captureRejected) {
+				snprintf((char *)statusBarMessage, STATUS_BAR_MESSAGE_BUFFER_LEN, "Capturing image %d/%d (%s)", gFlowCalib->calibImageCount() + 1, gFlowCalib->calibImageCountMax(), gFlowCalib->captureRejectReason().c_str());
+			} else {
+				snprintf((char *)statusBarMessage, STATUS_BAR_MESSAGE_BUFFER_LEN, "Capturing image %d/%d", gFlowCalib->calibImageCount() + 1, gFlowCalib->calibImageCountMax());
+			}
 			event = flowWaitForEvent();
 			if (gStop) break;
+			captureRejected = false;
 			if (event == EVENT_TOUCH) {
 
 				if (gFlowCalib->capture()) {
 			    	captureDoneSinceBackButtonLastPressed = true;
+				} else {
+					captureRejected = true;
 				}
 
 			} else if (event == EVENT_BACK_BUTTON) {
@@ -283,7 +354,22 @@ static void *flowThread(void *arg)
 		// Clear status bar.
 		statusBarMessage[0] = '\0';
 
-		if (gFlowCalib->calibImageCount() < gFlowCalib->calibImageCountMax()) {
+		if (reuseValidated) {
+
+            if (gReuseCallback) (*gReuseCallback)(&gReuseParam, reuseErrAvg, reuseErrMax, gReuseCallbackUserdata);
+            gFlowCalib->uncaptureAll(); // prepare for next run.
+
+			flowSetEventMask(EVENT_TOUCH);
+			flowStateSet(FLOW_STATE_DONE);
+			unsigned char *buf;
+			asprintf((char **)&buf, "Saved camera parameters validated and reused (error avg=%.3f, max=%.3f)", reuseErrAvg, reuseErrMax);
+			EdenMessageShow(buf);
+			free(buf);
+			flowWaitForEvent();
+			if (gStop) break;
+			EdenMessageHide();
+
+		} else if (gFlowCalib->calibImageCount() < gFlowCalib->calibImageCountMax()) {
 
 			flowSetEventMask(EVENT_TOUCH);
             flowStateSet(FLOW_STATE_DONE);
@@ -299,6 +385,7 @@ static void *flowThread(void *arg)
 			flowSetEventMask(EVENT_NONE);
 			flowStateSet(FLOW_STATE_CALIBRATING);
 			EdenMessageShow((const unsigned char *)"Calculating camera parameters...");
+			flowNotifyUpdate();
 			gFlowCalib->calib(&param, &err_min, &err_avg, &err_max);
     		EdenMessageHide();
 
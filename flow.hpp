@@ -45,6 +45,15 @@ extern unsigned char statusBarMessage[];
 // Called when the flow has completed and generated a calibration.
 typedef void (*FLOW_CALLBACK_t)(const ARParam *param, ARdouble err_min, ARdouble err_avg, ARdouble err_max, void *userdata);
 
+// Called from the flow thread when the flow state, status bar message, or on-screen message may have changed.
+typedef void (*FLOW_UPDATE_CALLBACK_t)(void *userdata);
+
+// Called when a calibration offered for reuse has been validated, with the reprojection error of the validation images.
+typedef void (*FLOW_REUSE_CALLBACK_t)(const ARParam *param, ARdouble err_avg, ARdouble err_max, void *userdata);
+
+// Number of images captured to validate a calibration offered for reuse.
+#define FLOW_REUSE_VALIDATION_IMAGE_COUNT 3
+
 typedef enum {
 	FLOW_STATE_NOT_INITED = 0,
 	FLOW_STATE_WELCOME,
@@ -62,6 +71,17 @@ typedef enum {
 
 bool flowInitAndStart(Calibration *calib, FLOW_CALLBACK_t callback, void *callback_userdata);
 
+// Set a function to be notified of changes to what the flow is displaying, so that a redraw can be scheduled.
+// May be called before flowInitAndStart().
+void flowSetUpdateCallback(FLOW_UPDATE_CALLBACK_t updateCallback, void *updateCallback_userdata);
+
+// Offer an existing calibration for reuse, or withdraw the offer if param is NULL. While an offer stands, the first
+// FLOW_REUSE_VALIDATION_IMAGE_COUNT images of each run are used to validate it. If the average reprojection error of
+// the validation images is no more than errorMax, the run ends and reuseCallback is called. Otherwise, the run
+// continues as a full calibration, keeping the images already captured.
+// Must be called before flowInitAndStart().
+void flowSetReuseCandidate(const ARParam *param, ARdouble errorMax, FLOW_REUSE_CALLBACK_t reuseCallback, void *reuseCallback_userdata);
+
 FLOW_STATE flowStateGet();
 
 bool flowHandleEvent(const EVENT_t event);
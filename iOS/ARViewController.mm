@@ -58,6 +58,7 @@
 #include <ARX/ARG/shader_gl.h>
 
 #include "fileUploader.h"
+#include "calibrationUploadKey.h"
 #include "Calibration.hpp"
 #include "flow.hpp"
 #include "Eden/EdenMessage.h"
@@ -277,6 +278,11 @@ static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg,
         if (!fileUploadHandle) {
             ARLOGe("Error: Could not initialise fileUploadHandle.\n");
         }
+        char *csbuu = getPreferenceCalibrationServerBatchUploadURL(gPreferences);
+        fileUploaderSetBatchUploads(fileUploadHandle, csbuu, 0);
+        free(csbuu);
+        fileUploaderSetMaxBytesPerSecond(fileUploadHandle, getPreferenceCalibrationServerUploadMaxBytesPerSecond(gPreferences));
+        fileUploaderSetDedupKeyFunction(fileUploadHandle, calibrationUploadKey);
         fileUploaderTickle(fileUploadHandle);
     }
     
@@ -515,6 +521,13 @@ static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg,
             }
         }
     }
+    if (fileUploadHandle) {
+        char *csbuu = getPreferenceCalibrationServerBatchUploadURL(gPreferences);
+        fileUploaderSetBatchUploads(fileUploadHandle, csbuu, 0);
+        free(csbuu);
+        fileUploaderSetMaxBytesPerSecond(fileUploadHandle, getPreferenceCalibrationServerUploadMaxBytesPerSecond(gPreferences));
+        fileUploaderSetDedupKeyFunction(fileUploadHandle, calibrationUploadKey);
+    }
     char *csat = getPreferenceCalibrationServerAuthenticationToken(gPreferences);
     if (csat && gCalibrationServerAuthenticationToken && strcmp(gCalibrationServerAuthenticationToken, csat) == 0) {
         free(csat);
@@ -50,6 +50,8 @@ static NSString *const kSettingCalibrationServerUploadCanonical = @"calibrationS
 static NSString *const kSettingCalibrationServerUploadUser = @"calibrationServerUploadUser";
 static NSString *const kSettingCalibrationServerUploadURL = @"calibrationServerUploadURL";
 static NSString *const kSettingCalibrationServerAuthenticationToken = @"calibrationServerAuthenticationToken";
+static NSString *const kSettingCalibrationServerBatchUploadURL = @"calibrationServerBatchUploadURL";
+static NSString *const kSettingCalibrationServerUploadMaxBytesPerSecond = @"calibrationServerUploadMaxBytesPerSecond";
 
 static NSString* const kCameraSourceFront = @"Front";
 static NSString* const kCameraSourceRear = @"Rear";
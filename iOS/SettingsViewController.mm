@@ -434,6 +434,26 @@ char *getPreferenceCalibrationServerAuthenticationToken(void *preferences)
 #endif
 }
 
+char *getPreferenceCalibrationServerBatchUploadURL(void *preferences)
+{
+#if defined(ARTOOLKITX_CSUU) && defined(ARTOOLKITX_CSAT)
+    return (NULL); // The canonical server takes one calibration per request.
+#else
+    NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+    
+    if (![defaults boolForKey:kSettingCalibrationServerUploadUser]) return (NULL);
+    NSString *csbuu = [defaults stringForKey:kSettingCalibrationServerBatchUploadURL]; // No UI; set with "defaults write".
+    if (csbuu.length != 0) return (strdup(csbuu.UTF8String));
+    return (NULL);
+#endif
+}
+
+long getPreferenceCalibrationServerUploadMaxBytesPerSecond(void *preferences)
+{
+    NSInteger maxBytesPerSecond = [[NSUserDefaults standardUserDefaults] integerForKey:kSettingCalibrationServerUploadMaxBytesPerSecond]; // No UI; set with "defaults write".
+    return (maxBytesPerSecond > 0 ? (long)maxBytesPerSecond : 0);
+}
+
 Calibration::CalibrationPatternType getPreferencesCalibrationPatternType(void *preferences)
 {
     Calibration::CalibrationPatternType patternType = CALIBRATION_PATTERN_TYPE_DEFAULT;
@@ -0,0 +1,125 @@
+/*
+ *  paramBuffer.c
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+
+#include "paramBuffer.h"
+
+#include <string.h>
+#include <stdint.h>
+
+static const int distFactorCount[PARAM_BUFFER_DIST_FUNCTION_VERSION_MAX + 1] = {0, 4, 5, 6, 9, 17};
+
+size_t paramBufferLen(int dist_function_version)
+{
+    if (dist_function_version < 1 || dist_function_version > PARAM_BUFFER_DIST_FUNCTION_VERSION_MAX) return (0);
+    return (sizeof(int32_t)*2 + sizeof(double)*(3*4 + distFactorCount[dist_function_version]));
+}
+
+static unsigned char *putInt32(unsigned char *p, int32_t i)
+{
+    uint32_t u = (uint32_t)i;
+    p[0] = (unsigned char)(u >> 24);
+    p[1] = (unsigned char)(u >> 16);
+    p[2] = (unsigned char)(u >> 8);
+    p[3] = (unsigned char)u;
+    return (p + 4);
+}
+
+static unsigned char *putDouble(unsigned char *p, double d)
+{
+    uint64_t u;
+    int i;
+    memcpy(&u, &d, sizeof(u));
+    for (i = 7; i >= 0; i--) {
+        p[i] = (unsigned char)u;
+        u >>= 8;
+    }
+    return (p + 8);
+}
+
+static const unsigned char *getInt32(const unsigned char *p, int *i_out)
+{
+    *i_out = (int)(int32_t)(((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3]);
+    return (p + 4);
+}
+
+static const unsigned char *getDouble(const unsigned char *p, ARdouble *d_out)
+{
+    uint64_t u = 0;
+    double d;
+    int i;
+    for (i = 0; i < 8; i++) u = (u << 8) | p[i];
+    memcpy(&d, &u, sizeof(d));
+    *d_out = (ARdouble)d;
+    return (p + 8);
+}
+
+size_t paramBufferWrite(const ARParam *param, unsigned char *buf, size_t bufLen)
+{
+    int i, j;
+
+    if (!param || !buf) return (0);
+    size_t len = paramBufferLen(param->dist_function_version);
+    if (!len || bufLen < len) return (0);
+
+    unsigned char *p = buf;
+    p = putInt32(p, param->xsize);
+    p = putInt32(p, param->ysize);
+    for (j = 0; j < 3; j++) for (i = 0; i < 4; i++) p = putDouble(p, (double)param->mat[j][i]);
+    for (i = 0; i < distFactorCount[param->dist_function_version]; i++) p = putDouble(p, (double)param->dist_factor[i]);
+
+    return (len);
+}
+
+bool paramBufferRead(const unsigned char *buf, size_t len, ARParam *param_out)
+{
+    int i, j, version;
+
+    if (!buf || !param_out) return (false);
+    for (version = PARAM_BUFFER_DIST_FUNCTION_VERSION_MAX; version >= 1; version--) {
+        if (paramBufferLen(version) == len) break;
+    }
+    if (version < 1) return (false);
+
+    memset(param_out, 0, sizeof(ARParam));
+    const unsigned char *p = buf;
+    p = getInt32(p, &(param_out->xsize));
+    p = getInt32(p, &(param_out->ysize));
+    for (j = 0; j < 3; j++) for (i = 0; i < 4; i++) p = getDouble(p, &(param_out->mat[j][i]));
+    for (i = 0; i < distFactorCount[version]; i++) p = getDouble(p, &(param_out->dist_factor[i]));
+    param_out->dist_function_version = version;
+
+    return (true);
+}
@@ -0,0 +1,71 @@
+/*
+ *  paramBuffer.h
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+
+#ifndef PARAMBUFFER_H
+#define PARAMBUFFER_H
+
+//
+// Reading and writing ARParam data in memory, in exactly the byte format of a camera parameters
+// file as written by arParamSave(), i.e. big-endian 32-bit xsize and ysize, followed by
+// big-endian doubles for mat[3][4] and then as many dist_factor values as the distortion
+// function version uses. The version is implied by the length.
+//
+
+#include <ARX/AR/ar.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PARAM_BUFFER_DIST_FUNCTION_VERSION_MAX 5
+#define PARAM_BUFFER_LEN_MAX 240 // Length of a version 5 parameter.
+
+// Length in bytes of a serialised parameter with the given distortion function version, or 0 if the version is not known.
+size_t paramBufferLen(int dist_function_version);
+
+// Serialise "param" into "buf". Returns the number of bytes written, or 0 in case of error.
+size_t paramBufferWrite(const ARParam *param, unsigned char *buf, size_t bufLen);
+
+// Deserialise a parameter from "buf", which must contain a single parameter exactly "len" bytes long.
+// Returns false in case of error.
+bool paramBufferRead(const unsigned char *buf, size_t len, ARParam *param_out);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // !PARAMBUFFER_H
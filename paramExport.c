@@ -0,0 +1,121 @@
+/*
+ *  paramExport.c
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+#include "paramExport.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+bool paramExportToOpenCV(const ARParam *param, double camera_matrix_out[3][3], double dist_coeffs_out[PARAM_EXPORT_DIST_COEFFS_MAX], int *dist_coeffs_count_out)
+{
+    double s;
+    int i, j, count;
+
+    if (!param || !camera_matrix_out || !dist_coeffs_out || !dist_coeffs_count_out) return (false);
+    if (param->dist_function_version == 5) {
+        count = 12;
+        s = (double)param->dist_factor[16];
+    } else if (param->dist_function_version == 4) {
+        count = 4;
+        s = (double)param->dist_factor[8];
+    } else {
+        return (false);
+    }
+    if (s == 0.0) return (false);
+
+    for (j = 0; j < 3; j++) for (i = 0; i < 3; i++) camera_matrix_out[j][i] = (double)param->mat[j][i];
+    // convParam() divided the focal terms by the size factor, which it keeps as the last distortion factor.
+    camera_matrix_out[0][0] *= s;
+    camera_matrix_out[0][1] *= s;
+    camera_matrix_out[1][0] *= s;
+    camera_matrix_out[1][1] *= s;
+
+    for (i = 0; i < count; i++) dist_coeffs_out[i] = (double)param->dist_factor[i];
+    *dist_coeffs_count_out = count;
+    return (true);
+}
+
+typedef struct {
+    char  *buf;
+    size_t len;
+    size_t used;
+    bool   overflow;
+} OUT_t;
+
+static void out(OUT_t *o, const char *format, ...)
+{
+    va_list ap;
+    if (o->overflow) return;
+    va_start(ap, format);
+    int n = vsnprintf(o->buf + o->used, o->len - o->used, format, ap);
+    va_end(ap);
+    if (n < 0 || (size_t)n >= o->len - o->used) o->overflow = true;
+    else o->used += (size_t)n;
+}
+
+static void outMatrix(OUT_t *o, PARAM_EXPORT_FORMAT format, const char *name, int rows, int cols, const double *data, bool last)
+{
+    int i;
+    if (format == PARAM_EXPORT_FORMAT_YAML) {
+        out(o, "%s: !!opencv-matrix\n   rows: %d\n   cols: %d\n   dt: d\n   data: [ ", name, rows, cols);
+        for (i = 0; i < rows*cols; i++) out(o, "%.17g%s", data[i], (i < rows*cols - 1 ? ", " : " ]\n"));
+    } else {
+        out(o, "    \"%s\": {\n        \"type_id\": \"opencv-matrix\",\n        \"rows\": %d,\n        \"cols\": %d,\n        \"dt\": \"d\",\n        \"data\": [ ", name, rows, cols);
+        for (i = 0; i < rows*cols; i++) out(o, "%.17g%s", data[i], (i < rows*cols - 1 ? ", " : " ]\n"));
+        out(o, "    }%s\n", (last ? "" : ","));
+    }
+}
+
+size_t paramExportWrite(const ARParam *param, PARAM_EXPORT_FORMAT format, char *buf, size_t bufLen)
+{
+    double cameraMatrix[3][3];
+    double distCoeffs[PARAM_EXPORT_DIST_COEFFS_MAX];
+    int distCoeffsCount;
+    OUT_t o = {buf, bufLen, 0, false};
+
+    if (!buf || !bufLen || !paramExportToOpenCV(param, cameraMatrix, distCoeffs, &distCoeffsCount)) return (0);
+    if (format == PARAM_EXPORT_FORMAT_YAML) {
+        out(&o, "%%YAML:1.0\n---\nimage_width: %d\nimage_height: %d\n", param->xsize, param->ysize);
+        outMatrix(&o, format, "camera_matrix", 3, 3, &cameraMatrix[0][0], false);
+        outMatrix(&o, format, "dist_coeffs", 1, distCoeffsCount, distCoeffs, true);
+    } else {
+        out(&o, "{\n    \"image_width\": %d,\n    \"image_height\": %d,\n", param->xsize, param->ysize);
+        outMatrix(&o, format, "camera_matrix", 3, 3, &cameraMatrix[0][0], false);
+        outMatrix(&o, format, "dist_coeffs", 1, distCoeffsCount, distCoeffs, true);
+        out(&o, "}\n");
+    }
+    return (o.overflow ? 0 : o.used);
+}
@@ -0,0 +1,72 @@
+/*
+ *  paramExport.h
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+#ifndef PARAMEXPORT_H
+#define PARAMEXPORT_H
+
+//
+// Conversion of camera parameters to OpenCV's camera matrix and distortion coefficients, and
+// formatting of them as OpenCV FileStorage YAML or JSON, readable with cv::FileStorage.
+//
+
+#include <ARX/AR/ar.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PARAM_EXPORT_DIST_COEFFS_MAX 12
+
+typedef enum {
+    PARAM_EXPORT_FORMAT_YAML,
+    PARAM_EXPORT_FORMAT_JSON
+} PARAM_EXPORT_FORMAT;
+
+// Recover the OpenCV camera matrix and distortion coefficients from "param", undoing the size factor
+// applied to the focal lengths when the parameters were made. Only distortion function versions 4
+// (k1, k2, p1, p2) and 5 (k1, k2, p1, p2, k3, k4, k5, k6, s1, s2, s3, s4) are OpenCV models.
+// Returns false if "param" has any other version.
+bool paramExportToOpenCV(const ARParam *param, double camera_matrix_out[3][3], double dist_coeffs_out[PARAM_EXPORT_DIST_COEFFS_MAX], int *dist_coeffs_count_out);
+
+// Format "param" as an OpenCV FileStorage document holding image_width, image_height, camera_matrix and
+// dist_coeffs. Returns the length of the document, which is nul-terminated, or 0 in case of error.
+size_t paramExportWrite(const ARParam *param, PARAM_EXPORT_FORMAT format, char *buf, size_t bufLen);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // !PARAMEXPORT_H
@@ -0,0 +1,313 @@
+/*
+ *  paramSaveQueue.c
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+#include "paramSaveQueue.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/param.h> // MAXPATHLEN
+
+#include "paramBuffer.h"
+#include "remapLUT.h"
+
+struct _PARAM_SAVE_QUEUE {
+    pthread_t         thread;
+    pthread_mutex_t   lock;
+    pthread_cond_t    notEmptyCond;
+    pthread_cond_t    notFullCond;  // Also signalled when the worker becomes idle.
+    PARAM_SAVE_JOB_t *jobs[PARAM_SAVE_QUEUE_LEN]; // Ring buffer.
+    int               head;
+    int               count;
+    bool              busy;         // The worker is writing a batch.
+    bool              stop;
+};
+
+PARAM_SAVE_JOB_t *paramSaveJobNew(const ARParam *param)
+{
+    if (!param) return (NULL);
+    PARAM_SAVE_JOB_t *job = (PARAM_SAVE_JOB_t *)calloc(1, sizeof(PARAM_SAVE_JOB_t));
+    if (!job) {
+        ARLOGe("Out of memory!\n");
+        return (NULL);
+    }
+    job->param = *param;
+    return (job);
+}
+
+void paramSaveJobFree(PARAM_SAVE_JOB_t **job_p)
+{
+    if (!job_p || !*job_p) return;
+    free((*job_p)->savePathname);
+    free((*job_p)->lutPathname);
+    free((*job_p)->cacheDir);
+    free((char *)(*job_p)->cacheKey.deviceID);
+    free((char *)(*job_p)->cacheKey.focalLength);
+    uploadJournalEntryFree(&((*job_p)->uploadEntry));
+    free(*job_p);
+    *job_p = NULL;
+}
+
+static bool writeFully(int fd, const void *buf, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return (false);
+        p += n;
+        len -= (size_t)n;
+    }
+    return (true);
+}
+
+// Create (or replace) "pathname" and write "buf" to it. Returns the open file, or -1 in case of error.
+static int writeNewFile(const char *pathname, const void *buf, size_t len)
+{
+    int fd = open(pathname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) return (-1);
+    if (!writeFully(fd, buf, len)) {
+        close(fd);
+        return (-1);
+    }
+    return (fd);
+}
+
+// Generate the remap table for "job" and write it. Returns the open file, or -1 in case of error.
+static int writeLUT(const PARAM_SAVE_JOB_t *job)
+{
+    int fd = -1;
+    REMAP_LUT_t *lut = remapLUTCreate(&job->param, REMAP_LUT_OBSERV2IDEAL, job->lutGridStep, 0);
+    if (!lut) return (-1);
+    size_t len = remapLUTBufferLen(lut);
+    unsigned char *buf = (unsigned char *)malloc(len);
+    if (!buf) {
+        ARLOGe("Out of memory!\n");
+    } else {
+        if (remapLUTBufferWrite(lut, buf, len)) fd = writeNewFile(job->lutPathname, buf, len);
+        free(buf);
+    }
+    remapLUTFree(&lut);
+    return (fd);
+}
+
+// Sync the directory containing "pathname", so that creation of the file is durable.
+static void syncParentDir(const char *pathname)
+{
+    char dir[MAXPATHLEN];
+    const char *sep = strrchr(pathname, '/');
+    if (!sep) snprintf(dir, sizeof(dir), ".");
+    else if (sep == pathname) snprintf(dir, sizeof(dir), "/");
+    else snprintf(dir, sizeof(dir), "%.*s", (int)(sep - pathname), pathname);
+    int dirfd = open(dir, O_RDONLY);
+    if (dirfd != -1) {
+        fsync(dirfd); // Not supported by all filesystems, so ignore errors.
+        close(dirfd);
+    }
+}
+
+static void saveBatch(PARAM_SAVE_JOB_t **jobs, int count)
+{
+    int fds[PARAM_SAVE_QUEUE_LEN];
+    int lutFds[PARAM_SAVE_QUEUE_LEN];
+    FILE_UPLOAD_HANDLE_t *uploaders[PARAM_SAVE_QUEUE_LEN];
+    int uploaderCount = 0;
+    int i, j;
+
+    // Write everything first.
+    for (i = 0; i < count; i++) {
+        PARAM_SAVE_JOB_t *job = jobs[i];
+        fds[i] = lutFds[i] = -1;
+
+        if (job->savePathname) {
+            unsigned char paramBuf[PARAM_BUFFER_LEN_MAX];
+            size_t paramBufLen = paramBufferWrite(&job->param, paramBuf, sizeof(paramBuf));
+            if (!paramBufLen) {
+                ARLOGe("Error serialising camera parameters.\n");
+            } else if ((fds[i] = writeNewFile(job->savePathname, paramBuf, paramBufLen)) == -1) {
+                ARLOGe("Error saving calibration to '%s'", job->savePathname);
+                ARLOGperror(NULL);
+            }
+        }
+
+        if (job->lutPathname) {
+            if ((lutFds[i] = writeLUT(job)) == -1) {
+                ARLOGe("Error saving remap table to '%s'.\n", job->lutPathname);
+            }
+        }
+
+        if (job->cacheDir) {
+            calibrationCachePut(job->cacheDir, &job->cacheKey, &job->param, job->err_avg, false);
+        }
+
+        if (job->uploader && job->uploadEntry) {
+            if (!fileUploaderEnqueue(job->uploader, job->uploadEntry)) {
+                ARLOGe("Error queueing calibration for upload.\n");
+            } else {
+                for (j = 0; j < uploaderCount && uploaders[j] != job->uploader; j++);
+                if (j == uploaderCount) uploaders[uploaderCount++] = job->uploader;
+            }
+        }
+    }
+
+    // Then make it durable in one batch.
+    for (i = 0; i < count; i++) {
+        if (fds[i] == -1) continue;
+        if (fsync(fds[i]) < 0 || close(fds[i]) < 0) {
+            ARLOGe("Error saving calibration to '%s'", jobs[i]->savePathname);
+            ARLOGperror(NULL);
+        } else {
+            syncParentDir(jobs[i]->savePathname);
+            ARLOGi("Saved calibration to '%s'.\n", jobs[i]->savePathname);
+        }
+    }
+    for (i = 0; i < count; i++) {
+        if (lutFds[i] == -1) continue;
+        if (fsync(lutFds[i]) < 0 || close(lutFds[i]) < 0) {
+            ARLOGe("Error saving remap table to '%s'", jobs[i]->lutPathname);
+            ARLOGperror(NULL);
+        } else {
+            syncParentDir(jobs[i]->lutPathname);
+            ARLOGi("Saved remap table to '%s'.\n", jobs[i]->lutPathname);
+        }
+    }
+    for (j = 0; j < uploaderCount; j++) fileUploaderSync(uploaders[j]);
+}
+
+static void *paramSaveThread(void *arg)
+{
+    PARAM_SAVE_QUEUE_t *queue = (PARAM_SAVE_QUEUE_t *)arg;
+    PARAM_SAVE_JOB_t *batch[PARAM_SAVE_QUEUE_LEN];
+    int i, count;
+
+    pthread_mutex_lock(&queue->lock);
+    while (1) {
+        while (!queue->count && !queue->stop) pthread_cond_wait(&queue->notEmptyCond, &queue->lock);
+        if (!queue->count) break; // Stopping, and all jobs done.
+
+        // Take all waiting jobs.
+        count = queue->count;
+        for (i = 0; i < count; i++) batch[i] = queue->jobs[(queue->head + i) % PARAM_SAVE_QUEUE_LEN];
+        queue->head = (queue->head + count) % PARAM_SAVE_QUEUE_LEN;
+        queue->count = 0;
+        queue->busy = true;
+        pthread_cond_broadcast(&queue->notFullCond);
+        pthread_mutex_unlock(&queue->lock);
+
+        saveBatch(batch, count);
+        for (i = 0; i < count; i++) paramSaveJobFree(&batch[i]);
+
+        pthread_mutex_lock(&queue->lock);
+        queue->busy = false;
+        pthread_cond_broadcast(&queue->notFullCond);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return (NULL);
+}
+
+PARAM_SAVE_QUEUE_t *paramSaveQueueInit(void)
+{
+    PARAM_SAVE_QUEUE_t *queue = (PARAM_SAVE_QUEUE_t *)calloc(1, sizeof(PARAM_SAVE_QUEUE_t));
+    if (!queue) {
+        ARLOGe("Out of memory!\n");
+        return (NULL);
+    }
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->notEmptyCond, NULL);
+    pthread_cond_init(&queue->notFullCond, NULL);
+    if (pthread_create(&queue->thread, NULL, paramSaveThread, queue) != 0) {
+        ARLOGe("Error creating save thread.\n");
+        pthread_cond_destroy(&queue->notFullCond);
+        pthread_cond_destroy(&queue->notEmptyCond);
+        pthread_mutex_destroy(&queue->lock);
+        free(queue);
+        return (NULL);
+    }
+    return (queue);
+}
+
+void paramSaveQueueFinal(PARAM_SAVE_QUEUE_t **queue_p)
+{
+    if (!queue_p || !*queue_p) return;
+    PARAM_SAVE_QUEUE_t *queue = *queue_p;
+
+    pthread_mutex_lock(&queue->lock);
+    queue->stop = true;
+    pthread_cond_signal(&queue->notEmptyCond);
+    pthread_cond_broadcast(&queue->notFullCond);
+    pthread_mutex_unlock(&queue->lock);
+    pthread_join(queue->thread, NULL);
+
+    pthread_cond_destroy(&queue->notFullCond);
+    pthread_cond_destroy(&queue->notEmptyCond);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue);
+    *queue_p = NULL;
+}
+
+void paramSaveQueueWait(PARAM_SAVE_QUEUE_t *queue)
+{
+    if (!queue) return;
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count || queue->busy) pthread_cond_wait(&queue->notFullCond, &queue->lock);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+bool paramSaveQueueSubmit(PARAM_SAVE_QUEUE_t *queue, PARAM_SAVE_JOB_t **job_p)
+{
+    if (!job_p || !*job_p) return (false);
+    if (!queue) {
+        paramSaveJobFree(job_p);
+        return (false);
+    }
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == PARAM_SAVE_QUEUE_LEN && !queue->stop) pthread_cond_wait(&queue->notFullCond, &queue->lock);
+    if (queue->stop) {
+        pthread_mutex_unlock(&queue->lock);
+        ARLOGe("Error: save queue is stopping.\n");
+        paramSaveJobFree(job_p);
+        return (false);
+    }
+    queue->jobs[(queue->head + queue->count) % PARAM_SAVE_QUEUE_LEN] = *job_p;
+    queue->count++;
+    *job_p = NULL;
+    pthread_cond_signal(&queue->notEmptyCond);
+    pthread_mutex_unlock(&queue->lock);
+    return (true);
+}
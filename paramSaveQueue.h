@@ -0,0 +1,98 @@
+/*
+ *  paramSaveQueue.h
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+#ifndef PARAMSAVEQUEUE_H
+#define PARAMSAVEQUEUE_H
+
+//
+// Saving of calibration results on a background I/O thread, so that the calibration flow can move on
+// as soon as the parameters are calculated.
+//
+// Each job carries the parameters and up to four destinations: a camera parameters file, a remap table
+// file (see remapLUT.h), the local calibration cache (see calibrationCache.h), and the upload queue. The
+// parameters are serialised once and written straight to each destination. The worker takes all the
+// jobs waiting each time it wakes, writes them, and then syncs the files and the upload journal
+// together, so a burst of saves costs a single batch of fsync() calls. Cache entries are not synced,
+// since losing one only costs a full calibration.
+//
+// The queue holds up to PARAM_SAVE_QUEUE_LEN jobs. Submitting to a full queue waits for space.
+//
+
+#include <ARX/AR/ar.h>
+#include <stdbool.h>
+#include "calibrationCache.h"
+#include "fileUploader.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PARAM_SAVE_QUEUE_LEN 4
+
+typedef struct {
+    ARParam                 param;
+    char                   *savePathname;   // If non-NULL, the parameters are saved to this file.
+    char                   *lutPathname;    // If non-NULL, a remap table is generated and saved to this file.
+    int                     lutGridStep;    // For the remap table, as for remapLUTCreate().
+    char                   *cacheDir;       // If non-NULL, the parameters are cached under cacheKey.
+    CALIBRATION_CACHE_KEY_t cacheKey;       // Strings are allocated, and freed with the job.
+    ARdouble                err_avg;        // For the cache.
+    FILE_UPLOAD_HANDLE_t   *uploader;       // If non-NULL, uploadEntry is queued with this uploader.
+    UPLOAD_JOURNAL_ENTRY_t *uploadEntry;    // Freed with the job.
+} PARAM_SAVE_JOB_t;
+
+typedef struct _PARAM_SAVE_QUEUE PARAM_SAVE_QUEUE_t;
+
+// Start the queue and its worker thread. Returns NULL in case of error.
+PARAM_SAVE_QUEUE_t *paramSaveQueueInit(void);
+
+// Complete all queued jobs, then stop the worker thread and free the queue.
+void paramSaveQueueFinal(PARAM_SAVE_QUEUE_t **queue_p);
+
+// Wait until all queued jobs are complete, e.g. before finalising an uploader that jobs refer to.
+void paramSaveQueueWait(PARAM_SAVE_QUEUE_t *queue);
+
+// Create a job saving "param" to no destinations. Returns NULL in case of error.
+PARAM_SAVE_JOB_t *paramSaveJobNew(const ARParam *param);
+
+void paramSaveJobFree(PARAM_SAVE_JOB_t **job_p);
+
+// Queue a job. The queue takes ownership of the job, and *job_p is set to NULL, even in case of error.
+bool paramSaveQueueSubmit(PARAM_SAVE_QUEUE_t *queue, PARAM_SAVE_JOB_t **job_p);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // !PARAMSAVEQUEUE_H
@@ -53,6 +53,9 @@ char *getPreferenceCameraResolutionToken(void *preferences);
 bool getPreferenceCalibrationSave(void *preferences);
 char *getPreferenceCalibrationServerUploadURL(void *preferences);
 char *getPreferenceCalibrationServerAuthenticationToken(void *preferences);
+char *getPreferenceCalibrationServerBatchUploadURL(void *preferences); // NULL unless the server accepts batch uploads.
+long getPreferenceCalibrationServerUploadMaxBytesPerSecond(void *preferences); // 0 for no limit.
+int getPreferenceCalibrationRemapLUTGridStep(void *preferences); // 0 if no remap table is to be saved with the calibration.
 Calibration::CalibrationPatternType getPreferencesCalibrationPatternType(void *preferences);
 cv::Size getPreferencesCalibrationPatternSize(void *preferences);
 float getPreferencesCalibrationPatternSpacing(void *preferences);
@@ -64,6 +64,9 @@ typedef struct {
     config_setting_t *settingCalibrationUpload;
     config_setting_t *settingCSUU;
     config_setting_t *settingCSAT;
+    config_setting_t *settingCSBUU;
+    config_setting_t *settingCSUMBPS;
+    config_setting_t *settingRemapLUTGridStep;
     config_setting_t *settingCalibrationPatternType;
     config_setting_t *settingCalibrationPatternSizeWidth;
     config_setting_t *settingCalibrationPatternSizeHeight;
@@ -76,6 +79,9 @@ static const char *kSettingCalibSaveDir = "calibSaveDir";
 static const char *kSettingCalibrationUpload = "calibrationUpload";
 static const char *kSettingCalibrationServerUploadURL = "calibrationServerUploadURL";
 static const char *kSettingCalibrationServerAuthenticationToken = "calibrationServerAuthenticationToken";
+static const char *kSettingCalibrationServerBatchUploadURL = "calibrationServerBatchUploadURL";
+static const char *kSettingCalibrationServerUploadMaxBytesPerSecond = "calibrationServerUploadMaxBytesPerSecond";
+static const char *kSettingCalibrationRemapLUTGridStep = "calibrationRemapLUTGridStep";
 static const char *kSettingCalibrationPatternType = "calibrationPatternType";
 static const char *kSettingCalibrationPatternSizeWidth = "calibrationPatternSizeWidth";
 static const char *kSettingCalibrationPatternSizeHeight = "calibrationPatternSizeHeight";
@@ -121,6 +127,9 @@ void *initPreferences(void)
         prefs->settingCalibrationUpload = config_setting_get_member(root, kSettingCalibrationUpload);
         prefs->settingCSUU = config_setting_get_member(root, kSettingCalibrationServerUploadURL);
         prefs->settingCSAT = config_setting_get_member(root, kSettingCalibrationServerAuthenticationToken);
+        prefs->settingCSBUU = config_setting_get_member(root, kSettingCalibrationServerBatchUploadURL);
+        prefs->settingCSUMBPS = config_setting_get_member(root, kSettingCalibrationServerUploadMaxBytesPerSecond);
+        prefs->settingRemapLUTGridStep = config_setting_get_member(root, kSettingCalibrationRemapLUTGridStep);
         prefs->settingCalibrationPatternType = config_setting_get_member(root, kSettingCalibrationPatternType);
         prefs->settingCalibrationPatternSizeWidth = config_setting_get_member(root, kSettingCalibrationPatternSizeWidth);
         prefs->settingCalibrationPatternSizeHeight = config_setting_get_member(root, kSettingCalibrationPatternSizeHeight);
@@ -137,6 +146,9 @@ void *initPreferences(void)
     }
     if (!prefs->settingCSUU) prefs->settingCSUU = config_setting_add(root, kSettingCalibrationServerUploadURL, CONFIG_TYPE_STRING);
     if (!prefs->settingCSAT) prefs->settingCSAT = config_setting_add(root, kSettingCalibrationServerAuthenticationToken, CONFIG_TYPE_STRING);
+    if (!prefs->settingCSBUU) prefs->settingCSBUU = config_setting_add(root, kSettingCalibrationServerBatchUploadURL, CONFIG_TYPE_STRING); // Set only by editing the config file.
+    if (!prefs->settingCSUMBPS) prefs->settingCSUMBPS = config_setting_add(root, kSettingCalibrationServerUploadMaxBytesPerSecond, CONFIG_TYPE_INT); // Set only by editing the config file.
+    if (!prefs->settingRemapLUTGridStep) prefs->settingRemapLUTGridStep = config_setting_add(root, kSettingCalibrationRemapLUTGridStep, CONFIG_TYPE_INT); // Set only by editing the config file.
     if (!prefs->settingCalibrationPatternType) prefs->settingCalibrationPatternType = config_setting_add(root, kSettingCalibrationPatternType, CONFIG_TYPE_STRING);
     if (!prefs->settingCalibrationPatternSizeWidth) prefs->settingCalibrationPatternSizeWidth = config_setting_add(root, kSettingCalibrationPatternSizeWidth, CONFIG_TYPE_INT);
     if (!prefs->settingCalibrationPatternSizeHeight) prefs->settingCalibrationPatternSizeHeight = config_setting_add(root, kSettingCalibrationPatternSizeHeight, CONFIG_TYPE_INT);
@@ -532,6 +544,36 @@ char *getPreferenceCalibrationServerAuthenticationToken(void *preferences)
 #endif
 }
 
+char *getPreferenceCalibrationServerBatchUploadURL(void *preferences)
+{
+    prefsLibConfig_t *prefs = (prefsLibConfig_t *)preferences;
+    if (!prefs) return NULL;
+    
+    bool uploadOn = config_setting_get_bool(prefs->settingCalibrationUpload);
+    if (!uploadOn) return (NULL);
+    const char *s = config_setting_get_string(prefs->settingCSBUU);
+    if (s && s[0]) return strdup(s);
+    return (NULL);
+}
+
+long getPreferenceCalibrationServerUploadMaxBytesPerSecond(void *preferences)
+{
+    prefsLibConfig_t *prefs = (prefsLibConfig_t *)preferences;
+    if (!prefs) return 0;
+    
+    int maxBytesPerSecond = config_setting_get_int(prefs->settingCSUMBPS);
+    return (maxBytesPerSecond > 0 ? (long)maxBytesPerSecond : 0);
+}
+
+int getPreferenceCalibrationRemapLUTGridStep(void *preferences)
+{
+    prefsLibConfig_t *prefs = (prefsLibConfig_t *)preferences;
+    if (!prefs) return 0;
+    
+    int gridStep = config_setting_get_int(prefs->settingRemapLUTGridStep);
+    return (gridStep > 0 ? gridStep : 0);
+}
+
 Calibration::CalibrationPatternType getPreferencesCalibrationPatternType(void *preferences)
 {
     Calibration::CalibrationPatternType patternType = CALIBRATION_PATTERN_TYPE_DEFAULT;
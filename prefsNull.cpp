@@ -80,6 +80,21 @@ char *getPreferenceCalibrationServerAuthenticationToken(void *preferences)
     return NULL;
 }
 
+char *getPreferenceCalibrationServerBatchUploadURL(void *preferences)
+{
+    return NULL;
+}
+
+long getPreferenceCalibrationServerUploadMaxBytesPerSecond(void *preferences)
+{
+    return 0;
+}
+
+int getPreferenceCalibrationRemapLUTGridStep(void *preferences)
+{
+    return 0;
+}
+
 Calibration::CalibrationPatternType getPreferencesCalibrationPatternType(void *preferences)
 {
     return CALIBRATION_PATTERN_TYPE_DEFAULT;
@@ -0,0 +1,378 @@
+/*
+ *  remapLUT.c
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+#include "remapLUT.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h> // crc32()
+
+//
+// File layout. All values little-endian.
+//
+//   0: magic "ARXRMLUT"
+//   8: uint32 version
+//  12: uint32 CRC-32 of bytes 16 to end of file
+//  16: int32 xsize
+//  20: int32 ysize
+//  24: int32 direction
+//  28: int32 grid shift
+//  32: int32 fractional bits
+//  36: int32 grid width
+//  40: int32 grid height
+//  44: uint32 reserved, 0
+//  48: int16 (dx, dy) pairs
+//
+
+#define LUT_MAGIC "ARXRMLUT"
+#define LUT_VERSION 1
+#define LUT_HEADER_LEN 48
+#define LUT_GRID_SHIFT_MAX 6 // log2(REMAP_LUT_GRID_STEP_MAX).
+#define THREADS_MAX 64
+
+// Shared by the threads evaluating the model.
+typedef struct {
+    pthread_mutex_t lock;
+    const ARParam  *param;
+    int             direction;
+    int             gridShift;
+    int             gridWidth;
+    int             gridHeight;
+    int             nextRow;
+    float          *d;          // Unquantized displacements.
+    bool            failed;
+} LUT_BUILD_t;
+
+static void put32(unsigned char *p, uint32_t v) { int i; for (i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8*i)); }
+static uint32_t get32(const unsigned char *p) { uint32_t v = 0; int i; for (i = 3; i >= 0; i--) v = (v << 8) | p[i]; return (v); }
+
+static void *buildThread(void *arg)
+{
+    LUT_BUILD_t *b = (LUT_BUILD_t *)arg;
+    ARdouble ox, oy;
+    int row, i;
+
+    while (1) {
+        pthread_mutex_lock(&b->lock);
+        row = (b->failed ? b->gridHeight : b->nextRow++);
+        pthread_mutex_unlock(&b->lock);
+        if (row >= b->gridHeight) break;
+
+        ARdouble y = (ARdouble)(row << b->gridShift);
+        float *d = b->d + (size_t)row*b->gridWidth*2;
+        for (i = 0; i < b->gridWidth; i++) {
+            ARdouble x = (ARdouble)(i << b->gridShift);
+            int ret;
+            if (b->direction == REMAP_LUT_OBSERV2IDEAL) ret = arParamObserv2Ideal(b->param->dist_factor, x, y, &ox, &oy, b->param->dist_function_version);
+            else ret = arParamIdeal2Observ(b->param->dist_factor, x, y, &ox, &oy, b->param->dist_function_version);
+            if (ret < 0 || !isfinite(ox) || !isfinite(oy)) {
+                pthread_mutex_lock(&b->lock);
+                b->failed = true;
+                pthread_mutex_unlock(&b->lock);
+                return (NULL);
+            }
+            d[i*2] = (float)(ox - x);
+            d[i*2 + 1] = (float)(oy - y);
+        }
+    }
+    return (NULL);
+}
+
+static REMAP_LUT_t *lutAlloc(int xsize, int ysize, int direction, int gridShift)
+{
+    REMAP_LUT_t *lut = (REMAP_LUT_t *)calloc(1, sizeof(REMAP_LUT_t));
+    if (!lut) return (NULL);
+    lut->xsize = xsize;
+    lut->ysize = ysize;
+    lut->direction = direction;
+    lut->gridShift = gridShift;
+    // One grid point beyond the last pixel, unless the last pixel falls on the grid, so every pixel has neighbours to interpolate between.
+    lut->gridWidth = ((xsize - 1 + (1 << gridShift) - 1) >> gridShift) + 1;
+    lut->gridHeight = ((ysize - 1 + (1 << gridShift) - 1) >> gridShift) + 1;
+    if (!(lut->d = (int16_t *)malloc((size_t)lut->gridWidth*lut->gridHeight*2*sizeof(int16_t)))) {
+        free(lut);
+        return (NULL);
+    }
+    return (lut);
+}
+
+REMAP_LUT_t *remapLUTCreate(const ARParam *param, REMAP_LUT_DIRECTION direction, int gridStep, int threadCount)
+{
+    LUT_BUILD_t b;
+    pthread_t threads[THREADS_MAX];
+    REMAP_LUT_t *lut = NULL;
+    int gridShift, i;
+
+    if (!param || param->xsize <= 0 || param->ysize <= 0) return (NULL);
+    if (direction != REMAP_LUT_OBSERV2IDEAL && direction != REMAP_LUT_IDEAL2OBSERV) return (NULL);
+    for (gridShift = 0; gridShift < LUT_GRID_SHIFT_MAX && (1 << gridShift) < gridStep; gridShift++);
+    if (gridStep <= 0 || (1 << gridShift) != gridStep) {
+        ARLOGe("Error: remap table grid step must be a power of 2 from 1 to %d.\n", REMAP_LUT_GRID_STEP_MAX);
+        return (NULL);
+    }
+    if (!(lut = lutAlloc(param->xsize, param->ysize, direction, gridShift))) {
+        ARLOGe("Out of memory!\n");
+        return (NULL);
+    }
+
+    memset(&b, 0, sizeof(b));
+    b.param = param;
+    b.direction = direction;
+    b.gridShift = gridShift;
+    b.gridWidth = lut->gridWidth;
+    b.gridHeight = lut->gridHeight;
+    size_t count = (size_t)lut->gridWidth*lut->gridHeight*2;
+    if (!(b.d = (float *)malloc(count*sizeof(float)))) {
+        ARLOGe("Out of memory!\n");
+        remapLUTFree(&lut);
+        return (NULL);
+    }
+    pthread_mutex_init(&b.lock, NULL);
+
+    if (threadCount <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threadCount = (cpus > 0 ? (int)cpus : 1);
+    }
+    if (threadCount > THREADS_MAX) threadCount = THREADS_MAX;
+    if (threadCount > lut->gridHeight) threadCount = lut->gridHeight;
+    for (i = 0; i < threadCount; i++) {
+        if (pthread_create(&threads[i], NULL, buildThread, &b) != 0) break;
+    }
+    threadCount = i;
+    if (!threadCount) buildThread(&b); // Do it on this thread instead.
+    for (i = 0; i < threadCount; i++) pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&b.lock);
+    if (b.failed) {
+        ARLOGe("Error: distortion model could not be evaluated over the whole image.\n");
+        goto bail;
+    }
+
+    // Use as many fractional bits as the largest displacement allows.
+    float dMax = 0.0f;
+    for (i = 0; i < (int)count; i++) if (fabsf(b.d[i]) > dMax) dMax = fabsf(b.d[i]);
+    for (lut->fracBits = REMAP_LUT_FRAC_BITS_MAX; lut->fracBits >= 0 && dMax*(float)(1 << lut->fracBits) >= 32767.0f; lut->fracBits--);
+    if (lut->fracBits < 0) {
+        ARLOGe("Error: distortion displacement of %.0f pixels is too large for a remap table.\n", dMax);
+        goto bail;
+    }
+    float scale = (float)(1 << lut->fracBits);
+    for (i = 0; i < (int)count; i++) lut->d[i] = (int16_t)lrintf(b.d[i]*scale);
+
+    free(b.d);
+    return (lut);
+
+bail:
+    free(b.d);
+    remapLUTFree(&lut);
+    return (NULL);
+}
+
+void remapLUTFree(REMAP_LUT_t **lut_p)
+{
+    if (!lut_p || !*lut_p) return;
+    free((*lut_p)->d);
+    free(*lut_p);
+    *lut_p = NULL;
+}
+
+// Bilinear interpolation between the four grid points around a pixel, all in integer arithmetic.
+// The result is in units of 1/(1 << (fracBits + 2*gridShift)) pixel.
+static inline void interpolate(const REMAP_LUT_t *lut, int x, int y, int32_t *dx, int32_t *dy)
+{
+    int step = 1 << lut->gridShift;
+    int gx = x >> lut->gridShift, fx = x & (step - 1);
+    int gy = y >> lut->gridShift, fy = y & (step - 1);
+    const int16_t *d0 = lut->d + ((size_t)gy*lut->gridWidth + gx)*2;
+    // Pixels on a grid line may lie on the last one, so don't step past it.
+    const int16_t *d1 = (fy ? d0 + (size_t)lut->gridWidth*2 : d0);
+    int n = (fx ? 2 : 0);
+    int32_t w00 = (step - fx)*(step - fy), w10 = fx*(step - fy), w01 = (step - fx)*fy, w11 = fx*fy;
+    *dx = w00*d0[0] + w10*d0[n] + w01*d1[0] + w11*d1[n];
+    *dy = w00*d0[1] + w10*d0[n + 1] + w01*d1[1] + w11*d1[n + 1];
+}
+
+bool remapLUTLookup(const REMAP_LUT_t *lut, int x, int y, float *ox, float *oy)
+{
+    int32_t dx, dy;
+
+    if (!lut || x < 0 || x >= lut->xsize || y < 0 || y >= lut->ysize || !ox || !oy) return (false);
+    interpolate(lut, x, y, &dx, &dy);
+    float scale = 1.0f/(float)(1 << (lut->fracBits + 2*lut->gridShift));
+    *ox = (float)x + (float)dx*scale;
+    *oy = (float)y + (float)dy*scale;
+    return (true);
+}
+
+bool remapLUTLookupRow(const REMAP_LUT_t *lut, int y, float *xy_out)
+{
+    int x, i;
+
+    if (!lut || y < 0 || y >= lut->ysize || !xy_out) return (false);
+    int32_t *v = (int32_t *)malloc((size_t)lut->gridWidth*2*sizeof(int32_t));
+    if (!v) {
+        ARLOGe("Out of memory!\n");
+        return (false);
+    }
+
+    // Interpolate down the grid columns once, so that each pixel only needs to interpolate across.
+    int step = 1 << lut->gridShift;
+    int gy = y >> lut->gridShift, fy = y & (step - 1);
+    const int16_t *d0 = lut->d + (size_t)gy*lut->gridWidth*2;
+    const int16_t *d1 = (fy ? d0 + (size_t)lut->gridWidth*2 : d0);
+    for (i = 0; i < lut->gridWidth*2; i++) v[i] = (step - fy)*d0[i] + fy*d1[i];
+
+    float scale = 1.0f/(float)(1 << (lut->fracBits + 2*lut->gridShift));
+    for (x = 0; x < lut->xsize; x++) {
+        int gx = x >> lut->gridShift, fx = x & (step - 1);
+        const int32_t *v0 = v + gx*2;
+        int32_t dx = (step - fx)*v0[0], dy = (step - fx)*v0[1];
+        if (fx) {
+            dx += fx*v0[2];
+            dy += fx*v0[3];
+        }
+        xy_out[x*2] = (float)x + (float)dx*scale;
+        xy_out[x*2 + 1] = (float)y + (float)dy*scale;
+    }
+    free(v);
+    return (true);
+}
+
+size_t remapLUTBufferLen(const REMAP_LUT_t *lut)
+{
+    if (!lut) return (0);
+    return (LUT_HEADER_LEN + (size_t)lut->gridWidth*lut->gridHeight*2*sizeof(int16_t));
+}
+
+size_t remapLUTBufferWrite(const REMAP_LUT_t *lut, unsigned char *buf, size_t bufLen)
+{
+    size_t len = remapLUTBufferLen(lut), i;
+
+    if (!len || !buf || bufLen < len) return (0);
+    memcpy(buf, LUT_MAGIC, 8);
+    put32(buf + 8, LUT_VERSION);
+    put32(buf + 16, (uint32_t)lut->xsize);
+    put32(buf + 20, (uint32_t)lut->ysize);
+    put32(buf + 24, (uint32_t)lut->direction);
+    put32(buf + 28, (uint32_t)lut->gridShift);
+    put32(buf + 32, (uint32_t)lut->fracBits);
+    put32(buf + 36, (uint32_t)lut->gridWidth);
+    put32(buf + 40, (uint32_t)lut->gridHeight);
+    put32(buf + 44, 0);
+    unsigned char *p = buf + LUT_HEADER_LEN;
+    for (i = 0; i < (size_t)lut->gridWidth*lut->gridHeight*2; i++) {
+        uint16_t v = (uint16_t)lut->d[i];
+        p[i*2] = (unsigned char)v;
+        p[i*2 + 1] = (unsigned char)(v >> 8);
+    }
+    put32(buf + 12, (uint32_t)crc32(0L, buf + 16, (uInt)(len - 16)));
+    return (len);
+}
+
+REMAP_LUT_t *remapLUTBufferRead(const unsigned char *buf, size_t bufLen)
+{
+    REMAP_LUT_t *lut;
+    size_t i;
+
+    if (!buf || bufLen < LUT_HEADER_LEN || memcmp(buf, LUT_MAGIC, 8) != 0 || get32(buf + 8) != LUT_VERSION) return (NULL);
+    int xsize = (int32_t)get32(buf + 16), ysize = (int32_t)get32(buf + 20);
+    int direction = (int32_t)get32(buf + 24), gridShift = (int32_t)get32(buf + 28), fracBits = (int32_t)get32(buf + 32);
+    int gridWidth = (int32_t)get32(buf + 36), gridHeight = (int32_t)get32(buf + 40);
+    if (direction != REMAP_LUT_OBSERV2IDEAL && direction != REMAP_LUT_IDEAL2OBSERV) return (NULL);
+    if (gridShift < 0 || gridShift > LUT_GRID_SHIFT_MAX || fracBits < 0 || fracBits > REMAP_LUT_FRAC_BITS_MAX) return (NULL);
+    // Check the sizes against each other and against the buffer before allocating anything.
+    if (xsize <= 0 || ysize <= 0 || xsize > INT32_MAX - REMAP_LUT_GRID_STEP_MAX || ysize > INT32_MAX - REMAP_LUT_GRID_STEP_MAX) return (NULL);
+    if (gridWidth != ((xsize - 1 + (1 << gridShift) - 1) >> gridShift) + 1 || gridHeight != ((ysize - 1 + (1 << gridShift) - 1) >> gridShift) + 1) return (NULL);
+    if ((uint64_t)bufLen != LUT_HEADER_LEN + (uint64_t)gridWidth*gridHeight*2*sizeof(int16_t)) return (NULL);
+    if (get32(buf + 12) != (uint32_t)crc32(0L, buf + 16, (uInt)(bufLen - 16))) return (NULL);
+    if (!(lut = lutAlloc(xsize, ysize, direction, gridShift))) return (NULL);
+    lut->fracBits = fracBits;
+    const unsigned char *p = buf + LUT_HEADER_LEN;
+    for (i = 0; i < (size_t)lut->gridWidth*lut->gridHeight*2; i++) lut->d[i] = (int16_t)(uint16_t)(p[i*2] | (p[i*2 + 1] << 8));
+    return (lut);
+}
+
+bool remapLUTSave(const char *pathname, const REMAP_LUT_t *lut)
+{
+    FILE *fp;
+    bool ok;
+
+    size_t len = remapLUTBufferLen(lut);
+    if (!pathname || !len) return (false);
+    unsigned char *buf = (unsigned char *)malloc(len);
+    if (!buf) {
+        ARLOGe("Out of memory!\n");
+        return (false);
+    }
+    remapLUTBufferWrite(lut, buf, len);
+    if (!(fp = fopen(pathname, "wb"))) {
+        ARLOGe("Error opening '%s' for writing.\n", pathname);
+        ARLOGperror(NULL);
+        free(buf);
+        return (false);
+    }
+    ok = (fwrite(buf, len, 1, fp) == 1);
+    if (fclose(fp) != 0) ok = false;
+    if (!ok) ARLOGe("Error writing '%s'.\n", pathname);
+    free(buf);
+    return (ok);
+}
+
+REMAP_LUT_t *remapLUTLoad(const char *pathname)
+{
+    FILE *fp;
+    long len;
+    REMAP_LUT_t *lut = NULL;
+
+    if (!pathname) return (NULL);
+    if (!(fp = fopen(pathname, "rb"))) {
+        ARLOGe("Error opening '%s'.\n", pathname);
+        ARLOGperror(NULL);
+        return (NULL);
+    }
+    if (fseek(fp, 0L, SEEK_END) == 0 && (len = ftell(fp)) > 0 && fseek(fp, 0L, SEEK_SET) == 0) {
+        unsigned char *buf = (unsigned char *)malloc((size_t)len);
+        if (buf) {
+            if (fread(buf, (size_t)len, 1, fp) == 1) lut = remapLUTBufferRead(buf, (size_t)len);
+            free(buf);
+        }
+    }
+    fclose(fp);
+    if (!lut) ARLOGe("Error: '%s' is not a valid remap table.\n", pathname);
+    return (lut);
+}
@@ -0,0 +1,98 @@
+/*
+ *  remapLUT.h
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+#ifndef REMAPLUT_H
+#define REMAPLUT_H
+
+//
+// Precomputed, quantized lookup tables of the camera distortion model, so that clients can build
+// undistortion maps without evaluating the model for every pixel. A table holds the displacement
+// between observed and ideal coordinates at every grid point, as 16-bit fixed-point values. With a grid
+// step greater than 1, displacements between grid points are bilinearly interpolated.
+//
+
+#include <ARX/AR/ar.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REMAP_LUT_GRID_STEP_MAX 64
+#define REMAP_LUT_FRAC_BITS_MAX 14
+
+typedef enum {
+    REMAP_LUT_OBSERV2IDEAL = 0, // Maps observed (distorted) pixels to ideal coordinates, as arParamObserv2Ideal().
+    REMAP_LUT_IDEAL2OBSERV = 1  // Maps ideal pixels to observed coordinates, as arParamIdeal2Observ(), e.g. for image remapping.
+} REMAP_LUT_DIRECTION;
+
+typedef struct {
+    int      xsize;
+    int      ysize;
+    int      direction;   // REMAP_LUT_DIRECTION.
+    int      gridShift;   // Grid points are every (1 << gridShift) pixels.
+    int      gridWidth;
+    int      gridHeight;
+    int      fracBits;    // Displacements are in units of 1/(1 << fracBits) pixel.
+    int16_t *d;           // gridWidth * gridHeight (dx, dy) pairs, row-major.
+} REMAP_LUT_t;
+
+// Evaluate the distortion model in "param" at every grid point, spreading the rows of the grid across
+// "threadCount" threads (0 for one per CPU). "gridStep" must be a power of 2 no greater than
+// REMAP_LUT_GRID_STEP_MAX; 1 gives a table entry for every pixel. Returns NULL in case of error.
+REMAP_LUT_t *remapLUTCreate(const ARParam *param, REMAP_LUT_DIRECTION direction, int gridStep, int threadCount);
+
+void remapLUTFree(REMAP_LUT_t **lut_p);
+
+// Look up pixel (x, y), which must lie inside the image. Returns false if it does not.
+bool remapLUTLookup(const REMAP_LUT_t *lut, int x, int y, float *ox, float *oy);
+
+// Look up every pixel in row "y", writing xsize (x, y) pairs to "xy_out".
+bool remapLUTLookupRow(const REMAP_LUT_t *lut, int y, float *xy_out);
+
+// Serialised form of a table, as saved by remapLUTSave().
+size_t remapLUTBufferLen(const REMAP_LUT_t *lut);
+size_t remapLUTBufferWrite(const REMAP_LUT_t *lut, unsigned char *buf, size_t bufLen);
+REMAP_LUT_t *remapLUTBufferRead(const unsigned char *buf, size_t bufLen);
+
+bool remapLUTSave(const char *pathname, const REMAP_LUT_t *lut);
+REMAP_LUT_t *remapLUTLoad(const char *pathname);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // !REMAPLUT_H
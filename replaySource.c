@@ -0,0 +1,377 @@
+/*
+ *  replaySource.c
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+#include "replaySource.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+
+#include <ARX/AR/ar.h>
+#include "sessionRecorder.h"
+
+// Synthetic frames.
+#define SYNTHETIC_BLACK 30
+#define SYNTHETIC_WHITE 225
+#define SYNTHETIC_BACKGROUND 100
+#define SYNTHETIC_NOISE 4            // Peak amplitude of noise added to each pixel.
+#define SYNTHETIC_TILT_MAX 35.0      // Maximum rotation of the board out of the image plane, in degrees, about each axis.
+#define SYNTHETIC_ROLL_MAX 25.0      // Maximum rotation of the board in the image plane, in degrees.
+#define SYNTHETIC_FILL_MIN 0.45      // Range of the fraction of the image width spanned by the board.
+#define SYNTHETIC_FILL_MAX 0.7
+#define SYNTHETIC_VIDEO_SIZE_MIN 16  // Smallest frame, in pixels, the board is drawn in.
+#define SYNTHETIC_BACKOFF_MAX 100    // Limit on the steps taken to back the camera off until the board is in view.
+
+struct _REPLAY_SOURCE {
+    int                  videoWidth;
+    int                  videoHeight;
+    int                  frameCount;
+    int                  patternType;
+    int                  patternWidth;
+    int                  patternHeight;
+    float                patternSpacing;
+    uint8_t             *frame;
+    float               *corners;
+    int                  next;
+    float                fps;
+    struct timespec      startTime;
+    // Recording.
+    SESSION_RECORDING_t *recording;
+    // Synthetic.
+    uint32_t             seed;
+};
+
+// A 3x3 homography, row-major.
+typedef struct {
+    double m[9];
+} HOMOGRAPHY_t;
+
+// Deterministic pseudo-random numbers, so that a synthetic frame depends only on seed and index.
+static uint32_t randomNext(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return (x);
+}
+
+static double randomUniform(uint32_t *state, double min, double max)
+{
+    return (min + (max - min)*(randomNext(state)/4294967296.0));
+}
+
+static uint32_t frameSeed(uint32_t seed, int index)
+{
+    uint32_t state = seed ^ ((uint32_t)index*0x9E3779B9u);
+    if (!state) state = 0x6D2B79F5u;
+    randomNext(&state);
+    return (state);
+}
+
+static bool homographyProject(const HOMOGRAPHY_t *h, double x, double y, double *u_out, double *v_out)
+{
+    double w = h->m[6]*x + h->m[7]*y + h->m[8];
+    if (w <= 0.0) return (false);
+    *u_out = (h->m[0]*x + h->m[1]*y + h->m[2])/w;
+    *v_out = (h->m[3]*x + h->m[4]*y + h->m[5])/w;
+    return (true);
+}
+
+static bool homographyInvert(const HOMOGRAPHY_t *h, HOMOGRAPHY_t *inv_out)
+{
+    const double *m = h->m;
+    double c0 = m[4]*m[8] - m[5]*m[7];
+    double c1 = m[5]*m[6] - m[3]*m[8];
+    double c2 = m[3]*m[7] - m[4]*m[6];
+    double det = m[0]*c0 + m[1]*c1 + m[2]*c2;
+    if (fabs(det) < 1e-12) return (false);
+    double *r = inv_out->m;
+    r[0] = c0/det; r[1] = (m[2]*m[7] - m[1]*m[8])/det; r[2] = (m[1]*m[5] - m[2]*m[4])/det;
+    r[3] = c1/det; r[4] = (m[0]*m[8] - m[2]*m[6])/det; r[5] = (m[2]*m[3] - m[0]*m[5])/det;
+    r[6] = c2/det; r[7] = (m[1]*m[6] - m[0]*m[7])/det; r[8] = (m[0]*m[4] - m[1]*m[3])/det;
+    return (true);
+}
+
+// Homography from the plane of the board, in units of squares with origin at the board centre, to
+// the image, for the pose of synthetic frame "index".
+static void syntheticHomography(const REPLAY_SOURCE_t *source, int index, HOMOGRAPHY_t *h_out)
+{
+    uint32_t state = frameSeed(source->seed, index);
+    double rx = randomUniform(&state, -SYNTHETIC_TILT_MAX, SYNTHETIC_TILT_MAX)*M_PI/180.0;
+    double ry = randomUniform(&state, -SYNTHETIC_TILT_MAX, SYNTHETIC_TILT_MAX)*M_PI/180.0;
+    double rz = randomUniform(&state, -SYNTHETIC_ROLL_MAX, SYNTHETIC_ROLL_MAX)*M_PI/180.0;
+    double fill = randomUniform(&state, SYNTHETIC_FILL_MIN, SYNTHETIC_FILL_MAX);
+    double jx = randomUniform(&state, -1.0, 1.0);
+    double jy = randomUniform(&state, -1.0, 1.0);
+
+    // R = Rz*Ry*Rx. Only the first two columns are needed for a plane at Z = 0.
+    double cx = cos(rx), sx = sin(rx), cy = cos(ry), sy = sin(ry), cz = cos(rz), sz = sin(rz);
+    double r1[3] = {cz*cy, sz*cy, -sy};
+    double r2[3] = {cz*sy*sx - sz*cx, sz*sy*sx + cz*cx, cy*sx};
+
+    // Nominal camera, as used by Calibration for pose estimation.
+    double f = (double)(source->videoWidth > source->videoHeight ? source->videoWidth : source->videoHeight);
+    double ppx = source->videoWidth/2.0, ppy = source->videoHeight/2.0;
+
+    // Board extent, including a one-square white border.
+    double halfW = (source->patternWidth + 3)/2.0, halfH = (source->patternHeight + 3)/2.0;
+    double z = f*(2.0*halfW)/(fill*source->videoWidth);
+    double t[3];
+    int backoff;
+    for (backoff = 0; ; backoff++) {
+        t[0] = jx*0.1*z*source->videoWidth/f;
+        t[1] = jy*0.1*z*source->videoHeight/f;
+        t[2] = z;
+        int i;
+        for (i = 0; i < 3; i++) {
+            h_out->m[i*3 + 0] = (i == 0 ? f*r1[0] + ppx*r1[2] : (i == 1 ? f*r1[1] + ppy*r1[2] : r1[2]));
+            h_out->m[i*3 + 1] = (i == 0 ? f*r2[0] + ppx*r2[2] : (i == 1 ? f*r2[1] + ppy*r2[2] : r2[2]));
+            h_out->m[i*3 + 2] = (i == 0 ? f*t[0] + ppx*t[2] : (i == 1 ? f*t[1] + ppy*t[2] : t[2]));
+        }
+        // Back the camera off until the whole board, with border, is in view.
+        bool inView = true;
+        for (i = 0; i < 4 && inView; i++) {
+            double u, v;
+            if (!homographyProject(h_out, (i & 1 ? halfW : -halfW), (i & 2 ? halfH : -halfH), &u, &v)) inView = false;
+            else if (u < 1.0 || v < 1.0 || u > source->videoWidth - 2.0 || v > source->videoHeight - 2.0) inView = false;
+        }
+        if (inView || backoff == SYNTHETIC_BACKOFF_MAX) break;
+        z *= 1.1;
+    }
+}
+
+static int syntheticCorners(REPLAY_SOURCE_t *source, int index)
+{
+    HOMOGRAPHY_t h;
+    int i, j;
+    double u, v;
+
+    syntheticHomography(source, index, &h);
+    for (j = 0; j < source->patternHeight; j++) {
+        for (i = 0; i < source->patternWidth; i++) {
+            homographyProject(&h, i + 1 - (source->patternWidth + 1)/2.0, j + 1 - (source->patternHeight + 1)/2.0, &u, &v);
+            source->corners[(j*source->patternWidth + i)*2] = (float)u;
+            source->corners[(j*source->patternWidth + i)*2 + 1] = (float)v;
+        }
+    }
+    return (source->patternWidth*source->patternHeight);
+}
+
+// Board intensity at a point in the plane of the board.
+static int syntheticSample(const REPLAY_SOURCE_t *source, const HOMOGRAPHY_t *inv, double x, double y)
+{
+    double bx, by;
+    if (!homographyProject(inv, x, y, &bx, &by)) return (SYNTHETIC_BACKGROUND);
+    // Squares are numbered from the top-left of the board, excluding the border.
+    double sx = bx + (source->patternWidth + 1)/2.0, sy = by + (source->patternHeight + 1)/2.0;
+    if (sx < -1.0 || sy < -1.0 || sx >= source->patternWidth + 2.0 || sy >= source->patternHeight + 2.0) return (SYNTHETIC_BACKGROUND);
+    if (sx < 0.0 || sy < 0.0 || sx >= source->patternWidth + 1.0 || sy >= source->patternHeight + 1.0) return (SYNTHETIC_WHITE);
+    return ((((int)sx + (int)sy) & 1) ? SYNTHETIC_WHITE : SYNTHETIC_BLACK);
+}
+
+static void syntheticRender(REPLAY_SOURCE_t *source, int index)
+{
+    HOMOGRAPHY_t h, inv;
+    int x, y;
+    uint32_t state = frameSeed(source->seed ^ 0xA5A5A5A5u, index);
+
+    syntheticHomography(source, index, &h);
+    homographyInvert(&h, &inv);
+    // 2x2 supersampling, for antialiased edges.
+    for (y = 0; y < source->videoHeight; y++) {
+        uint8_t *p = source->frame + y*source->videoWidth;
+        for (x = 0; x < source->videoWidth; x++) {
+            int sum = syntheticSample(source, &inv, x - 0.25, y - 0.25) + syntheticSample(source, &inv, x + 0.25, y - 0.25)
+                    + syntheticSample(source, &inv, x - 0.25, y + 0.25) + syntheticSample(source, &inv, x + 0.25, y + 0.25);
+            int value = sum/4 + (int)(randomNext(&state) % (2*SYNTHETIC_NOISE + 1)) - SYNTHETIC_NOISE;
+            p[x] = (uint8_t)(value < 0 ? 0 : (value > 255 ? 255 : value));
+        }
+    }
+}
+
+static REPLAY_SOURCE_t *replaySourceAlloc(int videoWidth, int videoHeight, int cornerCountMax)
+{
+    REPLAY_SOURCE_t *source;
+
+    if (!(source = (REPLAY_SOURCE_t *)calloc(1, sizeof(REPLAY_SOURCE_t)))) {
+        ARLOGe("Out of memory!\n");
+        return (NULL);
+    }
+    source->videoWidth = videoWidth;
+    source->videoHeight = videoHeight;
+    if (!(source->frame = (uint8_t *)malloc((size_t)videoWidth*videoHeight)) || !(source->corners = (float *)malloc(sizeof(float)*2*cornerCountMax))) {
+        ARLOGe("Out of memory!\n");
+        replaySourceClose(&source);
+        return (NULL);
+    }
+    return (source);
+}
+
+REPLAY_SOURCE_t *replaySourceOpenRecording(const char *pathname)
+{
+    SESSION_RECORDING_t *recording;
+    SESSION_RECORDING_INFO_t info;
+    REPLAY_SOURCE_t *source;
+
+    if (!(recording = sessionRecordingOpen(pathname))) return (NULL);
+    sessionRecordingGetInfo(recording, &info);
+    if (!(source = replaySourceAlloc(info.videoWidth, info.videoHeight, info.patternWidth*info.patternHeight))) {
+        sessionRecordingClose(&recording);
+        return (NULL);
+    }
+    source->recording = recording;
+    source->frameCount = sessionRecordingCaptureCount(recording);
+    source->patternType = info.patternType;
+    source->patternWidth = info.patternWidth;
+    source->patternHeight = info.patternHeight;
+    source->patternSpacing = info.patternSpacing;
+    return (source);
+}
+
+REPLAY_SOURCE_t *replaySourceOpenSynthetic(int patternWidth, int patternHeight, int videoWidth, int videoHeight, int frameCount, uint32_t seed)
+{
+    REPLAY_SOURCE_t *source;
+
+    if (patternWidth < 2 || patternHeight < 2 || frameCount < 0) return (NULL);
+    if (videoWidth < SYNTHETIC_VIDEO_SIZE_MIN || videoHeight < SYNTHETIC_VIDEO_SIZE_MIN) {
+        ARLOGe("Error: synthetic frames must be at least %dx%d pixels.\n", SYNTHETIC_VIDEO_SIZE_MIN, SYNTHETIC_VIDEO_SIZE_MIN);
+        return (NULL);
+    }
+    if (!(source = replaySourceAlloc(videoWidth, videoHeight, patternWidth*patternHeight))) return (NULL);
+    source->frameCount = frameCount;
+    source->patternType = 0; // Chessboard.
+    source->patternWidth = patternWidth;
+    source->patternHeight = patternHeight;
+    source->patternSpacing = 1.0f;
+    source->seed = seed;
+    return (source);
+}
+
+void replaySourceClose(REPLAY_SOURCE_t **source_p)
+{
+    if (!source_p || !*source_p) return;
+    sessionRecordingClose(&((*source_p)->recording));
+    free((*source_p)->frame);
+    free((*source_p)->corners);
+    free(*source_p);
+    *source_p = NULL;
+}
+
+int replaySourceGetVideoWidth(const REPLAY_SOURCE_t *source)
+{
+    return (source ? source->videoWidth : 0);
+}
+
+int replaySourceGetVideoHeight(const REPLAY_SOURCE_t *source)
+{
+    return (source ? source->videoHeight : 0);
+}
+
+int replaySourceGetFrameCount(const REPLAY_SOURCE_t *source)
+{
+    return (source ? source->frameCount : 0);
+}
+
+void replaySourceGetPattern(const REPLAY_SOURCE_t *source, int *patternType_out, int *patternWidth_out, int *patternHeight_out, float *patternSpacing_out)
+{
+    if (!source) return;
+    if (patternType_out) *patternType_out = source->patternType;
+    if (patternWidth_out) *patternWidth_out = source->patternWidth;
+    if (patternHeight_out) *patternHeight_out = source->patternHeight;
+    if (patternSpacing_out) *patternSpacing_out = source->patternSpacing;
+}
+
+void replaySourceSetFPS(REPLAY_SOURCE_t *source, float fps)
+{
+    if (!source) return;
+    source->fps = (fps > 0.0f ? fps : 0.0f);
+}
+
+void replaySourceRewind(REPLAY_SOURCE_t *source)
+{
+    if (!source) return;
+    source->next = 0;
+}
+
+const uint8_t *replaySourceNextFrame(REPLAY_SOURCE_t *source, int *index_out)
+{
+    if (!source || source->next >= source->frameCount) return (NULL);
+    int index = source->next;
+
+    if (source->recording) {
+        if (!sessionRecordingGetFrame(source->recording, index, source->frame)) return (NULL);
+    } else {
+        syntheticRender(source, index);
+    }
+
+    // Frames are due at fixed intervals from the first, so that pacing doesn't drift.
+    if (source->fps > 0.0f) {
+        if (index == 0) {
+            clock_gettime(CLOCK_MONOTONIC, &source->startTime);
+        } else {
+            double due = index/source->fps;
+            struct timespec now, ts;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            double wait = due - ((double)(now.tv_sec - source->startTime.tv_sec) + (double)(now.tv_nsec - source->startTime.tv_nsec)/1.0e9);
+            if (wait > 0.0) {
+                ts.tv_sec = (time_t)wait;
+                ts.tv_nsec = (long)((wait - (double)ts.tv_sec)*1.0e9);
+                while (nanosleep(&ts, &ts) == -1 && errno == EINTR);
+            }
+        }
+    }
+
+    source->next++;
+    if (index_out) *index_out = index;
+    return (source->frame);
+}
+
+int replaySourceGetReferenceCorners(REPLAY_SOURCE_t *source, int index, const float **corners_out)
+{
+    if (!source || index < 0 || index >= source->frameCount || !corners_out) return (0);
+    if (source->recording) {
+        SESSION_RECORDING_CAPTURE_t capture;
+        if (!sessionRecordingGetCapture(source->recording, index, &capture)) return (0);
+        *corners_out = capture.cornersRefined;
+        return (capture.cornerCount);
+    }
+    *corners_out = source->corners;
+    return (syntheticCorners(source, index));
+}
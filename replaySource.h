@@ -0,0 +1,98 @@
+/*
+ *  replaySource.h
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+#ifndef REPLAYSOURCE_H
+#define REPLAYSOURCE_H
+
+//
+// A source of luma video frames for driving calibration without a camera.
+//
+// Frames come either from a session recording (see sessionRecorder.h), in order of capture, or
+// are rendered synthetically: a chessboard at a sequence of pseudo-random poses seen by an ideal
+// pinhole camera. A synthetic frame depends only on the seed and its index, so runs are
+// repeatable. Each frame has reference corners against which corner finding results can be
+// compared: for recordings, the refined corners as recorded, and for synthetic frames, the exact
+// projection of the chessboard corners.
+//
+// Frames are delivered either as fast as they are requested, or paced to a fixed rate.
+//
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _REPLAY_SOURCE REPLAY_SOURCE_t;
+
+// Open a session recording for replay. Returns NULL in case of error.
+REPLAY_SOURCE_t *replaySourceOpenRecording(const char *pathname);
+
+// Create a source of "frameCount" synthetic frames of a chessboard with patternWidth x patternHeight
+// inner corners. Frames must be at least 16 pixels in each dimension. Returns NULL in case of error.
+REPLAY_SOURCE_t *replaySourceOpenSynthetic(int patternWidth, int patternHeight, int videoWidth, int videoHeight, int frameCount, uint32_t seed);
+
+void replaySourceClose(REPLAY_SOURCE_t **source_p);
+
+int replaySourceGetVideoWidth(const REPLAY_SOURCE_t *source);
+
+int replaySourceGetVideoHeight(const REPLAY_SOURCE_t *source);
+
+int replaySourceGetFrameCount(const REPLAY_SOURCE_t *source);
+
+// Get the calibration pattern in the frames. patternType is as Calibration::CalibrationPatternType.
+// Synthetic patterns have a spacing of 1.0.
+void replaySourceGetPattern(const REPLAY_SOURCE_t *source, int *patternType_out, int *patternWidth_out, int *patternHeight_out, float *patternSpacing_out);
+
+// Deliver frames at "fps" frames per second, or as fast as requested if 0.0f (the default).
+void replaySourceSetFPS(REPLAY_SOURCE_t *source, float fps);
+
+// Start again from the first frame.
+void replaySourceRewind(REPLAY_SOURCE_t *source);
+
+// Get the next frame, first waiting until it is due if paced. Returns NULL once all frames have
+// been delivered. If "index_out" is non-NULL, the frame's index is placed in it. The frame remains
+// valid until the next call, or until the source is closed.
+const uint8_t *replaySourceNextFrame(REPLAY_SOURCE_t *source, int *index_out);
+
+// Get the reference corners of frame "index", as (x, y) pairs. Returns the number of corners, or
+// 0 if none. The corners remain valid until the next call, or until the source is closed.
+int replaySourceGetReferenceCorners(REPLAY_SOURCE_t *source, int index, const float **corners_out);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // !REPLAYSOURCE_H
@@ -0,0 +1,755 @@
+/*
+ *  sessionRecorder.c
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+#include "sessionRecorder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h> // writev()
+#include <zlib.h>
+
+#include <ARX/AR/ar.h>
+
+//
+// File layout. All values little-endian.
+//
+// File header (SESSION_HEADER_LEN bytes):
+//   0: magic "ARXCALSS"
+//   8: uint32 version
+//  12: uint32 flags (SESSION_RECORDING_FLAG_*)
+//  16: uint32 pattern type
+//  20: uint32 pattern width
+//  24: uint32 pattern height
+//  28: float32 pattern spacing
+//  32: uint32 video width
+//  36: uint32 video height
+//  40: uint64 start time (microseconds since the epoch)
+//  48: uint64 offset of index record, or 0 if not closed
+//  56: uint32 capture count (valid only if index offset is non-zero)
+//  60: uint32 reserved
+//
+// Record header (RECORD_HEADER_LEN bytes):
+//   0: uint32 type (RECORD_TYPE_*)
+//   4: uint32 flags (SESSION_RECORDING_FLAG_COMPRESSED if frame is compressed)
+//   8: uint32 length of record, including header and padding to a multiple of 8 bytes
+//  12: uint32 sequence number of capture (capture and uncapture records)
+//  16: uint64 time (microseconds since start time)
+//  24: uint32 corner count (capture records)
+//  28: uint32 frame length (capture records), or entry count (index record)
+//
+// Capture records are followed by the raw corners, the refined corners (each as corner count
+// float32 x, y pairs) and then the frame. The index record is followed by, for each capture, a
+// uint64 record offset and a uint32 flags and uint32 reserved.
+//
+
+#define SESSION_MAGIC "ARXCALSS"
+#define SESSION_VERSION 1
+#define SESSION_HEADER_LEN 64
+#define RECORD_HEADER_LEN 32
+#define INDEX_ENTRY_LEN 16
+
+#define RECORD_TYPE_CAPTURE 1
+#define RECORD_TYPE_UNCAPTURE 2
+#define RECORD_TYPE_UNCAPTURE_ALL 3
+#define RECORD_TYPE_INDEX 4
+
+#define INDEX_FLAG_UNCAPTURED 0x01
+
+#define EVENT_QUEUE_LENGTH 64 // Queued captures and uncaptures. Captures are further limited by SESSION_RECORDER_QUEUE_LENGTH.
+
+typedef struct {
+    uint32_t type;
+    uint32_t sequence;
+    uint64_t time;
+    int      cornerCount;
+    int      buffer; // Index into frame and corner buffers, for captures.
+} SESSION_EVENT_t;
+
+typedef struct {
+    uint64_t offset;
+    uint32_t flags;
+} SESSION_INDEX_ENTRY_t;
+
+struct _SESSION_RECORDER {
+    char                *pathname;
+    int                  fd;
+    int                  videoWidth;
+    int                  videoHeight;
+    int                  cornerCountMax;
+    bool                 compress;
+    uint64_t             startTime;
+    uint32_t             flags;
+    // Queue, shared with the writer thread and protected by lock.
+    pthread_mutex_t      lock;
+    pthread_cond_t       cond;
+    pthread_t            thread;
+    bool                 threadRunning;
+    bool                 quit;
+    SESSION_EVENT_t      events[EVENT_QUEUE_LENGTH];
+    int                  eventHead;
+    int                  eventCount;
+    uint8_t             *frames[SESSION_RECORDER_QUEUE_LENGTH];
+    float               *corners[SESSION_RECORDER_QUEUE_LENGTH]; // Raw then refined.
+    bool                 bufferBusy[SESSION_RECORDER_QUEUE_LENGTH];
+    // Producer state. Sequence numbers of captures not yet undone, or -1 for captures dropped.
+    int32_t             *live;
+    int                  liveCount;
+    int                  liveCountMax;
+    uint32_t             nextSequence;
+    // Writer thread state.
+    uint64_t             size;
+    bool                 writeError;
+    unsigned char       *compressBuf;
+    uLong                compressBufLen;
+    SESSION_INDEX_ENTRY_t *index;
+    int                  indexCount;
+    int                  indexCountMax;
+};
+
+struct _SESSION_RECORDING {
+    const unsigned char *map;
+    size_t               mapLen;
+    SESSION_RECORDING_INFO_t info;
+    SESSION_INDEX_ENTRY_t *index;
+    int                  indexCount;
+};
+
+static void put32(unsigned char *p, uint32_t v) { int i; for (i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8*i)); }
+static void put64(unsigned char *p, uint64_t v) { int i; for (i = 0; i < 8; i++) p[i] = (unsigned char)(v >> (8*i)); }
+static uint32_t get32(const unsigned char *p) { uint32_t v = 0; int i; for (i = 3; i >= 0; i--) v = (v << 8) | p[i]; return (v); }
+static uint64_t get64(const unsigned char *p) { uint64_t v = 0; int i; for (i = 7; i >= 0; i--) v = (v << 8) | p[i]; return (v); }
+static void putFloat(unsigned char *p, float f) { uint32_t v; memcpy(&v, &f, 4); put32(p, v); }
+static float getFloat(const unsigned char *p) { uint32_t v = get32(p); float f; memcpy(&f, &v, 4); return (f); }
+
+// Corners are written and read in place as float32, so the host must be little-endian.
+static bool hostIsLittleEndian(void)
+{
+    const uint32_t v = 1;
+    return (*(const unsigned char *)&v == 1);
+}
+
+static uint64_t nowUs(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return ((uint64_t)tv.tv_sec*1000000 + (uint64_t)tv.tv_usec);
+}
+
+static bool writevFully(int fd, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return (false);
+        while (iovcnt && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt) {
+            iov->iov_base = (unsigned char *)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return (true);
+}
+
+static void recordHeaderMake(unsigned char header[RECORD_HEADER_LEN], uint32_t type, uint32_t flags, uint32_t length, uint32_t sequence, uint64_t time, uint32_t cornerCount, uint32_t frameLen)
+{
+    put32(header, type);
+    put32(header + 4, flags);
+    put32(header + 8, length);
+    put32(header + 12, sequence);
+    put64(header + 16, time);
+    put32(header + 24, cornerCount);
+    put32(header + 28, frameLen);
+}
+
+static bool indexAdd(SESSION_INDEX_ENTRY_t **index_p, int *count_p, int *countMax_p, uint64_t offset)
+{
+    if (*count_p == *countMax_p) {
+        int countMax = (*countMax_p ? *countMax_p*2 : 64);
+        SESSION_INDEX_ENTRY_t *index = (SESSION_INDEX_ENTRY_t *)realloc(*index_p, sizeof(SESSION_INDEX_ENTRY_t)*countMax);
+        if (!index) return (false);
+        *index_p = index;
+        *countMax_p = countMax;
+    }
+    (*index_p)[*count_p].offset = offset;
+    (*index_p)[*count_p].flags = 0;
+    (*count_p)++;
+    return (true);
+}
+
+// ---------------------------------------------------------------------------
+// Recording.
+// ---------------------------------------------------------------------------
+
+static bool writeCapture(SESSION_RECORDER_t *recorder, const SESSION_EVENT_t *event)
+{
+    unsigned char header[RECORD_HEADER_LEN];
+    static const unsigned char pad[8] = {0};
+    size_t cornersLen = sizeof(float)*2*event->cornerCount;
+    const unsigned char *frame = recorder->frames[event->buffer];
+    uLong frameLen = (uLong)recorder->videoWidth*recorder->videoHeight;
+    uint32_t flags = 0;
+
+    if (recorder->compress) {
+        uLongf compressedLen = recorder->compressBufLen;
+        if (compress2(recorder->compressBuf, &compressedLen, frame, frameLen, Z_BEST_SPEED) == Z_OK && compressedLen < frameLen) {
+            frame = recorder->compressBuf;
+            frameLen = compressedLen;
+            flags |= SESSION_RECORDING_FLAG_COMPRESSED;
+        }
+    }
+    size_t length = RECORD_HEADER_LEN + 2*cornersLen + frameLen;
+    size_t padLen = (8 - (length & 7)) & 7;
+    length += padLen;
+
+    recordHeaderMake(header, RECORD_TYPE_CAPTURE, flags, (uint32_t)length, event->sequence, event->time, (uint32_t)event->cornerCount, (uint32_t)frameLen);
+    struct iovec iov[4] = {
+        {header, RECORD_HEADER_LEN},
+        {recorder->corners[event->buffer], 2*cornersLen},
+        {(void *)frame, frameLen},
+        {(void *)pad, padLen}
+    };
+    if (!writevFully(recorder->fd, iov, 4)) return (false);
+    if (!indexAdd(&recorder->index, &recorder->indexCount, &recorder->indexCountMax, recorder->size)) {
+        ARLOGe("Out of memory!\n");
+        return (false);
+    }
+    recorder->size += length;
+    return (true);
+}
+
+static bool writeEvent(SESSION_RECORDER_t *recorder, const SESSION_EVENT_t *event)
+{
+    unsigned char header[RECORD_HEADER_LEN];
+    int i;
+
+    recordHeaderMake(header, event->type, 0, RECORD_HEADER_LEN, event->sequence, event->time, 0, 0);
+    struct iovec iov = {header, RECORD_HEADER_LEN};
+    if (!writevFully(recorder->fd, &iov, 1)) return (false);
+    recorder->size += RECORD_HEADER_LEN;
+
+    // Keep the index flags current.
+    if (event->type == RECORD_TYPE_UNCAPTURE) {
+        if (event->sequence < (uint32_t)recorder->indexCount) recorder->index[event->sequence].flags |= INDEX_FLAG_UNCAPTURED;
+    } else {
+        for (i = 0; i < recorder->indexCount; i++) recorder->index[i].flags |= INDEX_FLAG_UNCAPTURED;
+    }
+    return (true);
+}
+
+static void *sessionRecorderWriter(void *arg)
+{
+    SESSION_RECORDER_t *recorder = (SESSION_RECORDER_t *)arg;
+
+    pthread_mutex_lock(&recorder->lock);
+    while (1) {
+        while (!recorder->eventCount && !recorder->quit) pthread_cond_wait(&recorder->cond, &recorder->lock);
+        if (!recorder->eventCount) break; // Quit, with nothing left to write.
+
+        // The event (and its buffers) stay owned by the queue until written.
+        SESSION_EVENT_t event = recorder->events[recorder->eventHead];
+        pthread_mutex_unlock(&recorder->lock);
+
+        if (!recorder->writeError) {
+            bool ok = (event.type == RECORD_TYPE_CAPTURE ? writeCapture(recorder, &event) : writeEvent(recorder, &event));
+            if (!ok) {
+                ARLOGe("Error writing session recording '%s'. Recording stopped.\n", recorder->pathname);
+                ARLOGperror(NULL);
+                recorder->writeError = true;
+            }
+        }
+
+        pthread_mutex_lock(&recorder->lock);
+        if (event.type == RECORD_TYPE_CAPTURE) recorder->bufferBusy[event.buffer] = false;
+        recorder->eventHead = (recorder->eventHead + 1) % EVENT_QUEUE_LENGTH;
+        recorder->eventCount--;
+    }
+    pthread_mutex_unlock(&recorder->lock);
+    return (NULL);
+}
+
+SESSION_RECORDER_t *sessionRecorderOpen(const char *pathname, int patternType, int patternWidth, int patternHeight, float patternSpacing, int videoWidth, int videoHeight, bool compress)
+{
+    SESSION_RECORDER_t *recorder;
+    unsigned char header[SESSION_HEADER_LEN];
+    int i;
+
+    if (!pathname || patternWidth <= 0 || patternHeight <= 0 || videoWidth <= 0 || videoHeight <= 0) return (NULL);
+    if (!hostIsLittleEndian()) {
+        ARLOGe("Error: session recording is not supported on big-endian hosts.\n");
+        return (NULL);
+    }
+
+    if (!(recorder = (SESSION_RECORDER_t *)calloc(1, sizeof(SESSION_RECORDER_t)))) {
+        ARLOGe("Out of memory!\n");
+        return (NULL);
+    }
+    recorder->pathname = strdup(pathname);
+    recorder->fd = -1;
+    recorder->videoWidth = videoWidth;
+    recorder->videoHeight = videoHeight;
+    recorder->cornerCountMax = patternWidth*patternHeight;
+    recorder->compress = compress;
+    recorder->startTime = nowUs();
+    pthread_mutex_init(&recorder->lock, NULL);
+    pthread_cond_init(&recorder->cond, NULL);
+
+    // Preallocate all buffers, so that queueing a capture never allocates.
+    for (i = 0; i < SESSION_RECORDER_QUEUE_LENGTH; i++) {
+        recorder->frames[i] = (uint8_t *)malloc((size_t)videoWidth*videoHeight);
+        recorder->corners[i] = (float *)malloc(sizeof(float)*4*recorder->cornerCountMax);
+        if (!recorder->frames[i] || !recorder->corners[i]) {
+            ARLOGe("Out of memory!\n");
+            goto bail;
+        }
+        memset(recorder->frames[i], 0, (size_t)videoWidth*videoHeight); // Fault in now rather than on first capture.
+    }
+    if (compress) {
+        recorder->compressBufLen = compressBound((uLong)videoWidth*videoHeight);
+        if (!(recorder->compressBuf = (unsigned char *)malloc(recorder->compressBufLen))) {
+            ARLOGe("Out of memory!\n");
+            goto bail;
+        }
+    }
+
+    recorder->fd = open(pathname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (recorder->fd == -1) {
+        ARLOGe("Error creating session recording '%s'.\n", pathname);
+        ARLOGperror(NULL);
+        goto bail;
+    }
+    fcntl(recorder->fd, F_SETFD, FD_CLOEXEC);
+
+    memset(header, 0, SESSION_HEADER_LEN);
+    memcpy(header, SESSION_MAGIC, 8);
+    put32(header + 8, SESSION_VERSION);
+    put32(header + 12, (compress ? SESSION_RECORDING_FLAG_COMPRESSED : 0));
+    put32(header + 16, (uint32_t)patternType);
+    put32(header + 20, (uint32_t)patternWidth);
+    put32(header + 24, (uint32_t)patternHeight);
+    putFloat(header + 28, patternSpacing);
+    put32(header + 32, (uint32_t)videoWidth);
+    put32(header + 36, (uint32_t)videoHeight);
+    put64(header + 40, recorder->startTime);
+    struct iovec iov = {header, SESSION_HEADER_LEN};
+    if (!writevFully(recorder->fd, &iov, 1)) {
+        ARLOGe("Error writing session recording '%s'.\n", pathname);
+        ARLOGperror(NULL);
+        goto bail;
+    }
+    recorder->size = SESSION_HEADER_LEN;
+    recorder->flags = (compress ? SESSION_RECORDING_FLAG_COMPRESSED : 0);
+
+    if (pthread_create(&recorder->thread, NULL, sessionRecorderWriter, recorder) != 0) {
+        ARLOGe("Error: Unable to create session recording thread.\n");
+        goto bail;
+    }
+    recorder->threadRunning = true;
+
+    ARLOGi("Recording calibration session to '%s'.\n", pathname);
+    return (recorder);
+
+bail:
+    sessionRecorderClose(&recorder);
+    return (NULL);
+}
+
+// Queue an event. Must be called with the lock held.
+static bool queueEvent(SESSION_RECORDER_t *recorder, uint32_t type, uint32_t sequence, int cornerCount, int buffer)
+{
+    if (recorder->eventCount == EVENT_QUEUE_LENGTH) return (false);
+    SESSION_EVENT_t *event = &recorder->events[(recorder->eventHead + recorder->eventCount) % EVENT_QUEUE_LENGTH];
+    event->type = type;
+    event->sequence = sequence;
+    event->time = nowUs() - recorder->startTime;
+    event->cornerCount = cornerCount;
+    event->buffer = buffer;
+    recorder->eventCount++;
+    pthread_cond_signal(&recorder->cond);
+    return (true);
+}
+
+static bool livePush(SESSION_RECORDER_t *recorder, int32_t sequence)
+{
+    if (recorder->liveCount == recorder->liveCountMax) {
+        int liveCountMax = (recorder->liveCountMax ? recorder->liveCountMax*2 : 32);
+        int32_t *live = (int32_t *)realloc(recorder->live, sizeof(int32_t)*liveCountMax);
+        if (!live) return (false);
+        recorder->live = live;
+        recorder->liveCountMax = liveCountMax;
+    }
+    recorder->live[recorder->liveCount++] = sequence;
+    return (true);
+}
+
+bool sessionRecorderAddCapture(SESSION_RECORDER_t *recorder, const uint8_t *frame, const float *cornersRaw, const float *cornersRefined, int cornerCount)
+{
+    int buffer;
+    bool ok = false;
+
+    if (!recorder || !frame || !cornersRaw || !cornersRefined || cornerCount <= 0 || cornerCount > recorder->cornerCountMax) return (false);
+
+    pthread_mutex_lock(&recorder->lock);
+    for (buffer = 0; buffer < SESSION_RECORDER_QUEUE_LENGTH; buffer++) {
+        if (!recorder->bufferBusy[buffer]) break;
+    }
+    if (buffer < SESSION_RECORDER_QUEUE_LENGTH && recorder->eventCount < EVENT_QUEUE_LENGTH && livePush(recorder, (int32_t)recorder->nextSequence)) {
+        memcpy(recorder->frames[buffer], frame, (size_t)recorder->videoWidth*recorder->videoHeight);
+        memcpy(recorder->corners[buffer], cornersRaw, sizeof(float)*2*cornerCount);
+        memcpy(recorder->corners[buffer] + 2*cornerCount, cornersRefined, sizeof(float)*2*cornerCount);
+        recorder->bufferBusy[buffer] = true;
+        queueEvent(recorder, RECORD_TYPE_CAPTURE, recorder->nextSequence++, cornerCount, buffer);
+        ok = true;
+    } else {
+        // Remember the drop, so that undoing this capture doesn't undo an earlier one in the recording.
+        livePush(recorder, -1);
+        recorder->flags |= SESSION_RECORDING_FLAG_INCOMPLETE;
+        ARLOGw("Session recording can't keep up. Capture dropped from recording.\n");
+    }
+    pthread_mutex_unlock(&recorder->lock);
+    return (ok);
+}
+
+bool sessionRecorderUncapture(SESSION_RECORDER_t *recorder)
+{
+    bool ok = true;
+
+    if (!recorder) return (false);
+    pthread_mutex_lock(&recorder->lock);
+    if (recorder->liveCount) {
+        int32_t sequence = recorder->live[--recorder->liveCount];
+        if (sequence >= 0 && !queueEvent(recorder, RECORD_TYPE_UNCAPTURE, (uint32_t)sequence, 0, -1)) {
+            recorder->flags |= SESSION_RECORDING_FLAG_INCOMPLETE;
+            ok = false;
+        }
+    }
+    pthread_mutex_unlock(&recorder->lock);
+    return (ok);
+}
+
+bool sessionRecorderUncaptureAll(SESSION_RECORDER_t *recorder)
+{
+    bool ok = true;
+
+    if (!recorder) return (false);
+    pthread_mutex_lock(&recorder->lock);
+    if (recorder->liveCount) {
+        recorder->liveCount = 0;
+        if (!queueEvent(recorder, RECORD_TYPE_UNCAPTURE_ALL, 0, 0, -1)) {
+            recorder->flags |= SESSION_RECORDING_FLAG_INCOMPLETE;
+            ok = false;
+        }
+    }
+    pthread_mutex_unlock(&recorder->lock);
+    return (ok);
+}
+
+// Append the index and update the header. Called after the writer thread has exited.
+static bool writeIndex(SESSION_RECORDER_t *recorder)
+{
+    unsigned char header[RECORD_HEADER_LEN];
+    unsigned char *entries;
+    size_t entriesLen = (size_t)INDEX_ENTRY_LEN*recorder->indexCount;
+    int i;
+    bool ok;
+
+    if (entriesLen && !(entries = (unsigned char *)calloc(1, entriesLen))) {
+        ARLOGe("Out of memory!\n");
+        return (false);
+    } else if (!entriesLen) entries = NULL;
+    for (i = 0; i < recorder->indexCount; i++) {
+        put64(entries + INDEX_ENTRY_LEN*i, recorder->index[i].offset);
+        put32(entries + INDEX_ENTRY_LEN*i + 8, recorder->index[i].flags);
+    }
+    recordHeaderMake(header, RECORD_TYPE_INDEX, 0, (uint32_t)(RECORD_HEADER_LEN + entriesLen), 0, nowUs() - recorder->startTime, 0, (uint32_t)recorder->indexCount);
+    struct iovec iov[2] = {{header, RECORD_HEADER_LEN}, {entries, entriesLen}};
+    ok = writevFully(recorder->fd, iov, (entriesLen ? 2 : 1));
+    free(entries);
+    if (!ok) return (false);
+
+    // The index is only referenced from the header once it's durable.
+    unsigned char fields[16];
+    put64(fields, recorder->size);
+    put32(fields + 8, (uint32_t)recorder->indexCount);
+    put32(fields + 12, 0);
+    unsigned char flags[4];
+    put32(flags, recorder->flags);
+    if (fsync(recorder->fd) < 0 || pwrite(recorder->fd, flags, 4, 12) != 4 || pwrite(recorder->fd, fields, 16, 48) != 16) return (false);
+    return (true);
+}
+
+void sessionRecorderClose(SESSION_RECORDER_t **recorder_p)
+{
+    SESSION_RECORDER_t *recorder;
+    int i;
+
+    if (!recorder_p || !*recorder_p) return;
+    recorder = *recorder_p;
+
+    if (recorder->threadRunning) {
+        pthread_mutex_lock(&recorder->lock);
+        recorder->quit = true;
+        pthread_cond_signal(&recorder->cond);
+        pthread_mutex_unlock(&recorder->lock);
+        pthread_join(recorder->thread, NULL);
+
+        if (!recorder->writeError) {
+            if (!writeIndex(recorder) || fsync(recorder->fd) < 0) {
+                ARLOGe("Error finishing session recording '%s'.\n", recorder->pathname);
+                ARLOGperror(NULL);
+            } else {
+                ARLOGi("Recorded %d captures to '%s'%s.\n", recorder->indexCount, recorder->pathname, (recorder->flags & SESSION_RECORDING_FLAG_INCOMPLETE ? " (some captures were dropped)" : ""));
+            }
+        }
+    }
+    if (recorder->fd != -1) close(recorder->fd);
+
+    pthread_cond_destroy(&recorder->cond);
+    pthread_mutex_destroy(&recorder->lock);
+    for (i = 0; i < SESSION_RECORDER_QUEUE_LENGTH; i++) {
+        free(recorder->frames[i]);
+        free(recorder->corners[i]);
+    }
+    free(recorder->compressBuf);
+    free(recorder->index);
+    free(recorder->live);
+    free(recorder->pathname);
+    free(recorder);
+    *recorder_p = NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Reading.
+// ---------------------------------------------------------------------------
+
+// Check that the record at "offset" lies within the mapping, and is of the expected type.
+static bool recordValid(const SESSION_RECORDING_t *recording, uint64_t offset, uint32_t type)
+{
+    if (offset < SESSION_HEADER_LEN || (offset & 7) || offset + RECORD_HEADER_LEN > recording->mapLen) return (false);
+    const unsigned char *p = recording->map + offset;
+    uint32_t length = get32(p + 8);
+    if (length < RECORD_HEADER_LEN || offset + length > recording->mapLen) return (false);
+    if (get32(p) != type) return (false);
+    if (type == RECORD_TYPE_CAPTURE) {
+        uint64_t cornersLen = (uint64_t)sizeof(float)*4*get32(p + 24);
+        if (RECORD_HEADER_LEN + cornersLen + get32(p + 28) > length) return (false);
+    }
+    return (true);
+}
+
+// Read the index appended when the recording was closed.
+static bool readIndex(SESSION_RECORDING_t *recording, uint64_t indexOffset, uint32_t captureCount)
+{
+    int i;
+
+    if (!recordValid(recording, indexOffset, RECORD_TYPE_INDEX)) return (false);
+    const unsigned char *p = recording->map + indexOffset;
+    if (get32(p + 28) != captureCount || RECORD_HEADER_LEN + (uint64_t)INDEX_ENTRY_LEN*captureCount > get32(p + 8)) return (false);
+    if (captureCount && !(recording->index = (SESSION_INDEX_ENTRY_t *)malloc(sizeof(SESSION_INDEX_ENTRY_t)*captureCount))) return (false);
+    p += RECORD_HEADER_LEN;
+    for (i = 0; i < (int)captureCount; i++, p += INDEX_ENTRY_LEN) {
+        recording->index[i].offset = get64(p);
+        recording->index[i].flags = get32(p + 8);
+        if (!recordValid(recording, recording->index[i].offset, RECORD_TYPE_CAPTURE)) return (false);
+    }
+    recording->indexCount = (int)captureCount;
+    return (true);
+}
+
+// Rebuild the index of a recording that was never closed, by scanning its records in order. Stops
+// at the first torn record.
+static bool scanRecords(SESSION_RECORDING_t *recording)
+{
+    int countMax = 0;
+    int i;
+    uint64_t offset = SESSION_HEADER_LEN;
+
+    while (offset + RECORD_HEADER_LEN <= recording->mapLen) {
+        const unsigned char *p = recording->map + offset;
+        uint32_t type = get32(p);
+        if (!recordValid(recording, offset, type)) break;
+        if (type == RECORD_TYPE_CAPTURE) {
+            if (get32(p + 12) != (uint32_t)recording->indexCount) break;
+            if (!indexAdd(&recording->index, &recording->indexCount, &countMax, offset)) return (false);
+        } else if (type == RECORD_TYPE_UNCAPTURE) {
+            uint32_t sequence = get32(p + 12);
+            if (sequence < (uint32_t)recording->indexCount) recording->index[sequence].flags |= INDEX_FLAG_UNCAPTURED;
+        } else if (type == RECORD_TYPE_UNCAPTURE_ALL) {
+            for (i = 0; i < recording->indexCount; i++) recording->index[i].flags |= INDEX_FLAG_UNCAPTURED;
+        } else if (type != RECORD_TYPE_INDEX) {
+            break;
+        }
+        offset += get32(p + 8);
+    }
+    return (true);
+}
+
+SESSION_RECORDING_t *sessionRecordingOpen(const char *pathname)
+{
+    SESSION_RECORDING_t *recording;
+    struct stat st;
+    int fd;
+
+    if (!pathname) return (NULL);
+    if (!hostIsLittleEndian()) {
+        ARLOGe("Error: session recording is not supported on big-endian hosts.\n");
+        return (NULL);
+    }
+
+    if ((fd = open(pathname, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+        ARLOGe("Error opening session recording '%s'.\n", pathname);
+        ARLOGperror(NULL);
+        if (fd != -1) close(fd);
+        return (NULL);
+    }
+    if (st.st_size < SESSION_HEADER_LEN) {
+        ARLOGe("Error: '%s' is not a session recording.\n", pathname);
+        close(fd);
+        return (NULL);
+    }
+    if (!(recording = (SESSION_RECORDING_t *)calloc(1, sizeof(SESSION_RECORDING_t)))) {
+        ARLOGe("Out of memory!\n");
+        close(fd);
+        return (NULL);
+    }
+    recording->mapLen = (size_t)st.st_size;
+    recording->map = (const unsigned char *)mmap(NULL, recording->mapLen, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (recording->map == MAP_FAILED) {
+        ARLOGe("Error mapping session recording '%s'.\n", pathname);
+        ARLOGperror(NULL);
+        recording->map = NULL;
+        goto bail;
+    }
+
+    const unsigned char *h = recording->map;
+    if (memcmp(h, SESSION_MAGIC, 8) != 0 || get32(h + 8) != SESSION_VERSION) {
+        ARLOGe("Error: '%s' is not a session recording, or is an unsupported version.\n", pathname);
+        goto bail;
+    }
+    recording->info.flags = get32(h + 12);
+    recording->info.patternType = (int)get32(h + 16);
+    recording->info.patternWidth = (int)get32(h + 20);
+    recording->info.patternHeight = (int)get32(h + 24);
+    recording->info.patternSpacing = getFloat(h + 28);
+    recording->info.videoWidth = (int)get32(h + 32);
+    recording->info.videoHeight = (int)get32(h + 36);
+    recording->info.startTime = get64(h + 40);
+    uint64_t indexOffset = get64(h + 48);
+
+    if (!indexOffset || !readIndex(recording, indexOffset, get32(h + 56))) {
+        if (indexOffset) ARLOGw("Session recording '%s' has an invalid index. Scanning records.\n", pathname);
+        free(recording->index);
+        recording->index = NULL;
+        recording->indexCount = 0;
+        if (!scanRecords(recording)) {
+            ARLOGe("Out of memory!\n");
+            goto bail;
+        }
+        recording->info.flags |= SESSION_RECORDING_FLAG_INCOMPLETE;
+    }
+    return (recording);
+
+bail:
+    sessionRecordingClose(&recording);
+    return (NULL);
+}
+
+void sessionRecordingClose(SESSION_RECORDING_t **recording_p)
+{
+    if (!recording_p || !*recording_p) return;
+    if ((*recording_p)->map) munmap((void *)(*recording_p)->map, (*recording_p)->mapLen);
+    free((*recording_p)->index);
+    free(*recording_p);
+    *recording_p = NULL;
+}
+
+void sessionRecordingGetInfo(const SESSION_RECORDING_t *recording, SESSION_RECORDING_INFO_t *info_out)
+{
+    if (!recording || !info_out) return;
+    *info_out = recording->info;
+}
+
+int sessionRecordingCaptureCount(const SESSION_RECORDING_t *recording)
+{
+    if (!recording) return (0);
+    return (recording->indexCount);
+}
+
+bool sessionRecordingGetCapture(const SESSION_RECORDING_t *recording, int index, SESSION_RECORDING_CAPTURE_t *capture_out)
+{
+    if (!recording || index < 0 || index >= recording->indexCount || !capture_out) return (false);
+    const unsigned char *p = recording->map + recording->index[index].offset;
+    capture_out->sequence = get32(p + 12);
+    capture_out->time = get64(p + 16);
+    capture_out->cornerCount = (int)get32(p + 24);
+    capture_out->cornersRaw = (const float *)(p + RECORD_HEADER_LEN);
+    capture_out->cornersRefined = capture_out->cornersRaw + 2*capture_out->cornerCount;
+    capture_out->uncaptured = ((recording->index[index].flags & INDEX_FLAG_UNCAPTURED) != 0);
+    return (true);
+}
+
+bool sessionRecordingGetFrame(const SESSION_RECORDING_t *recording, int index, uint8_t *frame)
+{
+    if (!recording || index < 0 || index >= recording->indexCount || !frame) return (false);
+    const unsigned char *p = recording->map + recording->index[index].offset;
+    uint32_t flags = get32(p + 4);
+    const unsigned char *data = p + RECORD_HEADER_LEN + sizeof(float)*4*get32(p + 24);
+    uLong dataLen = get32(p + 28);
+    uLongf frameLen = (uLongf)recording->info.videoWidth*recording->info.videoHeight;
+
+    if (flags & SESSION_RECORDING_FLAG_COMPRESSED) {
+        uLongf len = frameLen;
+        if (uncompress(frame, &len, data, dataLen) != Z_OK || len != frameLen) {
+            ARLOGe("Error decompressing frame %d of session recording.\n", index);
+            return (false);
+        }
+    } else {
+        if (dataLen != frameLen) return (false);
+        memcpy(frame, data, frameLen);
+    }
+    return (true);
+}
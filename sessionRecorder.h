@@ -0,0 +1,140 @@
+/*
+ *  sessionRecorder.h
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+#ifndef SESSIONRECORDER_H
+#define SESSIONRECORDER_H
+
+//
+// Recording of calibration sessions.
+//
+// A session file holds the calibration pattern configuration and video size, followed by one
+// record per captured image: the luma frame in which the pattern was found (optionally
+// zlib-compressed), and the pattern corners both as found and after sub-pixel refinement.
+// Undoing a capture is also recorded. Sessions can later be replayed, re-solved or inspected
+// without a camera.
+//
+// Recording is done on a writer thread. sessionRecorderAddCapture() copies its inputs into one of
+// SESSION_RECORDER_QUEUE_LENGTH preallocated slots and returns immediately; if all slots are busy
+// (i.e. storage can't keep up) the capture is dropped from the recording, and the file is marked
+// incomplete, rather than blocking the caller.
+//
+// The file layout is little-endian, with every record 8-byte aligned, so that a recording can be
+// memory-mapped and its corners read in place. When the recorder is closed, an index of capture
+// records is appended and its offset written to the header. Recordings that were never closed
+// (e.g. after a crash) are still readable, by scanning the records in order.
+//
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SESSION_RECORDER_QUEUE_LENGTH 4
+
+#define SESSION_RECORDING_FLAG_COMPRESSED 0x01 // Frames are zlib-compressed.
+#define SESSION_RECORDING_FLAG_INCOMPLETE 0x02 // Captures were dropped from the recording.
+
+typedef struct _SESSION_RECORDER SESSION_RECORDER_t;
+typedef struct _SESSION_RECORDING SESSION_RECORDING_t;
+
+typedef struct {
+    uint32_t flags;           // SESSION_RECORDING_FLAG_*.
+    int      patternType;     // As Calibration::CalibrationPatternType.
+    int      patternWidth;
+    int      patternHeight;
+    float    patternSpacing;
+    int      videoWidth;
+    int      videoHeight;
+    uint64_t startTime;       // Microseconds since the epoch.
+} SESSION_RECORDING_INFO_t;
+
+typedef struct {
+    uint32_t     sequence;       // Zero-based, in order of capture.
+    uint64_t     time;           // Microseconds since startTime.
+    int          cornerCount;
+    const float *cornersRaw;     // cornerCount (x, y) pairs as found by the corner finder.
+    const float *cornersRefined; // cornerCount (x, y) pairs after sub-pixel refinement.
+    bool         uncaptured;     // true if the capture was later undone.
+} SESSION_RECORDING_CAPTURE_t;
+
+//
+// Recording.
+//
+
+// Create a new recording at "pathname", replacing any existing file. Returns NULL in case of error.
+SESSION_RECORDER_t *sessionRecorderOpen(const char *pathname, int patternType, int patternWidth, int patternHeight, float patternSpacing, int videoWidth, int videoHeight, bool compress);
+
+// Queue a capture for writing. "frame" is videoWidth x videoHeight bytes of luma. The corner
+// arrays hold cornerCount (x, y) pairs, at most patternWidth x patternHeight. Never blocks on
+// storage. Returns false if the capture was dropped.
+bool sessionRecorderAddCapture(SESSION_RECORDER_t *recorder, const uint8_t *frame, const float *cornersRaw, const float *cornersRefined, int cornerCount);
+
+// Record that the most recent capture was undone.
+bool sessionRecorderUncapture(SESSION_RECORDER_t *recorder);
+
+// Record that all captures were undone.
+bool sessionRecorderUncaptureAll(SESSION_RECORDER_t *recorder);
+
+// Write any queued captures, append the index and close the file.
+void sessionRecorderClose(SESSION_RECORDER_t **recorder_p);
+
+//
+// Reading.
+//
+
+// Map the recording at "pathname" for reading. Returns NULL in case of error.
+SESSION_RECORDING_t *sessionRecordingOpen(const char *pathname);
+
+void sessionRecordingClose(SESSION_RECORDING_t **recording_p);
+
+void sessionRecordingGetInfo(const SESSION_RECORDING_t *recording, SESSION_RECORDING_INFO_t *info_out);
+
+// Number of captures in the recording, including those later undone.
+int sessionRecordingCaptureCount(const SESSION_RECORDING_t *recording);
+
+// Get the capture at "index". Pointers remain valid until the recording is closed.
+bool sessionRecordingGetCapture(const SESSION_RECORDING_t *recording, int index, SESSION_RECORDING_CAPTURE_t *capture_out);
+
+// Copy (decompressing if necessary) the frame of the capture at "index" into "frame", which must
+// hold videoWidth x videoHeight bytes.
+bool sessionRecordingGetFrame(const SESSION_RECORDING_t *recording, int index, uint8_t *frame);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // !SESSIONRECORDER_H
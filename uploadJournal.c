@@ -0,0 +1,891 @@
+/*
+ *  uploadJournal.c
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+
+#include "uploadJournal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/uio.h> // writev()
+
+#include <ARX/AR/ar.h>
+
+//
+// File format. All integers are little-endian.
+//
+// File header (16 bytes):
+//     char[8]   magic "ARXUPJNL"
+//     uint32    format version (2; version 1 files, which lack keyed entries, are upgraded on open)
+//     uint32    reserved (0)
+// followed by zero or more records. Record header (20 bytes):
+//     uint32    payload length
+//     uint32    CRC-32 of the remainder of the header and the payload
+//     uint8     record type (1 = entry, 2 = done, 3 = keyed entry)
+//     uint8[3]  reserved (0)
+//     uint64    entry ID
+// followed by the payload. Keyed entry payload:
+//     uint64    key
+//     uint64    rank (IEEE 754 double)
+// followed by an entry payload. Entry payload:
+//     uint16    field count
+//     per field:
+//         uint8     kind (0 = text, 1 = file)
+//         uint8     reserved (0)
+//         uint16    name length
+//         uint16    filename length (0 for text fields)
+//         uint32    value length
+//         name, filename and value, each followed by a nul byte not included in its length.
+// Done records have no payload.
+//
+
+#define JOURNAL_MAGIC "ARXUPJNL"
+#define JOURNAL_VERSION 2
+#define JOURNAL_VERSION_MIN 1
+#define JOURNAL_HEADER_LEN 16
+#define RECORD_HEADER_LEN 20
+#define RECORD_TYPE_ENTRY 1
+#define RECORD_TYPE_DONE 2
+#define RECORD_TYPE_KEYED_ENTRY 3
+#define KEY_PREFIX_LEN 16
+#define RECORD_PAYLOAD_LEN_MAX (16*1024*1024)
+#define FIELD_HEADER_LEN 10
+#define FIELD_KIND_TEXT 0
+#define FIELD_KIND_FILE 1
+
+typedef struct {
+    uint64_t             id;
+    uint64_t             offset; // Offset of record header in file.
+    uint32_t             payloadLen;
+    bool                 keyed;
+    uint64_t             key;
+    double               rank;
+} JOURNAL_LIVE_ENTRY_t;
+
+struct _UPLOAD_JOURNAL {
+    char                *pathname;
+    int                  fd;
+    uint64_t             size;
+    uint64_t             nextID;
+    JOURNAL_LIVE_ENTRY_t *live; // Ascending by ID.
+    int                  liveCount;
+    int                  liveCapacity;
+    uint64_t             liveBytes;
+    uint64_t             deadBytes;
+    int                  unsyncedCount;
+    uint64_t             lastSyncTimeMs;
+    pthread_mutex_t      lock;
+};
+
+struct _UPLOAD_JOURNAL_ENTRY {
+    unsigned char       *buf; // Space for a record header, followed by the payload.
+    size_t               len;
+    size_t               capacity;
+};
+
+// ---------------------------------------------------------------------------
+
+static uint32_t crc32Table[256];
+static pthread_once_t crc32TableOnce = PTHREAD_ONCE_INIT;
+
+static void crc32TableInit(void)
+{
+    uint32_t i, j, c;
+    for (i = 0; i < 256; i++) {
+        c = i;
+        for (j = 0; j < 8; j++) c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+        crc32Table[i] = c;
+    }
+}
+
+static uint32_t crc32Update(uint32_t crc, const unsigned char *p, size_t len)
+{
+    crc = ~crc;
+    while (len--) crc = crc32Table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return (~crc);
+}
+
+static void put16(unsigned char *p, uint16_t v) { p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8); }
+static void put32(unsigned char *p, uint32_t v) { int i; for (i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8*i)); }
+static void put64(unsigned char *p, uint64_t v) { int i; for (i = 0; i < 8; i++) p[i] = (unsigned char)(v >> (8*i)); }
+static uint16_t get16(const unsigned char *p) { return ((uint16_t)(p[0] | (p[1] << 8))); }
+static uint32_t get32(const unsigned char *p) { uint32_t v = 0; int i; for (i = 3; i >= 0; i--) v = (v << 8) | p[i]; return (v); }
+static uint64_t get64(const unsigned char *p) { uint64_t v = 0; int i; for (i = 7; i >= 0; i--) v = (v << 8) | p[i]; return (v); }
+static void putDouble(unsigned char *p, double d) { uint64_t v; memcpy(&v, &d, 8); put64(p, v); }
+static double getDouble(const unsigned char *p) { uint64_t v = get64(p); double d; memcpy(&d, &v, 8); return (d); }
+
+static uint64_t nowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec*1000 + (uint64_t)ts.tv_nsec/1000000);
+}
+
+// Fill in a record header. The payload is "prefixLen" bytes of "prefix" followed by "payloadLen"
+// bytes of "payload". Either may be NULL if its length is 0.
+static void recordHeaderMake(unsigned char header[RECORD_HEADER_LEN], uint8_t type, uint64_t id, const unsigned char *prefix, uint32_t prefixLen, const unsigned char *payload, uint32_t payloadLen)
+{
+    put32(header, prefixLen + payloadLen);
+    header[8] = type;
+    header[9] = header[10] = header[11] = 0;
+    put64(header + 12, id);
+    uint32_t crc = crc32Update(0, header + 8, RECORD_HEADER_LEN - 8);
+    if (prefixLen) crc = crc32Update(crc, prefix, prefixLen);
+    if (payloadLen) crc = crc32Update(crc, payload, payloadLen);
+    put32(header + 4, crc);
+}
+
+static bool recordCRCValid(const unsigned char *header, const unsigned char *payload, uint32_t payloadLen)
+{
+    uint32_t crc = crc32Update(0, header + 8, RECORD_HEADER_LEN - 8);
+    if (payloadLen) crc = crc32Update(crc, payload, payloadLen);
+    return (crc == get32(header + 4));
+}
+
+static bool preadFully(int fd, void *buf, size_t len, uint64_t offset)
+{
+    unsigned char *p = (unsigned char *)buf;
+    while (len) {
+        ssize_t n = pread(fd, p, len, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return (false);
+        p += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return (true);
+}
+
+static bool writeFully(int fd, const void *buf, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return (false);
+        p += n;
+        len -= (size_t)n;
+    }
+    return (true);
+}
+
+// Sync the directory containing "pathname", so that a create or rename is durable.
+static void syncParentDir(const char *pathname)
+{
+    char *dir = strdup(pathname);
+    if (!dir) return;
+    char *slash = strrchr(dir, '/');
+    if (slash) {
+        if (slash == dir) slash[1] = '\0';
+        else *slash = '\0';
+    } else {
+        strcpy(dir, ".");
+    }
+    int dirfd = open(dir, O_RDONLY);
+    if (dirfd != -1) {
+        fsync(dirfd); // Not supported by all filesystems, so ignore errors.
+        close(dirfd);
+    }
+    free(dir);
+}
+
+static bool liveFind(const UPLOAD_JOURNAL_t *journal, uint64_t id, int *pos_p)
+{
+    int lo = 0, hi = journal->liveCount;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (journal->live[mid].id == id) {
+            *pos_p = mid;
+            return (true);
+        }
+        if (journal->live[mid].id < id) lo = mid + 1;
+        else hi = mid;
+    }
+    *pos_p = lo;
+    return (false);
+}
+
+// "key" is 0 for an entry without a key.
+static bool liveAdd(UPLOAD_JOURNAL_t *journal, uint64_t id, uint64_t offset, uint32_t payloadLen, uint64_t key, double rank)
+{
+    int pos;
+    if (liveFind(journal, id, &pos)) return (true);
+    if (journal->liveCount == journal->liveCapacity) {
+        int capacity = (journal->liveCapacity ? journal->liveCapacity*2 : 64);
+        JOURNAL_LIVE_ENTRY_t *live = (JOURNAL_LIVE_ENTRY_t *)realloc(journal->live, capacity*sizeof(JOURNAL_LIVE_ENTRY_t));
+        if (!live) {
+            ARLOGe("Out of memory!\n");
+            return (false);
+        }
+        journal->live = live;
+        journal->liveCapacity = capacity;
+    }
+    memmove(&(journal->live[pos + 1]), &(journal->live[pos]), (journal->liveCount - pos)*sizeof(JOURNAL_LIVE_ENTRY_t));
+    journal->live[pos].id = id;
+    journal->live[pos].offset = offset;
+    journal->live[pos].payloadLen = payloadLen;
+    journal->live[pos].keyed = (key != 0);
+    journal->live[pos].key = key;
+    journal->live[pos].rank = rank;
+    journal->liveCount++;
+    journal->liveBytes += RECORD_HEADER_LEN + payloadLen;
+    return (true);
+}
+
+static bool liveRemove(UPLOAD_JOURNAL_t *journal, uint64_t id)
+{
+    int pos;
+    if (!liveFind(journal, id, &pos)) return (false);
+    uint64_t bytes = RECORD_HEADER_LEN + journal->live[pos].payloadLen;
+    journal->liveBytes -= bytes;
+    journal->deadBytes += bytes;
+    journal->liveCount--;
+    memmove(&(journal->live[pos]), &(journal->live[pos + 1]), (journal->liveCount - pos)*sizeof(JOURNAL_LIVE_ENTRY_t));
+    return (true);
+}
+
+static bool writeJournalHeader(int fd)
+{
+    unsigned char header[JOURNAL_HEADER_LEN];
+    memcpy(header, JOURNAL_MAGIC, 8);
+    put32(header + 8, JOURNAL_VERSION);
+    put32(header + 12, 0);
+    return (writeFully(fd, header, JOURNAL_HEADER_LEN));
+}
+
+// Mark an older journal as the current version, so that it is not opened by code which would
+// misread records it doesn't know. Records in older versions are a subset of those in the current one.
+static bool upgradeJournalHeader(const char *pathname)
+{
+    unsigned char version[4];
+    bool ok = false;
+
+    put32(version, JOURNAL_VERSION);
+    int fd = open(pathname, O_WRONLY); // Not O_APPEND, which would make pwrite() append on some systems.
+    if (fd != -1) {
+        ok = (pwrite(fd, version, 4, 8) == 4 && fsync(fd) == 0);
+        close(fd);
+    }
+    if (!ok) {
+        ARLOGe("Error upgrading upload journal '%s'.\n", pathname);
+        ARLOGperror(NULL);
+    }
+    return (ok);
+}
+
+// Rebuild the list of live entries from the journal, truncating any invalid tail.
+static bool replay(UPLOAD_JOURNAL_t *journal)
+{
+    unsigned char header[RECORD_HEADER_LEN];
+    unsigned char *payload = NULL;
+    size_t payloadCapacity = 0;
+    uint64_t offset = JOURNAL_HEADER_LEN;
+    bool ok = true;
+
+    while (offset < journal->size) {
+        if (journal->size - offset < RECORD_HEADER_LEN || !preadFully(journal->fd, header, RECORD_HEADER_LEN, offset)) break;
+        uint32_t payloadLen = get32(header);
+        if (payloadLen > RECORD_PAYLOAD_LEN_MAX || journal->size - offset - RECORD_HEADER_LEN < payloadLen) break;
+        if (payloadLen > payloadCapacity) {
+            unsigned char *p = (unsigned char *)realloc(payload, payloadLen);
+            if (!p) {
+                ARLOGe("Out of memory!\n");
+                ok = false;
+                break;
+            }
+            payload = p;
+            payloadCapacity = payloadLen;
+        }
+        if (payloadLen && !preadFully(journal->fd, payload, payloadLen, offset + RECORD_HEADER_LEN)) break;
+        if (!recordCRCValid(header, payload, payloadLen)) break;
+
+        uint64_t id = get64(header + 12);
+        if (header[8] == RECORD_TYPE_ENTRY || header[8] == RECORD_TYPE_KEYED_ENTRY) {
+            uint64_t key = 0;
+            double rank = 0.0;
+            if (header[8] == RECORD_TYPE_KEYED_ENTRY) {
+                if (payloadLen < KEY_PREFIX_LEN) break;
+                key = get64(payload);
+                rank = getDouble(payload + 8);
+            }
+            if (!liveAdd(journal, id, offset, payloadLen, key, rank)) {
+                ok = false;
+                break;
+            }
+        } else {
+            liveRemove(journal, id);
+            journal->deadBytes += RECORD_HEADER_LEN + payloadLen;
+        }
+        if (id >= journal->nextID) journal->nextID = id + 1;
+        offset += RECORD_HEADER_LEN + payloadLen;
+    }
+    free(payload);
+    if (!ok) return (false);
+
+    if (offset < journal->size) {
+        ARLOGw("Warning: upload journal '%s' has an incomplete or corrupt record at offset %llu; discarding %llu bytes.\n", journal->pathname, (unsigned long long)offset, (unsigned long long)(journal->size - offset));
+        if (ftruncate(journal->fd, (off_t)offset) < 0 || fsync(journal->fd) < 0) {
+            ARLOGe("Error truncating upload journal '%s'.\n", journal->pathname);
+            ARLOGperror(NULL);
+            return (false);
+        }
+        journal->size = offset;
+    }
+    return (true);
+}
+
+// ---------------------------------------------------------------------------
+
+UPLOAD_JOURNAL_t *uploadJournalOpen(const char *pathname)
+{
+    UPLOAD_JOURNAL_t *journal;
+    struct stat st;
+
+    if (!pathname) return (NULL);
+    pthread_once(&crc32TableOnce, crc32TableInit);
+
+    if (!(journal = (UPLOAD_JOURNAL_t *)calloc(1, sizeof(UPLOAD_JOURNAL_t)))) {
+        ARLOGe("Out of memory!\n");
+        return (NULL);
+    }
+    journal->pathname = strdup(pathname);
+    journal->nextID = 1;
+    pthread_mutex_init(&(journal->lock), NULL);
+
+    journal->fd = open(pathname, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (journal->fd == -1 || fstat(journal->fd, &st) == -1) {
+        ARLOGe("Error opening upload journal '%s'.\n", pathname);
+        ARLOGperror(NULL);
+        goto bail;
+    }
+    fcntl(journal->fd, F_SETFD, FD_CLOEXEC);
+    journal->size = (uint64_t)st.st_size;
+
+    if (journal->size < JOURNAL_HEADER_LEN) {
+        // New (or torn during creation).
+        if (ftruncate(journal->fd, 0) < 0 || !writeJournalHeader(journal->fd) || fsync(journal->fd) < 0) {
+            ARLOGe("Error initialising upload journal '%s'.\n", pathname);
+            ARLOGperror(NULL);
+            goto bail;
+        }
+        syncParentDir(pathname);
+        journal->size = JOURNAL_HEADER_LEN;
+    } else {
+        unsigned char header[JOURNAL_HEADER_LEN];
+        uint32_t version = 0;
+        if (preadFully(journal->fd, header, JOURNAL_HEADER_LEN, 0) && memcmp(header, JOURNAL_MAGIC, 8) == 0) version = get32(header + 8);
+        if (version < JOURNAL_VERSION_MIN || version > JOURNAL_VERSION) {
+            ARLOGe("Error: '%s' is not an upload journal, or is an unsupported version.\n", pathname);
+            goto bail;
+        }
+        if (!replay(journal)) goto bail;
+        if (version < JOURNAL_VERSION && !upgradeJournalHeader(pathname)) goto bail;
+    }
+    journal->lastSyncTimeMs = nowMs();
+
+    ARLOGd("Opened upload journal '%s' with %d pending entries.\n", pathname, journal->liveCount);
+    return (journal);
+
+bail:
+    uploadJournalClose(&journal);
+    return (NULL);
+}
+
+void uploadJournalClose(UPLOAD_JOURNAL_t **journal_p)
+{
+    if (!journal_p || !*journal_p) return;
+
+    if ((*journal_p)->fd != -1) {
+        if ((*journal_p)->unsyncedCount) fsync((*journal_p)->fd);
+        close((*journal_p)->fd);
+    }
+    pthread_mutex_destroy(&((*journal_p)->lock));
+    free((*journal_p)->live);
+    free((*journal_p)->pathname);
+    free(*journal_p);
+    *journal_p = NULL;
+}
+
+static bool syncLocked(UPLOAD_JOURNAL_t *journal)
+{
+    if (!journal->unsyncedCount) return (true);
+    if (fsync(journal->fd) < 0) {
+        ARLOGe("Error syncing upload journal '%s'.\n", journal->pathname);
+        ARLOGperror(NULL);
+        return (false);
+    }
+    journal->unsyncedCount = 0;
+    journal->lastSyncTimeMs = nowMs();
+    return (true);
+}
+
+// Batched sync policy; see header.
+static bool syncIfDueLocked(UPLOAD_JOURNAL_t *journal)
+{
+    if (journal->unsyncedCount >= UPLOAD_JOURNAL_SYNC_BATCH_COUNT || nowMs() - journal->lastSyncTimeMs >= UPLOAD_JOURNAL_SYNC_INTERVAL_MS) {
+        return (syncLocked(journal));
+    }
+    return (true);
+}
+
+// Append a record with one write call. The payload is as for recordHeaderMake().
+// On failure, the journal is truncated back to its previous length.
+static bool appendRecordLocked(UPLOAD_JOURNAL_t *journal, uint8_t type, uint64_t id, const unsigned char *prefix, uint32_t prefixLen, const unsigned char *payload, uint32_t payloadLen)
+{
+    unsigned char header[RECORD_HEADER_LEN];
+    struct iovec iov[3];
+    int iovcnt = 1;
+    ssize_t n;
+
+    recordHeaderMake(header, type, id, prefix, prefixLen, payload, payloadLen);
+    iov[0].iov_base = header;
+    iov[0].iov_len = RECORD_HEADER_LEN;
+    if (prefixLen) {
+        iov[iovcnt].iov_base = (void *)prefix;
+        iov[iovcnt++].iov_len = prefixLen;
+    }
+    if (payloadLen) {
+        iov[iovcnt].iov_base = (void *)payload;
+        iov[iovcnt++].iov_len = payloadLen;
+    }
+    do {
+        n = writev(journal->fd, iov, iovcnt);
+    } while (n < 0 && errno == EINTR);
+    if (n != (ssize_t)(RECORD_HEADER_LEN + prefixLen + payloadLen)) {
+        ARLOGe("Error writing to upload journal '%s'.\n", journal->pathname);
+        if (n < 0) ARLOGperror(NULL);
+        if (ftruncate(journal->fd, (off_t)journal->size) < 0) ARLOGperror(NULL);
+        return (false);
+    }
+    journal->size += (uint64_t)n;
+    journal->unsyncedCount++;
+    return (true);
+}
+
+bool uploadJournalAppend(UPLOAD_JOURNAL_t *journal, const UPLOAD_JOURNAL_ENTRY_t *entry, uint64_t *id_out)
+{
+    return (uploadJournalAppendKeyed(journal, entry, 0, 0.0, id_out));
+}
+
+bool uploadJournalAppendKeyed(UPLOAD_JOURNAL_t *journal, const UPLOAD_JOURNAL_ENTRY_t *entry, uint64_t key, double rank, uint64_t *id_out)
+{
+    unsigned char prefix[KEY_PREFIX_LEN];
+    uint32_t prefixLen = 0;
+    bool ok = false;
+
+    if (!journal || !entry) return (false);
+    if (key) {
+        put64(prefix, key);
+        putDouble(prefix + 8, rank);
+        prefixLen = KEY_PREFIX_LEN;
+    }
+    uint32_t payloadLen = (uint32_t)(entry->len - RECORD_HEADER_LEN);
+    if (payloadLen + prefixLen > RECORD_PAYLOAD_LEN_MAX) {
+        ARLOGe("Error: upload journal entry too large (%u bytes).\n", payloadLen);
+        return (false);
+    }
+
+    pthread_mutex_lock(&(journal->lock));
+    uint64_t id = journal->nextID;
+    uint64_t offset = journal->size;
+    if (appendRecordLocked(journal, (key ? RECORD_TYPE_KEYED_ENTRY : RECORD_TYPE_ENTRY), id, prefix, prefixLen, entry->buf + RECORD_HEADER_LEN, payloadLen)) {
+        journal->nextID++;
+        ok = liveAdd(journal, id, offset, prefixLen + payloadLen, key, rank);
+        syncIfDueLocked(journal);
+    }
+    pthread_mutex_unlock(&(journal->lock));
+
+    if (ok && id_out) *id_out = id;
+    return (ok);
+}
+
+bool uploadJournalMarkDone(UPLOAD_JOURNAL_t *journal, uint64_t id)
+{
+    int pos;
+    bool ok = false;
+
+    if (!journal) return (false);
+
+    pthread_mutex_lock(&(journal->lock));
+    if (liveFind(journal, id, &pos) && appendRecordLocked(journal, RECORD_TYPE_DONE, id, NULL, 0, NULL, 0)) {
+        liveRemove(journal, id);
+        journal->deadBytes += RECORD_HEADER_LEN;
+        syncIfDueLocked(journal);
+        ok = true;
+    }
+    pthread_mutex_unlock(&(journal->lock));
+
+    return (ok);
+}
+
+typedef struct {
+    uint64_t             key;
+    double               rank;
+    uint64_t             id;
+} JOURNAL_KEYED_t;
+
+// Orders by key, and within a key, best (lowest rank, then newest) first.
+static int keyedCompare(const void *a, const void *b)
+{
+    const JOURNAL_KEYED_t *ka = (const JOURNAL_KEYED_t *)a, *kb = (const JOURNAL_KEYED_t *)b;
+    if (ka->key != kb->key) return (ka->key < kb->key ? -1 : 1);
+    if (ka->rank != kb->rank) return (ka->rank < kb->rank ? -1 : 1);
+    return (ka->id > kb->id ? -1 : (ka->id < kb->id ? 1 : 0));
+}
+
+int uploadJournalCoalesce(UPLOAD_JOURNAL_t *journal)
+{
+    JOURNAL_KEYED_t *keyed;
+    int i, keyedCount = 0, removed = 0;
+
+    if (!journal) return (-1);
+
+    pthread_mutex_lock(&(journal->lock));
+    if (!(keyed = (JOURNAL_KEYED_t *)malloc((journal->liveCount ? journal->liveCount : 1)*sizeof(JOURNAL_KEYED_t)))) {
+        ARLOGe("Out of memory!\n");
+        pthread_mutex_unlock(&(journal->lock));
+        return (-1);
+    }
+    for (i = 0; i < journal->liveCount; i++) {
+        if (!journal->live[i].keyed) continue;
+        keyed[keyedCount].key = journal->live[i].key;
+        keyed[keyedCount].rank = journal->live[i].rank;
+        keyed[keyedCount++].id = journal->live[i].id;
+    }
+    qsort(keyed, keyedCount, sizeof(JOURNAL_KEYED_t), keyedCompare);
+    for (i = 1; i < keyedCount; i++) {
+        if (keyed[i].key != keyed[i - 1].key) continue;
+        if (!appendRecordLocked(journal, RECORD_TYPE_DONE, keyed[i].id, NULL, 0, NULL, 0)) {
+            removed = -1;
+            break;
+        }
+        liveRemove(journal, keyed[i].id);
+        journal->deadBytes += RECORD_HEADER_LEN;
+        removed++;
+    }
+    if (removed) syncIfDueLocked(journal);
+    pthread_mutex_unlock(&(journal->lock));
+
+    free(keyed);
+    return (removed);
+}
+
+bool uploadJournalSync(UPLOAD_JOURNAL_t *journal)
+{
+    bool ok;
+
+    if (!journal) return (false);
+    pthread_mutex_lock(&(journal->lock));
+    ok = syncLocked(journal);
+    pthread_mutex_unlock(&(journal->lock));
+    return (ok);
+}
+
+// Write live records to a new file, then atomically replace the journal with it.
+static bool rewriteLocked(UPLOAD_JOURNAL_t *journal)
+{
+    size_t tempLen = strlen(journal->pathname) + 5;
+    char *tempPathname = (char *)malloc(tempLen);
+    uint64_t *offsets = (uint64_t *)malloc((journal->liveCount ? journal->liveCount : 1)*sizeof(uint64_t));
+    unsigned char *buf = NULL;
+    size_t bufCapacity = 0;
+    int fd = -1;
+    int i;
+    bool ok = false;
+
+    if (!tempPathname || !offsets) {
+        ARLOGe("Out of memory!\n");
+        goto done;
+    }
+    snprintf(tempPathname, tempLen, "%s.tmp", journal->pathname);
+    fd = open(tempPathname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || !writeJournalHeader(fd)) goto done;
+
+    uint64_t offset = JOURNAL_HEADER_LEN;
+    for (i = 0; i < journal->liveCount; i++) {
+        size_t len = RECORD_HEADER_LEN + journal->live[i].payloadLen;
+        if (len > bufCapacity) {
+            unsigned char *p = (unsigned char *)realloc(buf, len);
+            if (!p) goto done;
+            buf = p;
+            bufCapacity = len;
+        }
+        if (!preadFully(journal->fd, buf, len, journal->live[i].offset) || !writeFully(fd, buf, len)) goto done;
+        offsets[i] = offset;
+        offset += len;
+    }
+    if (fsync(fd) < 0 || close(fd) < 0) {
+        fd = -1;
+        goto done;
+    }
+    fd = -1;
+    if (rename(tempPathname, journal->pathname) < 0) goto done;
+    syncParentDir(journal->pathname);
+
+    // Switch to the new file.
+    int newfd = open(journal->pathname, O_RDWR | O_APPEND);
+    if (newfd == -1) {
+        // The old descriptor still refers to the old (unlinked) file. Nothing more can be appended safely.
+        ARLOGe("Error reopening upload journal '%s' after compaction.\n", journal->pathname);
+        ARLOGperror(NULL);
+        goto done;
+    }
+    fcntl(newfd, F_SETFD, FD_CLOEXEC);
+    close(journal->fd);
+    journal->fd = newfd;
+    for (i = 0; i < journal->liveCount; i++) journal->live[i].offset = offsets[i];
+    journal->size = offset;
+    journal->deadBytes = 0;
+    ok = true;
+
+done:
+    if (!ok) {
+        ARLOGe("Error compacting upload journal '%s'.\n", journal->pathname);
+        if (errno) ARLOGperror(NULL);
+        if (fd != -1) close(fd);
+        if (tempPathname) unlink(tempPathname);
+    }
+    free(buf);
+    free(offsets);
+    free(tempPathname);
+    return (ok);
+}
+
+bool uploadJournalCompact(UPLOAD_JOURNAL_t *journal)
+{
+    bool ok = true;
+
+    if (!journal) return (false);
+
+    pthread_mutex_lock(&(journal->lock));
+    if (!syncLocked(journal)) ok = false;
+    else if (journal->deadBytes) {
+        if (!journal->liveCount) {
+            // Nothing pending, so truncation suffices.
+            if (ftruncate(journal->fd, JOURNAL_HEADER_LEN) < 0 || fsync(journal->fd) < 0) {
+                ARLOGe("Error truncating upload journal '%s'.\n", journal->pathname);
+                ARLOGperror(NULL);
+                ok = false;
+            } else {
+                journal->size = JOURNAL_HEADER_LEN;
+                journal->deadBytes = 0;
+            }
+        } else if (journal->deadBytes >= UPLOAD_JOURNAL_COMPACT_MIN_BYTES && journal->deadBytes > journal->liveBytes) {
+            ok = rewriteLocked(journal);
+        }
+    }
+    pthread_mutex_unlock(&(journal->lock));
+
+    return (ok);
+}
+
+int uploadJournalCount(UPLOAD_JOURNAL_t *journal)
+{
+    int count;
+
+    if (!journal) return (0);
+    pthread_mutex_lock(&(journal->lock));
+    count = journal->liveCount;
+    pthread_mutex_unlock(&(journal->lock));
+    return (count);
+}
+
+bool uploadJournalGetID(UPLOAD_JOURNAL_t *journal, int index, uint64_t *id_out)
+{
+    bool ok = false;
+
+    if (!journal || !id_out) return (false);
+    pthread_mutex_lock(&(journal->lock));
+    if (index >= 0 && index < journal->liveCount) {
+        *id_out = journal->live[index].id;
+        ok = true;
+    }
+    pthread_mutex_unlock(&(journal->lock));
+    return (ok);
+}
+
+UPLOAD_JOURNAL_ENTRY_t *uploadJournalRead(UPLOAD_JOURNAL_t *journal, uint64_t id)
+{
+    UPLOAD_JOURNAL_ENTRY_t *entry = NULL;
+    int pos;
+
+    if (!journal) return (NULL);
+
+    pthread_mutex_lock(&(journal->lock));
+    if (!liveFind(journal, id, &pos)) goto done;
+    if (!(entry = (UPLOAD_JOURNAL_ENTRY_t *)calloc(1, sizeof(UPLOAD_JOURNAL_ENTRY_t)))) {
+        ARLOGe("Out of memory!\n");
+        goto done;
+    }
+    entry->len = entry->capacity = RECORD_HEADER_LEN + journal->live[pos].payloadLen;
+    if (!(entry->buf = (unsigned char *)malloc(entry->capacity))) {
+        ARLOGe("Out of memory!\n");
+        uploadJournalEntryFree(&entry);
+        goto done;
+    }
+    if (!preadFully(journal->fd, entry->buf, entry->len, journal->live[pos].offset) || !recordCRCValid(entry->buf, entry->buf + RECORD_HEADER_LEN, journal->live[pos].payloadLen)) {
+        ARLOGe("Error reading entry %llu from upload journal '%s'.\n", (unsigned long long)id, journal->pathname);
+        uploadJournalEntryFree(&entry);
+        goto done;
+    }
+    if (journal->live[pos].keyed) {
+        // The entry's fields start after the key.
+        memmove(entry->buf + RECORD_HEADER_LEN, entry->buf + RECORD_HEADER_LEN + KEY_PREFIX_LEN, entry->len - RECORD_HEADER_LEN - KEY_PREFIX_LEN);
+        entry->len -= KEY_PREFIX_LEN;
+    }
+done:
+    pthread_mutex_unlock(&(journal->lock));
+    return (entry);
+}
+
+// ---------------------------------------------------------------------------
+
+UPLOAD_JOURNAL_ENTRY_t *uploadJournalEntryNew(void)
+{
+    UPLOAD_JOURNAL_ENTRY_t *entry;
+
+    if (!(entry = (UPLOAD_JOURNAL_ENTRY_t *)calloc(1, sizeof(UPLOAD_JOURNAL_ENTRY_t)))) {
+        ARLOGe("Out of memory!\n");
+        return (NULL);
+    }
+    entry->capacity = 1024;
+    if (!(entry->buf = (unsigned char *)calloc(1, entry->capacity))) {
+        ARLOGe("Out of memory!\n");
+        free(entry);
+        return (NULL);
+    }
+    entry->len = RECORD_HEADER_LEN + 2; // Header space plus field count of 0.
+    return (entry);
+}
+
+void uploadJournalEntryFree(UPLOAD_JOURNAL_ENTRY_t **entry_p)
+{
+    if (!entry_p || !*entry_p) return;
+    free((*entry_p)->buf);
+    free(*entry_p);
+    *entry_p = NULL;
+}
+
+static bool entryAdd(UPLOAD_JOURNAL_ENTRY_t *entry, uint8_t kind, const char *name, const char *filename, const void *value, uint32_t valueLen)
+{
+    size_t nameLen = strlen(name);
+    size_t filenameLen = (filename ? strlen(filename) : 0);
+    if (nameLen > 0xFFFF || filenameLen > 0xFFFF) return (false);
+    uint16_t fieldCount = get16(entry->buf + RECORD_HEADER_LEN);
+    if (fieldCount == 0xFFFF) return (false);
+
+    size_t len = FIELD_HEADER_LEN + nameLen + 1 + filenameLen + 1 + valueLen + 1;
+    if (entry->len + len > RECORD_HEADER_LEN + RECORD_PAYLOAD_LEN_MAX) return (false);
+    if (entry->len + len > entry->capacity) {
+        size_t capacity = entry->capacity;
+        while (capacity < entry->len + len) capacity *= 2;
+        unsigned char *buf = (unsigned char *)realloc(entry->buf, capacity);
+        if (!buf) {
+            ARLOGe("Out of memory!\n");
+            return (false);
+        }
+        entry->buf = buf;
+        entry->capacity = capacity;
+    }
+
+    unsigned char *p = entry->buf + entry->len;
+    p[0] = kind;
+    p[1] = 0;
+    put16(p + 2, (uint16_t)nameLen);
+    put16(p + 4, (uint16_t)filenameLen);
+    put32(p + 6, valueLen);
+    p += FIELD_HEADER_LEN;
+    memcpy(p, name, nameLen); p += nameLen; *p++ = '\0';
+    if (filenameLen) memcpy(p, filename, filenameLen);
+    p += filenameLen; *p++ = '\0';
+    if (valueLen) memcpy(p, value, valueLen);
+    p += valueLen; *p++ = '\0';
+    entry->len += len;
+    put16(entry->buf + RECORD_HEADER_LEN, fieldCount + 1);
+    return (true);
+}
+
+bool uploadJournalEntryAddField(UPLOAD_JOURNAL_ENTRY_t *entry, const char *name, const char *value)
+{
+    if (!entry || !name || !value) return (false);
+    return (entryAdd(entry, FIELD_KIND_TEXT, name, NULL, value, (uint32_t)strlen(value)));
+}
+
+bool uploadJournalEntryAddFile(UPLOAD_JOURNAL_ENTRY_t *entry, const char *name, const char *filename, const void *data, uint32_t dataLen)
+{
+    if (!entry || !name || !filename || (!data && dataLen)) return (false);
+    return (entryAdd(entry, FIELD_KIND_FILE, name, filename, data, dataLen));
+}
+
+int uploadJournalEntryFieldCount(const UPLOAD_JOURNAL_ENTRY_t *entry)
+{
+    if (!entry) return (0);
+    return (get16(entry->buf + RECORD_HEADER_LEN));
+}
+
+bool uploadJournalEntryGetField(const UPLOAD_JOURNAL_ENTRY_t *entry, int index, const char **name_out, const char **filename_out, const void **value_out, uint32_t *valueLen_out)
+{
+    if (!entry || index < 0 || index >= uploadJournalEntryFieldCount(entry)) return (false);
+
+    const unsigned char *p = entry->buf + RECORD_HEADER_LEN + 2;
+    const unsigned char *end = entry->buf + entry->len;
+    int i;
+    for (i = 0; ; i++) {
+        if (end - p < FIELD_HEADER_LEN) return (false);
+        uint8_t kind = p[0];
+        size_t nameLen = get16(p + 2);
+        size_t filenameLen = get16(p + 4);
+        uint32_t valueLen = get32(p + 6);
+        size_t len = FIELD_HEADER_LEN + nameLen + 1 + filenameLen + 1 + (size_t)valueLen + 1;
+        if ((size_t)(end - p) < len) return (false);
+        if (i == index) {
+            const unsigned char *q = p + FIELD_HEADER_LEN;
+            if (name_out) *name_out = (const char *)q;
+            q += nameLen + 1;
+            if (filename_out) *filename_out = (kind == FIELD_KIND_FILE ? (const char *)q : NULL);
+            q += filenameLen + 1;
+            if (value_out) *value_out = q;
+            if (valueLen_out) *valueLen_out = valueLen;
+            return (true);
+        }
+        p += len;
+    }
+}
@@ -0,0 +1,132 @@
+/*
+ *  uploadJournal.h
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+
+#ifndef UPLOADJOURNAL_H
+#define UPLOADJOURNAL_H
+
+//
+// Append-only, checksummed journal of form submissions awaiting upload.
+//
+// Each entry holds a list of form fields. A field is either text, or a file, in which case it
+// also carries a filename and the file contents. Entries are appended to the journal with a single
+// write() call, and are later marked as done (also by appending a record) once uploaded.
+// fsync() is batched: an append syncs immediately only if nothing has been synced for
+// UPLOAD_JOURNAL_SYNC_INTERVAL_MS or if UPLOAD_JOURNAL_SYNC_BATCH_COUNT records are waiting.
+// uploadJournalSync() may be used to force a sync.
+//
+// Every record carries a CRC-32. When the journal is opened, it is replayed to rebuild the list
+// of pending entries, and any torn or corrupt tail (e.g. after a crash mid-write) is truncated.
+// uploadJournalCompact() rewrites the journal without records for completed entries.
+//
+// An entry may be appended with a key, identifying entries which are interchangeable, and a rank.
+// uploadJournalCoalesce() reduces each set of pending entries sharing a key to the one with the
+// lowest rank.
+//
+// All functions are thread-safe.
+//
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define UPLOAD_JOURNAL_SYNC_BATCH_COUNT 16
+#define UPLOAD_JOURNAL_SYNC_INTERVAL_MS 1000
+#define UPLOAD_JOURNAL_COMPACT_MIN_BYTES 65536 // Don't rewrite the journal to reclaim less than this.
+
+typedef struct _UPLOAD_JOURNAL UPLOAD_JOURNAL_t;
+typedef struct _UPLOAD_JOURNAL_ENTRY UPLOAD_JOURNAL_ENTRY_t;
+
+// Open the journal at "pathname", creating it if it doesn't exist. Returns NULL in case of error.
+UPLOAD_JOURNAL_t *uploadJournalOpen(const char *pathname);
+
+// Sync and close the journal.
+void uploadJournalClose(UPLOAD_JOURNAL_t **journal_p);
+
+// Append an entry. On success, if "id_out" is non-NULL, the ID of the new entry is placed in it.
+bool uploadJournalAppend(UPLOAD_JOURNAL_t *journal, const UPLOAD_JOURNAL_ENTRY_t *entry, uint64_t *id_out);
+
+// As uploadJournalAppend(), but with a key, which must be non-zero, and a rank, lower being better.
+bool uploadJournalAppendKeyed(UPLOAD_JOURNAL_t *journal, const UPLOAD_JOURNAL_ENTRY_t *entry, uint64_t key, double rank, uint64_t *id_out);
+
+// Of each set of pending entries with the same key, mark all but the lowest ranked as done. Of
+// equally ranked entries, the newest is kept. Returns the number of entries marked done, or -1
+// in case of error. Call only when none of the entries could be in use (e.g. being uploaded).
+int uploadJournalCoalesce(UPLOAD_JOURNAL_t *journal);
+
+// Mark a pending entry as done. It will no longer be returned by uploadJournalGetID().
+bool uploadJournalMarkDone(UPLOAD_JOURNAL_t *journal, uint64_t id);
+
+// Sync any records not yet synced to storage.
+bool uploadJournalSync(UPLOAD_JOURNAL_t *journal);
+
+// Sync, and then rewrite the journal if enough space would be reclaimed.
+bool uploadJournalCompact(UPLOAD_JOURNAL_t *journal);
+
+// Number of pending (not done) entries.
+int uploadJournalCount(UPLOAD_JOURNAL_t *journal);
+
+// Get the ID of the pending entry at "index", oldest first.
+bool uploadJournalGetID(UPLOAD_JOURNAL_t *journal, int index, uint64_t *id_out);
+
+// Read a pending entry. The entry must be freed with uploadJournalEntryFree().
+UPLOAD_JOURNAL_ENTRY_t *uploadJournalRead(UPLOAD_JOURNAL_t *journal, uint64_t id);
+
+//
+// Entries.
+//
+
+UPLOAD_JOURNAL_ENTRY_t *uploadJournalEntryNew(void);
+
+void uploadJournalEntryFree(UPLOAD_JOURNAL_ENTRY_t **entry_p);
+
+bool uploadJournalEntryAddField(UPLOAD_JOURNAL_ENTRY_t *entry, const char *name, const char *value);
+
+bool uploadJournalEntryAddFile(UPLOAD_JOURNAL_ENTRY_t *entry, const char *name, const char *filename, const void *data, uint32_t dataLen);
+
+int uploadJournalEntryFieldCount(const UPLOAD_JOURNAL_ENTRY_t *entry);
+
+// Get field at "index". For text fields, *filename_out is set to NULL and the value is nul-terminated
+// (not included in *valueLen_out). Pointers remain valid until the entry is freed.
+bool uploadJournalEntryGetField(const UPLOAD_JOURNAL_ENTRY_t *entry, int index, const char **name_out, const char **filename_out, const void **value_out, uint32_t *valueLen_out);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // !UPLOADJOURNAL_H
@@ -0,0 +1,285 @@
+/*
+ *  uploadQueue.c
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+
+#include "uploadQueue.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // strcasecmp()
+#include <errno.h>
+#include <dirent.h> // opendir(), readdir(), closedir()
+#include <unistd.h> // read(), close()
+#ifdef __linux__
+#  include <sys/inotify.h>
+#  define HAVE_INOTIFY 1
+#endif
+
+#include <ARX/AR/ar.h>
+
+#define UPLOAD_QUEUE_CAPACITY_INITIAL 64
+
+struct _UPLOAD_QUEUE {
+    char                *queueDirPath;
+    char                *ext;
+    size_t               extLen;
+    char               **names; // Sorted ascending by strcmp().
+    int                  count;
+    int                  capacity;
+    int                  inotifyFD; // -1 if not in use.
+};
+
+// ---------------------------------------------------------------------------
+
+// Cheap test of filename extension, case-insensitive, without allocating.
+static bool hasExtension(const UPLOAD_QUEUE_t *queue, const char *name)
+{
+    size_t len = strlen(name);
+    if (len <= queue->extLen + 1) return (false);
+    if (name[len - queue->extLen - 1] != '.') return (false);
+    return (strcasecmp(name + len - queue->extLen, queue->ext) == 0);
+}
+
+// Binary search. Returns true if found, and in either case sets *pos_p to the index at which the name is or would be.
+static bool find(const UPLOAD_QUEUE_t *queue, const char *name, int *pos_p)
+{
+    int lo = 0, hi = queue->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int c = strcmp(queue->names[mid], name);
+        if (c == 0) {
+            *pos_p = mid;
+            return (true);
+        }
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    *pos_p = lo;
+    return (false);
+}
+
+static bool grow(UPLOAD_QUEUE_t *queue)
+{
+    if (queue->count < queue->capacity) return (true);
+    int capacity = (queue->capacity ? queue->capacity * 2 : UPLOAD_QUEUE_CAPACITY_INITIAL);
+    char **names = (char **)realloc(queue->names, capacity * sizeof(char *));
+    if (!names) {
+        ARLOGe("Out of memory!\n");
+        return (false);
+    }
+    queue->names = names;
+    queue->capacity = capacity;
+    return (true);
+}
+
+static bool insert(UPLOAD_QUEUE_t *queue, const char *name)
+{
+    int pos;
+    if (find(queue, name, &pos)) return (true);
+    if (!grow(queue)) return (false);
+    char *nameCopy = strdup(name);
+    if (!nameCopy) {
+        ARLOGe("Out of memory!\n");
+        return (false);
+    }
+    memmove(&(queue->names[pos + 1]), &(queue->names[pos]), (queue->count - pos) * sizeof(char *));
+    queue->names[pos] = nameCopy;
+    queue->count++;
+    return (true);
+}
+
+static int compareNames(const void *a, const void *b)
+{
+    return (strcmp(*(char * const *)a, *(char * const *)b));
+}
+
+static void clear(UPLOAD_QUEUE_t *queue)
+{
+    int i;
+    for (i = 0; i < queue->count; i++) free(queue->names[i]);
+    queue->count = 0;
+}
+
+// ---------------------------------------------------------------------------
+
+UPLOAD_QUEUE_t *uploadQueueInit(const char *queueDirPath, const char *ext)
+{
+    UPLOAD_QUEUE_t *queue;
+
+    if (!queueDirPath || !ext) return (NULL);
+
+    if (!(queue = (UPLOAD_QUEUE_t *)calloc(1, sizeof(UPLOAD_QUEUE_t)))) {
+        ARLOGe("Out of memory!\n");
+        return (NULL);
+    }
+    queue->queueDirPath = strdup(queueDirPath);
+    queue->ext = strdup(ext);
+    queue->extLen = strlen(ext);
+    queue->inotifyFD = -1;
+
+#ifdef HAVE_INOTIFY
+    // Start watching before the initial scan, so that no change can be missed in between.
+    queue->inotifyFD = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (queue->inotifyFD == -1) {
+        ARLOGw("Warning: inotify unavailable; upload queue will be rescanned on each refresh.\n");
+    } else if (inotify_add_watch(queue->inotifyFD, queueDirPath, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF) == -1) {
+        ARLOGw("Warning: unable to watch upload queue dir '%s'; upload queue will be rescanned on each refresh.\n", queueDirPath);
+        close(queue->inotifyFD);
+        queue->inotifyFD = -1;
+    }
+#endif
+
+    if (!uploadQueueRescan(queue)) {
+        uploadQueueFinal(&queue);
+        return (NULL);
+    }
+
+    return (queue);
+}
+
+void uploadQueueFinal(UPLOAD_QUEUE_t **queue_p)
+{
+    if (!queue_p || !*queue_p) return;
+
+    if ((*queue_p)->inotifyFD != -1) close((*queue_p)->inotifyFD);
+    clear(*queue_p);
+    free((*queue_p)->names);
+    free((*queue_p)->queueDirPath);
+    free((*queue_p)->ext);
+    free(*queue_p);
+    *queue_p = NULL;
+}
+
+bool uploadQueueRescan(UPLOAD_QUEUE_t *queue)
+{
+    DIR *dirp;
+    struct dirent *direntp;
+
+    if (!queue) return (false);
+
+    if (!(dirp = opendir(queue->queueDirPath))) {
+        ARLOGe("Error opening upload queue dir '%s'.\n", queue->queueDirPath);
+        ARLOGperror(NULL);
+        return (false);
+    }
+
+    clear(queue);
+    bool ok = true;
+    while ((direntp = readdir(dirp))) {
+        if (!hasExtension(queue, direntp->d_name)) continue;
+        if (!grow(queue) || !(queue->names[queue->count] = strdup(direntp->d_name))) {
+            ARLOGe("Out of memory!\n");
+            ok = false;
+            break;
+        }
+        queue->count++;
+    }
+    closedir(dirp);
+
+    // Sort once, rather than inserting in order.
+    qsort(queue->names, queue->count, sizeof(char *), compareNames);
+
+    return (ok);
+}
+
+bool uploadQueueRefresh(UPLOAD_QUEUE_t *queue)
+{
+    if (!queue) return (false);
+
+#ifdef HAVE_INOTIFY
+    if (queue->inotifyFD != -1) {
+        char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+        bool rescan = false;
+        bool ok = true;
+        ssize_t len;
+
+        while ((len = read(queue->inotifyFD, buf, sizeof(buf))) > 0) {
+            char *p;
+            for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+                const struct inotify_event *event = (const struct inotify_event *)p;
+                if (event->mask & IN_Q_OVERFLOW) {
+                    rescan = true;
+                } else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                    // The directory itself went away. Fall back to rescanning.
+                    ARLOGw("Warning: upload queue dir '%s' moved or deleted; no longer watching.\n", queue->queueDirPath);
+                    close(queue->inotifyFD);
+                    queue->inotifyFD = -1;
+                    return (uploadQueueRescan(queue));
+                } else if (event->len && hasExtension(queue, event->name)) {
+                    if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                        if (!insert(queue, event->name)) ok = false;
+                    } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                        uploadQueueRemove(queue, event->name);
+                    }
+                }
+            }
+        }
+        if (len == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            ARLOGe("Error reading upload queue change events.\n");
+            ARLOGperror(NULL);
+            rescan = true;
+        }
+
+        if (rescan) return (uploadQueueRescan(queue));
+        return (ok);
+    }
+#endif
+    return (uploadQueueRescan(queue));
+}
+
+int uploadQueueCount(UPLOAD_QUEUE_t *queue)
+{
+    if (!queue) return (0);
+    return (queue->count);
+}
+
+const char *uploadQueueGet(UPLOAD_QUEUE_t *queue, int index)
+{
+    if (!queue || index < 0 || index >= queue->count) return (NULL);
+    return (queue->names[index]);
+}
+
+bool uploadQueueRemove(UPLOAD_QUEUE_t *queue, const char *filename)
+{
+    int pos;
+
+    if (!queue || !filename) return (false);
+    if (!find(queue, filename, &pos)) return (false);
+    free(queue->names[pos]);
+    queue->count--;
+    memmove(&(queue->names[pos]), &(queue->names[pos + 1]), (queue->count - pos) * sizeof(char *));
+    return (true);
+}
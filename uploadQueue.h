@@ -0,0 +1,83 @@
+/*
+ *  uploadQueue.h
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+
+#ifndef UPLOADQUEUE_H
+#define UPLOADQUEUE_H
+
+//
+// In-memory index of the upload queue directory.
+//
+// The queue directory is scanned once when the queue is created, and the names of all files with
+// the given extension are held in a sorted array. On Linux, the array is then kept current via inotify,
+// so picking the next file to upload costs nothing more than reading pending change events.
+// On other platforms, uploadQueueRefresh() falls back to a single rescan of the directory.
+//
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _UPLOAD_QUEUE UPLOAD_QUEUE_t;
+
+// Create the queue and scan "queueDirPath" for files with extension "ext" (not including the '.').
+// Returns NULL in case of error.
+UPLOAD_QUEUE_t *uploadQueueInit(const char *queueDirPath, const char *ext);
+
+void uploadQueueFinal(UPLOAD_QUEUE_t **queue_p);
+
+// Bring the queue up to date with changes made to the directory since the last refresh.
+// Returns false in case of error.
+bool uploadQueueRefresh(UPLOAD_QUEUE_t *queue);
+
+// Discard the queue contents and scan the directory again.
+bool uploadQueueRescan(UPLOAD_QUEUE_t *queue);
+
+int uploadQueueCount(UPLOAD_QUEUE_t *queue);
+
+// Get the filename (without directory) of the queue entry at "index", in ascending filename order.
+// The returned string is valid until the next call to any other uploadQueue function.
+const char *uploadQueueGet(UPLOAD_QUEUE_t *queue, int index);
+
+// Remove an entry from the queue (but not from the filesystem), e.g. after it has been uploaded.
+// Returns false if no such entry was queued.
+bool uploadQueueRemove(UPLOAD_QUEUE_t *queue, const char *filename);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // !UPLOADQUEUE_H
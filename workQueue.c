@@ -0,0 +1,423 @@
+/*
+ *  workQueue.c
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+#include "workQueue.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/param.h> // MAXPATHLEN
+#include <zlib.h>      // crc32()
+#include <ARX/AR/ar.h>
+
+//
+// File layout. All values little-endian.
+//
+// Header:
+//   0: magic "ARXWORKQ"
+//   8: uint32 version
+//  12: uint32 task count
+//  16: uint32 length of task strings, including nul terminators
+//  20: uint32 hint: no task before this index is pending
+//  24: uint32 CRC-32 of task strings
+//  28: uint32 reserved, 0
+//
+// Record, one per task:
+//   0: uint32 state (WORK_QUEUE_TASK_STATE)
+//   4: uint32 attempts
+//   8: int64 lease expiry, seconds since the epoch
+//  16: uint32 offset of task string
+//  20: uint32 length of task string, excluding nul terminator
+//  24: float64 results, WORK_QUEUE_RESULT_COUNT of them
+//  56: owner, nul-padded
+//
+// Task strings follow the records.
+//
+
+#define QUEUE_MAGIC "ARXWORKQ"
+#define QUEUE_VERSION 1
+#define QUEUE_HEADER_LEN 32
+#define RECORD_LEN 96
+#define RECORD_OWNER_OFFSET 56
+#define HINT_OFFSET 20
+#define SCAN_CHUNK 256 // Records read at once while looking for a task.
+
+struct _WORK_QUEUE {
+    int    fd;
+    int    taskCount;
+    char  *strings;
+    size_t stringsLen;
+    char   owner[WORK_QUEUE_OWNER_LEN];
+};
+
+static void put32(unsigned char *p, uint32_t v) { int i; for (i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8*i)); }
+static void put64(unsigned char *p, uint64_t v) { int i; for (i = 0; i < 8; i++) p[i] = (unsigned char)(v >> (8*i)); }
+static uint32_t get32(const unsigned char *p) { uint32_t v = 0; int i; for (i = 3; i >= 0; i--) v = (v << 8) | p[i]; return (v); }
+static uint64_t get64(const unsigned char *p) { uint64_t v = 0; int i; for (i = 7; i >= 0; i--) v = (v << 8) | p[i]; return (v); }
+static void putDouble(unsigned char *p, double d) { uint64_t v; memcpy(&v, &d, 8); put64(p, v); }
+static double getDouble(const unsigned char *p) { uint64_t v = get64(p); double d; memcpy(&d, &v, 8); return (d); }
+
+static bool preadFully(int fd, void *buf, size_t len, off_t offset)
+{
+    unsigned char *p = (unsigned char *)buf;
+    while (len) {
+        ssize_t n = pread(fd, p, len, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return (false);
+        p += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return (true);
+}
+
+static bool pwriteFully(int fd, const void *buf, size_t len, off_t offset)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+    while (len) {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return (false);
+        p += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return (true);
+}
+
+static bool lockQueue(int fd, short type)
+{
+    struct flock fl;
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET; // l_start and l_len 0: the whole file.
+    while (fcntl(fd, F_SETLKW, &fl) == -1) {
+        if (errno != EINTR) {
+            ARLOGe("Error locking work queue.\n");
+            ARLOGperror(NULL);
+            return (false);
+        }
+    }
+    return (true);
+}
+
+static void unlockQueue(int fd)
+{
+    struct flock fl;
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = F_UNLCK;
+    fl.l_whence = SEEK_SET;
+    fcntl(fd, F_SETLK, &fl);
+}
+
+static off_t recordOffset(int index)
+{
+    return ((off_t)QUEUE_HEADER_LEN + (off_t)index*RECORD_LEN);
+}
+
+bool workQueueCreate(const char *pathname, const char *const *tasks, int count)
+{
+    char tmpPathname[MAXPATHLEN];
+    char host[64] = "";
+    size_t stringsLen = 0;
+    int fd, i;
+    bool ok = false;
+
+    if (!pathname || !tasks || count <= 0) return (false);
+    for (i = 0; i < count; i++) stringsLen += strlen(tasks[i]) + 1;
+    if (stringsLen > UINT32_MAX) return (false);
+
+    size_t len = QUEUE_HEADER_LEN + (size_t)count*RECORD_LEN + stringsLen;
+    unsigned char *buf = (unsigned char *)calloc(1, len);
+    if (!buf) {
+        ARLOGe("Out of memory!\n");
+        return (false);
+    }
+    memcpy(buf, QUEUE_MAGIC, 8);
+    put32(buf + 8, QUEUE_VERSION);
+    put32(buf + 12, (uint32_t)count);
+    put32(buf + 16, (uint32_t)stringsLen);
+    unsigned char *strings = buf + QUEUE_HEADER_LEN + (size_t)count*RECORD_LEN;
+    uint32_t offset = 0;
+    for (i = 0; i < count; i++) {
+        size_t taskLen = strlen(tasks[i]);
+        unsigned char *r = buf + recordOffset(i);
+        put32(r + 16, offset);
+        put32(r + 20, (uint32_t)taskLen);
+        memcpy(strings + offset, tasks[i], taskLen + 1);
+        offset += (uint32_t)taskLen + 1;
+    }
+    put32(buf + 24, (uint32_t)crc32(0L, strings, (uInt)stringsLen));
+
+    // Write the whole queue to a file of our own, then link it into place, which fails if another
+    // process (perhaps on another machine) got there first.
+    gethostname(host, sizeof(host) - 1);
+    snprintf(tmpPathname, sizeof(tmpPathname), "%s.%s.%ld.tmp", pathname, host, (long)getpid());
+    if ((fd = open(tmpPathname, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+        ARLOGe("Error creating '%s'.\n", tmpPathname);
+        ARLOGperror(NULL);
+        free(buf);
+        return (false);
+    }
+    if (!pwriteFully(fd, buf, len, 0) || fsync(fd) < 0) {
+        ARLOGe("Error writing '%s'.\n", tmpPathname);
+        ARLOGperror(NULL);
+        close(fd);
+    } else if (close(fd) < 0) {
+        ARLOGe("Error writing '%s'.\n", tmpPathname);
+        ARLOGperror(NULL);
+    } else if (link(tmpPathname, pathname) < 0) {
+        if (errno != EEXIST) {
+            ARLOGe("Error creating '%s'.\n", pathname);
+            ARLOGperror(NULL);
+        }
+    } else {
+        ok = true;
+    }
+    int err = errno;
+    unlink(tmpPathname);
+    free(buf);
+    errno = (ok ? 0 : err);
+    return (ok);
+}
+
+WORK_QUEUE_t *workQueueOpen(const char *pathname)
+{
+    unsigned char header[QUEUE_HEADER_LEN];
+    char host[WORK_QUEUE_OWNER_LEN] = "";
+    WORK_QUEUE_t *queue;
+
+    if (!pathname) return (NULL);
+    if (!(queue = (WORK_QUEUE_t *)calloc(1, sizeof(WORK_QUEUE_t)))) {
+        ARLOGe("Out of memory!\n");
+        return (NULL);
+    }
+    if ((queue->fd = open(pathname, O_RDWR)) == -1) {
+        ARLOGe("Error opening work queue '%s'.\n", pathname);
+        ARLOGperror(NULL);
+        free(queue);
+        return (NULL);
+    }
+    if (!preadFully(queue->fd, header, sizeof(header), 0) || memcmp(header, QUEUE_MAGIC, 8) != 0 || get32(header + 8) != QUEUE_VERSION) goto bad;
+    queue->taskCount = (int)get32(header + 12);
+    uint32_t stringsLen = get32(header + 16);
+    if (queue->taskCount <= 0 || !stringsLen) goto bad;
+    queue->stringsLen = stringsLen;
+
+    // The task strings never change, so are read once.
+    if (!(queue->strings = (char *)malloc(stringsLen))) {
+        ARLOGe("Out of memory!\n");
+        goto bail;
+    }
+    if (!preadFully(queue->fd, queue->strings, stringsLen, recordOffset(queue->taskCount))
+        || get32(header + 24) != (uint32_t)crc32(0L, (const unsigned char *)queue->strings, stringsLen)
+        || queue->strings[stringsLen - 1] != '\0') goto bad;
+
+    gethostname(host, sizeof(host) - 1);
+    snprintf(queue->owner, sizeof(queue->owner), "%.*s:%ld", (int)sizeof(queue->owner) - 12, host, (long)getpid());
+    return (queue);
+
+bad:
+    ARLOGe("Error: '%s' is not a valid work queue.\n", pathname);
+bail:
+    close(queue->fd);
+    free(queue->strings);
+    free(queue);
+    return (NULL);
+}
+
+void workQueueClose(WORK_QUEUE_t **queue_p)
+{
+    if (!queue_p || !*queue_p) return;
+    close((*queue_p)->fd);
+    free((*queue_p)->strings);
+    free(*queue_p);
+    *queue_p = NULL;
+}
+
+int workQueueTaskCount(const WORK_QUEUE_t *queue)
+{
+    return (queue ? queue->taskCount : 0);
+}
+
+// Take task "index", described by record "r", writing the updated record back. Called with the lock held.
+static bool claimRecord(WORK_QUEUE_t *queue, int index, unsigned char *r, int leaseSeconds)
+{
+    put32(r, WORK_QUEUE_TASK_CLAIMED);
+    put32(r + 4, get32(r + 4) + 1);
+    put64(r + 8, (uint64_t)(int64_t)(time(NULL) + leaseSeconds));
+    memset(r + RECORD_OWNER_OFFSET, 0, WORK_QUEUE_OWNER_LEN);
+    memcpy(r + RECORD_OWNER_OFFSET, queue->owner, strlen(queue->owner));
+    return (pwriteFully(queue->fd, r, RECORD_LEN, recordOffset(index)));
+}
+
+static const char *recordTask(const WORK_QUEUE_t *queue, const unsigned char *r)
+{
+    uint32_t offset = get32(r + 16);
+    return (offset < queue->stringsLen ? queue->strings + offset : "");
+}
+
+int workQueueClaim(WORK_QUEUE_t *queue, int leaseSeconds, const char **task_out)
+{
+    unsigned char header[QUEUE_HEADER_LEN];
+    unsigned char *records;
+    int claimed = WORK_QUEUE_CLAIM_NONE;
+    int start, i, j, n;
+
+    if (!queue || leaseSeconds <= 0) return (WORK_QUEUE_CLAIM_ERROR);
+    if (!(records = (unsigned char *)malloc(SCAN_CHUNK*RECORD_LEN))) {
+        ARLOGe("Out of memory!\n");
+        return (WORK_QUEUE_CLAIM_ERROR);
+    }
+    if (!lockQueue(queue->fd, F_WRLCK)) {
+        free(records);
+        return (WORK_QUEUE_CLAIM_ERROR);
+    }
+    if (!preadFully(queue->fd, header, sizeof(header), 0)) goto error;
+
+    // First look for a pending task, from the hint onwards, then for an expired lease anywhere.
+    int hint = (int)get32(header + HINT_OFFSET);
+    int64_t now = (int64_t)time(NULL);
+    for (int pass = 0; pass < 2 && claimed == WORK_QUEUE_CLAIM_NONE; pass++) {
+        for (start = (pass == 0 ? hint : 0); start < queue->taskCount && claimed == WORK_QUEUE_CLAIM_NONE; start += n) {
+            n = MIN(SCAN_CHUNK, queue->taskCount - start);
+            if (!preadFully(queue->fd, records, (size_t)n*RECORD_LEN, recordOffset(start))) goto error;
+            for (j = 0; j < n; j++) {
+                unsigned char *r = records + j*RECORD_LEN;
+                i = start + j;
+                uint32_t state = get32(r);
+                if (pass == 0) {
+                    if (state != WORK_QUEUE_TASK_PENDING) continue;
+                    hint = i + 1;
+                } else {
+                    if (state != WORK_QUEUE_TASK_CLAIMED || (int64_t)get64(r + 8) > now) continue;
+                    if (get32(r + 4) >= WORK_QUEUE_ATTEMPTS_MAX) {
+                        ARLOGw("Giving up on task '%s' after %d attempts.\n", recordTask(queue, r), WORK_QUEUE_ATTEMPTS_MAX);
+                        put32(r, WORK_QUEUE_TASK_FAILED);
+                        if (!pwriteFully(queue->fd, r, RECORD_LEN, recordOffset(i))) goto error;
+                        continue;
+                    }
+                    ARLOGw("Lease on task '%s' held by %.*s has expired; claiming it again.\n", recordTask(queue, r), WORK_QUEUE_OWNER_LEN, (const char *)(r + RECORD_OWNER_OFFSET));
+                }
+                if (!claimRecord(queue, i, r, leaseSeconds)) goto error;
+                claimed = i;
+                if (task_out) *task_out = recordTask(queue, r);
+                break;
+            }
+            if (pass == 0 && claimed == WORK_QUEUE_CLAIM_NONE) hint = start + n;
+        }
+    }
+    put32(header + HINT_OFFSET, (uint32_t)hint);
+    if (!pwriteFully(queue->fd, header + HINT_OFFSET, 4, HINT_OFFSET)) goto error;
+    fsync(queue->fd); // Before unlocking, so that workers on other machines see the claim.
+    unlockQueue(queue->fd);
+    free(records);
+    return (claimed);
+
+error:
+    ARLOGe("Error updating work queue.\n");
+    ARLOGperror(NULL);
+    unlockQueue(queue->fd);
+    free(records);
+    return (WORK_QUEUE_CLAIM_ERROR);
+}
+
+bool workQueueFinish(WORK_QUEUE_t *queue, int index, bool succeeded, const double result[WORK_QUEUE_RESULT_COUNT])
+{
+    unsigned char r[RECORD_LEN];
+    int i;
+
+    if (!queue || index < 0 || index >= queue->taskCount) return (false);
+    if (!lockQueue(queue->fd, F_WRLCK)) return (false);
+    bool ok = preadFully(queue->fd, r, RECORD_LEN, recordOffset(index));
+    if (ok) {
+        if (strncmp((const char *)(r + RECORD_OWNER_OFFSET), queue->owner, WORK_QUEUE_OWNER_LEN) != 0) {
+            ARLOGw("Lease on task '%s' expired before it finished; recording the outcome anyway.\n", recordTask(queue, r));
+        }
+        put32(r, (succeeded ? WORK_QUEUE_TASK_DONE : WORK_QUEUE_TASK_FAILED));
+        for (i = 0; i < WORK_QUEUE_RESULT_COUNT; i++) putDouble(r + 24 + 8*i, (result ? result[i] : 0.0));
+        ok = pwriteFully(queue->fd, r, RECORD_LEN, recordOffset(index));
+        fsync(queue->fd);
+    }
+    if (!ok) {
+        ARLOGe("Error updating work queue.\n");
+        ARLOGperror(NULL);
+    }
+    unlockQueue(queue->fd);
+    return (ok);
+}
+
+bool workQueueGetTasks(WORK_QUEUE_t *queue, WORK_QUEUE_TASK_INFO_t *infos)
+{
+    unsigned char *records;
+    int i, j;
+
+    if (!queue || !infos) return (false);
+    size_t len = (size_t)queue->taskCount*RECORD_LEN;
+    if (!(records = (unsigned char *)malloc(len))) {
+        ARLOGe("Out of memory!\n");
+        return (false);
+    }
+    if (!lockQueue(queue->fd, F_RDLCK)) {
+        free(records);
+        return (false);
+    }
+    bool ok = preadFully(queue->fd, records, len, recordOffset(0));
+    unlockQueue(queue->fd);
+    if (ok) {
+        for (i = 0; i < queue->taskCount; i++) {
+            const unsigned char *r = records + (size_t)i*RECORD_LEN;
+            uint32_t state = get32(r);
+            if (state > WORK_QUEUE_TASK_FAILED) {
+                ARLOGe("Error: work queue record %d is damaged.\n", i);
+                ok = false;
+                break;
+            }
+            infos[i].task = recordTask(queue, r);
+            infos[i].state = (WORK_QUEUE_TASK_STATE)state;
+            infos[i].attempts = (int)get32(r + 4);
+            for (j = 0; j < WORK_QUEUE_RESULT_COUNT; j++) infos[i].result[j] = getDouble(r + 24 + 8*j);
+            memcpy(infos[i].owner, r + RECORD_OWNER_OFFSET, WORK_QUEUE_OWNER_LEN);
+            infos[i].owner[WORK_QUEUE_OWNER_LEN - 1] = '\0';
+        }
+    }
+    free(records);
+    return (ok);
+}
@@ -0,0 +1,109 @@
+/*
+ *  workQueue.h
+ *  artoolkitX
+ *
+ *  This file is part of artoolkitX.
+ *
+ *  artoolkitX is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  artoolkitX is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with artoolkitX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2018 Realmax, Inc.
+ *
+ *  Author(s): Philip Lamb
+ */
+
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+//
+// A work queue in a single file, shared by worker processes on one or more machines through a
+// common filesystem. The queue holds a fixed list of tasks, each a string (e.g. a pathname), made
+// when the queue is created. Workers claim tasks one at a time and record their outcome, and every
+// change is made under an fcntl() lock on the whole file, which also works over NFS.
+//
+// A claimed task carries a lease. If a worker dies, its task is claimed again once the lease has
+// expired, up to WORK_QUEUE_ATTEMPTS_MAX times before it is marked as failed. Lease expiry uses each
+// machine's wall clock, so machines sharing a queue should keep their clocks in sync.
+//
+// The file layout is little-endian: a header, then one fixed-size record per task, then the task
+// strings. Records are updated in place.
+//
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WORK_QUEUE_RESULT_COUNT 4
+#define WORK_QUEUE_ATTEMPTS_MAX 3
+#define WORK_QUEUE_OWNER_LEN 40
+
+#define WORK_QUEUE_CLAIM_NONE  -1 // No task is waiting, though some may still be in progress elsewhere.
+#define WORK_QUEUE_CLAIM_ERROR -2
+
+typedef enum {
+    WORK_QUEUE_TASK_PENDING = 0,
+    WORK_QUEUE_TASK_CLAIMED = 1,
+    WORK_QUEUE_TASK_DONE = 2,
+    WORK_QUEUE_TASK_FAILED = 3
+} WORK_QUEUE_TASK_STATE;
+
+typedef struct {
+    const char           *task;      // Valid until the queue is closed.
+    WORK_QUEUE_TASK_STATE state;
+    int                   attempts;
+    double                result[WORK_QUEUE_RESULT_COUNT]; // As recorded by workQueueFinish().
+    char                  owner[WORK_QUEUE_OWNER_LEN];     // "host:pid" of the last worker to claim the task.
+} WORK_QUEUE_TASK_INFO_t;
+
+typedef struct _WORK_QUEUE WORK_QUEUE_t;
+
+// Create a queue at "pathname" holding "count" tasks. The file appears complete or not at all.
+// Returns false if a queue already exists there (with errno set to EEXIST) or in case of error.
+bool workQueueCreate(const char *pathname, const char *const *tasks, int count);
+
+// Open an existing queue. Returns NULL in case of error.
+WORK_QUEUE_t *workQueueOpen(const char *pathname);
+
+void workQueueClose(WORK_QUEUE_t **queue_p);
+
+int workQueueTaskCount(const WORK_QUEUE_t *queue);
+
+// Claim the next waiting task, or a task whose lease has expired, holding it for "leaseSeconds".
+// Returns the task's index, with its string in *task_out, or WORK_QUEUE_CLAIM_NONE or
+// WORK_QUEUE_CLAIM_ERROR.
+int workQueueClaim(WORK_QUEUE_t *queue, int leaseSeconds, const char **task_out);
+
+// Record the outcome of a claimed task. "result" may be NULL.
+bool workQueueFinish(WORK_QUEUE_t *queue, int index, bool succeeded, const double result[WORK_QUEUE_RESULT_COUNT]);
+
+// Read the state of every task, into "infos", which must hold workQueueTaskCount() entries.
+// Returns false in case of error, including a damaged record.
+bool workQueueGetTasks(WORK_QUEUE_t *queue, WORK_QUEUE_TASK_INFO_t *infos);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // !WORKQUEUE_H